@@ -0,0 +1,499 @@
+#include "AudioMixer.h"
+#include <esp_heap_caps.h>
+#include <math.h>
+
+#define AUDIO_MIX_SRC_FRAMES (AUDIO_MIX_FRAMES * AUDIO_MIX_MAX_RATIO + 2)
+
+AudioMixer::AudioMixer()
+    : i2s(nullptr),
+      sample_rate(44100),
+      master_gain(32767),
+      acc_buf(nullptr),
+      mix_buf(nullptr),
+      voice_buf(nullptr),
+      src_buf(nullptr),
+      mixer_task(nullptr),
+      stopping(false) {
+    for (int i = 0; i < AUDIO_MIX_VOICES; i++) {
+        voices[i].state = VOICE_FREE;
+        voices[i].serial = 0;
+    }
+    for (int i = 0; i < 256; i++) {
+        sine[i] = (int16_t)lroundf(sinf(i * 2.0f * (float)M_PI / 256) * 32767);
+    }
+    portMUX_INITIALIZE(&voice_mux);
+    resetStats();
+}
+
+AudioMixer::~AudioMixer() {
+    end();
+}
+
+bool AudioMixer::begin(I2SClass& port, uint32_t rate, BaseType_t core) {
+    if (mixer_task) return true;
+
+    // 16-byte aligned for the vector loads
+    acc_buf = (int32_t*)heap_caps_aligned_alloc(16, AUDIO_MIX_FRAMES * 8, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    mix_buf = (int16_t*)heap_caps_aligned_alloc(16, AUDIO_MIX_FRAMES * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    voice_buf = (int16_t*)heap_caps_aligned_alloc(16, AUDIO_MIX_FRAMES * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    src_buf = (int16_t*)heap_caps_aligned_alloc(16, AUDIO_MIX_SRC_FRAMES * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!acc_buf || !mix_buf || !voice_buf || !src_buf) {
+        Serial.println("[AudioMixer] Out of memory");
+        freeBuffers();
+        return false;
+    }
+
+    if (!port.configureTX(rate, I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_STEREO)) {
+        Serial.printf("[AudioMixer] I2S cannot run at %u Hz\n", rate);
+        freeBuffers();
+        return false;
+    }
+    i2s = &port;
+    sample_rate = rate;
+    stats.period_us = (uint32_t)((uint64_t)AUDIO_MIX_FRAMES * 1000000 / rate);
+    stopping = false;
+
+    // Above the UI and the card reader: a late period is an audible gap
+    if (xTaskCreatePinnedToCore(mixerTask, "audio_mix", 4096, this, 10, &mixer_task, core) != pdPASS) {
+        mixer_task = nullptr;
+        Serial.println("[AudioMixer] Failed to start mixer task");
+        freeBuffers();
+        return false;
+    }
+    return true;
+}
+
+void AudioMixer::end() {
+    if (!mixer_task) return;
+
+    stopping = true;
+    while (mixer_task) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    stopping = false;
+
+    for (int i = 0; i < AUDIO_MIX_VOICES; i++) {
+        if (voices[i].state != VOICE_FREE) releaseVoice(&voices[i]);
+    }
+    i2s = nullptr;
+    freeBuffers();
+}
+
+AudioVoice AudioMixer::playSample(const int16_t* pcm, size_t frames, uint8_t channels, uint32_t rate,
+                                  uint8_t volume, int8_t pan, bool loop) {
+    if (!pcm || !frames || !rate) return AUDIO_VOICE_NONE;
+    AudioVoice handle;
+    Voice* v = claimVoice(handle);
+    if (!v) return AUDIO_VOICE_NONE;
+
+    v->kind = VOICE_SAMPLE;
+    v->rate = rate;
+    v->pcm = pcm;
+    v->frames = frames;
+    v->pos = 0;
+    v->channels = (channels == 1) ? 1 : 2;
+    v->loop = loop;
+    startVoice(v, volume, pan);
+    return handle;
+}
+
+AudioVoice AudioMixer::playTone(uint16_t freq_hz, uint16_t ms, uint8_t volume, int8_t pan, AudioWaveform wave) {
+    if (!freq_hz || !ms) return AUDIO_VOICE_NONE;
+    AudioVoice handle;
+    Voice* v = claimVoice(handle);
+    if (!v) return AUDIO_VOICE_NONE;
+
+    v->kind = VOICE_TONE;
+    v->rate = sample_rate;
+    v->phase = 0;
+    v->phase_inc = (uint32_t)(((uint64_t)freq_hz << 32) / sample_rate);
+    v->length = (uint32_t)((uint64_t)ms * sample_rate / 1000);
+    v->remaining = v->length;
+    v->wave = wave;
+    startVoice(v, volume, pan);
+    return handle;
+}
+
+AudioVoice AudioMixer::playStream(AudioPlayer& player, uint8_t volume, int8_t pan) {
+    AudioVoice handle;
+    Voice* v = claimVoice(handle);
+    if (!v) return AUDIO_VOICE_NONE;
+
+    v->kind = VOICE_STREAM;
+    v->rate = player.getFormat().sample_rate;
+    v->player = &player;
+    startVoice(v, volume, pan);
+    return handle;
+}
+
+AudioVoice AudioMixer::playSource(Source source, uint32_t rate, uint8_t volume, int8_t pan) {
+    if (!source || !rate) return AUDIO_VOICE_NONE;
+    AudioVoice handle;
+    Voice* v = claimVoice(handle);
+    if (!v) return AUDIO_VOICE_NONE;
+
+    v->kind = VOICE_SOURCE;
+    v->rate = rate;
+    v->source = source;
+    startVoice(v, volume, pan);
+    return handle;
+}
+
+void AudioMixer::stop(AudioVoice handle) {
+    portENTER_CRITICAL(&voice_mux);
+    Voice* v = findVoice(handle);
+    if (v) v->stop_request = true;
+    portEXIT_CRITICAL(&voice_mux);
+}
+
+void AudioMixer::stopAll() {
+    for (int i = 0; i < AUDIO_MIX_VOICES; i++) {
+        if (voices[i].state == VOICE_ACTIVE) voices[i].stop_request = true;
+    }
+}
+
+bool AudioMixer::isActive(AudioVoice handle) const {
+    return findVoice(handle) != nullptr;
+}
+
+void AudioMixer::setVolume(AudioVoice handle, uint8_t volume) {
+    portENTER_CRITICAL(&voice_mux);
+    Voice* v = findVoice(handle);
+    if (v) {
+        v->volume = (volume > 100) ? 100 : volume;
+        updateGain(v);
+    }
+    portEXIT_CRITICAL(&voice_mux);
+}
+
+void AudioMixer::setPan(AudioVoice handle, int8_t pan) {
+    portENTER_CRITICAL(&voice_mux);
+    Voice* v = findVoice(handle);
+    if (v) {
+        v->pan = (pan < -100) ? -100 : (pan > 100) ? 100 : pan;
+        updateGain(v);
+    }
+    portEXIT_CRITICAL(&voice_mux);
+}
+
+void AudioMixer::setMasterVolume(uint8_t percent) {
+    if (percent > 100) percent = 100;
+    master_gain = (int16_t)((int32_t)percent * 32767 / 100);
+}
+
+uint8_t AudioMixer::getActiveVoices() const {
+    uint8_t n = 0;
+    for (int i = 0; i < AUDIO_MIX_VOICES; i++) {
+        if (voices[i].state == VOICE_ACTIVE) n++;
+    }
+    return n;
+}
+
+void AudioMixer::resetStats() {
+    uint32_t period_us = stats.period_us;
+    memset(&stats, 0, sizeof(stats));
+    stats.period_us = period_us;
+}
+
+void AudioMixer::mixScalar(int32_t* acc, const int16_t* in, size_t samples, int16_t gain_l, int16_t gain_r) {
+    for (size_t i = 0; i + 1 < samples; i += 2) {
+        acc[i] += (in[i] * gain_l) >> 15;
+        acc[i + 1] += (in[i + 1] * gain_r) >> 15;
+    }
+}
+
+void AudioMixer::mix(int32_t* acc, const int16_t* in, size_t samples, int16_t gain_l, int16_t gain_r) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    if ((((uintptr_t)acc | (uintptr_t)in) & 15) == 0 && samples >= 8) {
+        // Eight samples (four frames) per pass: vmul scales by the gain
+        // lanes and shifts right by SAR, which cannot overflow 16 bits.
+        // vcmp and vzip sign-extend the products to 32 bits, and two
+        // vadds.s32 add them to the accumulator. The same arithmetic as
+        // mixScalar(), so the result is identical.
+        int16_t gains[8] __attribute__((aligned(16))) = {
+            gain_l, gain_r, gain_l, gain_r, gain_l, gain_r, gain_l, gain_r
+        };
+        size_t blocks = samples / 8;
+        int32_t* a = acc;
+        const int16_t* s = in;
+        __asm__ volatile(
+            "ssai            15\n"
+            "ee.zero.q       q6\n"
+            "ee.vld.128.ip   q7, %[g], 0\n"
+            "1:\n"
+            "ee.vld.128.ip   q0, %[s], 16\n"
+            "ee.vmul.s16     q1, q0, q7\n"
+            "ee.vcmp.lt.s16  q2, q1, q6\n"
+            "ee.vzip.16      q1, q2\n"
+            "ee.vld.128.ip   q3, %[a], 16\n"
+            "ee.vld.128.ip   q4, %[a], -16\n"
+            "ee.vadds.s32    q3, q3, q1\n"
+            "ee.vadds.s32    q4, q4, q2\n"
+            "ee.vst.128.ip   q3, %[a], 16\n"
+            "ee.vst.128.ip   q4, %[a], 16\n"
+            "addi            %[n], %[n], -1\n"
+            "bnez            %[n], 1b\n"
+            : [a] "+r"(a), [s] "+r"(s), [n] "+r"(blocks)
+            : [g] "r"(gains)
+            : "memory");
+        size_t done = samples & ~(size_t)7;
+        acc += done;
+        in += done;
+        samples -= done;
+    }
+#endif
+    mixScalar(acc, in, samples, gain_l, gain_r);
+}
+
+void AudioMixer::saturate(int16_t* out, const int32_t* acc, size_t samples) {
+    for (size_t i = 0; i < samples; i++) {
+        int32_t s = acc[i];
+        out[i] = (int16_t)(s > 32767 ? 32767 : s < -32768 ? -32768 : s);
+    }
+}
+
+bool AudioMixer::checkKernels() {
+    const size_t n = AUDIO_MIX_FRAMES * 2;
+    int16_t* in = (int16_t*)heap_caps_aligned_alloc(16, n * 2, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    int32_t* a = (int32_t*)heap_caps_aligned_alloc(16, n * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    int32_t* b = (int32_t*)heap_caps_aligned_alloc(16, n * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!in || !a || !b) {
+        if (in) heap_caps_free(in);
+        if (a) heap_caps_free(a);
+        if (b) heap_caps_free(b);
+        return false;
+    }
+
+    // Full-scale noise over a sum already past 16 bits, both signs
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1664525 + 1013904223;
+        in[i] = (int16_t)(seed >> 16);
+        a[i] = b[i] = (int32_t)seed >> 12;
+    }
+
+    uint32_t t0 = ESP.getCycleCount();
+    mixScalar(a, in, n, 32767, -20000);
+    uint32_t t1 = ESP.getCycleCount();
+    mix(b, in, n, 32767, -20000);
+    uint32_t t2 = ESP.getCycleCount();
+
+    bool same = memcmp(a, b, n * 4) == 0;
+    Serial.printf("[AudioMixer] Kernels %s; one voice, one period: scalar %u cycles, mix() %u cycles\n",
+                  same ? "match" : "DIFFER", t1 - t0, t2 - t1);
+    heap_caps_free(in);
+    heap_caps_free(a);
+    heap_caps_free(b);
+    return same;
+}
+
+// Private helper methods
+void AudioMixer::freeBuffers() {
+    if (acc_buf) heap_caps_free(acc_buf);
+    if (mix_buf) heap_caps_free(mix_buf);
+    if (voice_buf) heap_caps_free(voice_buf);
+    if (src_buf) heap_caps_free(src_buf);
+    acc_buf = nullptr;
+    mix_buf = nullptr;
+    voice_buf = nullptr;
+    src_buf = nullptr;
+}
+
+AudioMixer::Voice* AudioMixer::claimVoice(AudioVoice& handle) {
+    if (!mixer_task) return nullptr;
+
+    Voice* v = nullptr;
+    portENTER_CRITICAL(&voice_mux);
+    for (int i = 0; i < AUDIO_MIX_VOICES; i++) {
+        if (voices[i].state == VOICE_FREE) {
+            v = &voices[i];
+            v->state = VOICE_SETUP;
+            v->serial++;
+            handle = ((AudioVoice)v->serial << 8) | i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&voice_mux);
+    return v;
+}
+
+void AudioMixer::startVoice(Voice* v, uint8_t volume, int8_t pan) {
+    v->stop_request = false;
+    v->volume = (volume > 100) ? 100 : volume;
+    v->pan = (pan < -100) ? -100 : (pan > 100) ? 100 : pan;
+    v->carry_count = 0;
+    v->frac = 0;
+    updateGain(v);
+
+    // The mixer only looks at active voices, so the fields above are
+    // complete before it sees this one
+    v->state = VOICE_ACTIVE;
+}
+
+AudioMixer::Voice* AudioMixer::findVoice(AudioVoice handle) const {
+    if (handle < 0) return nullptr;
+    int slot = handle & 0xFF;
+    if (slot >= AUDIO_MIX_VOICES) return nullptr;
+    const Voice* v = &voices[slot];
+    if (v->serial != (uint8_t)(handle >> 8) || v->state != VOICE_ACTIVE) return nullptr;
+    return const_cast<Voice*>(v);
+}
+
+void AudioMixer::updateGain(Voice* v) {
+    // Balance: the far side fades out, the near one stays at the volume
+    int32_t base = (int32_t)v->volume * 32767 / 100;
+    v->gain_l = (int16_t)(v->pan > 0 ? base * (100 - v->pan) / 100 : base);
+    v->gain_r = (int16_t)(v->pan < 0 ? base * (100 + v->pan) / 100 : base);
+}
+
+void AudioMixer::releaseVoice(Voice* v) {
+    v->source = nullptr;
+    v->player = nullptr;
+    v->pcm = nullptr;
+    v->state = VOICE_FREE;
+}
+
+bool AudioMixer::pull(Voice* v, int16_t* dst, size_t frames) {
+    uint32_t rate = v->rate;
+    if (v->kind == VOICE_STREAM) rate = v->player->getFormat().sample_rate;
+    if (rate == sample_rate) {
+        v->carry_count = 0;
+        return generate(v, dst, frames);
+    }
+
+    // Linear interpolation. Output frame k sits at frac + k * step source
+    // frames past src[0]; the frames it needs are taken from the carry and
+    // then the voice, and whatever was fetched but not passed is carried.
+    uint32_t step = (uint32_t)(((uint64_t)rate << 16) / sample_rate);
+    if (step > (AUDIO_MIX_MAX_RATIO << 16)) step = AUDIO_MIX_MAX_RATIO << 16;
+    uint32_t last = v->frac + (uint32_t)(frames - 1) * step;
+    uint32_t end = v->frac + (uint32_t)frames * step;
+    size_t need = (last >> 16) + 2;
+    if ((end >> 16) + 1 > need) need = (end >> 16) + 1;
+
+    int16_t* src = src_buf;
+    memcpy(src, v->carry, v->carry_count * 4);
+    bool more = true;
+    if (need > v->carry_count) more = generate(v, src + v->carry_count * 2, need - v->carry_count);
+
+    uint32_t pos = v->frac;
+    for (size_t k = 0; k < frames; k++, pos += step) {
+        const int16_t* a = src + (pos >> 16) * 2;
+        int32_t f = (pos & 0xFFFF) >> 1;
+        dst[2 * k] = (int16_t)(a[0] + (((a[2] - a[0]) * f) >> 15));
+        dst[2 * k + 1] = (int16_t)(a[1] + (((a[3] - a[1]) * f) >> 15));
+    }
+
+    size_t used = end >> 16;
+    v->carry_count = (uint8_t)(need - used);
+    memcpy(v->carry, src + used * 2, v->carry_count * 4);
+    v->frac = end & 0xFFFF;
+    return more;
+}
+
+bool AudioMixer::generate(Voice* v, int16_t* dst, size_t frames) {
+    switch (v->kind) {
+        case VOICE_SAMPLE: {
+            size_t done = 0;
+            while (done < frames) {
+                if (v->pos >= v->frames) {
+                    if (!v->loop) break;
+                    v->pos = 0;
+                }
+                size_t n = v->frames - v->pos;
+                if (n > frames - done) n = frames - done;
+                if (v->channels == 2) {
+                    memcpy(dst + done * 2, v->pcm + v->pos * 2, n * 4);
+                } else {
+                    for (size_t i = 0; i < n; i++) {
+                        dst[(done + i) * 2] = dst[(done + i) * 2 + 1] = v->pcm[v->pos + i];
+                    }
+                }
+                v->pos += n;
+                done += n;
+            }
+            memset(dst + done * 2, 0, (frames - done) * 4);
+            return v->loop || v->pos < v->frames;
+        }
+
+        case VOICE_TONE: {
+            uint32_t ramp = sample_rate * AUDIO_MIX_RAMP_MS / 1000;
+            if (ramp > v->length / 2) ramp = v->length / 2;
+            for (size_t i = 0; i < frames; i++) {
+                int32_t s = 0;
+                if (v->remaining) {
+                    uint32_t t = v->length - v->remaining;
+                    if (v->wave == AUDIO_WAVE_SQUARE) {
+                        // Three quarters, about as loud as the sine
+                        s = (v->phase & 0x80000000) ? -24576 : 24576;
+                    } else if (v->wave == AUDIO_WAVE_TRIANGLE) {
+                        uint32_t p = v->phase >> 16;
+                        s = (int32_t)(p < 32768 ? p : 65535 - p) * 2 - 32767;
+                    } else {
+                        s = sine[v->phase >> 24];
+                    }
+                    if (t < ramp) s = s * (int32_t)t / (int32_t)ramp;
+                    else if (v->remaining < ramp) s = s * (int32_t)v->remaining / (int32_t)ramp;
+                    v->phase += v->phase_inc;
+                    v->remaining--;
+                }
+                dst[2 * i] = dst[2 * i + 1] = (int16_t)s;
+            }
+            return v->remaining > 0;
+        }
+
+        case VOICE_STREAM:
+            // Silence while the player is idle; the voice stays attached
+            v->player->read(dst, frames);
+            return true;
+
+        case VOICE_SOURCE:
+            return v->source(dst, frames);
+    }
+    return false;
+}
+
+void AudioMixer::renderPeriod() {
+    memset(acc_buf, 0, AUDIO_MIX_FRAMES * 8);
+    int32_t master = master_gain;
+    uint8_t active = 0;
+
+    for (int i = 0; i < AUDIO_MIX_VOICES; i++) {
+        Voice* v = &voices[i];
+        if (v->state != VOICE_ACTIVE) continue;
+        if (v->stop_request) {
+            releaseVoice(v);
+            continue;
+        }
+        active++;
+
+        bool more = pull(v, voice_buf, AUDIO_MIX_FRAMES);
+        int16_t gl = (int16_t)((v->gain_l * master) >> 15);
+        int16_t gr = (int16_t)((v->gain_r * master) >> 15);
+        mix(acc_buf, voice_buf, AUDIO_MIX_FRAMES * 2, gl, gr);
+        if (!more) releaseVoice(v);
+    }
+    saturate(mix_buf, acc_buf, AUDIO_MIX_FRAMES * 2);
+    if (active > stats.max_voices) stats.max_voices = active;
+}
+
+void AudioMixer::mixerTask(void* arg) {
+    AudioMixer* self = (AudioMixer*)arg;
+
+    while (!self->stopping) {
+        unsigned long start = micros();
+        self->renderPeriod();
+        uint32_t elapsed = micros() - start;
+        self->stats.periods++;
+        if (elapsed > self->stats.max_render_us) self->stats.max_render_us = elapsed;
+        if (elapsed > self->stats.period_us) self->stats.late++;
+
+        // Silence too when no voice plays: a starved DMA repeats its last
+        // buffer. The write blocks until the DMA has room, which sets the
+        // period.
+        self->i2s->write((const uint8_t*)self->mix_buf, AUDIO_MIX_FRAMES * 4);
+    }
+
+    self->mixer_task = nullptr;
+    vTaskDelete(nullptr);
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "ESP_I2S.h"
+#include "AudioPlayer.h"
+
+// Mixes several voices into the one I2S output, so a UI click or a
+// notification plays over the music instead of waiting for i2s.write() to
+// return. A voice is a sample in flash, a synthesized tone, an AudioPlayer
+// streaming from the card, or any callback that produces stereo frames.
+//
+// The mixer task renders a fixed period of AUDIO_MIX_FRAMES frames at a
+// time and hands it to the I2S driver, whose blocking write paces the loop.
+// A voice started between two periods is heard in the next one, so it gets
+// the same latency as the music it plays over: one period plus the
+// driver's DMA queue.
+//
+// Each voice has a volume and a pan, folded into one Q15 gain per channel.
+// Voices are scaled and summed into a 32-bit accumulator, one voice at a
+// time, and the sum is saturated to 16 bits once per sample, so the result
+// does not depend on the order the voices are added in. On the ESP32-S3 the
+// PIE vector unit scales and adds eight samples per pass, elsewhere
+// mixScalar() does it, and both give the same bits. Voices at another rate than the mixer are converted with linear
+// interpolation.
+//
+//   mixer.begin(i2s, 44100);
+//   mixer.playSample((const int16_t*)canon_pcm, canon_pcm_len / 4, 2, 16000, 40, 0, true);
+//   mixer.playTone(2000, 20);      // A click, on top of it
+
+#define AUDIO_MIX_VOICES 8
+#define AUDIO_MIX_FRAMES 128            // One period: 2.9 ms at 44.1 kHz
+#define AUDIO_MIX_MAX_RATIO 4           // Highest voice rate over the mixer rate
+#define AUDIO_MIX_RAMP_MS 2             // Tone fade in and out, against clicks
+
+typedef int32_t AudioVoice;             // Handle from play*(), stale once the voice ends
+#define AUDIO_VOICE_NONE (-1)
+
+enum AudioWaveform : uint8_t {
+    AUDIO_WAVE_SINE,
+    AUDIO_WAVE_SQUARE,
+    AUDIO_WAVE_TRIANGLE
+};
+
+class AudioMixer {
+public:
+    // Fills frames of stereo at the voice's rate. Returning false ends the
+    // voice after these frames. Runs on the mixer task: no card access.
+    typedef std::function<bool(int16_t* stereo, size_t frames)> Source;
+
+    struct Stats {
+        uint32_t periods;
+        uint32_t period_us;         // Time one period plays for
+        uint32_t max_render_us;     // Slowest mix of one period
+        uint32_t late;              // Periods that took longer to mix than to play
+        uint8_t max_voices;         // Most voices playing at once
+    };
+
+    AudioMixer();
+    ~AudioMixer();
+
+    bool begin(I2SClass& i2s, uint32_t sample_rate = 44100, BaseType_t core = 1);
+    void end();
+
+    // volume 0-100, pan -100 (left) to 100 (right). AUDIO_VOICE_NONE when
+    // all voices are busy or the mixer is not running.
+    AudioVoice playSample(const int16_t* pcm, size_t frames, uint8_t channels, uint32_t rate,
+                          uint8_t volume = 100, int8_t pan = 0, bool loop = false);
+    AudioVoice playTone(uint16_t freq_hz, uint16_t ms, uint8_t volume = 100, int8_t pan = 0,
+                        AudioWaveform wave = AUDIO_WAVE_SINE);
+    // The player must be started with begin() without a port. The voice
+    // follows the player's rate and stays until stop(), silent when idle.
+    AudioVoice playStream(AudioPlayer& player, uint8_t volume = 100, int8_t pan = 0);
+    AudioVoice playSource(Source source, uint32_t rate, uint8_t volume = 100, int8_t pan = 0);
+
+    void stop(AudioVoice voice);
+    void stopAll();
+    bool isActive(AudioVoice voice) const;
+    void setVolume(AudioVoice voice, uint8_t volume);
+    void setPan(AudioVoice voice, int8_t pan);
+    void setMasterVolume(uint8_t percent);
+
+    uint32_t getSampleRate() const { return sample_rate; }
+    uint8_t getActiveVoices() const;
+    Stats getStats() const { return stats; }
+    void resetStats();
+
+    // acc += (in * gain) >> 15 over interleaved stereo, gain_l and gain_r
+    // in Q15. mix() takes the SIMD path when both buffers are 16-byte
+    // aligned; mixScalar() is the reference. saturate() turns the sum into
+    // the 16-bit output.
+    static void mix(int32_t* acc, const int16_t* in, size_t samples, int16_t gain_l, int16_t gain_r);
+    static void mixScalar(int32_t* acc, const int16_t* in, size_t samples, int16_t gain_l, int16_t gain_r);
+    static void saturate(int16_t* out, const int32_t* acc, size_t samples);
+    // Runs both kernels on the same data and prints the result and timing
+    static bool checkKernels();
+
+private:
+    enum VoiceState : uint8_t { VOICE_FREE, VOICE_SETUP, VOICE_ACTIVE };
+    enum VoiceKind : uint8_t { VOICE_SAMPLE, VOICE_TONE, VOICE_STREAM, VOICE_SOURCE };
+
+    struct Voice {
+        volatile VoiceState state;
+        volatile bool stop_request;
+        VoiceKind kind;
+        uint8_t serial;             // Upper bits of the handle
+        uint8_t volume;
+        int8_t pan;
+        volatile int16_t gain_l;    // Q15, volume and pan together
+        volatile int16_t gain_r;
+        uint32_t rate;
+
+        // Rate conversion: source frames still to be played, and the
+        // position between the first two of them (Q16)
+        int16_t carry[4];
+        uint8_t carry_count;
+        uint32_t frac;
+
+        const int16_t* pcm;         // VOICE_SAMPLE
+        size_t frames;
+        size_t pos;
+        uint8_t channels;
+        bool loop;
+
+        uint32_t phase;             // VOICE_TONE
+        uint32_t phase_inc;
+        uint32_t length;            // Frames
+        uint32_t remaining;
+        AudioWaveform wave;
+
+        AudioPlayer* player;        // VOICE_STREAM
+        Source source;              // VOICE_SOURCE
+    };
+
+    I2SClass* i2s;
+    uint32_t sample_rate;
+    Voice voices[AUDIO_MIX_VOICES];
+    portMUX_TYPE voice_mux;
+    volatile int16_t master_gain;
+    int16_t sine[256];
+
+    int32_t* acc_buf;               // Sum of the voices for one period
+    int16_t* mix_buf;               // The saturated period, goes to I2S
+    int16_t* voice_buf;             // One voice at the mixer rate
+    int16_t* src_buf;               // One voice at its own rate
+
+    TaskHandle_t mixer_task;
+    volatile bool stopping;
+    Stats stats;
+
+    // Private helper methods
+    void freeBuffers();
+    Voice* claimVoice(AudioVoice& handle);
+    void startVoice(Voice* v, uint8_t volume, int8_t pan);
+    Voice* findVoice(AudioVoice handle) const;
+    void updateGain(Voice* v);
+    void releaseVoice(Voice* v);
+    bool pull(Voice* v, int16_t* dst, size_t frames);
+    bool generate(Voice* v, int16_t* dst, size_t frames);
+    void renderPeriod();
+    static void mixerTask(void* arg);
+};
@@ -0,0 +1,524 @@
+#include "AudioPlayer.h"
+#include <esp_heap_caps.h>
+
+#define AUDIO_RING_FALLBACK (32 * 1024)     // Internal RAM when there is no PSRAM
+
+AudioPlayer::AudioPlayer(SDMounter& mounter)
+    : sd(mounter),
+      i2s(nullptr),
+      file_open(false),
+      frame_bytes(4),
+      data_start(0),
+      data_end(0),
+      read_pos(0),
+      play_pos(0),
+      eof(true),
+      looping(false),
+      format_pending(false),
+      state(AUDIO_STOPPED),
+      gain(32768),
+      underrun_start(0),
+      ring(nullptr),
+      ring_size(0),
+      ring_head(0),
+      ring_tail(0),
+      ring_count(0),
+      ring_gen(0),
+      ring_primed(false),
+      read_buf(nullptr),
+      block(nullptr),
+      out(nullptr),
+      reader_task(nullptr),
+      output_task(nullptr),
+      stopping(false) {
+    path[0] = '\0';
+    format = {16000, 2, 16};
+    raw_format = format;
+    portMUX_INITIALIZE(&ring_mux);
+    ctl = xSemaphoreCreateMutex();
+    resetStats();
+}
+
+AudioPlayer::~AudioPlayer() {
+    end();
+    if (ctl) vSemaphoreDelete(ctl);
+}
+
+bool AudioPlayer::begin(I2SClass& port, size_t ring_bytes, BaseType_t core) {
+    if (output_task) return true;
+    if (!begin(ring_bytes, core ? 0 : 1)) return false;
+
+    // Output above the UI so it keeps the DMA fed; the reader only has to
+    // stay ahead of it, on the other core
+    i2s = &port;
+    if (xTaskCreatePinnedToCore(outputTask, "audio_out", 4096, this, 10, &output_task, core) != pdPASS) {
+        output_task = nullptr;
+        Serial.println("[AudioPlayer] Failed to start audio tasks");
+        end();
+        return false;
+    }
+    return true;
+}
+
+bool AudioPlayer::begin(size_t ring_bytes, BaseType_t core) {
+    if (reader_task) return true;
+    if (!ctl) return false;
+
+    // The ring lives in PSRAM. Card reads land in internal DMA memory first:
+    // the SDMMC driver would copy into PSRAM one sector at a time.
+    ring_size = ring_bytes - ring_bytes % 4;
+    ring = (uint8_t*)heap_caps_malloc(ring_size, MALLOC_CAP_SPIRAM);
+    if (!ring) {
+        ring_size = AUDIO_RING_FALLBACK;
+        ring = (uint8_t*)heap_caps_malloc(ring_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (ring) Serial.println("[AudioPlayer] No PSRAM, using a 32 KB ring");
+    }
+    read_buf = (uint8_t*)heap_caps_aligned_alloc(4, AUDIO_READ_CHUNK, MALLOC_CAP_DMA);
+    block = (uint8_t*)heap_caps_malloc(AUDIO_BLOCK_FRAMES * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    out = (int16_t*)heap_caps_malloc(AUDIO_BLOCK_FRAMES * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!ring || !read_buf || !block || !out) {
+        Serial.println("[AudioPlayer] Out of memory");
+        freeBuffers();
+        return false;
+    }
+
+    stopping = false;
+    ringReset(0);
+
+    if (xTaskCreatePinnedToCore(readerTask, "audio_read", 4096, this, 5, &reader_task, core) != pdPASS) {
+        reader_task = nullptr;
+        Serial.println("[AudioPlayer] Failed to start audio tasks");
+        freeBuffers();
+        return false;
+    }
+    return true;
+}
+
+void AudioPlayer::end() {
+    if (!ring) return;
+
+    stop();
+    stopping = true;
+    if (reader_task) xTaskNotifyGive(reader_task);
+    while (reader_task || output_task) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    stopping = false;
+    i2s = nullptr;
+    freeBuffers();
+}
+
+bool AudioPlayer::play(const char* file_path) {
+    if (!reader_task) return false;
+    stop();
+
+    xSemaphoreTake(ctl, portMAX_DELAY);
+    strlcpy(path, file_path, sizeof(path));
+    bool ok = reopen();
+    if (ok) {
+        bool is_wav = false;
+        uint32_t size = file.size();
+        if (!parseWav(size, is_wav)) {
+            if (is_wav) {
+                Serial.printf("[AudioPlayer] %s: unsupported or damaged WAV\n", path);
+                ok = false;
+            } else {
+                // No RIFF header: headerless PCM
+                format = raw_format;
+                data_start = 0;
+                data_end = size;
+            }
+        }
+    }
+    if (ok) {
+        frame_bytes = format.channels * 2;
+        data_end -= (data_end - data_start) % frame_bytes;
+        ok = file.seek(data_start);
+    }
+    if (!ok) {
+        closeFile();
+        path[0] = '\0';
+        xSemaphoreGive(ctl);
+        return false;
+    }
+
+    read_pos = data_start;
+    ringReset(data_start);
+    eof = data_end <= data_start;
+    format_pending = true;
+    underrun_start = 0;
+    state = AUDIO_BUFFERING;
+    xSemaphoreGive(ctl);
+
+    xTaskNotifyGive(reader_task);
+    return true;
+}
+
+void AudioPlayer::pause() {
+    if (state == AUDIO_PLAYING || state == AUDIO_BUFFERING) state = AUDIO_PAUSED;
+}
+
+void AudioPlayer::resume() {
+    if (state == AUDIO_PAUSED) state = AUDIO_BUFFERING;
+}
+
+void AudioPlayer::stop() {
+    if (!ctl) return;
+    xSemaphoreTake(ctl, portMAX_DELAY);
+    state = AUDIO_STOPPED;
+    eof = true;
+    closeFile();
+    path[0] = '\0';
+    if (ring) ringReset(data_start);
+    xSemaphoreGive(ctl);
+}
+
+bool AudioPlayer::seek(uint32_t ms) {
+    xSemaphoreTake(ctl, portMAX_DELAY);
+    if (!path[0] || (!file_open && !reopen())) {
+        xSemaphoreGive(ctl);
+        return false;
+    }
+
+    // Whole frames, clamped to the data
+    uint64_t frames = (uint64_t)ms * format.sample_rate / 1000;
+    uint64_t offset = frames * frame_bytes;
+    if (offset > data_end - data_start) offset = data_end - data_start;
+    uint32_t target = data_start + (uint32_t)offset;
+    if (!file.seek(target)) {
+        xSemaphoreGive(ctl);
+        return false;
+    }
+
+    read_pos = target;
+    ringReset(target);
+    eof = target >= data_end && !looping;
+    if (state == AUDIO_PLAYING) state = AUDIO_BUFFERING;
+    xSemaphoreGive(ctl);
+
+    xTaskNotifyGive(reader_task);
+    return true;
+}
+
+void AudioPlayer::setVolume(uint8_t percent) {
+    if (percent > 100) percent = 100;
+    gain = (int32_t)percent * 32768 / 100;
+}
+
+void AudioPlayer::setRawFormat(uint32_t sample_rate, uint8_t channels) {
+    raw_format.sample_rate = sample_rate;
+    raw_format.channels = (channels == 1) ? 1 : 2;
+    raw_format.bits = 16;
+}
+
+uint32_t AudioPlayer::getPositionMs() const {
+    return bytesToMs(play_pos - data_start);
+}
+
+uint32_t AudioPlayer::getDurationMs() const {
+    return bytesToMs(data_end - data_start);
+}
+
+uint32_t AudioPlayer::getBufferedMs() const {
+    return bytesToMs(ring_count);
+}
+
+AudioPlayer::Stats AudioPlayer::getStats() const {
+    Stats s = stats;
+    s.low_water_ms = (low_water == SIZE_MAX) ? 0 : bytesToMs(low_water);
+    return s;
+}
+
+void AudioPlayer::resetStats() {
+    memset(&stats, 0, sizeof(stats));
+    low_water = SIZE_MAX;
+}
+
+size_t AudioPlayer::read(int16_t* stereo, size_t frames) {
+    if (!ring) {
+        memset(stereo, 0, frames * 4);
+        return 0;
+    }
+    if (format_pending) {
+        format_pending = false;
+        if (on_format) on_format(format);
+    }
+
+    size_t done = 0;
+    size_t audio = 0;
+    while (done < frames) {
+        size_t n = frames - done;
+        if (n > AUDIO_BLOCK_FRAMES) n = AUDIO_BLOCK_FRAMES;
+        size_t got = render(stereo + done * 2, n);
+        memset(stereo + (done + got) * 2, 0, (n - got) * 4);
+        audio += got;
+        done += n;
+    }
+    return audio;
+}
+
+// Private helper methods
+void AudioPlayer::freeBuffers() {
+    if (ring) heap_caps_free(ring);
+    if (read_buf) heap_caps_free(read_buf);
+    if (block) heap_caps_free(block);
+    if (out) heap_caps_free(out);
+    ring = nullptr;
+    read_buf = nullptr;
+    block = nullptr;
+    out = nullptr;
+}
+
+bool AudioPlayer::reopen() {
+    file = sd.openFile(path);
+    if (!file || file.isDirectory()) {
+        Serial.printf("[AudioPlayer] Cannot open %s\n", path);
+        file.close();
+        return false;
+    }
+    file_open = true;
+    return true;
+}
+
+bool AudioPlayer::parseWav(uint32_t file_size, bool& is_wav) {
+    uint8_t hdr[16];
+    is_wav = false;
+    if (file.read(hdr, 12) != 12 || memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    is_wav = true;
+
+    bool have_fmt = false;
+    uint64_t pos = 12;
+    while (pos + 8 <= file_size) {
+        if (!file.seek(pos) || file.read(hdr, 8) != 8) return false;
+        uint32_t len;
+        memcpy(&len, hdr + 4, 4);
+
+        if (memcmp(hdr, "fmt ", 4) == 0) {
+            if (len < 16 || file.read(hdr, 16) != 16) return false;
+            uint16_t tag, channels, bits;
+            uint32_t rate;
+            memcpy(&tag, hdr, 2);
+            memcpy(&channels, hdr + 2, 2);
+            memcpy(&rate, hdr + 4, 4);
+            memcpy(&bits, hdr + 14, 2);
+            // WAVE_FORMAT_EXTENSIBLE carries plain PCM too at these sizes
+            if ((tag != 1 && tag != 0xFFFE) || bits != 16 || channels < 1 || channels > 2 || rate == 0) {
+                return false;
+            }
+            format = {rate, (uint8_t)channels, 16};
+            have_fmt = true;
+        } else if (memcmp(hdr, "data", 4) == 0) {
+            if (!have_fmt) return false;
+            data_start = pos + 8;
+            // A recording that was cut off leaves the size at 0 or too large
+            bool bad_len = (len == 0 || len > file_size - data_start);
+            data_end = bad_len ? file_size : data_start + len;
+            return true;
+        }
+        pos += 8 + (uint64_t)len + (len & 1);   // Chunks are padded to even sizes
+    }
+    return false;
+}
+
+void AudioPlayer::closeFile() {
+    if (!file_open) return;
+    file.close();
+    file_open = false;
+}
+
+void AudioPlayer::ringReset(uint32_t position) {
+    portENTER_CRITICAL(&ring_mux);
+    ring_head = 0;
+    ring_tail = 0;
+    ring_count = 0;
+    ring_gen++;
+    play_pos = position;
+    portEXIT_CRITICAL(&ring_mux);
+    ring_primed = false;
+}
+
+size_t AudioPlayer::ringSpace() {
+    portENTER_CRITICAL(&ring_mux);
+    size_t space = ring_size - ring_count;
+    portEXIT_CRITICAL(&ring_mux);
+    return space;
+}
+
+void AudioPlayer::ringWrite(const uint8_t* data, size_t len) {
+    // Only the reader moves the tail, so the copy needs no lock
+    size_t first = ring_size - ring_tail;
+    if (first > len) first = len;
+    memcpy(ring + ring_tail, data, first);
+    memcpy(ring, data + first, len - first);
+
+    portENTER_CRITICAL(&ring_mux);
+    ring_tail = (ring_tail + len) % ring_size;
+    ring_count += len;
+    portEXIT_CRITICAL(&ring_mux);
+}
+
+size_t AudioPlayer::ringRead(uint8_t* data, size_t len) {
+    portENTER_CRITICAL(&ring_mux);
+    size_t head = ring_head;
+    size_t avail = ring_count;
+    uint32_t gen = ring_gen;
+    portEXIT_CRITICAL(&ring_mux);
+
+    if (len > avail) len = avail;
+    size_t first = ring_size - head;
+    if (first > len) first = len;
+    memcpy(data, ring + head, first);
+    memcpy(data + first, ring, len - first);
+
+    portENTER_CRITICAL(&ring_mux);
+    if (gen != ring_gen) {
+        len = 0;    // Seek or stop while copying: that audio is gone
+    } else {
+        ring_head = (head + len) % ring_size;
+        ring_count -= len;
+        play_pos += len;
+        if (play_pos >= data_end && looping) play_pos -= data_end - data_start;
+    }
+    portEXIT_CRITICAL(&ring_mux);
+    return len;
+}
+
+uint32_t AudioPlayer::bytesToMs(uint64_t bytes) const {
+    if (!format.sample_rate || !frame_bytes) return 0;
+    return (uint32_t)(bytes / frame_bytes * 1000 / format.sample_rate);
+}
+
+size_t AudioPlayer::prefillBytes() const {
+    size_t bytes = (size_t)((uint64_t)format.sample_rate * frame_bytes * AUDIO_PREFILL_MS / 1000);
+    return (bytes < ring_size * 3 / 4) ? bytes : ring_size * 3 / 4;
+}
+
+bool AudioPlayer::fillRing() {
+    if (!file_open || eof) return false;
+    if (ringSpace() < AUDIO_READ_CHUNK) {
+        ring_primed = true;
+        return false;
+    }
+
+    uint32_t want = data_end - read_pos;
+    if (want > AUDIO_READ_CHUNK) want = AUDIO_READ_CHUNK;
+    unsigned long start = millis();
+    size_t got = want ? file.read(read_buf, want) : 0;
+    uint32_t elapsed = millis() - start;
+    if (elapsed > stats.max_read_ms) stats.max_read_ms = elapsed;
+
+    got -= got % frame_bytes;
+    if (got) {
+        ringWrite(read_buf, got);
+        stats.bytes_read += got;
+        read_pos += got;
+    }
+    if (got < want) {
+        Serial.printf("[AudioPlayer] Read failed at %u in %s\n", read_pos, path);
+    }
+
+    if (read_pos >= data_end || got < want) {
+        if (looping && got == want && file.seek(data_start)) {
+            read_pos = data_start;
+        } else {
+            // Everything left is in the ring; give the card back now
+            eof = true;
+            closeFile();
+        }
+    }
+    return got > 0;
+}
+
+size_t AudioPlayer::render(int16_t* dst, size_t max_frames) {
+    size_t frames = 0;
+
+    if (state == AUDIO_BUFFERING && (ring_count >= prefillBytes() || eof)) {
+        if (underrun_start) {
+            stats.underrun_ms += millis() - underrun_start;
+            underrun_start = 0;
+        }
+        state = AUDIO_PLAYING;
+    }
+
+    if (state == AUDIO_PLAYING) {
+        frames = ringRead(block, max_frames * frame_bytes) / frame_bytes;
+
+        // Q15 gain, 32768 = unity, so the product cannot leave 16 bits
+        const int16_t* in = (const int16_t*)block;
+        int32_t g = gain;
+        if (format.channels == 2) {
+            for (size_t i = 0; i < frames * 2; i++) {
+                dst[i] = (int16_t)((in[i] * g) >> 15);
+            }
+        } else {
+            for (size_t i = 0; i < frames; i++) {
+                int16_t s = (int16_t)((in[i] * g) >> 15);
+                dst[2 * i] = s;
+                dst[2 * i + 1] = s;
+            }
+        }
+
+        size_t left = ring_count;
+        if (frames < max_frames && state == AUDIO_PLAYING) {
+            if (eof && left == 0) {
+                state = AUDIO_STOPPED;
+                if (on_end) on_end();
+            } else {
+                // The reader fell behind: silence until the prefill is back
+                stats.underruns++;
+                underrun_start = millis();
+                state = AUDIO_BUFFERING;
+            }
+        } else if (ring_primed && !eof && left < low_water) {
+            low_water = left;
+        }
+
+        if (ringSpace() >= AUDIO_READ_CHUNK) xTaskNotifyGive(reader_task);
+    }
+    return frames;
+}
+
+void AudioPlayer::readerTask(void* arg) {
+    AudioPlayer* self = (AudioPlayer*)arg;
+
+    while (!self->stopping) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
+
+        // One chunk per turn of the lock, so seek() and stop() get in between
+        bool more = true;
+        while (more && !self->stopping) {
+            xSemaphoreTake(self->ctl, portMAX_DELAY);
+            more = self->fillRing();
+            xSemaphoreGive(self->ctl);
+        }
+    }
+
+    self->reader_task = nullptr;
+    vTaskDelete(nullptr);
+}
+
+void AudioPlayer::outputTask(void* arg) {
+    AudioPlayer* self = (AudioPlayer*)arg;
+
+    while (!self->stopping) {
+        if (self->format_pending) {
+            self->format_pending = false;
+            const AudioFormat& f = self->format;
+            if (!self->i2s->configureTX(f.sample_rate, I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_STEREO)) {
+                Serial.printf("[AudioPlayer] I2S cannot run at %u Hz\n", f.sample_rate);
+            }
+            if (self->on_format) self->on_format(f);
+        }
+
+        // Silence when idle too: a starved DMA repeats its last buffer.
+        // The write blocks until the DMA has room, which paces this loop.
+        size_t frames = self->render(self->out, AUDIO_BLOCK_FRAMES);
+        memset(self->out + frames * 2, 0, (AUDIO_BLOCK_FRAMES - frames) * 4);
+        self->i2s->write((const uint8_t*)self->out, AUDIO_BLOCK_FRAMES * 4);
+    }
+
+    self->output_task = nullptr;
+    vTaskDelete(nullptr);
+}
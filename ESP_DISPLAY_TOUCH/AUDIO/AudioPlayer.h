@@ -0,0 +1,157 @@
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "ESP_I2S.h"
+#include "SDMounter.h"
+
+// Streams WAV or raw PCM from the card to I2S, so audio is no longer
+// limited to what fits in flash. A reader task keeps a ring buffer in PSRAM
+// topped up from the card; an output task at a higher priority moves it to
+// the I2S DMA a block at a time. A slow card access or a busy UI drains the
+// ring for a moment, not the DMA queue, and the caller never blocks.
+//
+// When the ring runs dry before the end of the file (an underrun) the
+// output sends silence, since the DMA would otherwise repeat its last
+// buffer, and holds off until the ring is back at the prefill level: one
+// clean gap instead of a stutter. getStats() counts them and keeps the
+// ring's low-water mark, so the ring size can be set from real UI load.
+//
+// Formats: WAV (PCM, 16 bit, mono or stereo) and headerless 16-bit PCM in
+// the format set by setRawFormat(). Mono goes out on both channels. The
+// I2S port is switched to the file's rate; reprogram the codec (e.g.
+// es8311_sample_frequency_config()) in onFormat().
+//
+//   i2s.begin(I2S_MODE_STD, 16000, I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_STEREO);
+//   player.begin(i2s);
+//   player.play("/music/canon.wav");
+//
+// Without an I2S port the player only runs the reader, and whoever owns the
+// output (AudioMixer) pulls samples with read().
+
+#define AUDIO_RING_DEFAULT (256 * 1024)     // 1.5 s of 44.1 kHz stereo
+#define AUDIO_READ_CHUNK (16 * 1024)        // Card read size
+#define AUDIO_BLOCK_FRAMES 256              // Frames per I2S write
+#define AUDIO_PREFILL_MS 250                // Buffered before playing and after an underrun
+
+enum AudioPlayerState : uint8_t {
+    AUDIO_STOPPED,
+    AUDIO_BUFFERING,    // Filling the ring before (re)starting
+    AUDIO_PLAYING,
+    AUDIO_PAUSED
+};
+
+struct AudioFormat {
+    uint32_t sample_rate;
+    uint8_t channels;           // 1 or 2
+    uint8_t bits;               // 16
+};
+
+class AudioPlayer {
+public:
+    struct Stats {
+        uint32_t underruns;
+        uint32_t underrun_ms;       // Silence played because of them
+        uint32_t low_water_ms;      // Least audio left in the ring while playing
+        uint32_t max_read_ms;       // Slowest card read
+        uint64_t bytes_read;
+    };
+
+    explicit AudioPlayer(SDMounter& sd = SDCard);
+    ~AudioPlayer();
+
+    // The output task runs on core, the reader on the other one
+    bool begin(I2SClass& i2s, size_t ring_bytes = AUDIO_RING_DEFAULT, BaseType_t core = 1);
+    // Pull mode: the reader runs on core and nothing drives I2S
+    bool begin(size_t ring_bytes = AUDIO_RING_DEFAULT, BaseType_t core = 0);
+    void end();
+
+    // Pull mode: fills frames of stereo at getFormat().sample_rate, silence
+    // where there is no audio, and returns how many frames were audio
+    size_t read(int16_t* stereo, size_t frames);
+
+    bool play(const char* path);    // Stops what is playing first
+    void pause();
+    void resume();
+    void stop();
+    bool seek(uint32_t ms);
+
+    void setLoop(bool enable) { looping = enable; }
+    void setVolume(uint8_t percent);    // 0-100, applied to the samples
+    void setRawFormat(uint32_t sample_rate, uint8_t channels);
+
+    // Both run on the output task (or in read()); keep them short
+    void onFormat(std::function<void(const AudioFormat&)> callback) { on_format = callback; }
+    void onEnd(std::function<void()> callback) { on_end = callback; }
+
+    AudioPlayerState getState() const { return state; }
+    bool isPlaying() const { return state == AUDIO_PLAYING || state == AUDIO_BUFFERING; }
+    const AudioFormat& getFormat() const { return format; }
+    uint32_t getPositionMs() const;
+    uint32_t getDurationMs() const;
+    uint32_t getBufferedMs() const;
+    Stats getStats() const;
+    void resetStats();
+
+private:
+    SDMounter& sd;
+    I2SClass* i2s;
+    char path[SD_PATH_MAX];         // Kept so seek() can reopen after the reader closed it
+    File file;
+    bool file_open;
+    AudioFormat format;
+    AudioFormat raw_format;
+    uint32_t frame_bytes;
+    uint32_t data_start;            // File offsets of the PCM data
+    uint32_t data_end;
+    uint32_t read_pos;              // Next file offset the reader fetches
+    volatile uint32_t play_pos;     // File offset of the oldest byte in the ring
+    volatile bool eof;
+    volatile bool looping;
+    volatile bool format_pending;   // Output task reconfigures I2S
+    volatile AudioPlayerState state;
+    volatile int32_t gain;          // Q15
+    unsigned long underrun_start;
+
+    // Ring: the reader appends, the output task consumes. Indices move
+    // under ring_mux; a reset bumps ring_gen so a read in flight is dropped.
+    uint8_t* ring;
+    size_t ring_size;
+    size_t ring_head;
+    size_t ring_tail;
+    size_t ring_count;
+    uint32_t ring_gen;
+    portMUX_TYPE ring_mux;
+    volatile bool ring_primed;      // Filled up once since the last reset
+    size_t low_water;               // Least ring_count while primed, SIZE_MAX = none
+
+    uint8_t* read_buf;              // Internal DMA memory for card reads
+    uint8_t* block;                 // One block of file frames
+    int16_t* out;                   // The same block as stereo samples
+
+    SemaphoreHandle_t ctl;          // Serializes the file between callers and the reader
+    TaskHandle_t reader_task;
+    TaskHandle_t output_task;
+    volatile bool stopping;
+    std::function<void(const AudioFormat&)> on_format;
+    std::function<void()> on_end;
+    Stats stats;
+
+    // Private helper methods
+    void freeBuffers();
+    bool reopen();
+    bool parseWav(uint32_t file_size, bool& is_wav);
+    void closeFile();
+    void ringReset(uint32_t position);
+    size_t ringSpace();
+    void ringWrite(const uint8_t* data, size_t len);
+    size_t ringRead(uint8_t* data, size_t len);
+    uint32_t bytesToMs(uint64_t bytes) const;
+    size_t prefillBytes() const;
+    bool fillRing();
+    size_t render(int16_t* dst, size_t max_frames);
+    static void readerTask(void* arg);
+    static void outputTask(void* arg);
+};
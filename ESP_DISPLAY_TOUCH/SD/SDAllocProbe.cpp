@@ -0,0 +1,99 @@
+#include "SDAllocProbe.h"
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#if defined(CONFIG_HEAP_TRACING_STANDALONE)
+#include <esp_heap_trace.h>
+#define SD_ALLOC_TRACE_RECORDS 16   // Only the totals are read; old records roll off
+#endif
+
+// One probe at a time; the hook runs inside every malloc, so it only does
+// a handle compare and an increment
+static volatile TaskHandle_t probe_task = nullptr;
+static volatile uint32_t probe_count = 0;
+static bool hooks_installed = false;
+
+#if defined(CONFIG_HEAP_TRACING_STANDALONE)
+static heap_trace_record_t trace_records[SD_ALLOC_TRACE_RECORDS];
+static bool trace_ready = false;
+#endif
+
+static bool traceReady() {
+#if defined(CONFIG_HEAP_TRACING_STANDALONE)
+    if (!trace_ready) {
+        trace_ready = heap_trace_init_standalone(trace_records, SD_ALLOC_TRACE_RECORDS) == ESP_OK;
+    }
+    return trace_ready;
+#else
+    return false;
+#endif
+}
+
+static uint32_t allocatedBlocks() {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+    return info.allocated_blocks;
+}
+
+SDAllocProbe::SDAllocProbe()
+    : start_blocks(0),
+      active(false) {
+}
+
+SDAllocProbe::~SDAllocProbe() {
+    if (active) end();
+}
+
+void SDAllocProbe::begin() {
+    probe_count = 0;
+    start_blocks = allocatedBlocks();
+    active = true;
+
+#if defined(CONFIG_HEAP_TRACING_STANDALONE)
+    if (getMode() == MODE_HEAP_TRACE) {
+        heap_trace_start(HEAP_TRACE_ALL);
+        return;
+    }
+#endif
+    probe_task = xTaskGetCurrentTaskHandle();
+}
+
+uint32_t SDAllocProbe::end() {
+    if (!active) return 0;
+    probe_task = nullptr;
+    active = false;
+
+    switch (getMode()) {
+        case MODE_HOOKS:
+            return probe_count;
+#if defined(CONFIG_HEAP_TRACING_STANDALONE)
+        case MODE_HEAP_TRACE: {
+            heap_trace_stop();
+            heap_trace_summary_t summary;
+            return heap_trace_summary(&summary) == ESP_OK ? summary.total_allocations : 0;
+        }
+#endif
+        default: {
+            uint32_t blocks = allocatedBlocks();
+            return blocks > start_blocks ? blocks - start_blocks : 0;
+        }
+    }
+}
+
+SDAllocProbe::Mode SDAllocProbe::getMode() {
+    if (hooks_installed) return MODE_HOOKS;
+    if (traceReady()) return MODE_HEAP_TRACE;
+    return MODE_NET_BLOCKS;
+}
+
+bool SDAllocProbe::useHooks() {
+    hooks_installed = true;
+    return true;
+}
+
+void IRAM_ATTR SDAllocProbe::noteAlloc() {
+    if (probe_task && xTaskGetCurrentTaskHandle() == probe_task) {
+        probe_count++;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <Arduino.h>
+
+// Counts heap allocations made between begin() and end(), to check that a
+// code path stays off the heap:
+//
+//   SDAllocProbe probe;
+//   probe.begin();
+//   SDCard.existsFile("/config.json");
+//   Serial.println(probe.end());   // 0 when nothing allocated
+//
+// How allocations are counted depends on the core:
+//   MODE_HOOKS       Allocations by the calling task. Needs a core built with
+//                    CONFIG_HEAP_USE_HOOKS (IDF 5.1+) and one file of the
+//                    sketch defining SD_ALLOC_PROBE_HOOKS before including
+//                    this header. The hooks are strong symbols, so only one
+//                    file in the link may provide them.
+//   MODE_HEAP_TRACE  Allocations by every task, from the standalone heap
+//                    trace (CONFIG_HEAP_TRACING_STANDALONE).
+//   MODE_NET_BLOCKS  Neither: only allocations still held when end() runs.
+// Counts include allocations made below SDMounter, e.g. FatFs long-name
+// buffers when CONFIG_FATFS_LFN_HEAP is set.
+
+class SDAllocProbe {
+public:
+    enum Mode {
+        MODE_HOOKS,
+        MODE_HEAP_TRACE,
+        MODE_NET_BLOCKS
+    };
+
+    SDAllocProbe();
+    ~SDAllocProbe();
+
+    void begin();
+    uint32_t end();
+    static Mode getMode();
+    static bool isExact() { return getMode() != MODE_NET_BLOCKS; }
+
+    // Called by the heap hooks below
+    static bool useHooks();
+    static void noteAlloc();
+
+private:
+    uint32_t start_blocks;
+    bool active;
+};
+
+#if defined(SD_ALLOC_PROBE_HOOKS) && defined(CONFIG_HEAP_USE_HOOKS)
+extern "C" void IRAM_ATTR esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps) {
+    if (ptr) SDAllocProbe::noteAlloc();
+}
+
+extern "C" void IRAM_ATTR esp_heap_trace_free_hook(void* ptr) {
+}
+
+[[maybe_unused]] static const bool sd_alloc_probe_hooked = SDAllocProbe::useHooks();
+#endif
@@ -0,0 +1,338 @@
+#include "SDAsync.h"
+#include <algorithm>
+
+SDAsync::SDAsync()
+    : sd(nullptr),
+      delivery(SD_ASYNC_DELIVER_POLL),
+      worker(nullptr),
+      high_queue(nullptr),
+      low_queue(nullptr),
+      done_queue(nullptr),
+      work_signal(nullptr),
+      pending_lock(nullptr),
+      next_id(1),
+      stopping(false) {
+}
+
+SDAsync::~SDAsync() {
+    end();
+}
+
+bool SDAsync::begin(SDMounter& sd_mounter, SDAsyncDelivery mode, uint8_t queue_depth,
+                    BaseType_t core, UBaseType_t priority, uint32_t stack_size) {
+    if (worker) return true;
+
+    sd = &sd_mounter;
+    delivery = mode;
+    stopping = false;
+
+    high_queue = xQueueCreate(queue_depth, sizeof(Request*));
+    low_queue = xQueueCreate(queue_depth, sizeof(Request*));
+    done_queue = xQueueCreate(queue_depth * 2, sizeof(Completion*));
+    work_signal = xSemaphoreCreateCounting(queue_depth * 2, 0);
+    pending_lock = xSemaphoreCreateMutex();
+
+    if (!high_queue || !low_queue || !done_queue || !work_signal || !pending_lock) {
+        Serial.println("[SDAsync] Failed to create queues");
+        end();
+        return false;
+    }
+
+    if (xTaskCreatePinnedToCore(workerTask, "sd_async", stack_size, this,
+                                priority, &worker, core) != pdPASS) {
+        Serial.println("[SDAsync] Failed to start worker task");
+        worker = nullptr;
+        end();
+        return false;
+    }
+
+    Serial.printf("[SDAsync] Worker started on core %d\n", (int)core);
+    return true;
+}
+
+void SDAsync::end() {
+    if (worker) {
+        stopping = true;
+        xSemaphoreGive(work_signal); // Wake the worker so it can exit
+        while (worker) {
+            vTaskDelay(pdMS_TO_TICKS(5));
+        }
+    }
+
+    // Drop anything still queued
+    Request* req;
+    while (high_queue && xQueueReceive(high_queue, &req, 0) == pdTRUE) delete req;
+    while (low_queue && xQueueReceive(low_queue, &req, 0) == pdTRUE) delete req;
+    Completion* done;
+    while (done_queue && xQueueReceive(done_queue, &done, 0) == pdTRUE) delete done;
+
+    if (high_queue) vQueueDelete(high_queue);
+    if (low_queue) vQueueDelete(low_queue);
+    if (done_queue) vQueueDelete(done_queue);
+    if (work_signal) vSemaphoreDelete(work_signal);
+    if (pending_lock) vSemaphoreDelete(pending_lock);
+    high_queue = low_queue = done_queue = nullptr;
+    work_signal = pending_lock = nullptr;
+    pending.clear();
+}
+
+uint32_t SDAsync::read(const char* path, SDAsyncCallback callback, SDAsyncPriority priority) {
+    return read(path, nullptr, 0, callback, priority);
+}
+
+uint32_t SDAsync::read(const char* path, uint8_t* buffer, size_t max_len, SDAsyncCallback callback,
+                       SDAsyncPriority priority) {
+    Request* req = new Request();
+    req->op = SD_ASYNC_READ;
+    req->path = path;
+    req->out_buffer = buffer;
+    req->out_len = max_len;
+    req->callback = callback;
+    return submit(req, priority);
+}
+
+uint32_t SDAsync::write(const char* path, const uint8_t* data, size_t len, SDAsyncCallback callback,
+                        SDAsyncPriority priority) {
+    Request* req = new Request();
+    req->op = SD_ASYNC_WRITE;
+    req->path = path;
+    req->data.assign(data, data + len);
+    req->callback = callback;
+    return submit(req, priority);
+}
+
+uint32_t SDAsync::write(const char* path, const char* content, SDAsyncCallback callback,
+                        SDAsyncPriority priority) {
+    return write(path, (const uint8_t*)content, strlen(content), callback, priority);
+}
+
+uint32_t SDAsync::append(const char* path, const uint8_t* data, size_t len, SDAsyncCallback callback,
+                         SDAsyncPriority priority) {
+    Request* req = new Request();
+    req->op = SD_ASYNC_APPEND;
+    req->path = path;
+    req->data.assign(data, data + len);
+    req->callback = callback;
+    return submit(req, priority);
+}
+
+uint32_t SDAsync::append(const char* path, const char* content, SDAsyncCallback callback,
+                         SDAsyncPriority priority) {
+    return append(path, (const uint8_t*)content, strlen(content), callback, priority);
+}
+
+uint32_t SDAsync::list(const char* path, SDAsyncCallback callback, SDAsyncPriority priority) {
+    Request* req = new Request();
+    req->op = SD_ASYNC_LIST;
+    req->path = path;
+    req->callback = callback;
+    return submit(req, priority);
+}
+
+uint32_t SDAsync::stat(const char* path, SDAsyncCallback callback, SDAsyncPriority priority) {
+    Request* req = new Request();
+    req->op = SD_ASYNC_STAT;
+    req->path = path;
+    req->callback = callback;
+    return submit(req, priority);
+}
+
+uint32_t SDAsync::copy(const char* src, const char* dst, SDAsyncCallback callback,
+                       SDAsyncPriority priority) {
+    Request* req = new Request();
+    req->op = SD_ASYNC_COPY;
+    req->path = src;
+    req->path2 = dst;
+    req->callback = callback;
+    return submit(req, priority);
+}
+
+bool SDAsync::cancel(uint32_t id) {
+    if (!pending_lock || id == 0) return false;
+
+    // FreeRTOS queues cannot drop an item from the middle, so the request
+    // stays in its lane without its payload and the worker only reports it
+    bool found = false;
+    xSemaphoreTake(pending_lock, portMAX_DELAY);
+    for (Request* req : pending) {
+        if (req->id == id) {
+            found = !req->cancelled;
+            req->cancelled = true;
+            std::vector<uint8_t>().swap(req->data);
+            break;
+        }
+    }
+    xSemaphoreGive(pending_lock);
+    return found;
+}
+
+uint8_t SDAsync::poll(uint8_t max_completions) {
+    if (!done_queue) return 0;
+
+    uint8_t delivered = 0;
+    Completion* done;
+    while (delivered < max_completions && xQueueReceive(done_queue, &done, 0) == pdTRUE) {
+        if (done->callback) {
+            done->callback(done->result);
+        }
+        delete done;
+        delivered++;
+    }
+    return delivered;
+}
+
+uint32_t SDAsync::pendingRequests() const {
+    if (!high_queue) return 0;
+    return uxQueueMessagesWaiting(high_queue) + uxQueueMessagesWaiting(low_queue);
+}
+
+// Private helper methods
+uint32_t SDAsync::submit(Request* req, SDAsyncPriority priority) {
+    if (!worker) {
+        delete req;
+        return 0;
+    }
+
+    uint32_t id = next_id++;
+    if (next_id == 0) next_id = 1;
+    req->id = id; // The worker may free req as soon as it is queued
+    req->cancelled = false;
+
+    // Listed before it is queued, so the worker always finds it to take
+    QueueHandle_t lane = (priority == SD_ASYNC_HIGH) ? high_queue : low_queue;
+    xSemaphoreTake(pending_lock, portMAX_DELAY);
+    pending.push_back(req);
+    bool queued = xQueueSend(lane, &req, 0) == pdTRUE;
+    if (!queued) pending.pop_back();
+    xSemaphoreGive(pending_lock);
+
+    if (!queued) {
+        Serial.println("[SDAsync] Request queue full");
+        delete req;
+        return 0;
+    }
+
+    xSemaphoreGive(work_signal);
+    return id;
+}
+
+bool SDAsync::takeRequest(Request* req) {
+    // Off the pending list, so cancel() no longer finds it; true if it was cancelled
+    xSemaphoreTake(pending_lock, portMAX_DELAY);
+    auto it = std::find(pending.begin(), pending.end(), req);
+    if (it != pending.end()) pending.erase(it);
+    bool cancelled = req->cancelled;
+    xSemaphoreGive(pending_lock);
+
+    return cancelled;
+}
+
+void SDAsync::execute(Request* req, SDAsyncResult& result) {
+    const char* path = req->path.c_str();
+
+    switch (req->op) {
+        case SD_ASYNC_READ:
+            if (req->out_buffer) {
+                result.bytes = sd->readFile(path, req->out_buffer, req->out_len);
+                result.ok = (sd->getErrorCode() == 0);
+            } else {
+                result.text = sd->readFile(path);
+                result.bytes = result.text.length();
+                result.ok = (sd->getErrorCode() == 0);
+            }
+            break;
+
+        case SD_ASYNC_WRITE:
+            result.ok = sd->writeFile(path, req->data.data(), req->data.size());
+            result.bytes = result.ok ? req->data.size() : 0;
+            break;
+
+        case SD_ASYNC_APPEND:
+            result.ok = sd->appendFile(path, req->data.data(), req->data.size());
+            result.bytes = result.ok ? req->data.size() : 0;
+            break;
+
+        case SD_ASYNC_LIST:
+            result.entries = sd->listDirVector(path);
+            result.ok = (sd->getErrorCode() == 0);
+            break;
+
+        case SD_ASYNC_STAT: {
+            result.ok = sd->existsFile(path);
+            if (result.ok) {
+                File file = sd->openFile(path, FILE_READ);
+                if (file) {
+                    result.is_dir = file.isDirectory();
+                    result.bytes = result.is_dir ? 0 : file.size();
+                    file.close();
+                }
+            }
+            break;
+        }
+
+        case SD_ASYNC_COPY:
+            result.ok = sd->copyFile(path, req->path2.c_str());
+            result.bytes = result.ok ? sd->getFileSize(req->path2.c_str()) : 0;
+            break;
+    }
+
+    result.error_code = sd->getErrorCode();
+}
+
+void SDAsync::complete(Request* req, SDAsyncResult& result) {
+    if (!req->callback) return;
+
+    if (delivery == SD_ASYNC_DELIVER_WORKER) {
+        req->callback(result);
+        return;
+    }
+
+    Completion* done = new Completion();
+    done->callback = req->callback;
+    done->result = std::move(result);
+
+    // Wait for poll() to make room rather than lose a completion
+    while (xQueueSend(done_queue, &done, pdMS_TO_TICKS(100)) != pdTRUE) {
+        if (stopping) {
+            delete done;
+            return;
+        }
+    }
+}
+
+void SDAsync::workerTask(void* arg) {
+    SDAsync* self = (SDAsync*)arg;
+
+    while (true) {
+        xSemaphoreTake(self->work_signal, portMAX_DELAY);
+        if (self->stopping) break;
+
+        // High lane first; each signal matches exactly one queued request
+        Request* req = nullptr;
+        if (xQueueReceive(self->high_queue, &req, 0) != pdTRUE &&
+            xQueueReceive(self->low_queue, &req, 0) != pdTRUE) {
+            continue;
+        }
+
+        SDAsyncResult result;
+        result.id = req->id;
+        result.op = req->op;
+        result.ok = false;
+        result.cancelled = false;
+        result.error_code = 0;
+        result.bytes = 0;
+        result.is_dir = false;
+
+        if (self->takeRequest(req)) {
+            result.cancelled = true;
+        } else {
+            self->execute(req, result);
+        }
+
+        self->complete(req, result);
+        delete req;
+    }
+
+    self->worker = nullptr;
+    vTaskDelete(nullptr);
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "SDMounter.h"
+
+// Asynchronous front end for SDMounter.
+// Requests go into a bounded queue (two priority lanes) and are executed by
+// a worker task pinned to one core, so the UI thread never waits on the card.
+// Completions are either run on the worker or queued for poll(), which the
+// LVGL thread calls from loop() so callbacks can touch widgets directly.
+//
+// SDMounter is thread safe, so direct calls may run alongside the worker;
+// they simply wait for the mounter's lock while a request is executing.
+
+enum SDAsyncOp {
+    SD_ASYNC_READ,
+    SD_ASYNC_WRITE,
+    SD_ASYNC_APPEND,
+    SD_ASYNC_LIST,
+    SD_ASYNC_STAT,
+    SD_ASYNC_COPY
+};
+
+enum SDAsyncPriority {
+    SD_ASYNC_HIGH,      // UI reads - always served first
+    SD_ASYNC_LOW        // Background logging, copies
+};
+
+enum SDAsyncDelivery {
+    SD_ASYNC_DELIVER_WORKER,    // Callback runs on the worker task
+    SD_ASYNC_DELIVER_POLL       // Callback runs inside poll()
+};
+
+struct SDAsyncResult {
+    uint32_t id;
+    SDAsyncOp op;
+    bool ok;
+    bool cancelled;
+    int error_code;
+    size_t bytes;                   // Read/written/copied, or size for STAT
+    bool is_dir;                    // STAT
+    String text;                    // READ without a caller buffer
+    std::vector<String> entries;    // LIST
+};
+
+typedef std::function<void(const SDAsyncResult& result)> SDAsyncCallback;
+
+class SDAsync {
+public:
+    SDAsync();
+    ~SDAsync();
+
+    bool begin(SDMounter& sd, SDAsyncDelivery delivery = SD_ASYNC_DELIVER_POLL,
+               uint8_t queue_depth = 16, BaseType_t core = 0,
+               UBaseType_t priority = 1, uint32_t stack_size = 6144);
+    void end();
+    bool isRunning() const { return worker != nullptr; }
+
+    // Submit - return a request id, or 0 when the queue is full (never blocks)
+    uint32_t read(const char* path, SDAsyncCallback callback,
+                  SDAsyncPriority priority = SD_ASYNC_HIGH);
+    uint32_t read(const char* path, uint8_t* buffer, size_t max_len, SDAsyncCallback callback,
+                  SDAsyncPriority priority = SD_ASYNC_HIGH);
+    uint32_t write(const char* path, const uint8_t* data, size_t len, SDAsyncCallback callback = nullptr,
+                   SDAsyncPriority priority = SD_ASYNC_LOW);
+    uint32_t write(const char* path, const char* content, SDAsyncCallback callback = nullptr,
+                   SDAsyncPriority priority = SD_ASYNC_LOW);
+    uint32_t append(const char* path, const uint8_t* data, size_t len, SDAsyncCallback callback = nullptr,
+                    SDAsyncPriority priority = SD_ASYNC_LOW);
+    uint32_t append(const char* path, const char* content, SDAsyncCallback callback = nullptr,
+                    SDAsyncPriority priority = SD_ASYNC_LOW);
+    uint32_t list(const char* path, SDAsyncCallback callback,
+                  SDAsyncPriority priority = SD_ASYNC_HIGH);
+    uint32_t stat(const char* path, SDAsyncCallback callback,
+                  SDAsyncPriority priority = SD_ASYNC_HIGH);
+    uint32_t copy(const char* src, const char* dst, SDAsyncCallback callback = nullptr,
+                  SDAsyncPriority priority = SD_ASYNC_LOW);
+
+    // Cancel a queued request: it is skipped and completes with cancelled
+    // set. False when the id is not queued (unknown, running or finished).
+    bool cancel(uint32_t id);
+
+    // Deliver queued completions (SD_ASYNC_DELIVER_POLL). Call from loop().
+    uint8_t poll(uint8_t max_completions = 8);
+
+    uint32_t pendingRequests() const;
+
+private:
+    struct Request {
+        uint32_t id;
+        SDAsyncOp op;
+        String path;
+        String path2;                   // COPY destination
+        std::vector<uint8_t> data;      // WRITE/APPEND payload (owned copy)
+        uint8_t* out_buffer;            // READ into caller memory
+        size_t out_len;
+        SDAsyncCallback callback;
+        bool cancelled;
+    };
+
+    struct Completion {
+        SDAsyncCallback callback;
+        SDAsyncResult result;
+    };
+
+    SDMounter* sd;
+    SDAsyncDelivery delivery;
+    TaskHandle_t worker;
+    QueueHandle_t high_queue;
+    QueueHandle_t low_queue;
+    QueueHandle_t done_queue;
+    SemaphoreHandle_t work_signal;     // Counts queued requests across both lanes
+    SemaphoreHandle_t pending_lock;
+    std::vector<Request*> pending;     // Queued, not yet taken by the worker
+    uint32_t next_id;
+    volatile bool stopping;
+
+    uint32_t submit(Request* req, SDAsyncPriority priority);
+    bool takeRequest(Request* req);
+    void execute(Request* req, SDAsyncResult& result);
+    void complete(Request* req, SDAsyncResult& result);
+    static void workerTask(void* arg);
+};
@@ -0,0 +1,368 @@
+#include "SDBenchmark.h"
+#include <algorithm>
+
+SDBenchmark::SDBenchmark(fs::FS& filesystem, const char* dir)
+    : fs(filesystem),
+      work_dir(dir),
+      cfg(defaultConfig()),
+      samples(nullptr),
+      sample_count(0),
+      op_count(0),
+      min_seen(0),
+      max_seen(0),
+      buffer(nullptr),
+      buffer_size(0) {
+}
+
+SDBenchmark::~SDBenchmark() {
+    release();
+}
+
+SDBenchmark::Config SDBenchmark::defaultConfig() {
+    Config c;
+    c.file_size = 4 * 1024 * 1024;
+    c.min_block = 512;
+    c.max_block = 256 * 1024;
+    c.random_ops = 256;
+    c.small_files = 100;
+    c.small_file_size = 1024;
+    c.max_samples = 8192;
+    return c;
+}
+
+bool SDBenchmark::runAll() {
+    bool ok = true;
+
+    for (size_t block = cfg.min_block; block <= cfg.max_block; block *= 2) {
+        ok &= runSequential(block);
+    }
+    ok &= runRandom(4096);
+    ok &= runSmallFiles();
+
+    fs.remove(testFilePath().c_str());
+    fs.rmdir(work_dir.c_str());
+    release();
+    return ok;
+}
+
+bool SDBenchmark::runSequential(size_t block_size) {
+    if (!runSequentialWrite(block_size)) return false;
+    return runSequentialRead(block_size);
+}
+
+bool SDBenchmark::runSequentialWrite(size_t block_size) {
+    if (!prepare(block_size)) return false;
+
+    uint32_t blocks = cfg.file_size / block_size;
+    if (blocks == 0) blocks = 1;
+
+    beginSamples();
+    uint32_t start = micros();
+
+    File file = fs.open(testFilePath().c_str(), FILE_WRITE);
+    if (!file) {
+        Serial.println("[SDBenchmark] Failed to create test file");
+        return false;
+    }
+
+    uint64_t written = 0;
+    for (uint32_t i = 0; i < blocks; i++) {
+        uint32_t t0 = micros();
+        size_t n = file.write(buffer, block_size);
+        recordSample(micros() - t0);
+        written += n;
+        if (n != block_size) break;
+    }
+    file.close(); // Includes the final flush, as a real writer would pay it
+
+    finishResult("seq_write", block_size, written, micros() - start);
+    return written == (uint64_t)blocks * block_size;
+}
+
+bool SDBenchmark::runSequentialRead(size_t block_size) {
+    if (!prepare(block_size)) return false;
+    if (!ensureTestFile()) return false;
+
+    beginSamples();
+    uint32_t start = micros();
+
+    File file = fs.open(testFilePath().c_str(), FILE_READ);
+    if (!file) {
+        Serial.println("[SDBenchmark] Failed to open test file");
+        return false;
+    }
+
+    uint64_t total_read = 0;
+    while (true) {
+        uint32_t t0 = micros();
+        size_t n = file.read(buffer, block_size);
+        if (n == 0) break;
+        recordSample(micros() - t0);
+        total_read += n;
+    }
+    file.close();
+
+    finishResult("seq_read", block_size, total_read, micros() - start);
+    return total_read > 0;
+}
+
+bool SDBenchmark::runRandom(size_t block_size) {
+    if (!prepare(block_size)) return false;
+    if (!ensureTestFile()) return false;
+
+    File file = fs.open(testFilePath().c_str(), "r+");
+    if (!file) {
+        Serial.println("[SDBenchmark] Failed to open test file for random I/O");
+        return false;
+    }
+
+    uint32_t slots = file.size() / block_size;
+    if (slots == 0) {
+        file.close();
+        return false;
+    }
+
+    // Random writes
+    beginSamples();
+    uint32_t start = micros();
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < cfg.random_ops; i++) {
+        uint32_t offset = (uint32_t)random(slots) * block_size;
+        uint32_t t0 = micros();
+        file.seek(offset);
+        bytes += file.write(buffer, block_size);
+        recordSample(micros() - t0);
+    }
+    file.flush();
+    finishResult("rand_write", block_size, bytes, micros() - start);
+
+    // Random reads
+    beginSamples();
+    start = micros();
+    bytes = 0;
+    for (uint32_t i = 0; i < cfg.random_ops; i++) {
+        uint32_t offset = (uint32_t)random(slots) * block_size;
+        uint32_t t0 = micros();
+        file.seek(offset);
+        bytes += file.read(buffer, block_size);
+        recordSample(micros() - t0);
+    }
+    finishResult("rand_read", block_size, bytes, micros() - start);
+
+    file.close();
+    return true;
+}
+
+bool SDBenchmark::runSmallFiles() {
+    if (!prepare(cfg.small_file_size)) return false;
+
+    String dir = work_dir + "/small";
+    fs.mkdir(dir.c_str());
+    char path[96];
+
+    // Create
+    beginSamples();
+    uint32_t start = micros();
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < cfg.small_files; i++) {
+        snprintf(path, sizeof(path), "%s/f%05u.bin", dir.c_str(), (unsigned)i);
+        uint32_t t0 = micros();
+        File file = fs.open(path, FILE_WRITE);
+        if (file) {
+            bytes += file.write(buffer, cfg.small_file_size);
+            file.close();
+        }
+        recordSample(micros() - t0);
+    }
+    finishResult("file_create", cfg.small_file_size, bytes, micros() - start);
+
+    // Enumerate
+    beginSamples();
+    start = micros();
+    File root = fs.open(dir.c_str());
+    if (root && root.isDirectory()) {
+        uint32_t t0 = micros();
+        File entry = root.openNextFile();
+        while (entry) {
+            entry.close();
+            recordSample(micros() - t0);
+            t0 = micros();
+            entry = root.openNextFile();
+        }
+        root.close();
+    }
+    finishResult("dir_enum", 0, 0, micros() - start);
+
+    // Delete
+    beginSamples();
+    start = micros();
+    for (uint32_t i = 0; i < cfg.small_files; i++) {
+        snprintf(path, sizeof(path), "%s/f%05u.bin", dir.c_str(), (unsigned)i);
+        uint32_t t0 = micros();
+        fs.remove(path);
+        recordSample(micros() - t0);
+    }
+    finishResult("file_delete", cfg.small_file_size, 0, micros() - start);
+
+    fs.rmdir(dir.c_str());
+    return bytes == (uint64_t)cfg.small_files * cfg.small_file_size;
+}
+
+const SDBenchmark::Result* SDBenchmark::findResult(const char* workload, size_t block_size) const {
+    for (const Result& r : results) {
+        if (r.block_size == block_size && strcmp(r.workload, workload) == 0) {
+            return &r;
+        }
+    }
+    return nullptr;
+}
+
+void SDBenchmark::printResults() {
+    Serial.println("\n================================ SD BENCHMARK ================================");
+    Serial.println("workload     |  block |   ops |     KB/s |   IOPS |  p50 us |  p90 us |  p99 us |  max us");
+    for (const Result& r : results) {
+        Serial.printf("%-12s | %6u | %5u | %8.1f | %6.0f | %7u | %7u | %7u | %7u\n",
+                      r.workload, (unsigned)r.block_size, r.ops, r.kbps, r.iops,
+                      r.p50_us, r.p90_us, r.p99_us, r.max_us);
+    }
+    Serial.println("==============================================================================\n");
+}
+
+bool SDBenchmark::writeCsv(const char* path) {
+    File file = fs.open(path, FILE_WRITE);
+    if (!file) return false;
+
+    file.println("workload,block_size,ops,bytes,total_us,kbps,iops,min_us,p50_us,p90_us,p99_us,max_us");
+    for (const Result& r : results) {
+        file.printf("%s,%u,%u,%llu,%u,%.2f,%.2f,%u,%u,%u,%u,%u\n",
+                    r.workload, (unsigned)r.block_size, r.ops, (unsigned long long)r.bytes,
+                    r.total_us, r.kbps, r.iops, r.min_us, r.p50_us, r.p90_us, r.p99_us, r.max_us);
+    }
+    file.close();
+    return true;
+}
+
+bool SDBenchmark::writeJson(const char* path) {
+    File file = fs.open(path, FILE_WRITE);
+    if (!file) return false;
+
+    file.println("{\"results\":[");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        file.printf("{\"workload\":\"%s\",\"block_size\":%u,\"ops\":%u,\"bytes\":%llu,"
+                    "\"total_us\":%u,\"kbps\":%.2f,\"iops\":%.2f,\"min_us\":%u,"
+                    "\"p50_us\":%u,\"p90_us\":%u,\"p99_us\":%u,\"max_us\":%u}%s\n",
+                    r.workload, (unsigned)r.block_size, r.ops, (unsigned long long)r.bytes,
+                    r.total_us, r.kbps, r.iops, r.min_us, r.p50_us, r.p90_us, r.p99_us, r.max_us,
+                    (i + 1 < results.size()) ? "," : "");
+    }
+    file.println("]}");
+    file.close();
+    return true;
+}
+
+// Private helper methods
+bool SDBenchmark::prepare(size_t block_size) {
+    fs.mkdir(work_dir.c_str());
+
+    if (!samples) {
+        samples = (uint32_t*)malloc(cfg.max_samples * sizeof(uint32_t));
+        if (!samples) {
+            Serial.println("[SDBenchmark] Memory allocation failed");
+            return false;
+        }
+    }
+
+    if (buffer_size < block_size) {
+        free(buffer);
+        buffer = (uint8_t*)malloc(block_size);
+        buffer_size = buffer ? block_size : 0;
+        if (!buffer) {
+            Serial.println("[SDBenchmark] Memory allocation failed");
+            return false;
+        }
+        fillPattern(buffer, block_size, block_size);
+    }
+
+    return true;
+}
+
+void SDBenchmark::release() {
+    free(samples);
+    free(buffer);
+    samples = nullptr;
+    buffer = nullptr;
+    buffer_size = 0;
+}
+
+bool SDBenchmark::ensureTestFile() {
+    File file = fs.open(testFilePath().c_str(), FILE_READ);
+    bool ok = file && file.size() >= cfg.file_size;
+    if (file) file.close();
+    if (ok) return true;
+
+    // Not timed: written with whatever buffer is currently allocated
+    file = fs.open(testFilePath().c_str(), FILE_WRITE);
+    if (!file) return false;
+    size_t written = 0;
+    while (written < cfg.file_size) {
+        size_t n = file.write(buffer, buffer_size);
+        if (n == 0) break;
+        written += n;
+    }
+    file.close();
+    return written >= cfg.file_size;
+}
+
+void SDBenchmark::fillPattern(uint8_t* buf, size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)((i * 31 + seed) & 0xFF);
+    }
+}
+
+void SDBenchmark::beginSamples() {
+    sample_count = 0;
+    op_count = 0;
+    min_seen = UINT32_MAX;
+    max_seen = 0;
+}
+
+void SDBenchmark::recordSample(uint32_t us) {
+    op_count++;
+    if (us < min_seen) min_seen = us;
+    if (us > max_seen) max_seen = us;
+    if (sample_count < cfg.max_samples) {
+        samples[sample_count++] = us;
+    } else {
+        // Reservoir sampling keeps the percentiles unbiased for long runs
+        uint32_t slot = (uint32_t)random(op_count);
+        if (slot < cfg.max_samples) samples[slot] = us;
+    }
+}
+
+void SDBenchmark::finishResult(const char* workload, size_t block_size, uint64_t bytes, uint32_t total_us) {
+    Result r;
+    memset(&r, 0, sizeof(r));
+    strncpy(r.workload, workload, sizeof(r.workload) - 1);
+    r.block_size = block_size;
+    r.ops = op_count;
+    r.bytes = bytes;
+    r.total_us = total_us;
+
+    float seconds = total_us / 1000000.0f;
+    if (seconds > 0) {
+        r.kbps = (bytes / 1024.0f) / seconds;
+        r.iops = op_count / seconds;
+    }
+
+    if (sample_count > 0) {
+        std::sort(samples, samples + sample_count);
+        r.min_us = min_seen;
+        r.p50_us = samples[(sample_count - 1) * 50 / 100];
+        r.p90_us = samples[(sample_count - 1) * 90 / 100];
+        r.p99_us = samples[(sample_count - 1) * 99 / 100];
+        r.max_us = max_seen;
+    }
+
+    results.push_back(r);
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+
+// Storage benchmark suite. Runs against any fs::FS (SD_MMC, or a RAM-disk
+// backend on the bench) so results from the watch and the host line up.
+//
+// Workloads:
+//   seq_write / seq_read   - one file, block size swept from 512 B to 256 KB
+//   rand_write / rand_read - 4 KB accesses at random aligned offsets
+//   file_create / file_delete - many small files
+//   dir_enum               - enumerating the small-file directory
+
+class SDBenchmark {
+public:
+    struct Config {
+        size_t file_size;         // Sequential/random test file size
+        size_t min_block;         // Sequential sweep start (power of two)
+        size_t max_block;         // Sequential sweep end (power of two)
+        uint32_t random_ops;      // Operations per random workload
+        uint32_t small_files;     // Files for create/delete/enumerate
+        size_t small_file_size;
+        uint32_t max_samples;     // Latency samples kept per workload
+    };
+
+    struct Result {
+        char workload[16];
+        size_t block_size;
+        uint32_t ops;
+        uint64_t bytes;
+        uint32_t total_us;
+        float kbps;
+        float iops;
+        uint32_t min_us;
+        uint32_t p50_us;
+        uint32_t p90_us;
+        uint32_t p99_us;
+        uint32_t max_us;
+    };
+
+    SDBenchmark(fs::FS& fs, const char* work_dir = "/bench");
+    ~SDBenchmark();
+
+    static Config defaultConfig();
+    void setConfig(const Config& config) { cfg = config; }
+    const Config& getConfig() const { return cfg; }
+
+    // Workloads (each appends one Result per run)
+    bool runAll();
+    bool runSequential(size_t block_size);
+    bool runSequentialWrite(size_t block_size);
+    bool runSequentialRead(size_t block_size);
+    bool runRandom(size_t block_size = 4096);
+    bool runSmallFiles();
+
+    // Reporting
+    const std::vector<Result>& getResults() const { return results; }
+    const Result* findResult(const char* workload, size_t block_size) const;
+    void clearResults() { results.clear(); }
+    void printResults();
+    bool writeCsv(const char* path);
+    bool writeJson(const char* path);
+
+private:
+    fs::FS& fs;
+    String work_dir;
+    Config cfg;
+    std::vector<Result> results;
+
+    // Latency recorder (reservoir sampled once max_samples is reached)
+    uint32_t* samples;
+    uint32_t sample_count;
+    uint32_t op_count;
+    uint32_t min_seen;
+    uint32_t max_seen;
+
+    uint8_t* buffer;
+    size_t buffer_size;
+
+    bool prepare(size_t block_size);
+    void release();
+    bool ensureTestFile();
+    String testFilePath() const { return work_dir + "/seq.bin"; }
+    void fillPattern(uint8_t* buf, size_t len, uint32_t seed);
+
+    void beginSamples();
+    void recordSample(uint32_t us);
+    void finishResult(const char* workload, size_t block_size, uint64_t bytes, uint32_t total_us);
+};
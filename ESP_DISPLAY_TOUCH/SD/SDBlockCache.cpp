@@ -0,0 +1,526 @@
+#include "SDBlockCache.h"
+#include "SDMounter.h"
+#include <esp_heap_caps.h>
+#include <algorithm>
+
+SDBlockCache::SDBlockCache()
+    : block_size(SD_CACHE_DEFAULT_BLOCK),
+      prefetch_depth(SD_CACHE_DEFAULT_PREFETCH),
+      use_clock(0),
+      next_file_id(1),
+      lock(nullptr),
+      changed(nullptr),
+      waiters(0),
+      prefetch_queue(nullptr),
+      prefetcher(nullptr),
+      stopping(false) {
+    resetStats();
+}
+
+SDBlockCache::~SDBlockCache() {
+    end();
+}
+
+bool SDBlockCache::begin(size_t size, uint8_t count, uint8_t depth, BaseType_t core) {
+    if (lock) return true;
+
+    block_size = (size + SD_CACHE_ALIGN - 1) & ~(size_t)(SD_CACHE_ALIGN - 1);
+    prefetch_depth = depth;
+    use_clock = 0;
+    stopping = false;
+    resetStats();
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t* data = (uint8_t*)heap_caps_aligned_alloc(SD_CACHE_ALIGN, block_size, MALLOC_CAP_SPIRAM);
+        if (!data) {
+            data = (uint8_t*)heap_caps_aligned_alloc(SD_CACHE_ALIGN, block_size, MALLOC_CAP_8BIT);
+        }
+        if (!data) break; // Run with what we have
+
+        Block block;
+        block.data = data;
+        block.file_id = 0;
+        block.block_no = 0;
+        block.length = 0;
+        block.last_use = 0;
+        block.pins = 0;
+        block.state = BLOCK_FREE;
+        block.prefetched = false;
+        blocks.push_back(block);
+    }
+
+    // One block for the reader, at least one more to read ahead into
+    if (blocks.size() < 2) {
+        Serial.println("[SDBlockCache] Not enough memory for cache blocks");
+        end();
+        return false;
+    }
+
+    lock = xSemaphoreCreateMutex();
+    changed = xSemaphoreCreateCounting(UINT8_MAX, 0);
+    waiters = 0;
+    prefetch_queue = xQueueCreate(blocks.size(), sizeof(PrefetchRequest));
+    if (!lock || !changed || !prefetch_queue) {
+        end();
+        return false;
+    }
+
+    if (prefetch_depth > 0 &&
+        xTaskCreatePinnedToCore(prefetchTask, "sd_prefetch", 4096, this, 2, &prefetcher, core) != pdPASS) {
+        Serial.println("[SDBlockCache] Failed to start prefetch task, read-ahead disabled");
+        prefetcher = nullptr;
+    }
+
+    Serial.printf("[SDBlockCache] %u x %u KB blocks, read-ahead %u\n",
+                  (unsigned)blocks.size(), (unsigned)(block_size / 1024), prefetch_depth);
+    return true;
+}
+
+void SDBlockCache::end() {
+    if (prefetcher) {
+        stopping = true;
+        PrefetchRequest wake = {0, 0};
+        xQueueSend(prefetch_queue, &wake, portMAX_DELAY);
+        while (prefetcher) {
+            vTaskDelay(pdMS_TO_TICKS(5));
+        }
+    }
+
+    while (!files.empty()) {
+        files.back()->close();
+    }
+
+    // Readers still copying out of a block or filling one finish first
+    if (lock) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        while (true) {
+            bool busy = false;
+            for (Block& block : blocks) {
+                if (block.pins || block.state == BLOCK_LOADING) busy = true;
+            }
+            if (!busy) break;
+            waitLocked();
+        }
+        xSemaphoreGive(lock);
+    }
+
+    for (Block& block : blocks) {
+        heap_caps_free(block.data);
+    }
+    blocks.clear();
+
+    if (prefetch_queue) vQueueDelete(prefetch_queue);
+    if (changed) vSemaphoreDelete(changed);
+    if (lock) vSemaphoreDelete(lock);
+    prefetch_queue = nullptr;
+    changed = nullptr;
+    lock = nullptr;
+}
+
+SDBlockCache::Stats SDBlockCache::getStats() const {
+    if (!lock) return stats;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    Stats copy = stats;
+    xSemaphoreGive(lock);
+    return copy;
+}
+
+float SDBlockCache::getHitRate() const {
+    Stats s = getStats();
+    uint32_t total = s.hits + s.misses;
+    return total ? (float)s.hits / total : 0.0f;
+}
+
+void SDBlockCache::resetStats() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+    memset(&stats, 0, sizeof(stats));
+    if (lock) xSemaphoreGive(lock);
+}
+
+void SDBlockCache::printStats() {
+    Stats s = getStats();
+    Serial.println("=== SD Block Cache ===");
+    Serial.printf("Blocks: %u x %u KB\n", (unsigned)blocks.size(), (unsigned)(block_size / 1024));
+    Serial.printf("Hits: %u  Misses: %u  Hit rate: %.1f%%\n",
+                  s.hits, s.misses, getHitRate() * 100.0f);
+    Serial.printf("Prefetch: issued %u, used %u, wasted %u, waited on %u\n",
+                  s.prefetch_issued, s.prefetch_hits, s.prefetch_wasted, s.waits);
+    Serial.println("======================");
+}
+
+// Used by SDCachedFile
+uint32_t SDBlockCache::attach(SDCachedFile* file) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t id = next_file_id++;
+    if (next_file_id == 0) next_file_id = 1;
+    files.push_back(file);
+    xSemaphoreGive(lock);
+    return id;
+}
+
+void SDBlockCache::detach(SDCachedFile* file) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    files.erase(std::remove(files.begin(), files.end(), file), files.end());
+
+    // The prefetch task may still be filling a block from this file's handle
+    while (true) {
+        bool loading = false;
+        for (Block& block : blocks) {
+            if (block.file_id == file->id && block.state == BLOCK_LOADING) loading = true;
+        }
+        if (!loading) break;
+        waitLocked();
+    }
+
+    for (Block& block : blocks) {
+        if (block.file_id == file->id) {
+            block.state = BLOCK_FREE;
+            block.file_id = 0;
+            block.prefetched = false;
+        }
+    }
+    wakeLocked();
+    xSemaphoreGive(lock);
+}
+
+SDBlockCache::Block* SDBlockCache::acquire(SDCachedFile* file, uint32_t block_no) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    // Read-ahead for this block still on its way in is worth waiting for
+    // rather than reading it a second time. With every block pinned by other
+    // readers or loading there is nowhere to read it, so wait for one too:
+    // giving up would end the caller's read short of EOF.
+    Block* block;
+    bool hit;
+    bool waited = false;
+    while (true) {
+        block = findLocked(file->id, block_no);
+        if (block && block->state == BLOCK_LOADING) {
+            waited = true;
+            waitLocked();
+            continue;
+        }
+        hit = (block != nullptr);
+        if (!block) block = evictLocked();
+        if (block) break;
+        waitLocked();
+    }
+    if (waited) stats.waits++;
+
+    if (hit) {
+        stats.hits++;
+        if (block->prefetched) {
+            stats.prefetch_hits++;
+            block->prefetched = false;
+        }
+        block->pins++;
+        block->last_use = ++use_clock;
+        xSemaphoreGive(lock);
+        return block;
+    }
+
+    // Miss: read it here
+    stats.misses++;
+    block->file_id = file->id;
+    block->block_no = block_no;
+    block->state = BLOCK_LOADING;
+    block->prefetched = false;
+    block->pins = 1;
+    xSemaphoreGive(lock);
+
+    size_t got = 0;
+    if (file->file.seek((uint32_t)block_no * block_size)) {
+        got = file->file.read(block->data, block_size);
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    block->length = got;
+    block->last_use = ++use_clock;
+    block->state = got ? BLOCK_READY : BLOCK_FREE;
+    if (!got) {
+        block->pins = 0;
+        block->file_id = 0;
+        block = nullptr;
+    }
+    wakeLocked();
+    xSemaphoreGive(lock);
+
+    return block;
+}
+
+void SDBlockCache::release(Block* block) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (block->pins && --block->pins == 0) wakeLocked();
+    xSemaphoreGive(lock);
+}
+
+void SDBlockCache::prefetch(uint32_t file_id, uint32_t block_no) {
+    if (!prefetcher) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (!findLocked(file_id, block_no)) {
+        PrefetchRequest req = {file_id, block_no};
+        if (xQueueSend(prefetch_queue, &req, 0) == pdTRUE) {
+            stats.prefetch_issued++;
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+// Private helper methods
+SDBlockCache::Block* SDBlockCache::findLocked(uint32_t file_id, uint32_t block_no) {
+    for (Block& block : blocks) {
+        if (block.state != BLOCK_FREE && block.file_id == file_id && block.block_no == block_no) {
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+SDBlockCache::Block* SDBlockCache::evictLocked() {
+    Block* victim = nullptr;
+    for (Block& block : blocks) {
+        if (block.state == BLOCK_FREE) return &block;
+        if (block.state != BLOCK_READY || block.pins) continue;
+        if (!victim || block.last_use < victim->last_use) victim = &block;
+    }
+
+    if (victim && victim->prefetched) {
+        stats.prefetch_wasted++;
+    }
+    return victim;
+}
+
+void SDBlockCache::waitLocked() {
+    // Registered under the lock, so a wake between giving it and taking
+    // changed is still counted
+    waiters++;
+    xSemaphoreGive(lock);
+    xSemaphoreTake(changed, portMAX_DELAY);
+    xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void SDBlockCache::wakeLocked() {
+    for (; waiters; waiters--) {
+        xSemaphoreGive(changed);
+    }
+}
+
+void SDBlockCache::loadPrefetch(const PrefetchRequest& req) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    SDCachedFile* file = nullptr;
+    for (SDCachedFile* f : files) {
+        if (f->id == req.file_id) file = f;
+    }
+    if (!file || findLocked(req.file_id, req.block_no)) {
+        xSemaphoreGive(lock);
+        return; // Closed meanwhile, or the reader got there first
+    }
+
+    Block* block = evictLocked();
+    if (!block) {
+        xSemaphoreGive(lock);
+        return;
+    }
+    block->file_id = req.file_id;
+    block->block_no = req.block_no;
+    block->state = BLOCK_LOADING;
+    block->prefetched = true;
+    block->pins = 0;
+    xSemaphoreGive(lock);
+
+    // detach() waits for LOADING blocks, so the file stays open until we are done.
+    // Opened straight on the filesystem: the file's mounter handle covers it,
+    // and taking the mounter lock here could deadlock a reader holding it.
+    if (!file->prefetch_file) {
+        file->prefetch_file = file->fs->open(file->path.c_str(), FILE_READ);
+    }
+
+    size_t got = 0;
+    if (file->prefetch_file && file->prefetch_file.seek((uint32_t)req.block_no * block_size)) {
+        got = file->prefetch_file.read(block->data, block_size);
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    block->length = got;
+    block->last_use = ++use_clock; // Counts as recent so it survives until used
+    block->state = got ? BLOCK_READY : BLOCK_FREE;
+    if (!got) {
+        block->file_id = 0;
+        block->prefetched = false;
+    }
+    wakeLocked();
+    xSemaphoreGive(lock);
+}
+
+void SDBlockCache::prefetchTask(void* arg) {
+    SDBlockCache* self = (SDBlockCache*)arg;
+    PrefetchRequest req;
+
+    while (true) {
+        xQueueReceive(self->prefetch_queue, &req, portMAX_DELAY);
+        if (self->stopping) break;
+        self->loadPrefetch(req);
+    }
+
+    self->prefetcher = nullptr;
+    vTaskDelete(nullptr);
+}
+
+// SDCachedFile
+SDCachedFile::SDCachedFile()
+    : cache(nullptr),
+      fs(nullptr),
+      mounter(nullptr),
+      id(0),
+      file_size(0),
+      pos(0),
+      last_block(UINT32_MAX),
+      streak(0),
+      prefetched_until(0) {
+}
+
+SDCachedFile::~SDCachedFile() {
+    close();
+}
+
+bool SDCachedFile::open(SDBlockCache& block_cache, SDMounter& sd, const char* file_path) {
+    File handle = sd.openFile(file_path, FILE_READ);
+    if (!handle) return false;
+    if (!attachTo(block_cache, sd.getSD(), handle)) return false;
+
+    // The foreground File counts itself; this one is for prefetch_file
+    mounter = &sd;
+    mounter->acquireHandle();
+    return true;
+}
+
+bool SDCachedFile::open(SDBlockCache& block_cache, fs::FS& filesystem, const char* file_path) {
+    File handle = filesystem.open(file_path, FILE_READ);
+    if (!handle) return false;
+    return attachTo(block_cache, filesystem, handle);
+}
+
+void SDCachedFile::close() {
+    if (!cache) return;
+
+    cache->detach(this);
+    if (prefetch_file) prefetch_file.close();
+    if (file) file.close();
+    cache = nullptr;
+    fs = nullptr;
+
+    if (mounter) {
+        mounter->releaseHandle();
+        mounter = nullptr;
+    }
+}
+
+size_t SDCachedFile::read(uint8_t* buffer, size_t len) {
+    if (!cache) return 0;
+
+    size_t done = 0;
+    while (done < len && pos < file_size) {
+        uint32_t block_no = pos / cache->block_size;
+        uint32_t offset = pos % cache->block_size;
+
+        notePattern(block_no);
+
+        SDBlockCache::Block* block = cache->acquire(this, block_no);
+        if (!block) break;
+
+        size_t n = 0;
+        if (offset < block->length) {
+            n = block->length - offset;
+            if (n > len - done) n = len - done;
+            memcpy(buffer + done, block->data + offset, n);
+        }
+        cache->release(block);
+
+        if (n == 0) break;
+        done += n;
+        pos += n;
+    }
+
+    return done;
+}
+
+bool SDCachedFile::seek(uint32_t new_pos) {
+    if (!cache || new_pos > file_size) return false;
+    pos = new_pos;
+    return true;
+}
+
+int SDCachedFile::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int SDCachedFile::peek() {
+    uint32_t saved = pos;
+    int c = read();
+    pos = saved;
+    return c;
+}
+
+int SDCachedFile::available() {
+    if (!cache) return 0;
+    uint32_t left = file_size - pos;
+    return left > INT32_MAX ? INT32_MAX : (int)left;
+}
+
+// Private helper methods
+bool SDCachedFile::attachTo(SDBlockCache& block_cache, fs::FS& filesystem, File& handle) {
+    close();
+
+    if (!block_cache.isRunning()) {
+        Serial.println("[SDBlockCache] Cache not started");
+        handle.close();
+        return false;
+    }
+    if (handle.isDirectory()) {
+        handle.close();
+        return false;
+    }
+
+    file = handle;
+    fs = &filesystem;
+    path = handle.path();
+    file_size = handle.size();
+    pos = 0;
+    last_block = UINT32_MAX;
+    streak = 0;
+    prefetched_until = 0;
+    cache = &block_cache;
+    id = cache->attach(this);
+    return true;
+}
+
+uint32_t SDCachedFile::blockCount() const {
+    return (file_size + cache->block_size - 1) / cache->block_size;
+}
+
+void SDCachedFile::notePattern(uint32_t block_no) {
+    if (block_no == last_block) return;
+
+    streak = (last_block != UINT32_MAX && block_no == last_block + 1) ? streak + 1 : 0;
+    last_block = block_no;
+    if (streak > 250) streak = 250;
+
+    // Two blocks in a row look like a stream: keep prefetch_depth blocks ahead
+    if (streak < 1) {
+        prefetched_until = block_no;
+        return;
+    }
+
+    uint32_t target = block_no + cache->prefetch_depth;
+    uint32_t last = blockCount();
+    if (target >= last) target = last - 1;
+
+    uint32_t next = (prefetched_until > block_no) ? prefetched_until + 1 : block_no + 1;
+    for (; next <= target; next++) {
+        cache->prefetch(id, next);
+    }
+    if (target > prefetched_until) prefetched_until = target;
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+class SDMounter;
+class SDCachedFile;
+
+// Read cache for files streamed from the card (audio, images, large JSON).
+// Files are read in whole aligned blocks (PSRAM when available) kept in a
+// small LRU. When an SDCachedFile reads two blocks in a row, the next
+// prefetch_depth blocks are queued for a background task that reads them
+// through its own file handle, so a steady stream finds its data already in
+// RAM when it crosses into the next block.
+//
+// The cache is for read-only use: blocks of a file are not updated when the
+// same file is written through SDMounter.
+
+#define SD_CACHE_ALIGN              64
+#define SD_CACHE_DEFAULT_BLOCK      (16 * 1024)
+#define SD_CACHE_DEFAULT_BLOCKS     16
+#define SD_CACHE_DEFAULT_PREFETCH   2
+
+class SDBlockCache {
+public:
+    struct Stats {
+        uint32_t hits;
+        uint32_t misses;            // Foreground reads that went to the card
+        uint32_t prefetch_issued;
+        uint32_t prefetch_hits;     // First use of a prefetched block
+        uint32_t prefetch_wasted;   // Prefetched blocks evicted unused
+        uint32_t waits;             // Reads that had to wait for an in-flight prefetch
+    };
+
+    SDBlockCache();
+    ~SDBlockCache();
+
+    bool begin(size_t block_size = SD_CACHE_DEFAULT_BLOCK, uint8_t block_count = SD_CACHE_DEFAULT_BLOCKS,
+               uint8_t prefetch_depth = SD_CACHE_DEFAULT_PREFETCH, BaseType_t core = 0);
+    void end();
+    bool isRunning() const { return lock != nullptr; }
+
+    size_t getBlockSize() const { return block_size; }
+    uint8_t getBlockCount() const { return blocks.size(); }
+    void setPrefetchDepth(uint8_t depth) { prefetch_depth = depth; }
+    uint8_t getPrefetchDepth() const { return prefetch_depth; }
+
+    Stats getStats() const;
+    float getHitRate() const;
+    void resetStats();
+    void printStats();
+
+private:
+    friend class SDCachedFile;
+
+    enum BlockState : uint8_t {
+        BLOCK_FREE,
+        BLOCK_LOADING,
+        BLOCK_READY
+    };
+
+    struct Block {
+        uint8_t* data;
+        uint32_t file_id;
+        uint32_t block_no;
+        uint32_t length;        // Valid bytes (short for the last block of a file)
+        uint32_t last_use;
+        uint8_t pins;           // Readers copying out of the block
+        BlockState state;
+        bool prefetched;        // Loaded ahead and not used yet
+    };
+
+    struct PrefetchRequest {
+        uint32_t file_id;
+        uint32_t block_no;
+    };
+
+    std::vector<Block> blocks;
+    std::vector<SDCachedFile*> files;   // Open files, for the prefetch task
+    size_t block_size;
+    uint8_t prefetch_depth;
+    uint32_t use_clock;
+    uint32_t next_file_id;
+    Stats stats;
+
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t changed;      // Given once per waiter when a block is unpinned or loaded
+    uint8_t waiters;
+    QueueHandle_t prefetch_queue;
+    TaskHandle_t prefetcher;
+    volatile bool stopping;
+
+    // Used by SDCachedFile
+    uint32_t attach(SDCachedFile* file);
+    void detach(SDCachedFile* file);
+    Block* acquire(SDCachedFile* file, uint32_t block_no);
+    void release(Block* block);
+    void prefetch(uint32_t file_id, uint32_t block_no);
+
+    Block* findLocked(uint32_t file_id, uint32_t block_no);
+    Block* evictLocked();
+    void waitLocked();
+    void wakeLocked();
+    void loadPrefetch(const PrefetchRequest& req);
+    static void prefetchTask(void* arg);
+};
+
+// Stream over a cached file; works anywhere a Stream is read (ArduinoJson,
+// image decoders, audio readers).
+class SDCachedFile : public Stream {
+public:
+    SDCachedFile();
+    ~SDCachedFile();
+
+    bool open(SDBlockCache& cache, SDMounter& sd, const char* path);
+    bool open(SDBlockCache& cache, fs::FS& fs, const char* path);
+    void close();
+    bool isOpen() const { return cache != nullptr; }
+    operator bool() const { return isOpen(); }
+
+    size_t read(uint8_t* buffer, size_t len);
+    size_t readBytes(char* buffer, size_t len) override { return read((uint8_t*)buffer, len); }
+    bool seek(uint32_t pos);
+    uint32_t position() const { return pos; }
+    uint32_t size() const { return file_size; }
+
+    // Stream interface
+    int read() override;
+    int peek() override;
+    int available() override;
+    size_t write(uint8_t) override { return 0; }
+    void flush() override {}
+
+private:
+    friend class SDBlockCache;
+
+    SDBlockCache* cache;
+    fs::FS* fs;
+    SDMounter* mounter;     // Holds a handle for prefetch_file when opened through SDMounter
+    File file;              // Foreground reads
+    File prefetch_file;     // Only touched by the prefetch task
+    String path;
+    uint32_t id;
+    uint32_t file_size;
+    uint32_t pos;
+    uint32_t last_block;
+    uint8_t streak;         // Consecutive sequential block accesses
+    uint32_t prefetched_until;
+
+    bool attachTo(SDBlockCache& cache, fs::FS& fs, File& file);
+    uint32_t blockCount() const;
+    void notePattern(uint32_t block_no);
+};
@@ -0,0 +1,450 @@
+#include "SDCompressedFile.h"
+#include "SDMounter.h"
+#include "SDCrc.h"
+#include <esp_heap_caps.h>
+
+struct SDZHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t codec;
+    uint8_t block_shift;
+    uint8_t reserved[9];
+};
+
+struct SDZFooter {
+    uint64_t raw_size;
+    uint32_t block_count;
+    uint32_t index_offset;
+    uint32_t index_crc;
+    uint32_t magic;
+};
+
+static_assert(sizeof(SDZHeader) == SD_Z_HEADER_SIZE, "SDZ header layout");
+static_assert(sizeof(SDZFooter) == SD_Z_FOOTER_SIZE, "SDZ footer layout");
+
+// LZ4 jumps back into what it just wrote, which PSRAM serves far slower
+// than internal RAM; PSRAM only when internal RAM is short
+static void* allocBuffer(size_t size) {
+    void* buf = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!buf) buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    return buf;
+}
+
+static uint8_t blockShiftFor(size_t block_size) {
+    uint8_t shift = 10;     // SD_Z_MIN_BLOCK
+    while (shift < 16 && (1UL << (shift + 1)) <= block_size) shift++;
+    return shift;
+}
+
+SDCompressedFile::SDCompressedFile()
+    : opened(false),
+      compressed(false),
+      recovered(false),
+      block_shift(0),
+      raw_size(0),
+      stored_size(0),
+      pos(0),
+      block(nullptr),
+      packed(nullptr),
+      cur_block(UINT32_MAX) {
+    resetStats();
+}
+
+SDCompressedFile::~SDCompressedFile() {
+    close();
+}
+
+bool SDCompressedFile::open(SDMounter& sd, const char* path) {
+    File handle = sd.openFile(path, FILE_READ);
+    if (!handle) return false;
+    return attach(handle);
+}
+
+bool SDCompressedFile::open(fs::FS& fs, const char* path) {
+    File handle = fs.open(path, FILE_READ);
+    if (!handle) return false;
+    return attach(handle);
+}
+
+void SDCompressedFile::close() {
+    if (!opened) return;
+
+    file.close();
+    freeBuffers();
+    index.clear();
+    opened = false;
+}
+
+size_t SDCompressedFile::read(uint8_t* buffer, size_t len) {
+    if (!opened) return 0;
+
+    if (!compressed) {
+        size_t n = file.read(buffer, len);
+        pos += n;
+        return n;
+    }
+
+    size_t done = 0;
+    while (done < len && pos < raw_size) {
+        uint32_t block_no = pos >> block_shift;
+        uint32_t offset = pos & ((1UL << block_shift) - 1);
+        uint32_t length = blockLength(block_no);
+
+        // A whole block wanted: decompress straight into the caller's buffer
+        if (offset == 0 && len - done >= length && block_no != cur_block) {
+            if (!loadBlock(block_no, buffer + done)) break;
+            done += length;
+            pos += length;
+            continue;
+        }
+
+        if (block_no != cur_block) {
+            if (!loadBlock(block_no, block)) {
+                cur_block = UINT32_MAX;
+                break;
+            }
+            cur_block = block_no;
+        }
+
+        size_t n = length - offset;
+        if (n > len - done) n = len - done;
+        memcpy(buffer + done, block + offset, n);
+        done += n;
+        pos += n;
+    }
+
+    return done;
+}
+
+bool SDCompressedFile::seek(uint32_t new_pos) {
+    if (!opened || new_pos > raw_size) return false;
+    if (!compressed && !file.seek(new_pos)) return false;
+    pos = new_pos;
+    return true;
+}
+
+int SDCompressedFile::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int SDCompressedFile::peek() {
+    uint32_t saved = pos;
+    int c = read();
+    seek(saved);
+    return c;
+}
+
+int SDCompressedFile::available() {
+    if (!opened) return 0;
+    uint32_t left = raw_size - pos;
+    return left > INT32_MAX ? INT32_MAX : (int)left;
+}
+
+// Private helper methods
+bool SDCompressedFile::attach(File& handle) {
+    close();
+
+    if (handle.isDirectory()) {
+        handle.close();
+        return false;
+    }
+
+    file = handle;
+    stored_size = file.size();
+    pos = 0;
+    cur_block = UINT32_MAX;
+    compressed = false;
+    recovered = false;
+    resetStats();
+
+    SDZHeader header;
+    bool is_sdz = (stored_size >= SD_Z_HEADER_SIZE &&
+                   file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                   header.magic == SD_Z_MAGIC);
+
+    if (!is_sdz) {
+        // Plain file: pass reads through
+        file.seek(0);
+        raw_size = stored_size;
+        opened = true;
+        return true;
+    }
+
+    if (header.version != SD_Z_VERSION || header.codec != SD_Z_CODEC_LZ4 ||
+        header.block_shift < 10 || header.block_shift > 16) {
+        Serial.printf("[SDCompressedFile] %s: unsupported format\n", file.path());
+        file.close();
+        return false;
+    }
+    block_shift = header.block_shift;
+
+    size_t block_size = 1UL << block_shift;
+    block = (uint8_t*)allocBuffer(block_size);
+    packed = (uint8_t*)allocBuffer(sdLz4Bound(block_size));
+    if (!block || !packed) {
+        Serial.println("[SDCompressedFile] Out of memory for block buffers");
+        freeBuffers();
+        file.close();
+        return false;
+    }
+
+    if (!loadFooter()) {
+        recovered = true;
+        rebuildIndex();
+    }
+
+    compressed = true;
+    opened = true;
+    return true;
+}
+
+bool SDCompressedFile::loadFooter() {
+    if (stored_size < SD_Z_HEADER_SIZE + SD_Z_FOOTER_SIZE) return false;
+
+    SDZFooter footer;
+    if (!file.seek(stored_size - SD_Z_FOOTER_SIZE) ||
+        file.read((uint8_t*)&footer, sizeof(footer)) != sizeof(footer)) {
+        return false;
+    }
+
+    uint64_t block_size = 1ULL << block_shift;
+    uint64_t index_end = (uint64_t)footer.index_offset + (uint64_t)footer.block_count * 4;
+    if (footer.magic != SD_Z_END_MAGIC || footer.raw_size > UINT32_MAX ||
+        index_end + SD_Z_FOOTER_SIZE != stored_size ||
+        footer.block_count != (footer.raw_size + block_size - 1) / block_size) {
+        return false;
+    }
+
+    index.resize(footer.block_count);
+    size_t index_bytes = footer.block_count * 4;
+    if (!file.seek(footer.index_offset) ||
+        file.read((uint8_t*)index.data(), index_bytes) != index_bytes ||
+        sdCrc32(index.data(), index_bytes) != footer.index_crc) {
+        index.clear();
+        return false;
+    }
+
+    raw_size = footer.raw_size;
+    return true;
+}
+
+bool SDCompressedFile::rebuildIndex() {
+    // Keep every block whose header and data made it to the card
+    uint32_t block_size = 1UL << block_shift;
+    uint32_t offset = SD_Z_HEADER_SIZE;
+    raw_size = 0;
+    index.clear();
+
+    while (offset + SD_Z_BLOCK_HEADER <= stored_size) {
+        uint32_t header[2];
+        if (!file.seek(offset) || file.read((uint8_t*)header, sizeof(header)) != sizeof(header)) break;
+
+        uint32_t stored = header[0] & ~SD_Z_STORED;
+        uint32_t raw = header[1];
+        if (raw == 0 || raw > block_size || stored > sdLz4Bound(block_size) ||
+            offset + SD_Z_BLOCK_HEADER + stored > stored_size) {
+            break;
+        }
+
+        index.push_back(offset);
+        raw_size += raw;
+        offset += SD_Z_BLOCK_HEADER + stored;
+        if (raw < block_size) break;    // Only the last block is short
+    }
+
+    Serial.printf("[SDCompressedFile] %s: no index, recovered %u blocks (%u bytes)\n",
+                  file.path(), (unsigned)index.size(), raw_size);
+    return !index.empty();
+}
+
+uint32_t SDCompressedFile::blockLength(uint32_t block_no) const {
+    uint32_t start = block_no << block_shift;
+    uint32_t left = raw_size - start;
+    return (left < (1UL << block_shift)) ? left : (1UL << block_shift);
+}
+
+bool SDCompressedFile::loadBlock(uint32_t block_no, uint8_t* out) {
+    if (block_no >= index.size()) return false;
+
+    uint32_t header[2];
+    if (!file.seek(index[block_no]) || file.read((uint8_t*)header, sizeof(header)) != sizeof(header)) {
+        return false;
+    }
+
+    uint32_t stored = header[0] & ~SD_Z_STORED;
+    uint32_t raw = header[1];
+    if (raw != blockLength(block_no) || stored > sdLz4Bound(1UL << block_shift)) return false;
+
+    if (header[0] & SD_Z_STORED) {
+        if (stored != raw || file.read(out, raw) != raw) return false;
+    } else {
+        if (file.read(packed, stored) != stored) return false;
+
+        unsigned long start = micros();
+        int n = sdLz4Decompress(packed, stored, out, raw);
+        stats.decompress_us += micros() - start;
+        if (n != (int)raw) {
+            Serial.printf("[SDCompressedFile] %s: block %u corrupt\n", file.path(), block_no);
+            return false;
+        }
+    }
+
+    stats.blocks_loaded++;
+    stats.card_bytes += SD_Z_BLOCK_HEADER + stored;
+    stats.raw_bytes += raw;
+    return true;
+}
+
+void SDCompressedFile::freeBuffers() {
+    if (block) heap_caps_free(block);
+    if (packed) heap_caps_free(packed);
+    block = nullptr;
+    packed = nullptr;
+}
+
+SDCompressedWriter::SDCompressedWriter()
+    : opened(false),
+      failed(false),
+      block_shift(0),
+      fill(0),
+      raw_bytes(0),
+      file_offset(0),
+      block(nullptr),
+      packed(nullptr),
+      table(nullptr) {
+}
+
+SDCompressedWriter::~SDCompressedWriter() {
+    close();
+}
+
+bool SDCompressedWriter::open(SDMounter& sd, const char* path, size_t block_size) {
+    File handle = sd.openFile(path, FILE_WRITE);
+    if (!handle) return false;
+    return attach(handle, block_size);
+}
+
+bool SDCompressedWriter::open(fs::FS& fs, const char* path, size_t block_size) {
+    File handle = fs.open(path, FILE_WRITE);
+    if (!handle) return false;
+    return attach(handle, block_size);
+}
+
+bool SDCompressedWriter::close() {
+    if (!opened) return false;
+
+    bool ok = !failed && (fill == 0 || flushBlock());
+
+    if (ok) {
+        SDZFooter footer;
+        footer.raw_size = raw_bytes;
+        footer.block_count = index.size();
+        footer.index_offset = file_offset;
+        footer.index_crc = sdCrc32(index.data(), index.size() * 4);
+        footer.magic = SD_Z_END_MAGIC;
+
+        size_t index_bytes = index.size() * 4;
+        ok = file.write((const uint8_t*)index.data(), index_bytes) == index_bytes &&
+             file.write((const uint8_t*)&footer, sizeof(footer)) == sizeof(footer);
+        if (ok) file_offset += index_bytes + sizeof(footer);
+    }
+
+    file.close();
+    freeBuffers();
+    index.clear();
+    opened = false;
+    return ok;
+}
+
+size_t SDCompressedWriter::write(const uint8_t* data, size_t len) {
+    if (!opened || failed) return 0;
+
+    size_t block_size = 1UL << block_shift;
+    size_t done = 0;
+    while (done < len) {
+        size_t n = block_size - fill;
+        if (n > len - done) n = len - done;
+        memcpy(block + fill, data + done, n);
+        fill += n;
+        done += n;
+        raw_bytes += n;
+
+        if (fill == block_size && !flushBlock()) return done;
+    }
+    return done;
+}
+
+// Private helper methods
+bool SDCompressedWriter::attach(File& handle, size_t block_size) {
+    close();
+
+    file = handle;
+    block_shift = blockShiftFor(block_size);
+    block_size = 1UL << block_shift;
+    fill = 0;
+    raw_bytes = 0;
+    failed = false;
+
+    block = (uint8_t*)allocBuffer(block_size);
+    packed = (uint8_t*)allocBuffer(sdLz4Bound(block_size));
+    table = (uint16_t*)allocBuffer(SD_LZ4_TABLE_BYTES);
+    if (!block || !packed || !table) {
+        Serial.println("[SDCompressedFile] Out of memory for block buffers");
+        freeBuffers();
+        file.close();
+        return false;
+    }
+
+    SDZHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SD_Z_MAGIC;
+    header.version = SD_Z_VERSION;
+    header.codec = SD_Z_CODEC_LZ4;
+    header.block_shift = block_shift;
+    if (file.write((const uint8_t*)&header, sizeof(header)) != sizeof(header)) {
+        freeBuffers();
+        file.close();
+        return false;
+    }
+
+    file_offset = sizeof(header);
+    opened = true;
+    return true;
+}
+
+bool SDCompressedWriter::flushBlock() {
+    size_t stored = sdLz4Compress(block, fill, packed, sdLz4Bound(fill), table);
+
+    // Data that does not shrink is kept as is, so reading it costs nothing extra
+    uint32_t header[2];
+    const uint8_t* data = packed;
+    if (stored == 0 || stored >= fill) {
+        stored = fill;
+        data = block;
+        header[0] = stored | SD_Z_STORED;
+    } else {
+        header[0] = stored;
+    }
+    header[1] = fill;
+
+    if (file.write((const uint8_t*)header, sizeof(header)) != sizeof(header) ||
+        file.write(data, stored) != stored) {
+        failed = true;
+        return false;
+    }
+
+    index.push_back(file_offset);
+    file_offset += sizeof(header) + stored;
+    fill = 0;
+    return true;
+}
+
+void SDCompressedWriter::freeBuffers() {
+    if (block) heap_caps_free(block);
+    if (packed) heap_caps_free(packed);
+    if (table) heap_caps_free(table);
+    block = nullptr;
+    packed = nullptr;
+    table = nullptr;
+}
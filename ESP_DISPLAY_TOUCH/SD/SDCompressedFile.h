@@ -0,0 +1,143 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+#include "SDLz4.h"
+
+class SDMounter;
+
+// Compressed files (.sdz): the data is cut into fixed blocks that are LZ4
+// compressed one by one, and an index of block offsets sits at the end.
+// A reader seeks by loading only the block that holds the position, so
+// logs, layout JSON and text assets take 3-10x fewer bytes off the card
+// while staying randomly accessible. On a 1-bit bus that is faster than
+// reading the plain file, decompression included.
+//
+// File layout (little endian):
+//   header   "SDZ1" | version (1) | codec (1) | block shift (1) | reserved (9)      16 bytes
+//   blocks   stored length | SD_Z_STORED flag (4) | raw length (4) | data
+//   index    file offset of every block (4 each)
+//   footer   raw size (8) | block count (4) | index offset (4) | index CRC32 (4) | "SDZE" (4)
+//
+// The block size is the seek granularity: a random read costs at most one
+// block of decompression. tools/sdpack.py packs and unpacks these files on
+// a PC. A file whose writer never reached close() has no index; the reader
+// then rebuilds it by walking the block headers and keeps every complete
+// block.
+
+#define SD_Z_MAGIC          0x315A4453  // "SDZ1"
+#define SD_Z_END_MAGIC      0x455A4453  // "SDZE"
+#define SD_Z_VERSION        1
+#define SD_Z_CODEC_LZ4      1
+#define SD_Z_HEADER_SIZE    16
+#define SD_Z_FOOTER_SIZE    24
+#define SD_Z_BLOCK_HEADER   8
+#define SD_Z_STORED         0x80000000u // Block kept as is, it did not shrink
+#define SD_Z_MIN_BLOCK      1024
+#define SD_Z_MAX_BLOCK      SD_LZ4_MAX_BLOCK
+#define SD_Z_DEFAULT_BLOCK  (16 * 1024)
+
+// Reads .sdz files, and plain files as they are, so callers need not know
+// which one is on the card.
+class SDCompressedFile : public Stream {
+public:
+    struct Stats {
+        uint32_t blocks_loaded;
+        uint64_t card_bytes;        // Read from the card, block headers included
+        uint64_t raw_bytes;         // Produced by those reads
+        uint32_t decompress_us;
+    };
+
+    SDCompressedFile();
+    ~SDCompressedFile();
+
+    bool open(SDMounter& sd, const char* path);
+    bool open(fs::FS& fs, const char* path);
+    void close();
+    bool isOpen() const { return opened; }
+    operator bool() const { return isOpen(); }
+
+    bool isCompressed() const { return compressed; }
+    bool wasRecovered() const { return recovered; }    // Index rebuilt, writer was cut short
+    uint32_t getBlockSize() const { return compressed ? 1UL << block_shift : 0; }
+    uint32_t getBlockCount() const { return index.size(); }
+    uint32_t getStoredSize() const { return stored_size; }  // Bytes on the card
+
+    size_t read(uint8_t* buffer, size_t len);
+    size_t readBytes(char* buffer, size_t len) override { return read((uint8_t*)buffer, len); }
+    bool seek(uint32_t pos);
+    uint32_t position() const { return pos; }
+    uint32_t size() const { return raw_size; }
+
+    // Stream interface
+    int read() override;
+    int peek() override;
+    int available() override;
+    size_t write(uint8_t) override { return 0; }
+    void flush() override {}
+
+    Stats getStats() const { return stats; }
+    void resetStats() { stats = {0, 0, 0, 0}; }
+
+private:
+    File file;
+    bool opened;
+    bool compressed;
+    bool recovered;
+    uint8_t block_shift;
+    uint32_t raw_size;
+    uint32_t stored_size;
+    uint32_t pos;
+    std::vector<uint32_t> index;
+    uint8_t* block;         // Last decompressed block
+    uint8_t* packed;        // Compressed bytes of the block being loaded
+    uint32_t cur_block;
+    Stats stats;
+
+    bool attach(File& handle);
+    bool loadFooter();
+    bool rebuildIndex();
+    uint32_t blockLength(uint32_t block_no) const;
+    bool loadBlock(uint32_t block_no, uint8_t* out);
+    void freeBuffers();
+};
+
+// Writes a .sdz file as a stream: each block is compressed and written once
+// it is full, so memory use does not grow with the file. Use it anywhere a
+// Print is accepted.
+class SDCompressedWriter : public Print {
+public:
+    SDCompressedWriter();
+    ~SDCompressedWriter();
+
+    // block_size is rounded down to a power of two between 1 KB and 64 KB
+    bool open(SDMounter& sd, const char* path, size_t block_size = SD_Z_DEFAULT_BLOCK);
+    bool open(fs::FS& fs, const char* path, size_t block_size = SD_Z_DEFAULT_BLOCK);
+    bool close();   // Writes the last block, the index and the footer
+    bool isOpen() const { return opened; }
+    bool hasFailed() const { return failed; }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* data, size_t len) override;
+
+    uint64_t getRawBytes() const { return raw_bytes; }
+    uint32_t getStoredBytes() const { return file_offset; }
+    float getRatio() const { return file_offset ? (float)raw_bytes / file_offset : 0.0f; }
+
+private:
+    File file;
+    bool opened;
+    bool failed;
+    uint8_t block_shift;
+    size_t fill;
+    uint64_t raw_bytes;
+    uint32_t file_offset;
+    std::vector<uint32_t> index;
+    uint8_t* block;
+    uint8_t* packed;
+    uint16_t* table;        // LZ4 hash table
+
+    bool attach(File& handle, size_t block_size);
+    bool flushBlock();
+    void freeBuffers();
+};
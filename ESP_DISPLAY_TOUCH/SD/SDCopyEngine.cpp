@@ -0,0 +1,246 @@
+#include "SDCopyEngine.h"
+#include <esp_heap_caps.h>
+
+// The SDMMC driver can only DMA to and from internal RAM; a PSRAM buffer
+// makes it bounce every sector through a small internal one. Internal RAM
+// is also what LVGL and WiFi live on, so at most one small buffer comes
+// from it, and only while the largest free block keeps a margin. The rest
+// of the ring is PSRAM, cache-line aligned.
+#define SD_COPY_ALIGN           64
+#define SD_COPY_INTERNAL_MAX    (16 * 1024)
+#define SD_COPY_INTERNAL_MARGIN (64 * 1024)
+
+SDCopyEngine::SDCopyEngine()
+    : buffer_size(SD_COPY_DEFAULT_BUFFER),
+      ring_size(3),
+      pipelined(true),
+      progress_callback(nullptr),
+      last_copy_us(0),
+      last_copy_bytes(0),
+      last_pipelined(false),
+      allocated(0),
+      reader_src(nullptr),
+      reader_limit(0),
+      abort_requested(false),
+      free_queue(nullptr),
+      full_queue(nullptr),
+      caller_task(nullptr) {
+    for (uint8_t i = 0; i < SD_COPY_MAX_RING; i++) {
+        buffers[i] = nullptr;
+        lengths[i] = 0;
+    }
+}
+
+SDCopyEngine::~SDCopyEngine() {
+    freeBuffers();
+}
+
+void SDCopyEngine::setBufferSize(size_t size) {
+    if (size < SD_COPY_MIN_BUFFER) size = SD_COPY_MIN_BUFFER;
+    if (size > SD_COPY_MAX_BUFFER) size = SD_COPY_MAX_BUFFER;
+    // Keep whole sectors so every filesystem access stays sector aligned
+    buffer_size = size & ~(size_t)(SD_COPY_MIN_BUFFER - 1);
+}
+
+void SDCopyEngine::setRingSize(uint8_t count) {
+    if (count < 2) count = 2;
+    if (count > SD_COPY_MAX_RING) count = SD_COPY_MAX_RING;
+    ring_size = count;
+}
+
+float SDCopyEngine::getLastThroughputKBps() const {
+    if (last_copy_us == 0) return 0.0f;
+    return (last_copy_bytes / 1024.0f) / (last_copy_us / 1000000.0f);
+}
+
+size_t SDCopyEngine::copy(File& src, File& dst, size_t max_bytes) {
+    size_t remaining = src.size() > src.position() ? src.size() - src.position() : 0;
+    size_t total = (remaining < max_bytes) ? remaining : max_bytes;
+
+    uint32_t start = micros();
+    size_t copied = 0;
+    last_pipelined = false;
+
+    if (total > 0) {
+        // Only spin up the reader task when the copy spans several buffers
+        uint8_t wanted = (pipelined && total > buffer_size) ? ring_size : 1;
+        uint8_t got = allocBuffers(wanted);
+        if (got >= 2) {
+            last_pipelined = true;
+            copied = copyPipelined(src, dst, total);
+        } else if (got == 1) {
+            copied = copySequential(src, dst, total);
+        }
+        freeBuffers();
+    }
+
+    last_copy_us = micros() - start;
+    last_copy_bytes = copied;
+    return copied;
+}
+
+uint8_t SDCopyEngine::allocBuffers(uint8_t wanted) {
+    allocated = 0;
+    size_t size = buffer_size;
+
+    // A sequential copy is worth a smaller buffer if it can be DMA'd; the
+    // pipelined ring shares one size, so there it must already be small
+    size_t internal_size = size;
+    if (wanted == 1 && internal_size > SD_COPY_INTERNAL_MAX) internal_size = SD_COPY_INTERNAL_MAX;
+    if (internal_size <= SD_COPY_INTERNAL_MAX &&
+        heap_caps_get_largest_free_block(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL) >=
+            internal_size + SD_COPY_INTERNAL_MARGIN) {
+        uint8_t* buf = (uint8_t*)heap_caps_aligned_alloc(SD_COPY_ALIGN, internal_size,
+                                                         MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        if (buf) {
+            buffers[0] = buf;
+            lengths[0] = internal_size;
+            allocated = 1;
+        }
+    }
+
+    while (allocated < wanted) {
+        uint8_t* buf = (uint8_t*)heap_caps_aligned_alloc(SD_COPY_ALIGN, size, MALLOC_CAP_SPIRAM);
+        if (!buf && allocated == 0) {
+            // No PSRAM: one buffer from wherever it fits, and copy sequentially
+            buf = (uint8_t*)heap_caps_aligned_alloc(SD_COPY_ALIGN, size, MALLOC_CAP_8BIT);
+        }
+        if (!buf) {
+            if (allocated > 0) break; // Run with what we have
+            if (size <= SD_COPY_MIN_BUFFER) break;
+            size /= 2; // Low memory: shrink until the first buffer fits
+            continue;
+        }
+        buffers[allocated] = buf;
+        lengths[allocated] = size;
+        allocated++;
+    }
+
+    return allocated;
+}
+
+void SDCopyEngine::freeBuffers() {
+    for (uint8_t i = 0; i < SD_COPY_MAX_RING; i++) {
+        if (buffers[i]) {
+            heap_caps_free(buffers[i]);
+            buffers[i] = nullptr;
+        }
+        lengths[i] = 0;
+    }
+    allocated = 0;
+}
+
+void SDCopyEngine::reportProgress(size_t copied, size_t total) {
+    if (progress_callback) {
+        progress_callback(copied, total);
+    }
+}
+
+size_t SDCopyEngine::copySequential(File& src, File& dst, size_t total) {
+    uint8_t* buffer = buffers[0];
+    size_t capacity = lengths[0];
+    size_t copied = 0;
+
+    while (copied < total) {
+        size_t to_read = (total - copied < capacity) ? total - copied : capacity;
+        size_t bytes_read = src.read(buffer, to_read);
+        if (bytes_read == 0) break;
+
+        size_t bytes_written = dst.write(buffer, bytes_read);
+        copied += bytes_written;
+        reportProgress(copied, total);
+
+        if (bytes_written != bytes_read) break;
+    }
+
+    return copied;
+}
+
+size_t SDCopyEngine::copyPipelined(File& src, File& dst, size_t total) {
+    free_queue = xQueueCreate(allocated, sizeof(uint8_t));
+    full_queue = xQueueCreate(allocated + 1, sizeof(uint8_t));
+    if (!free_queue || !full_queue) {
+        if (free_queue) vQueueDelete(free_queue);
+        if (full_queue) vQueueDelete(full_queue);
+        free_queue = full_queue = nullptr;
+        return copySequential(src, dst, total);
+    }
+
+    // All buffers share the smallest allocated size
+    size_t chunk = lengths[0];
+    for (uint8_t i = 0; i < allocated; i++) {
+        if (lengths[i] < chunk) chunk = lengths[i];
+        xQueueSend(free_queue, &i, 0);
+    }
+
+    reader_src = &src;
+    reader_limit = total;
+    abort_requested = false;
+    caller_task = xTaskGetCurrentTaskHandle();
+    for (uint8_t i = 0; i < allocated; i++) lengths[i] = chunk;
+
+    TaskHandle_t reader = nullptr;
+    if (xTaskCreate(readerTask, "sd_copy_rd", 4096, this,
+                    uxTaskPriorityGet(nullptr), &reader) != pdPASS) {
+        vQueueDelete(free_queue);
+        vQueueDelete(full_queue);
+        free_queue = full_queue = nullptr;
+        return copySequential(src, dst, total);
+    }
+
+    size_t copied = 0;
+    while (true) {
+        uint8_t index;
+        xQueueReceive(full_queue, &index, portMAX_DELAY);
+        if (index == 0xFF) break; // Reader finished
+
+        size_t len = lengths[index];
+        if (!abort_requested) {
+            size_t bytes_written = dst.write(buffers[index], len);
+            copied += bytes_written;
+            reportProgress(copied, total);
+            if (bytes_written != len) {
+                abort_requested = true; // Drain the ring, reader stops at next buffer
+            }
+        }
+        lengths[index] = chunk;
+        xQueueSend(free_queue, &index, portMAX_DELAY);
+    }
+
+    // Reader notifies right before deleting itself
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    vQueueDelete(free_queue);
+    vQueueDelete(full_queue);
+    free_queue = full_queue = nullptr;
+    reader_src = nullptr;
+    return copied;
+}
+
+void SDCopyEngine::readerTask(void* arg) {
+    SDCopyEngine* self = (SDCopyEngine*)arg;
+    size_t read_total = 0;
+
+    while (read_total < self->reader_limit && !self->abort_requested) {
+        uint8_t index;
+        xQueueReceive(self->free_queue, &index, portMAX_DELAY);
+
+        size_t capacity = self->lengths[index];
+        size_t left = self->reader_limit - read_total;
+        size_t to_read = (left < capacity) ? left : capacity;
+        size_t bytes_read = self->reader_src->read(self->buffers[index], to_read);
+        if (bytes_read == 0) {
+            xQueueSend(self->free_queue, &index, 0);
+            break;
+        }
+
+        self->lengths[index] = bytes_read;
+        read_total += bytes_read;
+        xQueueSend(self->full_queue, &index, portMAX_DELAY);
+    }
+
+    uint8_t done = 0xFF;
+    xQueueSend(self->full_queue, &done, portMAX_DELAY);
+    xTaskNotifyGive(self->caller_task);
+    vTaskDelete(nullptr);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+// Bulk copy engine used by SDMounter for copyFile/moveFile/truncateFile.
+// Copies through large aligned buffers (PSRAM, plus at most one small
+// DMA-capable internal one) and can overlap reads and writes by running a
+// reader task that fills a small buffer ring while the calling task drains
+// it to the destination file.
+
+#define SD_COPY_MIN_BUFFER      (512)
+#define SD_COPY_MAX_BUFFER      (128 * 1024)
+#define SD_COPY_DEFAULT_BUFFER  (64 * 1024)
+#define SD_COPY_MAX_RING        4
+
+// copied: bytes written so far, total: bytes the copy is expected to write
+typedef std::function<void(size_t copied, size_t total)> SDCopyProgressCallback;
+
+class SDCopyEngine {
+public:
+    SDCopyEngine();
+    ~SDCopyEngine();
+
+    // Configuration
+    void setBufferSize(size_t size);
+    size_t getBufferSize() const { return buffer_size; }
+    void setRingSize(uint8_t count);
+    uint8_t getRingSize() const { return ring_size; }
+    void setPipelined(bool enable) { pipelined = enable; }
+    bool isPipelined() const { return pipelined; }
+    void onProgress(SDCopyProgressCallback callback) { progress_callback = callback; }
+
+    // Copy up to max_bytes from the current position of src to dst.
+    // Returns the number of bytes written to dst.
+    size_t copy(File& src, File& dst, size_t max_bytes = SIZE_MAX);
+
+    // Stats of the last copy
+    uint32_t getLastCopyMicros() const { return last_copy_us; }
+    bool lastCopyUsedPipeline() const { return last_pipelined; }
+    float getLastThroughputKBps() const;
+
+private:
+    size_t buffer_size;
+    uint8_t ring_size;
+    bool pipelined;
+    SDCopyProgressCallback progress_callback;
+
+    uint32_t last_copy_us;
+    size_t last_copy_bytes;
+    bool last_pipelined;
+
+    // Per-copy state (valid only while copy() runs)
+    uint8_t* buffers[SD_COPY_MAX_RING];
+    size_t lengths[SD_COPY_MAX_RING];
+    uint8_t allocated;
+    File* reader_src;
+    size_t reader_limit;
+    volatile bool abort_requested;
+    QueueHandle_t free_queue;
+    QueueHandle_t full_queue;
+    TaskHandle_t caller_task;
+
+    uint8_t allocBuffers(uint8_t wanted);
+    void freeBuffers();
+    size_t copySequential(File& src, File& dst, size_t total);
+    size_t copyPipelined(File& src, File& dst, size_t total);
+    void reportProgress(size_t copied, size_t total);
+    static void readerTask(void* arg);
+};
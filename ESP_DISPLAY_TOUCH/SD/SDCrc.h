@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#if defined(ESP_PLATFORM)
+#include <esp_rom_crc.h>
+#endif
+
+// CRC-32 (IEEE 802.3, same values as zlib's crc32()) shared by the SD
+// modules. Chain calls by passing the previous result back in as crc.
+// Uses the ROM routine on the ESP32 and a table elsewhere, so files written
+// on the watch verify on the host and the other way round.
+
+inline uint32_t sdCrc32(const void* data, size_t len, uint32_t crc = 0) {
+#if defined(ESP_PLATFORM)
+    return esp_rom_crc32_le(crc, (const uint8_t*)data, len);
+#else
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        table_ready = true;
+    }
+
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    while (len--) {
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+#endif
+}
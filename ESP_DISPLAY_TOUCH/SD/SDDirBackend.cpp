@@ -0,0 +1,417 @@
+#include "SDDirBackend.h"
+#include <FSImpl.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+using namespace fs;
+
+// File objects handed out by fs(), as for the RAM disk: a file wraps a
+// descriptor of this backend and a directory wraps a listing cursor, so
+// both see the same faults as the descriptor and path calls.
+class SDDirFileImpl : public FileImpl {
+public:
+    SDDirFileImpl(SDDirBackend* backend, const char* path, int fd, void* dir)
+        : backend(backend), fd(fd), dir(dir), file_path(path) {
+        const char* slash = strrchr(path, '/');
+        name_offset = slash ? (slash - path) + 1 : 0;
+    }
+
+    ~SDDirFileImpl() { close(); }
+
+    size_t write(const uint8_t* buf, size_t size) {
+        int n = (fd >= 0) ? backend->write(fd, buf, size) : -1;
+        return n > 0 ? n : 0;
+    }
+
+    size_t read(uint8_t* buf, size_t size) {
+        int n = (fd >= 0) ? backend->read(fd, buf, size) : -1;
+        return n > 0 ? n : 0;
+    }
+
+    void flush() {
+        if (fd >= 0) backend->sync(fd);
+    }
+
+    bool seek(uint32_t pos, SeekMode mode) { return fd >= 0 && backend->seekHandle(fd, pos, mode); }
+    size_t position() const { return fd >= 0 ? backend->tell(fd) : 0; }
+    size_t size() const { return fd >= 0 ? backend->sizeOf(fd) : 0; }
+    bool setBufferSize(size_t size) { return true; }
+
+    void close() {
+        if (fd >= 0) {
+            backend->close(fd);
+            fd = -1;
+        }
+        if (dir) {
+            backend->closeDir(dir);
+            dir = nullptr;
+        }
+    }
+
+    time_t getLastWrite() { return backend->modified(file_path.c_str()); }
+    const char* path() const { return file_path.c_str(); }
+    const char* name() const { return file_path.c_str() + name_offset; }
+    bool isDirectory() { return dir != nullptr; }
+
+    FileImplPtr openNextFile(const char* mode) {
+        char child[SD_DIR_PATH_MAX];
+        if (!nextEntry(child, sizeof(child), nullptr)) return FileImplPtr();
+        return backend->openFile(child, mode, false);
+    }
+
+    bool seekDir(long position) {
+        char child[SD_DIR_PATH_MAX];
+        rewindDirectory();
+        while (position-- > 0) {
+            if (!nextEntry(child, sizeof(child), nullptr)) return false;
+        }
+        return true;
+    }
+
+    String getNextFileName() {
+        return getNextFileName(nullptr);
+    }
+
+    String getNextFileName(bool* is_dir) {
+        char child[SD_DIR_PATH_MAX];
+        return nextEntry(child, sizeof(child), is_dir) ? String(child) : String();
+    }
+
+    void rewindDirectory() {
+        if (!dir) return;
+        backend->closeDir(dir);
+        dir = backend->openDir(file_path.c_str());
+    }
+
+    operator bool() { return fd >= 0 || dir != nullptr; }
+
+private:
+    SDDirBackend* backend;
+    int fd;
+    void* dir;
+    String file_path;
+    size_t name_offset;
+
+    // Full volume path of the next entry in a directory
+    bool nextEntry(char* out, size_t out_size, bool* is_dir) {
+        if (!dir) return false;
+        size_t len = (file_path == "/") ? 0 : strlcpy(out, file_path.c_str(), out_size);
+        if (len + 2 > out_size) return false;
+        out[len++] = '/';
+        return backend->readDir(dir, out + len, out_size - len, is_dir) == 1;
+    }
+};
+
+class SDDirFSImpl : public FSImpl {
+public:
+    explicit SDDirFSImpl(SDDirBackend* backend) : backend(backend) {}
+
+    FileImplPtr open(const char* path, const char* mode, const bool create) {
+        return backend->openFile(path, mode, create);
+    }
+
+    bool exists(const char* path) { return backend->stat(path); }
+    bool rename(const char* from, const char* to) { return backend->rename(from, to); }
+    bool remove(const char* path) { return backend->unlink(path); }
+    bool mkdir(const char* path) { return backend->mkdir(path); }
+    bool rmdir(const char* path) { return backend->rmdir(path); }
+
+private:
+    SDDirBackend* backend;
+};
+
+SDDirBackend::SDDirBackend(const char* dir_root, uint64_t capacity)
+    : capacity(capacity),
+      cluster_bytes(SD_DIR_CLUSTER),
+      begun(false),
+      dir_fs(FSImplPtr(new SDDirFSImpl(this))) {
+    strlcpy(root, dir_root, sizeof(root));
+    size_t len = strlen(root);
+    if (len > 1 && root[len - 1] == '/') root[len - 1] = '\0';
+}
+
+bool SDDirBackend::begin(const char* mount_point, uint8_t bus_width, int freq_khz, bool format_if_failed) {
+    if (isRemoved()) return false;
+
+    struct stat st;
+    if (::stat(root, &st) != 0) {
+        if (!format_if_failed || ::mkdir(root, 0775) != 0) return false;
+    } else if (!S_ISDIR(st.st_mode)) {
+        return false;
+    }
+    begun = true;
+    return true;
+}
+
+void SDDirBackend::end() {
+    begun = false;
+}
+
+bool SDDirBackend::isPresent() {
+    struct stat st;
+    return begun && !isRemoved() && ::stat(root, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool SDDirBackend::getSpace(uint64_t& total, uint64_t& free, uint32_t& cluster) {
+    if (!begun || !inject(OP_STAT)) return false;
+
+    // No allocation table to ask, so count what the tree holds
+    char path[SD_DIR_PATH_MAX];
+    size_t len = strlcpy(path, root, sizeof(path));
+    uint64_t used = usedBelow(path, len, 0);
+
+    total = capacity;
+    free = (used < capacity) ? capacity - used : 0;
+    cluster = cluster_bytes;
+    return true;
+}
+
+SDFormatResult SDDirBackend::format(uint32_t cluster_size, int* fs_error) {
+    if (!begun) return SD_FORMAT_NO_VOLUME;
+    if (!inject(OP_WRITE)) return SD_FORMAT_FAILED;
+
+    char path[SD_DIR_PATH_MAX];
+    size_t len = strlcpy(path, root, sizeof(path));
+    if (!removeBelow(path, len, 0)) {
+        if (fs_error) *fs_error = errno;
+        return SD_FORMAT_FAILED;
+    }
+
+    bool valid = (cluster_size >= 512 && (cluster_size & (cluster_size - 1)) == 0);
+    cluster_bytes = valid ? cluster_size : SD_DIR_CLUSTER;
+    return SD_FORMAT_OK;
+}
+
+int SDDirBackend::open(const char* path, SDOpenMode mode) {
+    if (!inject(OP_OPEN)) return -1;
+
+    char host_path[SD_DIR_PATH_MAX];
+    int flags = O_RDONLY;
+    if (mode == SD_OPEN_WRITE) flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (mode == SD_OPEN_APPEND) flags = O_WRONLY | O_CREAT | O_APPEND;
+    if (mode == SD_OPEN_UPDATE) flags = O_WRONLY;
+    return ::open(hostPath(path, host_path), flags, 0666);
+}
+
+int SDDirBackend::read(int fd, void* buffer, size_t len) {
+    if (!inject(OP_READ, len)) return -1;
+    return ::read(fd, buffer, len);
+}
+
+int SDDirBackend::write(int fd, const void* buffer, size_t len) {
+    if (!inject(OP_WRITE, len)) return -1;
+    return ::write(fd, buffer, len);
+}
+
+bool SDDirBackend::sync(int fd) {
+    if (!inject(OP_SYNC)) return false;
+    return ::fsync(fd) == 0;
+}
+
+int64_t SDDirBackend::size(int fd) {
+    if (!inject(OP_STAT)) return -1;
+
+    struct stat st;
+    return (::fstat(fd, &st) == 0) ? st.st_size : -1;
+}
+
+void SDDirBackend::close(int fd) {
+    ::close(fd);
+}
+
+bool SDDirBackend::stat(const char* path, bool* is_dir, size_t* size) {
+    if (!inject(OP_STAT)) return false;
+
+    char host_path[SD_DIR_PATH_MAX];
+    struct stat st;
+    if (::stat(hostPath(path, host_path), &st) != 0) return false;
+
+    if (is_dir) *is_dir = S_ISDIR(st.st_mode);
+    if (size) *size = S_ISDIR(st.st_mode) ? 0 : st.st_size;
+    return true;
+}
+
+bool SDDirBackend::unlink(const char* path) {
+    if (!inject(OP_UNLINK)) return false;
+
+    char host_path[SD_DIR_PATH_MAX];
+    return ::unlink(hostPath(path, host_path)) == 0;
+}
+
+bool SDDirBackend::rename(const char* from, const char* to) {
+    if (!inject(OP_RENAME)) return false;
+
+    char host_from[SD_DIR_PATH_MAX];
+    char host_to[SD_DIR_PATH_MAX];
+    hostPath(from, host_from);
+    hostPath(to, host_to);
+
+    // POSIX rename() replaces an existing file; FAT refuses, and SDMounter
+    // relies on that to detect a clash
+    struct stat st;
+    if (::stat(host_to, &st) == 0) return false;
+    return ::rename(host_from, host_to) == 0;
+}
+
+bool SDDirBackend::mkdir(const char* path) {
+    if (!inject(OP_MKDIR)) return false;
+
+    char host_path[SD_DIR_PATH_MAX];
+    return ::mkdir(hostPath(path, host_path), 0775) == 0;
+}
+
+bool SDDirBackend::rmdir(const char* path) {
+    if (!inject(OP_RMDIR)) return false;
+
+    char host_path[SD_DIR_PATH_MAX];
+    return ::rmdir(hostPath(path, host_path)) == 0;
+}
+
+bool SDDirBackend::truncate(const char* path, size_t size) {
+    if (!inject(OP_TRUNCATE)) return false;
+
+    char host_path[SD_DIR_PATH_MAX];
+    return ::truncate(hostPath(path, host_path), size) == 0;
+}
+
+void* SDDirBackend::openDir(const char* path) {
+    if (!inject(OP_LIST)) return nullptr;
+
+    char host_path[SD_DIR_PATH_MAX];
+    return opendir(hostPath(path, host_path));
+}
+
+int SDDirBackend::readDir(void* dir, char* name, size_t name_size, bool* is_dir) {
+    if (!inject(OP_LIST)) return -1;
+
+    struct dirent* entry;
+    do {
+        entry = readdir((DIR*)dir);
+        if (!entry) return 0;
+    } while (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0);
+
+    if (strlcpy(name, entry->d_name, name_size) >= name_size) return -1;
+    if (is_dir) *is_dir = (entry->d_type == DT_DIR);
+    return 1;
+}
+
+void SDDirBackend::closeDir(void* dir) {
+    closedir((DIR*)dir);
+}
+
+// Private helper methods
+const char* SDDirBackend::hostPath(const char* path, char* out) {
+    snprintf(out, SD_DIR_PATH_MAX, "%s%s", root, strcmp(path, "/") == 0 ? "" : path);
+    return out;
+}
+
+uint64_t SDDirBackend::usedBelow(char* path, size_t path_len, uint8_t depth) {
+    DIR* dir = opendir(path);
+    if (!dir) return 0;
+
+    uint64_t used = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        int len = snprintf(path + path_len, SD_DIR_PATH_MAX - path_len, "/%s", entry->d_name);
+        if (len < 0 || path_len + len >= SD_DIR_PATH_MAX) continue;
+
+        struct stat st;
+        if (::stat(path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            used += cluster_bytes;      // A FAT directory takes a cluster
+            if (depth + 1 < SD_DIR_MAX_DEPTH) used += usedBelow(path, path_len + len, depth + 1);
+        } else {
+            used += ((uint64_t)st.st_size + cluster_bytes - 1) / cluster_bytes * cluster_bytes;
+        }
+    }
+    path[path_len] = '\0';
+    closedir(dir);
+    return used;
+}
+
+FileImplPtr SDDirBackend::openFile(const char* path, const char* mode, bool create) {
+    bool is_dir = false;
+    if (strcmp(path, "/") == 0 || (stat(path, &is_dir) && is_dir)) {
+        void* dir = openDir(path);
+        return dir ? FileImplPtr(new SDDirFileImpl(this, path, -1, dir)) : FileImplPtr();
+    }
+
+    // Arduino modes: "r", "w", "a", each with an optional "+"
+    char m = mode[0];
+    bool plus = (strchr(mode, '+') != nullptr);
+    if (create && m != 'r') {
+        // Like VFSImpl, create missing parent directories
+        char parent[SD_DIR_PATH_MAX];
+        strlcpy(parent, path, sizeof(parent));
+        for (char* slash = strchr(parent + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+            *slash = '\0';
+            if (!stat(parent)) mkdir(parent);
+            *slash = '/';
+        }
+    }
+
+    if (!inject(OP_OPEN)) return FileImplPtr();
+
+    int flags = plus ? O_RDWR : (m == 'r') ? O_RDONLY : O_WRONLY;
+    if (m == 'w') flags |= O_CREAT | O_TRUNC;
+    if (m == 'a') flags |= O_CREAT | O_APPEND;
+    char host_path[SD_DIR_PATH_MAX];
+    int fd = ::open(hostPath(path, host_path), flags, 0666);
+    return (fd >= 0) ? FileImplPtr(new SDDirFileImpl(this, path, fd, nullptr)) : FileImplPtr();
+}
+
+bool SDDirBackend::seekHandle(int fd, int64_t pos, SeekMode mode) {
+    int whence = (mode == SeekSet) ? SEEK_SET : (mode == SeekCur) ? SEEK_CUR : SEEK_END;
+    return ::lseek(fd, pos, whence) >= 0;
+}
+
+size_t SDDirBackend::tell(int fd) {
+    off_t pos = ::lseek(fd, 0, SEEK_CUR);
+    return pos >= 0 ? pos : 0;
+}
+
+size_t SDDirBackend::sizeOf(int fd) {
+    struct stat st;
+    return (::fstat(fd, &st) == 0) ? st.st_size : 0;
+}
+
+time_t SDDirBackend::modified(const char* path) {
+    char host_path[SD_DIR_PATH_MAX];
+    struct stat st;
+    return (::stat(hostPath(path, host_path), &st) == 0) ? st.st_mtime : 0;
+}
+
+bool SDDirBackend::removeBelow(char* path, size_t path_len, uint8_t depth) {
+    DIR* dir = opendir(path);
+    if (!dir) return false;
+
+    bool ok = true;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        int len = snprintf(path + path_len, SD_DIR_PATH_MAX - path_len, "/%s", entry->d_name);
+        if (len < 0 || path_len + len >= SD_DIR_PATH_MAX) {
+            ok = false;
+            continue;
+        }
+
+        struct stat st;
+        if (::stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (depth + 1 >= SD_DIR_MAX_DEPTH || !removeBelow(path, path_len + len, depth + 1) ||
+                ::rmdir(path) != 0) {
+                ok = false;
+            }
+        } else if (::unlink(path) != 0) {
+            ok = false;
+        }
+    }
+    path[path_len] = '\0';
+    closedir(dir);
+    return ok;
+}
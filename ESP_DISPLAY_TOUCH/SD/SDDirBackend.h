@@ -0,0 +1,70 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include "SDStorageBackend.h"
+
+// A volume kept in a directory of another filesystem: a LittleFS or FAT
+// partition on the flash ("/littlefs/sdroot"), or a directory on the host
+// when SDMounter is built for a PC. Every operation, including File access
+// through fs(), goes through the fault injection of SDStorageBackend. Space
+// is reported against a fixed capacity and counted in clusters, like a card
+// of that size.
+
+#define SD_DIR_ROOT_MAX 64
+#define SD_DIR_PATH_MAX (SD_DIR_ROOT_MAX + 272)     // Root + volume path + suffix
+#define SD_DIR_CLUSTER  4096                        // Allocation unit for space figures
+#define SD_DIR_MAX_DEPTH 16
+
+class SDDirBackend : public SDStorageBackend {
+public:
+    // root: an existing directory on a mounted VFS
+    explicit SDDirBackend(const char* root, uint64_t capacity = 64ULL * 1024 * 1024);
+
+    const char* name() const { return "DIR"; }
+
+    bool begin(const char* mount_point, uint8_t bus_width, int freq_khz, bool format_if_failed);
+    void end();
+    bool isPresent();
+    fs::FS& fs() { return dir_fs; }
+    uint64_t cardSize() { return capacity; }
+    bool getSpace(uint64_t& total, uint64_t& free, uint32_t& cluster);
+    SDFormatResult format(uint32_t cluster_size, int* fs_error = nullptr);
+
+    int open(const char* path, SDOpenMode mode);
+    int read(int fd, void* buffer, size_t len);
+    int write(int fd, const void* buffer, size_t len);
+    bool sync(int fd);
+    int64_t size(int fd);
+    void close(int fd);
+
+    bool stat(const char* path, bool* is_dir = nullptr, size_t* size = nullptr);
+    bool unlink(const char* path);
+    bool rename(const char* from, const char* to);
+    bool mkdir(const char* path);
+    bool rmdir(const char* path);
+    bool truncate(const char* path, size_t size);
+
+    void* openDir(const char* path);
+    int readDir(void* dir, char* name, size_t name_size, bool* is_dir);
+    void closeDir(void* dir);
+
+private:
+    friend class SDDirFSImpl;
+    friend class SDDirFileImpl;
+
+    char root[SD_DIR_ROOT_MAX];
+    uint64_t capacity;
+    uint32_t cluster_bytes;
+    bool begun;
+    fs::FS dir_fs;
+
+    // Private helper methods
+    const char* hostPath(const char* path, char* out);
+    fs::FileImplPtr openFile(const char* path, const char* mode, bool create);
+    bool seekHandle(int fd, int64_t pos, fs::SeekMode mode);
+    size_t tell(int fd);
+    size_t sizeOf(int fd);
+    time_t modified(const char* path);
+    uint64_t usedBelow(char* path, size_t path_len, uint8_t depth);
+    bool removeBelow(char* path, size_t path_len, uint8_t depth);
+};
@@ -0,0 +1,363 @@
+#include "SDDirIndex.h"
+#include <algorithm>
+#include <time.h>
+#include <strings.h>
+#include "SDDirIterator.h"     // SD_ENTRY_PATH_MAX
+
+SDDirIndex::SDDirIndex() : fs(nullptr) {
+}
+
+void SDDirIndex::clear() {
+    dirs.clear();
+}
+
+const SDDirIndex::DirNode* SDDirIndex::getDir(const char* dir_path) {
+    char dir[SD_ENTRY_PATH_MAX];
+    if (!normalize(dir_path, dir)) return nullptr;
+
+    DirNode* node = findLoaded(dir);
+    if (node) {
+        if (node->has_stale) refresh(dir, *node);
+        return node;
+    }
+
+    DirNode fresh;
+    if (!build(dir, fresh)) return nullptr;
+
+    auto result = dirs.emplace(String(dir), std::move(fresh));
+    return &result.first->second;
+}
+
+bool SDDirIndex::lookup(const char* path, Info& info) {
+    char full[SD_ENTRY_PATH_MAX];
+    if (!normalize(path, full)) return false;
+
+    if (strcmp(full, "/") == 0) {
+        info.is_dir = true;
+        info.size = 0;
+        info.mtime = 0;
+        return true;
+    }
+
+    const char* parent;
+    const char* name;
+    split(full, parent, name);
+
+    DirNode* node = (DirNode*)getDir(parent);
+    if (!node) return false;
+
+    bool found = false;
+    int pos = find(*node, name, found);
+    if (!found) return false;
+
+    Entry& entry = node->entries[pos];
+    if (entry.flags & FLAG_STALE) {
+        normalize(path, full);  // Rejoin what split() cut; name still points at its tail
+        if (!restat(full, entry)) {
+            erase(*node, name);
+            return false;
+        }
+    }
+
+    info.is_dir = (entry.flags & FLAG_DIR) != 0;
+    info.size = entry.size;
+    info.mtime = entry.mtime;
+    return true;
+}
+
+size_t SDDirIndex::upperBound(const DirNode& node, const char* name) const {
+    bool found = false;
+    int pos = find(node, name, found);
+    return found ? pos + 1 : pos;
+}
+
+void SDDirIndex::noteFile(const char* path, uint32_t size) {
+    char full[SD_ENTRY_PATH_MAX];
+    if (!normalize(path, full)) return;
+    const char* parent;
+    const char* name;
+    split(full, parent, name);
+
+    DirNode* node = findLoaded(parent);
+    if (node) upsert(*node, name, size, (uint32_t)time(nullptr), 0);
+}
+
+void SDDirIndex::noteGrow(const char* path, uint32_t delta) {
+    char full[SD_ENTRY_PATH_MAX];
+    if (!normalize(path, full)) return;
+    const char* parent;
+    const char* name;
+    split(full, parent, name);
+
+    DirNode* node = findLoaded(parent);
+    if (!node) return;
+
+    bool found = false;
+    int pos = find(*node, name, found);
+    if (found && !(node->entries[pos].flags & FLAG_STALE)) {
+        node->entries[pos].size += delta;
+        node->entries[pos].mtime = (uint32_t)time(nullptr);
+    } else {
+        // Append may have created the file - size only known by the card
+        upsert(*node, name, 0, 0, FLAG_STALE);
+    }
+}
+
+void SDDirIndex::noteStale(const char* path) {
+    char full[SD_ENTRY_PATH_MAX];
+    if (!normalize(path, full)) return;
+    const char* parent;
+    const char* name;
+    split(full, parent, name);
+
+    DirNode* node = findLoaded(parent);
+    if (node) upsert(*node, name, 0, 0, FLAG_STALE);
+}
+
+void SDDirIndex::noteDir(const char* path) {
+    char full[SD_ENTRY_PATH_MAX];
+    if (!normalize(path, full)) return;
+    const char* parent;
+    const char* name;
+    split(full, parent, name);
+
+    DirNode* node = findLoaded(parent);
+    if (node) upsert(*node, name, 0, (uint32_t)time(nullptr), FLAG_DIR);
+}
+
+void SDDirIndex::noteRemoved(const char* path) {
+    char full[SD_ENTRY_PATH_MAX];
+    if (!normalize(path, full)) {
+        clear();    // Cannot tell what it covered
+        return;
+    }
+    dropSubtree(full);
+
+    const char* parent;
+    const char* name;
+    split(full, parent, name);
+    DirNode* node = findLoaded(parent);
+    if (node) erase(*node, name);
+}
+
+void SDDirIndex::noteRenamed(const char* from, const char* to) {
+    char full_from[SD_ENTRY_PATH_MAX];
+    char full_to[SD_ENTRY_PATH_MAX];
+    if (!normalize(from, full_from) || !normalize(to, full_to)) {
+        clear();
+        return;
+    }
+
+    // A renamed directory keeps its contents, but the cached keys are by path
+    dropSubtree(full_from);
+    dropSubtree(full_to);
+
+    const char* from_parent;
+    const char* from_name;
+    const char* to_parent;
+    const char* to_name;
+    split(full_from, from_parent, from_name);
+    split(full_to, to_parent, to_name);
+
+    Entry moved = {0, 0, 0, FLAG_STALE};
+    DirNode* src = findLoaded(from_parent);
+    if (!src || !erase(*src, from_name, &moved)) {
+        moved.flags = FLAG_STALE; // Unknown source: let the target re-stat
+    }
+
+    DirNode* dst = findLoaded(to_parent);
+    if (dst) upsert(*dst, to_name, moved.size, moved.mtime, moved.flags);
+}
+
+size_t SDDirIndex::entryCount() const {
+    size_t count = 0;
+    for (const auto& kv : dirs) count += kv.second.entries.size();
+    return count;
+}
+
+size_t SDDirIndex::memoryUsage() const {
+    size_t bytes = 0;
+    for (const auto& kv : dirs) {
+        bytes += kv.first.length() + sizeof(DirNode);
+        bytes += kv.second.entries.capacity() * sizeof(Entry);
+        bytes += kv.second.names.capacity();
+    }
+    return bytes;
+}
+
+// Private helper methods
+size_t SDDirIndex::normalize(const char* path, char* out) {
+    // Into a caller's SD_ENTRY_PATH_MAX buffer, so lookups allocate nothing
+    if (!path) path = "";
+    size_t len = 0;
+    if (path[0] != '/') out[len++] = '/';
+    size_t path_len = strlen(path);
+    if (len + path_len >= SD_ENTRY_PATH_MAX) return 0;
+    memcpy(out + len, path, path_len + 1);
+    len += path_len;
+    while (len > 1 && out[len - 1] == '/') out[--len] = '\0';
+    return len;
+}
+
+void SDDirIndex::split(char* full, const char*& parent, const char*& name) {
+    // In place: the last slash becomes the parent's terminator
+    char* slash = strrchr(full, '/');
+    name = slash + 1;
+    if (slash == full) {
+        parent = "/";
+    } else {
+        *slash = '\0';
+        parent = full;
+    }
+}
+
+SDDirIndex::DirNode* SDDirIndex::findLoaded(const char* dir) {
+    auto it = dirs.find(dir);
+    return (it == dirs.end()) ? nullptr : &it->second;
+}
+
+bool SDDirIndex::build(const char* dir, DirNode& node) {
+    if (!fs) return false;
+
+    File root = fs->open(dir);
+    if (!root || !root.isDirectory()) {
+        if (root) root.close();
+        return false;
+    }
+
+    File file = root.openNextFile();
+    while (file) {
+        Entry e;
+        e.name_offset = node.names.size();
+        e.size = file.isDirectory() ? 0 : file.size();
+        e.mtime = (uint32_t)file.getLastWrite();
+        e.flags = file.isDirectory() ? FLAG_DIR : 0;
+
+        const char* name = file.name();
+        node.names.insert(node.names.end(), name, name + strlen(name) + 1);
+        node.entries.push_back(e);
+
+        file.close();
+        file = root.openNextFile();
+    }
+    root.close();
+
+    std::sort(node.entries.begin(), node.entries.end(), [&node](const Entry& a, const Entry& b) {
+        return strcasecmp(node.nameOf(a), node.nameOf(b)) < 0;
+    });
+    node.entries.shrink_to_fit();
+    node.names.shrink_to_fit();
+    return true;
+}
+
+int SDDirIndex::find(const DirNode& node, const char* name, bool& found) const {
+    int lo = 0;
+    int hi = (int)node.entries.size();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcasecmp(node.nameOf(node.entries[mid]), name);
+        if (cmp == 0) {
+            found = true;
+            return mid;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    found = false;
+    return lo;
+}
+
+void SDDirIndex::upsert(DirNode& node, const char* name, uint32_t size, uint32_t mtime, uint8_t flags) {
+    bool found = false;
+    int pos = find(node, name, found);
+
+    if (flags & FLAG_STALE) node.has_stale = true;
+
+    if (found) {
+        Entry& e = node.entries[pos];
+        e.size = size;
+        e.mtime = mtime;
+        e.flags = flags;
+        return;
+    }
+
+    Entry e;
+    e.name_offset = node.names.size();
+    e.size = size;
+    e.mtime = mtime;
+    e.flags = flags;
+    node.names.insert(node.names.end(), name, name + strlen(name) + 1);
+    node.entries.insert(node.entries.begin() + pos, e);
+}
+
+bool SDDirIndex::erase(DirNode& node, const char* name, Entry* removed) {
+    bool found = false;
+    int pos = find(node, name, found);
+    if (!found) return false;
+
+    if (removed) *removed = node.entries[pos];
+    node.garbage += strlen(node.nameOf(node.entries[pos])) + 1;
+    node.entries.erase(node.entries.begin() + pos);
+
+    if (node.garbage > node.names.size() / 2) {
+        compact(node);
+    }
+    return true;
+}
+
+void SDDirIndex::compact(DirNode& node) {
+    std::vector<char> packed;
+    packed.reserve(node.names.size() - node.garbage);
+    for (Entry& e : node.entries) {
+        const char* name = node.nameOf(e);
+        e.name_offset = packed.size();
+        packed.insert(packed.end(), name, name + strlen(name) + 1);
+    }
+    node.names.swap(packed);
+    node.garbage = 0;
+}
+
+void SDDirIndex::dropSubtree(const char* dir) {
+    size_t len = strlen(dir);
+    bool root = (len == 1);
+    for (auto it = dirs.begin(); it != dirs.end();) {
+        const char* key = it->first.c_str();
+        if (root || (strncmp(key, dir, len) == 0 && (key[len] == '\0' || key[len] == '/'))) {
+            it = dirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool SDDirIndex::restat(const char* path, Entry& entry) {
+    if (!fs) return false;
+
+    File file = fs->open(path);
+    if (!file) return false;
+
+    entry.size = file.isDirectory() ? 0 : file.size();
+    entry.mtime = (uint32_t)file.getLastWrite();
+    entry.flags = file.isDirectory() ? FLAG_DIR : 0;
+    file.close();
+    return true;
+}
+
+void SDDirIndex::refresh(const char* dir, DirNode& node) {
+    // A listing would otherwise show a file written through a File, or
+    // created by an append, with size 0
+    char path[SD_ENTRY_PATH_MAX];
+    const char* sep = (strcmp(dir, "/") == 0) ? "" : "/";
+    for (size_t i = 0; i < node.entries.size();) {
+        Entry& e = node.entries[i];
+        if (!(e.flags & FLAG_STALE)) {
+            i++;
+            continue;
+        }
+        const char* name = node.nameOf(e);
+        int len = snprintf(path, sizeof(path), "%s%s%s", dir, sep, name);
+        if (len < (int)sizeof(path) && restat(path, e)) i++;
+        else erase(node, name);    // Gone since it was noted
+    }
+    node.has_stale = false;
+}
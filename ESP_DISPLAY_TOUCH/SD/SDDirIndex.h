@@ -0,0 +1,90 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <map>
+#include <vector>
+
+// In-memory directory index for SDMounter.
+// Each directory is read from the card once, on first use, and stored as a
+// sorted entry table plus a packed name pool. SDMounter keeps loaded
+// directories coherent through the note*() hooks; anything that changes the
+// card behind its back (other FS users, card swap) needs clear().
+// Paths are absolute card paths ("/dir/file.txt"). FAT names compare
+// case-insensitively.
+
+class SDDirIndex {
+public:
+    enum {
+        FLAG_DIR   = 0x01,
+        FLAG_STALE = 0x02   // Size/mtime unknown, re-read on next lookup
+    };
+
+    struct Entry {
+        uint32_t name_offset;   // Into DirNode::names
+        uint32_t size;
+        uint32_t mtime;
+        uint8_t flags;
+    };
+
+    struct DirNode {
+        std::vector<Entry> entries;   // Sorted by name
+        std::vector<char> names;      // NUL-terminated names back to back
+        uint32_t garbage = 0;         // Pool bytes owned by erased entries
+        bool has_stale = false;       // Refreshed by getDir() before anyone reads it
+        const char* nameOf(const Entry& e) const { return &names[e.name_offset]; }
+    };
+
+    struct Info {
+        bool is_dir;
+        uint32_t size;
+        uint32_t mtime;
+    };
+
+    SDDirIndex();
+
+    void setFS(fs::FS* filesystem) { fs = filesystem; clear(); }
+    void clear();
+
+    // Lookups (build the containing directory on first use)
+    const DirNode* getDir(const char* dir_path);
+    bool lookup(const char* path, Info& info);
+    size_t upperBound(const DirNode& node, const char* name) const;
+
+    // Coherency hooks - only directories already in the index are touched
+    void noteFile(const char* path, uint32_t size);
+    void noteGrow(const char* path, uint32_t delta);
+    void noteStale(const char* path);
+    void noteDir(const char* path);
+    void noteRemoved(const char* path);
+    void noteRenamed(const char* from, const char* to);
+
+    // Stats
+    size_t dirCount() const { return dirs.size(); }
+    size_t entryCount() const;
+    size_t memoryUsage() const;
+
+private:
+    // Finds keys by const char*, so a lookup builds no String
+    struct PathLess {
+        using is_transparent = void;
+        bool operator()(const String& a, const String& b) const { return strcmp(a.c_str(), b.c_str()) < 0; }
+        bool operator()(const String& a, const char* b) const { return strcmp(a.c_str(), b) < 0; }
+        bool operator()(const char* a, const String& b) const { return strcmp(a, b.c_str()) < 0; }
+    };
+
+    fs::FS* fs;
+    std::map<String, DirNode, PathLess> dirs;
+
+    static size_t normalize(const char* path, char* out);
+    static void split(char* full, const char*& parent, const char*& name);
+
+    DirNode* findLoaded(const char* dir);
+    bool build(const char* dir, DirNode& node);
+    int find(const DirNode& node, const char* name, bool& found) const;
+    void upsert(DirNode& node, const char* name, uint32_t size, uint32_t mtime, uint8_t flags);
+    bool erase(DirNode& node, const char* name, Entry* removed = nullptr);
+    void compact(DirNode& node);
+    void dropSubtree(const char* dir);
+    bool restat(const char* path, Entry& entry);
+    void refresh(const char* dir, DirNode& node);
+};
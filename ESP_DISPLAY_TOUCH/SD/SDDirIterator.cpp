@@ -0,0 +1,118 @@
+#include "SDDirIterator.h"
+#include "SDMounter.h"
+#include <strings.h>
+
+bool SDDirFilter::matches(const char* name, bool is_dir) const {
+    if (dirs_only && !is_dir) return false;
+    if (files_only && is_dir) return false;
+
+    if (extension && extension[0]) {
+        if (is_dir) return false;
+        size_t name_len = strlen(name);
+        size_t ext_len = strlen(extension);
+        if (name_len < ext_len) return false;
+        if (strcasecmp(name + name_len - ext_len, extension) != 0) return false;
+    }
+
+    return true;
+}
+
+SDDirIterator::SDDirIterator()
+    : is_open(false),
+      index(nullptr),
+      holder(nullptr),
+      matched_count(0),
+      delivered_count(0) {
+    path[0] = '\0';
+    last_name[0] = '\0';
+}
+
+bool SDDirIterator::open(fs::FS& fs, SDDirIndex* dir_index, const char* dir_path,
+                         const SDDirFilter& dir_filter) {
+    close();
+
+    strncpy(path, dir_path, sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        path[--len] = '\0';
+    }
+
+    filter = dir_filter;
+    index = dir_index;
+    last_name[0] = '\0';
+    matched_count = 0;
+    delivered_count = 0;
+
+    if (index) {
+        if (!index->getDir(path)) return false;
+    } else {
+        dir = fs.open(path);
+        if (!dir || !dir.isDirectory()) {
+            if (dir) dir.close();
+            return false;
+        }
+    }
+
+    is_open = true;
+    return true;
+}
+
+bool SDDirIterator::next(SDDirEntry& entry) {
+    if (!is_open) return false;
+    if (filter.limit && delivered_count >= filter.limit) return false;
+
+    while (nextRaw(entry)) {
+        if (!filter.matches(entry.name, entry.is_dir)) continue;
+        if (matched_count++ < filter.skip) continue;
+
+        delivered_count++;
+        return true;
+    }
+
+    return false;
+}
+
+void SDDirIterator::close() {
+    if (dir) dir.close();
+    is_open = false;
+    if (holder) {
+        SDMounter* sd = holder;
+        holder = nullptr;
+        sd->releaseHandle();
+    }
+}
+
+bool SDDirIterator::nextRaw(SDDirEntry& entry) {
+    entry.depth = 0;
+
+    if (!index) {
+        File file = dir.openNextFile();
+        if (!file) return false;
+
+        strncpy(entry.name, file.name(), sizeof(entry.name) - 1);
+        entry.name[sizeof(entry.name) - 1] = '\0';
+        entry.is_dir = file.isDirectory();
+        entry.size = entry.is_dir ? 0 : file.size();
+        entry.mtime = (uint32_t)file.getLastWrite();
+        file.close();
+        return true;
+    }
+
+    // Re-find our place by name each step, so SDMounter calls made from
+    // inside the loop (deletes, renames) cannot invalidate the iterator
+    const SDDirIndex::DirNode* node = index->getDir(path);
+    if (!node) return false;
+
+    size_t pos = last_name[0] ? index->upperBound(*node, last_name) : 0;
+    if (pos >= node->entries.size()) return false;
+
+    const SDDirIndex::Entry& e = node->entries[pos];
+    strncpy(entry.name, node->nameOf(e), sizeof(entry.name) - 1);
+    entry.name[sizeof(entry.name) - 1] = '\0';
+    strcpy(last_name, entry.name);
+    entry.is_dir = (e.flags & SDDirIndex::FLAG_DIR) != 0;
+    entry.size = e.size;
+    entry.mtime = e.mtime;     // getDir() re-read any stale entry
+    return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <functional>
+#include "SDDirIndex.h"
+
+// Streaming directory enumeration for SDMounter.
+// Entries are produced one at a time into a caller-owned fixed-size record,
+// so memory use does not grow with the size of the directory. An iterator
+// from SDMounter::openDirIterator() holds one of its handles until close().
+
+class SDMounter;
+
+#define SD_ENTRY_NAME_MAX 256   // FAT long names are at most 255 characters
+#define SD_ENTRY_PATH_MAX 256
+
+struct SDDirEntry {
+    char name[SD_ENTRY_NAME_MAX];
+    uint32_t size;
+    uint32_t mtime;
+    bool is_dir;
+    uint8_t depth;              // 0 = directly inside the listed directory
+};
+
+struct SDDirFilter {
+    const char* extension = nullptr;  // e.g. ".txt", case-insensitive
+    bool dirs_only = false;
+    bool files_only = false;
+    bool recursive = false;           // forEachEntry only
+    uint32_t skip = 0;                // Matching entries to skip (pagination)
+    uint32_t limit = 0;               // Max entries to deliver, 0 = no limit
+
+    bool matches(const char* name, bool is_dir) const;
+};
+
+// Return false to stop the enumeration early
+typedef std::function<bool(const SDDirEntry& entry)> SDDirVisitor;
+
+class SDDirIterator {
+public:
+    SDDirIterator();
+    ~SDDirIterator() { close(); }
+
+    // index may be nullptr; when set, entries come from RAM
+    bool open(fs::FS& fs, SDDirIndex* index, const char* dir_path,
+              const SDDirFilter& filter = SDDirFilter());
+    bool next(SDDirEntry& entry);
+    void close();
+
+    bool isOpen() const { return is_open; }
+    uint32_t delivered() const { return delivered_count; }
+
+private:
+    friend class SDMounter;
+
+    bool is_open;
+    File dir;
+    SDDirIndex* index;
+    SDMounter* holder;      // Mounter whose handle this holds, if any
+    char path[SD_ENTRY_PATH_MAX];
+    char last_name[SD_ENTRY_NAME_MAX];  // Index mode resumes after this name
+    SDDirFilter filter;
+    uint32_t matched_count;
+    uint32_t delivered_count;
+
+    bool nextRaw(SDDirEntry& entry);
+};
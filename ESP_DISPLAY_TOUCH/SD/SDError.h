@@ -0,0 +1,86 @@
+#pragma once
+
+// Error codes reported by SDMounter::getErrorCode(). Setting an error only
+// stores the code and copies an optional detail (usually the path) into a
+// fixed buffer; the message text is produced when someone asks for it.
+
+enum SDError : int {
+    SD_OK = 0,
+    SD_ERR_NOT_MOUNTED,
+    SD_ERR_ALREADY_MOUNTED,
+    SD_ERR_MOUNT_FAILED,
+    SD_ERR_FS_ACCESS,
+    SD_ERR_NO_MEMORY,
+    SD_ERR_FORMAT_FAILED,
+    SD_ERR_REMOUNT_FAILED,
+    SD_ERR_ROOT_OPEN,
+    SD_ERR_ROOT_NOT_DIR,
+    SD_ERR_PATH_TOO_LONG,
+    SD_ERR_NOT_FOUND,
+    SD_ERR_OPEN_FAILED,
+    SD_ERR_NOT_A_DIRECTORY,
+    SD_ERR_IS_A_DIRECTORY,
+    SD_ERR_INVALID_HANDLE,
+    SD_ERR_WRITE_FAILED,
+    SD_ERR_SEEK_FAILED,
+    SD_ERR_TEMP_CREATE,
+    SD_ERR_REPLACE_FAILED,
+    SD_ERR_TRUNCATE_FAILED,
+    SD_ERR_DELETE_FAILED,
+    SD_ERR_RENAME_FAILED,
+    SD_ERR_COPY_FAILED,
+    SD_ERR_MOVE_FAILED,
+    SD_ERR_SAME_FILE,
+    SD_ERR_MKDIR_FAILED,
+    SD_ERR_RMDIR_FAILED,
+    SD_ERR_CACHE_START,
+    SD_ERR_TXN_FAILED,
+    SD_ERR_TXN_APPLY,
+    SD_ERR_BUSY,
+    SD_ERR_NO_SPACE,
+    SD_ERR_PREALLOC_FAILED,
+    SD_ERR_EXPORTED,
+    SD_ERR_EXPORT_FAILED
+};
+
+inline const char* sdErrorText(SDError code) {
+    switch (code) {
+        case SD_OK:                  return "No error";
+        case SD_ERR_NOT_MOUNTED:     return "SD card not mounted";
+        case SD_ERR_ALREADY_MOUNTED: return "SD card already mounted";
+        case SD_ERR_MOUNT_FAILED:    return "SD card mount failed";
+        case SD_ERR_FS_ACCESS:       return "Failed to access filesystem";
+        case SD_ERR_NO_MEMORY:       return "Out of memory";
+        case SD_ERR_FORMAT_FAILED:   return "Format failed";
+        case SD_ERR_REMOUNT_FAILED:  return "Remount after format failed";
+        case SD_ERR_ROOT_OPEN:       return "Failed to open root directory";
+        case SD_ERR_ROOT_NOT_DIR:    return "Root is not a directory";
+        case SD_ERR_PATH_TOO_LONG:   return "Path too long";
+        case SD_ERR_NOT_FOUND:       return "No such file or directory";
+        case SD_ERR_OPEN_FAILED:     return "Failed to open file";
+        case SD_ERR_NOT_A_DIRECTORY: return "Not a directory";
+        case SD_ERR_IS_A_DIRECTORY:  return "Is a directory";
+        case SD_ERR_INVALID_HANDLE:  return "Invalid file handle";
+        case SD_ERR_WRITE_FAILED:    return "Write size mismatch";
+        case SD_ERR_SEEK_FAILED:     return "Seek operation failed";
+        case SD_ERR_TEMP_CREATE:     return "Failed to create temp file";
+        case SD_ERR_REPLACE_FAILED:  return "Atomic replace failed";
+        case SD_ERR_TRUNCATE_FAILED: return "Truncate failed";
+        case SD_ERR_DELETE_FAILED:   return "Failed to delete";
+        case SD_ERR_RENAME_FAILED:   return "Rename failed";
+        case SD_ERR_COPY_FAILED:     return "Copy failed - size mismatch";
+        case SD_ERR_MOVE_FAILED:     return "Move failed";
+        case SD_ERR_SAME_FILE:       return "Source and destination are the same file";
+        case SD_ERR_MKDIR_FAILED:    return "Failed to create directory";
+        case SD_ERR_RMDIR_FAILED:    return "Failed to remove directory";
+        case SD_ERR_CACHE_START:     return "Failed to start block cache";
+        case SD_ERR_TXN_FAILED:      return "Transaction failed";
+        case SD_ERR_TXN_APPLY:       return "Transaction apply failed, will be replayed at mount";
+        case SD_ERR_BUSY:            return "Files still open on the card";
+        case SD_ERR_NO_SPACE:        return "Not enough free space";
+        case SD_ERR_PREALLOC_FAILED: return "Preallocation failed";
+        case SD_ERR_EXPORTED:        return "Card in use by the USB host";
+        case SD_ERR_EXPORT_FAILED:   return "Could not hand the card to USB";
+    }
+    return "Unknown error";
+}
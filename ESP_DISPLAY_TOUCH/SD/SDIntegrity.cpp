@@ -0,0 +1,543 @@
+#include "SDIntegrity.h"
+#include "SDCrc.h"
+#include <algorithm>
+#include <esp_heap_caps.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/version.h>
+
+#define SD_INTEGRITY_CHUNK  8192        // Read size while hashing, DMA capable
+#define SD_MANIFEST_LINE    (SD_PATH_MAX + 96)
+#define SD_FAT_MTIME_STEP   2           // FAT keeps write times to 2 s
+#define SD_CLOCK_SET_AFTER  1577836800  // 2020-01-01: earlier means no clock yet
+
+// mbedtls 3 (IDF 5) dropped the _ret suffix that 2.x needs
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+#define sd_sha256_starts mbedtls_sha256_starts
+#define sd_sha256_update mbedtls_sha256_update
+#define sd_sha256_finish mbedtls_sha256_finish
+#else
+#define sd_sha256_starts mbedtls_sha256_starts_ret
+#define sd_sha256_update mbedtls_sha256_update_ret
+#define sd_sha256_finish mbedtls_sha256_finish_ret
+#endif
+
+static const char* algoName(SDHashAlgo algo) {
+    return algo == SD_HASH_SHA256 ? "sha256" : "crc32";
+}
+
+static bool byPath(const String& a, const String& b) {
+    return strcmp(a.c_str(), b.c_str()) < 0;
+}
+
+// A file written in the 2 s tick it is hashed in can be written again
+// without its mtime moving, so that hash is only a guess
+static bool mtimeSettled(uint32_t mtime) {
+    time_t now = time(nullptr);
+    if (now < SD_CLOCK_SET_AFTER) return true;     // Nothing to compare with
+    return (int64_t)now - mtime > SD_FAT_MTIME_STEP;
+}
+
+SDIntegrity::SDIntegrity(SDMounter& mounter)
+    : sd(mounter),
+      loaded(false),
+      loaded_algo(SD_HASH_CRC32),
+      buffer(nullptr),
+      throttled(false),
+      pace_start_ms(0),
+      pace_bytes(0),
+      task(nullptr),
+      stopping(false),
+      scanning(false) {
+    memset(&last_report, 0, sizeof(last_report));
+    state_lock = xSemaphoreCreateMutex();
+    scan_lock = xSemaphoreCreateMutex();
+}
+
+SDIntegrity::~SDIntegrity() {
+    end();
+    if (buffer) heap_caps_free(buffer);
+    if (state_lock) vSemaphoreDelete(state_lock);
+    if (scan_lock) vSemaphoreDelete(scan_lock);
+}
+
+void SDIntegrity::setConfig(const Config& config) {
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    if (!cfg.manifest || !config.manifest || strcmp(cfg.manifest, config.manifest) != 0) {
+        loaded = false;     // Another manifest: read it at the next scan
+    }
+    cfg = config;
+    xSemaphoreGive(scan_lock);
+}
+
+bool SDIntegrity::scan(SDIntegrityReport& report) {
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    throttled = false;
+    bool ok = runScan(report);
+    xSemaphoreGive(scan_lock);
+    return ok;
+}
+
+bool SDIntegrity::begin(BaseType_t core, UBaseType_t priority) {
+    if (task) return true;
+    if (!state_lock || !scan_lock) return false;
+
+    stopping = false;
+    if (xTaskCreatePinnedToCore(scanTask, "sd_verify", 6144, this, priority, &task, core) != pdPASS) {
+        task = nullptr;
+        Serial.println("[SDIntegrity] Failed to start scan task");
+        return false;
+    }
+    return true;
+}
+
+void SDIntegrity::end() {
+    if (!task) return;
+
+    // A running scan stops at its next chunk and keeps what it verified
+    stopping = true;
+    xTaskNotifyGive(task);
+    while (task) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    stopping = false;
+}
+
+void SDIntegrity::requestScan() {
+    if (task) xTaskNotifyGive(task);
+}
+
+SDIntegrityReport SDIntegrity::getLastReport() const {
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    SDIntegrityReport report = last_report;
+    xSemaphoreGive(state_lock);
+    return report;
+}
+
+uint32_t SDIntegrity::getCorruptCount() const {
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    uint32_t count = 0;
+    for (const Entry& e : entries) {
+        if (e.corrupt) count++;
+    }
+    xSemaphoreGive(state_lock);
+    return count;
+}
+
+bool SDIntegrity::isCorrupt(const char* path) const {
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    auto it = std::lower_bound(entries.begin(), entries.end(), path,
+                               [](const Entry& e, const char* p) { return strcmp(e.path.c_str(), p) < 0; });
+    bool corrupt = (it != entries.end() && it->path == path && it->corrupt);
+    xSemaphoreGive(state_lock);
+    return corrupt;
+}
+
+bool SDIntegrity::hashFile(const char* path, SDHashAlgo algo, uint8_t* out, size_t* size) {
+    // Its own buffer and no pacing, so it can run beside a background scan
+    uint8_t* chunk = (uint8_t*)heap_caps_malloc(SD_INTEGRITY_CHUNK, MALLOC_CAP_DMA);
+    if (!chunk) return false;
+    bool ok = hashPath(path, algo, out, size, chunk, false);
+    heap_caps_free(chunk);
+    return ok;
+}
+
+// Private helper methods
+bool SDIntegrity::hashPath(const char* path, SDHashAlgo algo, uint8_t* out, size_t* size,
+                           uint8_t* chunk, bool paced) {
+    int fd;
+    {
+        SDLock guard(sd);
+        char full_path[SD_PATH_MAX];
+        if (!sd.isMounted() || !sd.resolvePath(path, full_path)) return false;
+        fd = sd.backend->open(full_path, SD_OPEN_READ);
+        if (fd < 0) return false;
+        sd.acquireHandle();
+    }
+
+    // Reads on an open descriptor do not hold the lock, so other card users
+    // get their turn between chunks
+    uint64_t bytes = 0;
+    bool ok = hashFd(fd, algo, out, bytes, chunk, paced);
+    sd.backend->close(fd);
+    sd.releaseHandle();
+
+    if (size) *size = bytes;
+    return ok;
+}
+
+bool SDIntegrity::runScan(SDIntegrityReport& report) {
+    memset(&report, 0, sizeof(report));
+    unsigned long start = millis();
+
+    if (!sd.isMounted()) {
+        sd.setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+
+    if (!buffer) {
+        buffer = (uint8_t*)heap_caps_malloc(SD_INTEGRITY_CHUNK, MALLOC_CAP_DMA);
+        if (!buffer) {
+            sd.setError(SD_ERR_NO_MEMORY);
+            return false;
+        }
+    }
+
+    // No mounter handle across the scan, only while a file is open, so an
+    // unmount is not held up until the scan ends
+    scanning = true;
+    pace_start_ms = millis();
+    pace_bytes = 0;
+
+    if (!loaded) loadManifest();
+    SDHashAlgo algo = cfg.algo;
+    bool rehash_all = (loaded_algo != algo);
+    uint8_t hash_len = hashLength(algo);
+
+    std::vector<Found> found;
+    bool ok = walk(found);
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return byPath(a.path, b.path); });
+
+    // Merge the tree into the manifest; both are sorted by path
+    std::vector<Entry> next;
+    std::vector<size_t> unchanged;
+    next.reserve(found.size());
+    size_t j = 0;
+    for (size_t i = 0; ok && i < found.size(); i++) {
+        const Found& f = found[i];
+        while (j < entries.size() && byPath(entries[j].path, f.path)) {
+            report.removed++;
+            j++;
+        }
+
+        bool known = (j < entries.size() && entries[j].path == f.path);
+        if (known && !rehash_all && entries[j].size == f.size && entries[j].mtime == f.mtime) {
+            next.push_back(entries[j++]);
+            unchanged.push_back(next.size() - 1);
+            continue;
+        }
+
+        Entry e;
+        e.path = f.path;
+        e.size = f.size;
+        e.mtime = f.mtime;
+        e.corrupt = false;
+        memset(e.hash, 0, sizeof(e.hash));
+
+        size_t size = 0;
+        if (hashPath(f.path.c_str(), algo, e.hash, &size, buffer, throttled)) {
+            if (!mtimeSettled(e.mtime)) e.mtime = 0;    // Hashed again next scan
+            report.bytes_hashed += size;
+            if (known) report.changed++;
+            else report.added++;
+            next.push_back(e);
+        } else if (stopping || !sd.isMounted()) {
+            ok = false;
+        } else {
+            // Retried next scan: a changed file keeps its old metadata
+            report.unreadable++;
+            if (known && !rehash_all) next.push_back(entries[j]);
+        }
+        if (known) j++;
+    }
+    report.removed += entries.size() - j;
+
+    // Re-hash unchanged files, continuing after the last scan's cursor
+    String new_cursor = cursor;
+    uint64_t verify_bytes = 0;
+    size_t first = std::upper_bound(unchanged.begin(), unchanged.end(), cursor,
+                                    [&next](const String& c, size_t idx) { return byPath(c, next[idx].path); })
+                   - unchanged.begin();
+    for (size_t k = 0; ok && k < unchanged.size(); k++) {
+        if (cfg.verify_bytes && verify_bytes >= cfg.verify_bytes) break;
+        if (stopping || !sd.isMounted()) break;
+
+        Entry& e = next[unchanged[(first + k) % unchanged.size()]];
+        uint8_t hash[SD_HASH_MAX];
+        size_t size = 0;
+        if (!hashPath(e.path.c_str(), algo, hash, &size, buffer, throttled)) {
+            if (!stopping && sd.isMounted()) report.unreadable++;
+            continue;
+        }
+        report.bytes_hashed += size;
+        verify_bytes += size;
+        new_cursor = e.path;
+
+        if (memcmp(hash, e.hash, hash_len) == 0) {
+            e.corrupt = false;
+            report.verified++;
+            continue;
+        }
+
+        // Written since the walk: a legitimate change, not corruption
+        bool rewritten = false;
+        {
+            SDLock guard(sd);
+            File now = sd.backend->fs().open(e.path.c_str(), FILE_READ);
+            if (now && (now.size() != e.size || (uint32_t)now.getLastWrite() != e.mtime)) {
+                e.size = now.size();
+                e.mtime = (uint32_t)now.getLastWrite();
+                rewritten = true;
+            }
+            if (now) now.close();
+        }
+        if (rewritten) {
+            if (!mtimeSettled(e.mtime)) e.mtime = 0;
+            memcpy(e.hash, hash, hash_len);
+            e.corrupt = false;
+            report.changed++;
+            continue;
+        }
+
+        report.corrupt++;
+        Serial.printf("[SDIntegrity] %s: content changed without a write\n", e.path.c_str());
+        if (!e.corrupt) {
+            e.corrupt = true;   // Old hash kept, so it stays flagged until rewritten
+            if (on_corruption) on_corruption(e.path.c_str());
+        }
+    }
+
+    if (ok) {
+        xSemaphoreTake(state_lock, portMAX_DELAY);
+        entries.swap(next);
+        cursor = new_cursor;
+        loaded_algo = algo;
+        xSemaphoreGive(state_lock);
+
+        if (!saveManifest()) {
+            Serial.println("[SDIntegrity] Failed to write the manifest");
+        }
+    }
+
+    report.files = entries.size();
+    report.elapsed_ms = millis() - start;
+    report.complete = ok && !stopping;
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    last_report = report;
+    xSemaphoreGive(state_lock);
+
+    scanning = false;
+    return ok;
+}
+
+bool SDIntegrity::walk(std::vector<Found>& found) {
+    // Iterative, so deep trees cost heap instead of stack
+    std::vector<String> dirs;
+    dirs.push_back(cfg.root);
+
+    SDDirEntry entry;
+    char path[SD_PATH_MAX];
+    while (!dirs.empty()) {
+        if (stopping) return false;
+
+        String dir = dirs.back();
+        dirs.pop_back();
+
+        // Raw listing rather than the dir index, for the card's own mtimes
+        SDLock guard(sd);
+        SDDirIterator it;
+        if (!sd.isMounted() || !it.open(sd.backend->fs(), nullptr, dir.c_str())) {
+            return false;
+        }
+
+        const char* sep = (dir.length() > 0 && dir[dir.length() - 1] == '/') ? "" : "/";
+        while (it.next(entry)) {
+            if ((size_t)snprintf(path, sizeof(path), "%s%s%s", dir.c_str(), sep, entry.name) >= sizeof(path)) {
+                continue;
+            }
+            if (entry.is_dir) {
+                dirs.push_back(path);
+            } else if (!isManifestFile(path)) {
+                found.push_back({String(path), entry.size, entry.mtime});
+            }
+        }
+    }
+    return true;
+}
+
+bool SDIntegrity::isManifestFile(const char* path) const {
+    size_t len = strlen(cfg.manifest);
+    if (strncmp(path, cfg.manifest, len) != 0) return false;
+    return path[len] == '\0' || strcmp(path + len, SD_REPLACE_TEMP) == 0 ||
+           strcmp(path + len, SD_REPLACE_BACKUP) == 0;
+}
+
+bool SDIntegrity::loadManifest() {
+    entries.clear();
+    cursor = "";
+    loaded = true;
+    loaded_algo = cfg.algo;
+
+    File file;
+    {
+        SDLock guard(sd);
+        char full_path[SD_PATH_MAX];
+        if (!sd.resolvePath(cfg.manifest, full_path)) return false;
+        if (!sd.backend->stat(full_path)) return false;    // First scan
+        file = sd.openFile(full_path, FILE_READ);
+    }
+    if (!file) return false;
+    file.setTimeout(0);
+
+    char line[SD_MANIFEST_LINE];
+    size_t n = file.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[n] = '\0';
+
+    char algo_name[8];
+    int version = 0;
+    if (sscanf(line, "SDMANIFEST %d %7s", &version, algo_name) != 2 || version != 1) {
+        Serial.printf("[SDIntegrity] %s is not a manifest, starting over\n", cfg.manifest);
+        file.close();
+        return false;
+    }
+    loaded_algo = (strcmp(algo_name, "sha256") == 0) ? SD_HASH_SHA256 : SD_HASH_CRC32;
+    uint8_t hash_len = hashLength(loaded_algo);
+
+    while (file.available()) {
+        n = file.readBytesUntil('\n', line, sizeof(line) - 1);
+        line[n] = '\0';
+        if (line[0] == '@') {
+            cursor = line + 1;
+            continue;
+        }
+
+        // hash \t size \t mtime \t path
+        char* size_field = strchr(line, '\t');
+        char* mtime_field = size_field ? strchr(size_field + 1, '\t') : nullptr;
+        char* path_field = mtime_field ? strchr(mtime_field + 1, '\t') : nullptr;
+        if (!path_field || size_field - line != hash_len * 2 || path_field[1] != '/') continue;
+
+        Entry e;
+        e.corrupt = false;
+        memset(e.hash, 0, sizeof(e.hash));
+        for (uint8_t i = 0; i < hash_len; i++) {
+            char hex[3] = {line[i * 2], line[i * 2 + 1], '\0'};
+            e.hash[i] = (uint8_t)strtoul(hex, nullptr, 16);
+        }
+        e.size = strtoul(size_field + 1, nullptr, 10);
+        e.mtime = strtoul(mtime_field + 1, nullptr, 10);
+        e.path = path_field + 1;
+        entries.push_back(e);
+    }
+    file.close();
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return byPath(a.path, b.path); });
+    return true;
+}
+
+bool SDIntegrity::saveManifest() {
+    char full_path[SD_PATH_MAX];
+    char temp_path[SD_PATH_MAX + sizeof(SD_REPLACE_TEMP)];
+    File file;
+    {
+        SDLock guard(sd);
+        if (!sd.isMounted() || !sd.resolvePath(cfg.manifest, full_path)) return false;
+        snprintf(temp_path, sizeof(temp_path), "%s" SD_REPLACE_TEMP, full_path);
+        file = sd.openFile(temp_path, FILE_WRITE);
+    }
+    if (!file) return false;
+
+    bool ok = file.printf("SDMANIFEST 1 %s\n", algoName(loaded_algo)) > 0;
+    if (cursor.length()) ok = file.printf("@%s\n", cursor.c_str()) > 0 && ok;
+
+    char hex[SD_HASH_MAX * 2 + 1];
+    uint8_t hash_len = hashLength(loaded_algo);
+    for (const Entry& e : entries) {
+        if (!ok) break;
+        for (uint8_t i = 0; i < hash_len; i++) {
+            sprintf(hex + i * 2, "%02x", e.hash[i]);
+        }
+        ok = file.printf("%s\t%u\t%u\t%s\n", hex, e.size, e.mtime, e.path.c_str()) > 0;
+    }
+    file.flush();
+    file.close();
+
+    // Same swap as atomic writes, so a power cut leaves the old manifest
+    SDLock guard(sd);
+    if (!ok) {
+        sd.backend->unlink(temp_path);
+        return false;
+    }
+    if (!sd.replaceWithTemp(full_path)) return false;
+    if (sd.dir_index_enabled) {
+        sd.dir_index.noteStale(full_path);
+        sd.dir_index.noteRemoved(temp_path);
+    }
+    return true;
+}
+
+bool SDIntegrity::hashFd(int fd, SDHashAlgo algo, uint8_t* out, uint64_t& bytes, uint8_t* chunk, bool paced) {
+    uint32_t crc = 0;
+    mbedtls_sha256_context sha;
+    if (algo == SD_HASH_SHA256) {
+        mbedtls_sha256_init(&sha);
+        sd_sha256_starts(&sha, 0);
+    }
+
+    bool ok = true;
+    while (true) {
+        if (stopping) {
+            ok = false;
+            break;
+        }
+
+        int n = sd.backend->read(fd, chunk, SD_INTEGRITY_CHUNK);
+        if (n < 0) ok = false;
+        if (n <= 0) break;
+
+        if (algo == SD_HASH_SHA256) {
+            sd_sha256_update(&sha, chunk, n);
+        } else {
+            crc = sdCrc32(chunk, n, crc);
+        }
+        bytes += n;
+        if (paced) pace(n);
+    }
+
+    if (algo == SD_HASH_SHA256) {
+        sd_sha256_finish(&sha, out);
+        mbedtls_sha256_free(&sha);
+    } else {
+        memcpy(out, &crc, sizeof(crc));
+    }
+    return ok;
+}
+
+void SDIntegrity::pace(size_t bytes) {
+    if (!throttled || cfg.budget_kbps == 0) return;
+
+    // Sleep whenever the scan gets ahead of the budget since it started
+    pace_bytes += bytes;
+    uint32_t due_ms = (uint32_t)(pace_bytes * 1000 / ((uint64_t)cfg.budget_kbps * 1024));
+    uint32_t elapsed_ms = millis() - pace_start_ms;
+    if (due_ms > elapsed_ms) {
+        vTaskDelay(pdMS_TO_TICKS(due_ms - elapsed_ms));
+    }
+}
+
+void SDIntegrity::scanTask(void* arg) {
+    SDIntegrity* self = (SDIntegrity*)arg;
+
+    // First scan shortly after start, so mount and the UI settle first
+    TickType_t wait = pdMS_TO_TICKS(5000);
+    while (!self->stopping) {
+        ulTaskNotifyTake(pdTRUE, wait);
+        if (self->stopping) break;
+
+        if (self->sd.isMounted()) {
+            SDIntegrityReport report;
+            xSemaphoreTake(self->scan_lock, portMAX_DELAY);
+            self->throttled = true;
+            self->runScan(report);
+            xSemaphoreGive(self->scan_lock);
+
+            Serial.printf("[SDIntegrity] %u files: %u new, %u changed, %u verified, %u corrupt (%u ms)\n",
+                          report.files, report.added, report.changed, report.verified,
+                          report.corrupt, report.elapsed_ms);
+        }
+        wait = pdMS_TO_TICKS((uint64_t)self->cfg.interval_s * 1000);
+    }
+
+    self->task = nullptr;
+    vTaskDelete(nullptr);
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "SDMounter.h"
+
+// Card integrity scan. Every file under a root is hashed into a manifest
+// kept on the card. A scan walks the tree (metadata only), hashes files
+// that are new or whose size or mtime changed, and re-hashes unchanged
+// files to compare against the manifest. An unchanged file with different
+// content is silent corruption. FAT mtimes have 2 s steps, so a file hashed
+// within 2 s of its last write is recorded with mtime 0 and hashed again by
+// the next scan instead of being trusted as a baseline.
+//
+// Verification of unchanged files is incremental: each scan continues where
+// the last one stopped (the cursor is saved in the manifest) and checks up
+// to verify_bytes, so a large card is covered over several scans. Run on
+// the background task, reads are paced to budget_kbps so the UI and other
+// card users keep most of the bus.
+//
+// CRC32 uses the ROM routine. SHA-256 goes through mbedtls, which the IDF
+// runs on the S3's SHA peripheral.
+//
+// Manifest (text, sorted by path):
+//   SDMANIFEST 1 <crc32|sha256>
+//   @<path the last verification stopped at>
+//   <hash hex> <tab> <size> <tab> <mtime> <tab> <path>
+
+enum SDHashAlgo : uint8_t {
+    SD_HASH_CRC32,
+    SD_HASH_SHA256
+};
+
+#define SD_HASH_MAX 32      // SHA-256
+
+struct SDIntegrityReport {
+    uint32_t files;             // In the manifest after the scan
+    uint32_t added;             // New files, hashed and recorded
+    uint32_t changed;           // Size or mtime changed, re-hashed and recorded
+    uint32_t removed;
+    uint32_t verified;          // Unchanged and still matching
+    uint32_t corrupt;           // Unchanged metadata, different content
+    uint32_t unreadable;
+    uint64_t bytes_hashed;
+    uint32_t elapsed_ms;
+    bool complete;              // false when stopped or the card went away
+};
+
+typedef std::function<void(const char* path)> SDCorruptionCallback;
+
+class SDIntegrity {
+public:
+    struct Config {
+        SDHashAlgo algo = SD_HASH_CRC32;
+        const char* root = "/";
+        const char* manifest = "/.sdmanifest";
+        uint64_t verify_bytes = 64ULL * 1024 * 1024;    // Per scan, 0 = every unchanged file
+        uint32_t budget_kbps = 512;         // Background read rate, 0 = unthrottled
+        uint32_t interval_s = 3600;         // Between background scans
+    };
+
+    explicit SDIntegrity(SDMounter& sd = SDCard);
+    ~SDIntegrity();
+
+    // Takes effect at the next scan; changing algo re-hashes everything
+    void setConfig(const Config& config);
+    const Config& getConfig() const { return cfg; }
+
+    // Foreground scan at full speed; creates the manifest on first use
+    bool scan(SDIntegrityReport& report);
+
+    // Background scans: one soon after begin(), then every interval_s, or
+    // right away after requestScan()
+    bool begin(BaseType_t core = 0, UBaseType_t priority = 0);
+    void end();
+    bool isRunning() const { return task != nullptr; }
+    bool isScanning() const { return scanning; }
+    void requestScan();
+    SDIntegrityReport getLastReport() const;
+
+    // Runs on the scanning task for each corrupt file
+    void onCorruption(SDCorruptionCallback callback) { on_corruption = callback; }
+    uint32_t getCorruptCount() const;
+    bool isCorrupt(const char* path) const;
+
+    // Hashes one file; out receives 4 bytes (CRC32) or 32 (SHA-256)
+    bool hashFile(const char* path, SDHashAlgo algo, uint8_t* out, size_t* size = nullptr);
+
+private:
+    struct Entry {
+        String path;
+        uint32_t size;
+        uint32_t mtime;
+        uint8_t hash[SD_HASH_MAX];
+        bool corrupt;
+    };
+
+    struct Found {
+        String path;
+        uint32_t size;
+        uint32_t mtime;
+    };
+
+    SDMounter& sd;
+    Config cfg;
+    std::vector<Entry> entries;         // Sorted by path
+    bool loaded;
+    SDHashAlgo loaded_algo;
+    String cursor;                      // Verification resumes after this path
+    SDCorruptionCallback on_corruption;
+    SDIntegrityReport last_report;
+
+    uint8_t* buffer;                    // Scan reads; hashFile() brings its own
+    bool throttled;                     // Pace reads to budget_kbps
+    unsigned long pace_start_ms;
+    uint64_t pace_bytes;
+
+    SemaphoreHandle_t state_lock;       // Guards entries, cursor and last_report
+    SemaphoreHandle_t scan_lock;        // One scan at a time
+    TaskHandle_t task;
+    volatile bool stopping;
+    volatile bool scanning;
+
+    // Private helper methods
+    bool hashPath(const char* path, SDHashAlgo algo, uint8_t* out, size_t* size, uint8_t* chunk, bool paced);
+    bool runScan(SDIntegrityReport& report);
+    bool walk(std::vector<Found>& found);
+    bool isManifestFile(const char* path) const;
+    bool loadManifest();
+    bool saveManifest();
+    bool hashFd(int fd, SDHashAlgo algo, uint8_t* out, uint64_t& bytes, uint8_t* chunk, bool paced);
+    void pace(size_t bytes);
+    uint8_t hashLength(SDHashAlgo algo) const { return algo == SD_HASH_SHA256 ? 32 : 4; }
+    static void scanTask(void* arg);
+};
@@ -0,0 +1,60 @@
+#include "SDLatencyHistogram.h"
+
+#define SD_HIST_BAR 40
+
+void SDLatencyHistogram::reset() {
+    memset(buckets, 0, sizeof(buckets));
+    samples = 0;
+    total_us = 0;
+    max_us = 0;
+}
+
+void SDLatencyHistogram::record(uint32_t us) {
+    uint8_t i = 0;
+    while (i < SD_HIST_BUCKETS - 1 && us >= bucketLimit(i)) i++;
+    buckets[i]++;
+    samples++;
+    total_us += us;
+    if (us > max_us) max_us = us;
+}
+
+uint32_t SDLatencyHistogram::percentile(uint8_t pct) const {
+    if (samples == 0) return 0;
+
+    uint64_t target = ((uint64_t)samples * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (uint8_t i = 0; i < SD_HIST_BUCKETS - 1; i++) {
+        seen += buckets[i];
+        if (seen >= target) return bucketLimit(i);
+    }
+    return max_us;
+}
+
+void SDLatencyHistogram::print(Print& out, const char* title) const {
+    if (title) out.printf("%s\n", title);
+    out.printf("  %u samples, mean %u us, p50 <%u us, p99 <%u us, max %u us\n",
+               samples, meanMicros(), percentile(50), percentile(99), max_us);
+    if (samples == 0) return;
+
+    uint32_t peak = 0;
+    for (uint8_t i = 0; i < SD_HIST_BUCKETS; i++) {
+        if (buckets[i] > peak) peak = buckets[i];
+    }
+
+    char bar[SD_HIST_BAR + 1];
+    for (uint8_t i = 0; i < SD_HIST_BUCKETS; i++) {
+        if (buckets[i] == 0) continue;
+
+        // Any non-empty bucket shows at least one mark, so rare spikes stay visible
+        size_t len = (size_t)((uint64_t)buckets[i] * SD_HIST_BAR / peak);
+        if (len == 0) len = 1;
+        memset(bar, '#', len);
+        bar[len] = '\0';
+
+        if (i == SD_HIST_BUCKETS - 1) {
+            out.printf("  >=%7u us %8u %s\n", bucketLimit(i - 1), buckets[i], bar);
+        } else {
+            out.printf("  < %7u us %8u %s\n", bucketLimit(i), buckets[i], bar);
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <Arduino.h>
+
+// Latency histogram with power-of-two buckets: the first holds everything
+// under 64 us, each next one twice the range of the last, and the final one
+// everything from about one second up. Recording is a few instructions and
+// allocates nothing, so it can sit on a write path.
+
+#define SD_HIST_BUCKETS 16
+#define SD_HIST_FIRST_US 64
+
+class SDLatencyHistogram {
+public:
+    SDLatencyHistogram() { reset(); }
+
+    void reset();
+    void record(uint32_t us);
+
+    uint32_t count() const { return samples; }
+    uint32_t bucket(uint8_t i) const { return (i < SD_HIST_BUCKETS) ? buckets[i] : 0; }
+    uint32_t bucketLimit(uint8_t i) const { return SD_HIST_FIRST_US << i; } // Upper bound in us
+    uint32_t maxMicros() const { return max_us; }
+    uint32_t meanMicros() const { return samples ? total_us / samples : 0; }
+    uint32_t percentile(uint8_t pct) const;    // Upper bound of the bucket holding it
+
+    // One line per non-empty bucket with a bar scaled to the largest
+    void print(Print& out, const char* title = nullptr) const;
+
+private:
+    uint32_t buckets[SD_HIST_BUCKETS];
+    uint32_t samples;
+    uint64_t total_us;
+    uint32_t max_us;
+};
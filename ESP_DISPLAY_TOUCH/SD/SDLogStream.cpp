@@ -0,0 +1,348 @@
+#include "SDLogStream.h"
+#include "SDMounter.h"
+#include <esp_heap_caps.h>
+
+SDLogStream::SDLogStream()
+    : sd(nullptr),
+      suspended(false),
+      active(0),
+      pending(-1),
+      capacity(0),
+      threshold(0),
+      interval_ms(1000),
+      block_timeout_ms(0),
+      last_flush_ms(0),
+      durability(SD_LOG_FLUSHED),
+      bytes_written(0),
+      dropped_bytes(0),
+      flush_count(0),
+      index_backlog(0),
+      space_dirty(false),
+      buffer_lock(nullptr),
+      io_lock(nullptr),
+      flusher(nullptr),
+      stopping(false) {
+    buffers[0] = buffers[1] = nullptr;
+    fill[0] = fill[1] = 0;
+}
+
+SDLogStream::~SDLogStream() {
+    end();
+}
+
+bool SDLogStream::begin(SDMounter& sd_mounter, const char* log_path, size_t buffer_size,
+                        SDLogDurability level, bool background) {
+    if (sd) return true;
+
+    if (!sd_mounter.isMounted()) {
+        Serial.println("[SDLogStream] SD card not mounted");
+        return false;
+    }
+
+    char full_path[SD_PATH_MAX];
+    if (!sd_mounter.resolvePath(log_path, full_path)) {
+        Serial.printf("[SDLogStream] Bad path %s\n", log_path);
+        return false;
+    }
+    path = full_path;
+
+    // Two buffers: one takes appends while the other is on its way to the card
+    for (int i = 0; i < 2; i++) {
+        buffers[i] = (uint8_t*)heap_caps_malloc(buffer_size, MALLOC_CAP_SPIRAM);
+        if (!buffers[i]) {
+            buffers[i] = (uint8_t*)heap_caps_malloc(buffer_size, MALLOC_CAP_8BIT);
+        }
+        fill[i] = 0;
+    }
+    buffer_lock = xSemaphoreCreateMutex();
+    io_lock = xSemaphoreCreateMutex();
+
+    if (!buffers[0] || !buffers[1] || !buffer_lock || !io_lock) {
+        Serial.println("[SDLogStream] Failed to allocate buffers");
+        end();
+        return false;
+    }
+
+    // Through the mounter, so the open log holds one of its handles
+    file = sd_mounter.openFile(path.c_str(), FILE_APPEND);
+    if (!file) {
+        Serial.printf("[SDLogStream] Failed to open %s\n", path.c_str());
+        end();
+        return false;
+    }
+
+    sd = &sd_mounter;
+    capacity = buffer_size;
+    threshold = buffer_size / 2;
+    durability = level;
+    active = 0;
+    pending = -1;
+    suspended = false;
+    stopping = false;
+    last_flush_ms = millis();
+
+    if (background) {
+        if (xTaskCreatePinnedToCore(flusherTask, "sd_log", 4096, this, 1, &flusher, 0) != pdPASS) {
+            Serial.println("[SDLogStream] Failed to start flusher task, flushing from loop()");
+            flusher = nullptr;
+        }
+    }
+
+    sd->registerLogStream(this);
+    Serial.printf("[SDLogStream] Logging to %s (%u byte buffers)\n", path.c_str(), (unsigned)capacity);
+    return true;
+}
+
+void SDLogStream::end() {
+    if (sd) {
+        sync();
+        noteMounter(true);
+        sd->unregisterLogStream(this);
+    }
+
+    if (flusher) {
+        stopping = true;
+        xTaskNotifyGive(flusher);
+        while (flusher) {
+            vTaskDelay(pdMS_TO_TICKS(5));
+        }
+    }
+
+    if (file) file.close();
+
+    for (int i = 0; i < 2; i++) {
+        if (buffers[i]) heap_caps_free(buffers[i]);
+        buffers[i] = nullptr;
+        fill[i] = 0;
+    }
+    if (buffer_lock) vSemaphoreDelete(buffer_lock);
+    if (io_lock) vSemaphoreDelete(io_lock);
+    buffer_lock = io_lock = nullptr;
+    sd = nullptr;
+}
+
+size_t SDLogStream::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t SDLogStream::write(const uint8_t* data, size_t len) {
+    if (!sd) return 0;
+
+    size_t accepted = 0;
+    uint32_t start = millis();
+
+    xSemaphoreTake(buffer_lock, portMAX_DELAY);
+    while (accepted < len) {
+        size_t space = capacity - fill[active];
+
+        if (space == 0) {
+            if (rotateLocked()) {
+                wakeFlusher();
+                continue;
+            }
+
+            // Both buffers full: the card is behind
+            xSemaphoreGive(buffer_lock);
+            bool waited = false;
+            if (!suspended && millis() - start < block_timeout_ms) {
+                if (flusher) {
+                    vTaskDelay(1);
+                } else {
+                    flushPending();
+                }
+                waited = true;
+            }
+            xSemaphoreTake(buffer_lock, portMAX_DELAY);
+            if (waited) continue;
+
+            dropped_bytes += len - accepted;
+            break;
+        }
+
+        size_t n = (len - accepted < space) ? len - accepted : space;
+        memcpy(buffers[active] + fill[active], data + accepted, n);
+        fill[active] += n;
+        accepted += n;
+    }
+
+    bool wake = (fill[active] >= threshold) && rotateLocked();
+    xSemaphoreGive(buffer_lock);
+
+    if (durability == SD_LOG_SYNC_EACH) {
+        sync();
+    } else if (wake) {
+        wakeFlusher();
+    }
+
+    return accepted;
+}
+
+bool SDLogStream::sync() {
+    if (!sd) return false;
+
+    // At most two buffers can hold data
+    for (int i = 0; i < 2; i++) {
+        xSemaphoreTake(buffer_lock, portMAX_DELAY);
+        if (pending < 0 && fill[active] > 0) {
+            rotateLocked();
+        }
+        bool has_pending = (pending >= 0);
+        xSemaphoreGive(buffer_lock);
+
+        if (!has_pending) break;
+        if (!flushPending()) return false;
+    }
+
+    return true;
+}
+
+void SDLogStream::loop() {
+    if (!sd) return;
+
+    if (!flusher && (pending >= 0 || millis() - last_flush_ms >= interval_ms)) {
+        sync();
+    }
+    noteMounter(false);
+}
+
+void SDLogStream::suspend(bool flush_first) {
+    if (!sd) return;
+
+    if (flush_first) {
+        sync();
+    }
+
+    xSemaphoreTake(io_lock, portMAX_DELAY);
+    suspended = true;
+    File closing = file;
+    file = File();
+    xSemaphoreGive(io_lock);
+
+    // Releases the handle, so the card can be ended right after
+    closing.close();
+}
+
+void SDLogStream::resume() {
+    if (!sd || !suspended) return;
+
+    xSemaphoreTake(io_lock, portMAX_DELAY);
+    file = sd->openFile(path.c_str(), FILE_APPEND);
+    suspended = !file;
+    xSemaphoreGive(io_lock);
+
+    if (suspended) {
+        Serial.printf("[SDLogStream] Failed to reopen %s\n", path.c_str());
+        return;
+    }
+
+    // Whatever was buffered while the card was away goes out now
+    wakeFlusher();
+}
+
+// Private helper methods
+bool SDLogStream::rotateLocked() {
+    if (pending >= 0 || fill[active] == 0) return false;
+
+    pending = active;
+    active ^= 1;
+    fill[active] = 0;
+    return true;
+}
+
+bool SDLogStream::flushPending() {
+    xSemaphoreTake(io_lock, portMAX_DELAY);
+
+    // pending only changes back to -1 here, under io_lock, so two flushers
+    // can never write the same buffer
+    int8_t index = pending;
+    if (index < 0 || suspended || !file) {
+        xSemaphoreGive(io_lock);
+        return index < 0;
+    }
+
+    size_t len = fill[index];
+    size_t written = file.write(buffers[index], len);
+    if (durability != SD_LOG_BUFFERED) {
+        file.flush(); // fflush + fsync: data and directory entry reach the card
+    }
+
+    xSemaphoreTake(buffer_lock, portMAX_DELAY);
+    if (written == len) {
+        fill[index] = 0;
+        pending = -1;
+    } else {
+        // Keep the unwritten tail for the next attempt
+        memmove(buffers[index], buffers[index] + written, len - written);
+        fill[index] = len - written;
+    }
+    if (sd->isDirIndexEnabled()) index_backlog += written;
+    if (written > 0 && sd->isSpaceInfoReady()) space_dirty = true;
+    xSemaphoreGive(buffer_lock);
+
+    xSemaphoreGive(io_lock);
+
+    if (written > 0) {
+        bytes_written += written;
+        flush_count++;
+        last_flush_ms = millis();
+    }
+
+    if (written != len) {
+        Serial.printf("[SDLogStream] Short write to %s (%u of %u)\n",
+                      path.c_str(), (unsigned)written, (unsigned)len);
+        return false;
+    }
+
+    return true;
+}
+
+void SDLogStream::noteMounter(bool wait) {
+    // Only when the mounter is free: a logger must not queue up behind a
+    // long copy or format just to update the index and free space. What is
+    // not reported now is on the next try.
+    if (index_backlog == 0 && !space_dirty) return;
+    if (wait) {
+        sd->lock();
+    } else if (!sd->tryLock()) {
+        return;
+    }
+
+    xSemaphoreTake(buffer_lock, portMAX_DELAY);
+    uint32_t delta = index_backlog;
+    bool space = space_dirty;
+    index_backlog = 0;
+    space_dirty = false;
+    xSemaphoreGive(buffer_lock);
+
+    if (delta && sd->isDirIndexEnabled()) {
+        sd->getDirIndex().noteGrow(path.c_str(), delta);
+    }
+    // Appends fill the last cluster before taking another; FatFs knows which
+    if (space) sd->noteSpace(-1, 0);
+    sd->unlock();
+}
+
+void SDLogStream::wakeFlusher() {
+    if (flusher) {
+        xTaskNotifyGive(flusher);
+    }
+}
+
+void SDLogStream::flusherTask(void* arg) {
+    SDLogStream* self = (SDLogStream*)arg;
+
+    while (true) {
+        uint32_t woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(self->interval_ms));
+        if (self->stopping) break;
+
+        if (woken) {
+            self->flushPending();
+        } else {
+            self->sync(); // Interval elapsed: push out the partial buffer too
+        }
+        self->noteMounter(false);
+    }
+
+    self->flusher = nullptr;
+    vTaskDelete(nullptr);
+}
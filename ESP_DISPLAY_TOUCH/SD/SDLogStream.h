@@ -0,0 +1,94 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+class SDMounter;
+
+// Buffered write-behind log file for high-rate append workloads.
+// The file stays open; appends are copied into one of two RAM buffers and
+// written to the card as a group when a size threshold or time interval is
+// reached, or on sync(). A background task (optional) does the card writes so
+// the logging caller never waits on the card.
+//
+// SDMounter flushes registered streams before unmount (call
+// SDCard.flushLogs() before sleep), parks them when the card is pulled and
+// reopens them on the next mount. The open log holds a mounter handle
+// until end() or until it is parked.
+
+enum SDLogDurability {
+    SD_LOG_BUFFERED,    // Group writes, no fsync: fastest, power loss may lose the FAT size update
+    SD_LOG_FLUSHED,     // Group writes followed by fsync (group commit)
+    SD_LOG_SYNC_EACH    // Every write() is written and fsynced before returning
+};
+
+class SDLogStream : public Print {
+public:
+    SDLogStream();
+    ~SDLogStream();
+
+    bool begin(SDMounter& sd, const char* path, size_t buffer_size = 8192,
+               SDLogDurability durability = SD_LOG_FLUSHED, bool background = true);
+    void end();
+
+    // Print interface - print(), printf() and println() all land here
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* data, size_t len) override;
+    using Print::write;
+
+    bool sync();    // Write everything buffered and fsync now
+    void loop();    // Time-based flush without the background task; never waits on the mounter
+
+    // Configuration
+    void setFlushThreshold(size_t bytes) { threshold = (bytes < capacity) ? bytes : capacity; }
+    void setFlushInterval(uint32_t ms) { interval_ms = ms; }
+    void setDurability(SDLogDurability level) { durability = level; }
+    void setBlockWhenFull(uint32_t timeout_ms) { block_timeout_ms = timeout_ms; } // 0 = drop
+
+    // Stats
+    uint32_t getBytesWritten() const { return bytes_written; }
+    uint32_t getDroppedBytes() const { return dropped_bytes; }
+    uint32_t getFlushCount() const { return flush_count; }
+    bool isOpen() const { return sd != nullptr; }
+    bool isSuspended() const { return suspended; }
+
+    // Called by SDMounter around unmount/mount and card removal
+    void suspend(bool flush_first);
+    void resume();
+
+private:
+    SDMounter* sd;
+    String path;
+    File file;
+    volatile bool suspended;
+
+    uint8_t* buffers[2];
+    size_t fill[2];
+    uint8_t active;             // Buffer receiving appends
+    int8_t pending;             // Buffer waiting for the card, -1 if none
+    size_t capacity;
+    size_t threshold;
+    uint32_t interval_ms;
+    uint32_t block_timeout_ms;
+    uint32_t last_flush_ms;
+    SDLogDurability durability;
+
+    uint32_t bytes_written;
+    uint32_t dropped_bytes;
+    uint32_t flush_count;
+    uint32_t index_backlog;     // Bytes written but not yet reported to the dir index
+    volatile bool space_dirty;  // Written since the mounter's free space was last updated
+
+    SemaphoreHandle_t buffer_lock;  // Guards buffers/fill/active/pending
+    SemaphoreHandle_t io_lock;      // Guards file
+    TaskHandle_t flusher;
+    volatile bool stopping;
+
+    bool rotateLocked();
+    bool flushPending();
+    void noteMounter(bool wait);
+    void wakeFlusher();
+    static void flusherTask(void* arg);
+};
@@ -0,0 +1,145 @@
+#include "SDLz4.h"
+#include <string.h>
+
+#define LZ4_MIN_MATCH   4
+#define LZ4_MFLIMIT     12      // A match must start this far before the end
+#define LZ4_LAST_LITERALS 5     // The block always ends with this many literals
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);   // Unaligned safe; one load on Xtensa and x86
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - SD_LZ4_HASH_BITS);
+}
+
+// Length above 15 (literals) or 19 (matches) continues in 255 steps
+static inline uint8_t* writeLength(uint8_t* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+size_t sdLz4Compress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_cap, uint16_t* table) {
+    if (len > SD_LZ4_MAX_BLOCK) return 0;
+
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + dst_cap;
+    size_t anchor = 0;
+    size_t i = 0;
+
+    memset(table, 0, SD_LZ4_TABLE_BYTES);
+
+    while (i + LZ4_MFLIMIT <= len) {
+        uint32_t seq = read32(src + i);
+        uint32_t h = hash4(seq);
+        size_t ref = table[h];
+        table[h] = (uint16_t)i;
+
+        if (ref >= i || read32(src + ref) != seq) {
+            // Skip faster through data that does not compress
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+
+        size_t match_end = i + LZ4_MIN_MATCH;
+        size_t ref_end = ref + LZ4_MIN_MATCH;
+        while (match_end < len - LZ4_LAST_LITERALS && src[match_end] == src[ref_end]) {
+            match_end++;
+            ref_end++;
+        }
+
+        size_t literals = i - anchor;
+        size_t match_len = match_end - i - LZ4_MIN_MATCH;
+        size_t need = 1 + literals / 255 + 1 + literals + 2 + match_len / 255 + 1;
+        if ((size_t)(oend - op) < need) return 0;
+
+        uint8_t* token = op++;
+        *token = (uint8_t)(((literals < 15) ? literals : 15) << 4);
+        if (literals >= 15) op = writeLength(op, literals - 15);
+        memcpy(op, src + anchor, literals);
+        op += literals;
+
+        uint16_t offset = (uint16_t)(i - ref);
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+
+        *token |= (uint8_t)((match_len < 15) ? match_len : 15);
+        if (match_len >= 15) op = writeLength(op, match_len - 15);
+
+        // Remember a position near the end so back-to-back matches are found
+        if (match_end + LZ4_MFLIMIT <= len) {
+            table[hash4(read32(src + match_end - 2))] = (uint16_t)(match_end - 2);
+        }
+        anchor = i = match_end;
+    }
+
+    size_t literals = len - anchor;
+    if ((size_t)(oend - op) < 1 + literals / 255 + 1 + literals) return 0;
+    *op++ = (uint8_t)(((literals < 15) ? literals : 15) << 4);
+    if (literals >= 15) op = writeLength(op, literals - 15);
+    memcpy(op, src + anchor, literals);
+    op += literals;
+
+    return op - dst;
+}
+
+int sdLz4Decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_cap) {
+    const uint8_t* ip = src;
+    const uint8_t* const iend = src + len;
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + dst_cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip == iend) break;      // The last sequence has no match
+
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+
+        size_t match_len = token & 15;
+        if (match_len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (match_len > (size_t)(oend - op)) return -1;
+
+        const uint8_t* match = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        } else {
+            // Overlapping copy repeats the last offset bytes (runs)
+            while (match_len--) *op++ = *match++;
+        }
+    }
+
+    return (int)(op - dst);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// LZ4 block format (the raw blocks of the reference liblz4, without the
+// frame wrapper), so tools/sdpack.py and lz4.block on a PC produce and read
+// the same bytes. The compressor is the greedy single-probe variant: fast
+// enough to run on log writes, and text still shrinks 3-5x.
+//
+// Blocks are limited to 64 KB so match offsets and the hash table fit in
+// 16 bits. Both functions are plain C++ with no Arduino dependency.
+
+#define SD_LZ4_MAX_BLOCK    65536
+#define SD_LZ4_HASH_BITS    12
+#define SD_LZ4_TABLE_BYTES  ((1 << SD_LZ4_HASH_BITS) * sizeof(uint16_t))
+
+// Worst-case compressed size of len input bytes (incompressible data)
+inline size_t sdLz4Bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+// Compress src into dst. table is scratch space of SD_LZ4_TABLE_BYTES.
+// Returns the compressed size, or 0 if it does not fit in dst_cap or len
+// is above SD_LZ4_MAX_BLOCK.
+size_t sdLz4Compress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_cap, uint16_t* table);
+
+// Decompress one block. Every length and offset is checked against both
+// buffers, so a corrupt block fails instead of writing out of bounds.
+// Returns the decompressed size or -1.
+int sdLz4Decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_cap);
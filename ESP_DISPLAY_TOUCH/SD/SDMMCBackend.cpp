@@ -0,0 +1,347 @@
+#include "SDMMCBackend.h"
+#include "pin_config.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <esp_heap_caps.h>
+#include "ff.h"
+#include <driver/sdmmc_host.h>
+
+#include <diskio_sdmmc.h>
+#include <esp_vfs_fat.h>
+
+#if defined(SDMMC_D1) && defined(SDMMC_D2) && defined(SDMMC_D3)
+#define SD_BOARD_HAS_4BIT 1
+#else
+#define SD_BOARD_HAS_4BIT 0
+#endif
+
+// SD_MMC is the first FAT volume, so it is FatFs drive 0 (SD_MMC itself
+// queries "0:" for its space figures)
+#define SD_MMC_PDRV 0
+
+// ff_sdmmc_set_disk_status_check() arrived in IDF 5.1
+#define SD_HAS_STATUS_CHECK (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0))
+
+// esp_vfs_fat_create_contiguous_file() (f_expand) arrived in IDF 5.3
+#define SD_HAS_CONTIGUOUS_FILE (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0))
+
+#define SD_FORMAT_WORKBUF       (16 * 1024)  // mkfs work buffer, DMA capable
+
+SDMMCBackend::SDMMCBackend()
+    : real_freq_khz(0),
+      detached_fs(nullptr) {
+    strcpy(mount_point, "/sdcard");
+}
+
+bool SDMMCBackend::begin(const char* mp, uint8_t bus_width, int freq_khz, bool format_if_failed) {
+#if SD_BOARD_HAS_4BIT
+    if (bus_width == 4) {
+        SD_MMC.setPins(SDMMC_CLK, SDMMC_CMD, SDMMC_DATA, SDMMC_D1, SDMMC_D2, SDMMC_D3);
+    } else
+#endif
+    {
+        SD_MMC.setPins(SDMMC_CLK, SDMMC_CMD, SDMMC_DATA);  // Pins from pin_config.h
+    }
+    
+    if (!SD_MMC.begin(mp, bus_width == 1, format_if_failed, freq_khz)) {
+        return false;
+    }
+    
+    if (mp != mount_point) {
+        strlcpy(mount_point, mp, sizeof(mount_point));
+    }
+    real_freq_khz = freq_khz;
+    
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    // Cards without high-speed support stay at the default clock
+    int real_khz = 0;
+    if (sdmmc_host_get_real_freq(SDMMC_HOST_SLOT_1, &real_khz) == ESP_OK && real_khz > 0) {
+        real_freq_khz = real_khz;
+    }
+#endif
+    
+    return true;
+}
+
+void SDMMCBackend::end() {
+    if (detached_fs) {
+        // SD_MMC.end() unregisters a mounted volume
+        const char drive[] = {(char)('0' + SD_MMC_PDRV), ':', '\0'};
+        f_mount(detached_fs, drive, 0);
+        detached_fs = nullptr;
+    }
+    SD_MMC.end();
+    real_freq_khz = 0;
+}
+
+bool SDMMCBackend::isPresent() {
+    if (SD_MMC.cardType() == CARD_NONE) return false;
+    
+#if SD_HAS_STATUS_CHECK
+    // One SEND_STATUS command. Status checks are left off for normal I/O,
+    // where FatFs would otherwise issue one per file operation.
+    ff_sdmmc_set_disk_status_check(SD_MMC_PDRV, true);
+    DSTATUS status = ff_sdmmc_status(SD_MMC_PDRV);
+    ff_sdmmc_set_disk_status_check(SD_MMC_PDRV, false);
+    return !(status & STA_NOINIT);
+#else
+    // Older IDF: try to access root
+    File root = SD_MMC.open("/");
+    bool accessible = (root && root.isDirectory());
+    if (root) root.close();
+    return accessible;
+#endif
+}
+
+uint8_t SDMMCBackend::maxBusWidth() const {
+    return SD_BOARD_HAS_4BIT ? 4 : 1;
+}
+
+const char* SDMMCBackend::typeName() {
+    switch (SD_MMC.cardType()) {
+        case CARD_NONE: return "NONE";
+        case CARD_MMC: return "MMC";
+        case CARD_SD: return "SD";
+        case CARD_SDHC: return "SDHC";
+        case CARD_UNKNOWN:
+        default: return "UNKNOWN";
+    }
+}
+
+bool SDMMCBackend::getSpace(uint64_t& total, uint64_t& free, uint32_t& cluster) {
+    // Without FSINFO, the first f_getfree() walks the whole FAT. FatFs then
+    // keeps the free count current itself, so later calls return at once.
+    const char drive[] = {(char)('0' + SD_MMC_PDRV), ':', '\0'};
+    FATFS* fs = nullptr;
+    DWORD free_clusters = 0;
+    
+    if (f_getfree(drive, &free_clusters, &fs) != FR_OK || !fs) {
+        return false;
+    }
+    
+#if FF_MAX_SS != FF_MIN_SS
+    uint32_t sector_bytes = fs->ssize;
+#else
+    uint32_t sector_bytes = FF_MAX_SS;
+#endif
+    cluster = fs->csize * sector_bytes;
+    total = (uint64_t)(fs->n_fatent - 2) * cluster;
+    free = (uint64_t)free_clusters * cluster;
+    return true;
+}
+
+SDFormatResult SDMMCBackend::format(uint32_t cluster_size, int* fs_error) {
+    const char drive[] = {(char)('0' + SD_MMC_PDRV), ':', '\0'};
+    FATFS* fs = nullptr;
+    DWORD free_clusters = 0;
+    if (f_getfree(drive, &free_clusters, &fs) != FR_OK || !fs) {
+        return SD_FORMAT_NO_VOLUME;
+    }
+    
+    // A real mkfs writes fresh FATs and an empty root instead of deleting
+    // files one by one. The work buffer sets how much FAT goes out per write.
+    size_t work_size = SD_FORMAT_WORKBUF;
+    void* work = heap_caps_malloc(work_size, MALLOC_CAP_DMA);
+    if (!work) {
+        work_size = FF_MAX_SS;
+        work = heap_caps_malloc(work_size, MALLOC_CAP_DMA);
+    }
+    if (!work) {
+        return SD_FORMAT_NO_MEMORY;
+    }
+    
+    f_mount(nullptr, drive, 0);
+    
+    const MKFS_PARM opt = {(BYTE)FM_ANY, 0, 0, 0, cluster_size};
+    FRESULT res = f_mkfs(drive, &opt, work, work_size);
+    free(work);
+    
+    // Re-attach the same FATFS object the VFS registered at mount
+    FRESULT mount_res = f_mount(fs, drive, 1);
+    
+    if (mount_res != FR_OK) {
+        if (fs_error) *fs_error = mount_res;
+        return SD_FORMAT_LOST_VOLUME;
+    }
+    if (res != FR_OK) {
+        if (fs_error) *fs_error = res;
+        return SD_FORMAT_FAILED;
+    }
+    return SD_FORMAT_OK;
+}
+
+int SDMMCBackend::open(const char* path, SDOpenMode mode) {
+    char vfs_path[SD_MMC_VFS_PATH_MAX];
+    int flags = O_RDONLY;
+    if (mode == SD_OPEN_WRITE) flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (mode == SD_OPEN_APPEND) flags = O_WRONLY | O_CREAT | O_APPEND;
+    if (mode == SD_OPEN_UPDATE) flags = O_WRONLY;
+    return ::open(vfsPath(path, vfs_path, sizeof(vfs_path)), flags, 0666);
+}
+
+int SDMMCBackend::read(int fd, void* buffer, size_t len) {
+    return ::read(fd, buffer, len);
+}
+
+int SDMMCBackend::write(int fd, const void* buffer, size_t len) {
+    return ::write(fd, buffer, len);
+}
+
+bool SDMMCBackend::sync(int fd) {
+    return ::fsync(fd) == 0;
+}
+
+int64_t SDMMCBackend::size(int fd) {
+    struct stat st;
+    return (::fstat(fd, &st) == 0) ? st.st_size : -1;
+}
+
+void SDMMCBackend::close(int fd) {
+    ::close(fd);
+}
+
+bool SDMMCBackend::stat(const char* path, bool* is_dir, size_t* size) {
+    char vfs_path[SD_MMC_VFS_PATH_MAX];
+    struct stat st;
+    if (::stat(vfsPath(path, vfs_path, sizeof(vfs_path)), &st) != 0) return false;
+    
+    if (is_dir) *is_dir = S_ISDIR(st.st_mode);
+    if (size) *size = S_ISDIR(st.st_mode) ? 0 : st.st_size;
+    return true;
+}
+
+bool SDMMCBackend::unlink(const char* path) {
+    char vfs_path[SD_MMC_VFS_PATH_MAX];
+    return ::unlink(vfsPath(path, vfs_path, sizeof(vfs_path))) == 0;
+}
+
+bool SDMMCBackend::rename(const char* from, const char* to) {
+    char vfs_from[SD_MMC_VFS_PATH_MAX];
+    char vfs_to[SD_MMC_VFS_PATH_MAX];
+    return ::rename(vfsPath(from, vfs_from, sizeof(vfs_from)), vfsPath(to, vfs_to, sizeof(vfs_to))) == 0;
+}
+
+bool SDMMCBackend::mkdir(const char* path) {
+    char vfs_path[SD_MMC_VFS_PATH_MAX];
+    return ::mkdir(vfsPath(path, vfs_path, sizeof(vfs_path)), 0775) == 0;
+}
+
+bool SDMMCBackend::rmdir(const char* path) {
+    char vfs_path[SD_MMC_VFS_PATH_MAX];
+    return ::rmdir(vfsPath(path, vfs_path, sizeof(vfs_path))) == 0;
+}
+
+bool SDMMCBackend::truncate(const char* path, size_t size) {
+    // The FAT VFS maps truncate() to f_truncate, which only cuts the
+    // cluster chain - no file data is read or written
+    char vfs_path[SD_MMC_VFS_PATH_MAX];
+    return ::truncate(vfsPath(path, vfs_path, sizeof(vfs_path)), size) == 0;
+}
+
+bool SDMMCBackend::preallocate(const char* path, uint64_t size, bool* contiguous) {
+    char vfs_path[SD_MMC_VFS_PATH_MAX];
+    vfsPath(path, vfs_path, sizeof(vfs_path));
+    if (contiguous) *contiguous = false;
+    
+#if SD_HAS_CONTIGUOUS_FILE
+    // f_expand finds one run of free clusters and links it in a single FAT
+    // update; nothing is written to the data area
+    if (size > 0 && esp_vfs_fat_create_contiguous_file(mount_point, vfs_path, size, true) == ESP_OK) {
+        bool is_contiguous = false;
+        if (esp_vfs_fat_test_contiguous_file(mount_point, vfs_path, &is_contiguous) == ESP_OK && contiguous) {
+            *contiguous = is_contiguous;
+        }
+        return true;
+    }
+    // No free run that long: let FatFs chain whatever clusters are free
+#endif
+    
+    int fd = ::open(vfs_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return false;
+    
+    // Seeking past the end makes FatFs allocate the chain up to there
+    // without writing the clusters; the last byte fixes the size
+    bool ok = (size == 0) ||
+              (::lseek(fd, size - 1, SEEK_SET) == (off_t)(size - 1) && ::write(fd, "", 1) == 1);
+    ok = (::fsync(fd) == 0) && ok;
+    ::close(fd);
+    return ok;
+}
+
+bool SDMMCBackend::detachVolume() {
+    // f_getfree() is how the registered FATFS object is found (format does
+    // the same); the free count is cached by now, so it does not scan
+    const char drive[] = {(char)('0' + SD_MMC_PDRV), ':', '\0'};
+    FATFS* fs = nullptr;
+    DWORD free_clusters = 0;
+    if (f_getfree(drive, &free_clusters, &fs) != FR_OK || !fs) {
+        return false;
+    }
+    
+    // Every VFS call now fails with FR_NOT_ENABLED instead of using a stale FAT
+    if (f_mount(nullptr, drive, 0) != FR_OK) return false;
+    detached_fs = fs;
+    return true;
+}
+
+bool SDMMCBackend::attachVolume() {
+    if (!detached_fs) return false;
+    
+    const char drive[] = {(char)('0' + SD_MMC_PDRV), ':', '\0'};
+    FATFS* fs = detached_fs;
+    detached_fs = nullptr;
+    if (f_mount(fs, drive, 1) == FR_OK) return true;
+    
+    f_mount(fs, drive, 0);  // Registered again, mounted lazily
+    return false;
+}
+
+bool SDMMCBackend::sectorInfo(uint32_t& count, uint16_t& size) {
+    LBA_t sectors = 0;
+    WORD sector_size = 0;
+    if (ff_sdmmc_ioctl(SD_MMC_PDRV, GET_SECTOR_COUNT, &sectors) != RES_OK ||
+        ff_sdmmc_ioctl(SD_MMC_PDRV, GET_SECTOR_SIZE, &sector_size) != RES_OK) {
+        return false;
+    }
+    count = (uint32_t)sectors;
+    size = sector_size;
+    return true;
+}
+
+bool SDMMCBackend::readSectors(uint32_t lba, void* buffer, uint32_t count) {
+    // One multi-block command when buffer is DMA capable and word aligned;
+    // otherwise the driver copies through a bounce buffer sector by sector
+    return ff_sdmmc_read(SD_MMC_PDRV, (BYTE*)buffer, lba, count) == RES_OK;
+}
+
+bool SDMMCBackend::writeSectors(uint32_t lba, const void* buffer, uint32_t count) {
+    return ff_sdmmc_write(SD_MMC_PDRV, (const BYTE*)buffer, lba, count) == RES_OK;
+}
+
+void* SDMMCBackend::openDir(const char* path) {
+    char vfs_path[SD_MMC_VFS_PATH_MAX];
+    return opendir(vfsPath(path, vfs_path, sizeof(vfs_path)));
+}
+
+int SDMMCBackend::readDir(void* dir, char* name, size_t name_size, bool* is_dir) {
+    // d_type says file or directory, so no entry has to be opened
+    struct dirent* entry = readdir((DIR*)dir);
+    if (!entry) return 0;
+    
+    if (strlcpy(name, entry->d_name, name_size) >= name_size) return -1;
+    if (is_dir) *is_dir = (entry->d_type == DT_DIR);
+    return 1;
+}
+
+void SDMMCBackend::closeDir(void* dir) {
+    closedir((DIR*)dir);
+}
+
+// Private helper methods
+const char* SDMMCBackend::vfsPath(const char* path, char* out, size_t out_size) {
+    // The root is the mount point itself
+    snprintf(out, out_size, "%s%s", mount_point, strcmp(path, "/") == 0 ? "" : path);
+    return out;
+}
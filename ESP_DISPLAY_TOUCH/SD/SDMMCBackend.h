@@ -0,0 +1,62 @@
+#pragma once
+#include <Arduino.h>
+#include <SD_MMC.h>
+#include "ff.h"
+#include "SDStorageBackend.h"
+
+// The SD card on the SDMMC peripheral, through SD_MMC and the FAT VFS.
+// Pins come from pin_config.h (see SDMounter.h). Path operations go to the
+// VFS directly, without Arduino File objects.
+
+#define SD_MMC_MOUNT_POINT_MAX 32
+#define SD_MMC_VFS_PATH_MAX    (SD_MMC_MOUNT_POINT_MAX + 264)  // Mount point + path + suffix
+
+class SDMMCBackend : public SDStorageBackend {
+public:
+    SDMMCBackend();
+
+    const char* name() const { return "SDMMC"; }
+
+    bool begin(const char* mount_point, uint8_t bus_width, int freq_khz, bool format_if_failed);
+    void end();
+    bool isPresent();
+    fs::FS& fs() { return SD_MMC; }
+    uint8_t maxBusWidth() const;
+    int busFrequency() const { return real_freq_khz; }
+    const char* typeName();
+    uint64_t cardSize() { return SD_MMC.cardSize(); }
+    bool getSpace(uint64_t& total, uint64_t& free, uint32_t& cluster);
+    SDFormatResult format(uint32_t cluster_size, int* fs_error = nullptr);
+
+    int open(const char* path, SDOpenMode mode);
+    int read(int fd, void* buffer, size_t len);
+    int write(int fd, const void* buffer, size_t len);
+    bool sync(int fd);
+    int64_t size(int fd);
+    void close(int fd);
+
+    bool stat(const char* path, bool* is_dir = nullptr, size_t* size = nullptr);
+    bool unlink(const char* path);
+    bool rename(const char* from, const char* to);
+    bool mkdir(const char* path);
+    bool rmdir(const char* path);
+    bool truncate(const char* path, size_t size);
+    bool preallocate(const char* path, uint64_t size, bool* contiguous = nullptr);
+    
+    bool detachVolume();
+    bool attachVolume();
+    bool sectorInfo(uint32_t& count, uint16_t& size);
+    bool readSectors(uint32_t lba, void* buffer, uint32_t count);
+    bool writeSectors(uint32_t lba, const void* buffer, uint32_t count);
+
+    void* openDir(const char* path);
+    int readDir(void* dir, char* name, size_t name_size, bool* is_dir);
+    void closeDir(void* dir);
+
+private:
+    char mount_point[SD_MMC_MOUNT_POINT_MAX];
+    int real_freq_khz;
+    FATFS* detached_fs;     // Registered by the VFS, kept while a host owns the card
+
+    const char* vfsPath(const char* path, char* out, size_t out_size);
+};
@@ -1,9 +1,150 @@
 #include "SDMounter.h"
+#include "SDLogStream.h"
+#include "SDTransaction.h"
 #include "pin_config.h"
+#include <FSImpl.h>
+#include <algorithm>
+
+// Optional card-detect switch: define SDMMC_CD (and SDMMC_CD_ACTIVE, default
+// LOW) in pin_config.h to get interrupt-driven hot-swap detection
+#if defined(SDMMC_CD)
+#define SD_BOARD_HAS_CD 1
+#ifndef SDMMC_CD_ACTIVE
+#define SDMMC_CD_ACTIVE LOW
+#endif
+#else
+#define SD_BOARD_HAS_CD 0
+#endif
+
+#define SD_HOTSWAP_POLL_MS      200   // Poll interval while a card is present
+#define SD_HOTSWAP_BACKOFF_MS   5000  // Slowest probe interval for an empty slot
+#define SD_HOTSWAP_STABLE_PROBES 3    // Probes in a row a new card must answer
+#define SD_CD_DEBOUNCE_MS       250   // CD line must be stable this long
+
+// The card on the SDMMC peripheral, used until setBackend() picks another.
+// A host build has no card and starts on an empty RAM disk instead.
+#if defined(ESP_PLATFORM)
+static SDMMCBackend default_backend;
+#else
+#include "SDRamDiskBackend.h"
+static SDRamDiskBackend default_backend(4 * 1024 * 1024);
+#endif
 
 // Global instance definition
 SDMounter SDCard;
 
+// The last error of a task lives in its thread-local storage: allocated on
+// its first error, freed when the task is deleted, and never shared, so one
+// task's errors cannot overwrite or evict another's. ESP-IDF reserves TLS
+// index 0 for pthreads; with only that one (the Arduino default) the state
+// hangs off a pthread key, which is stored in that index.
+struct TaskError {
+    const SDMounter* owner;     // Mounter that set it; others read SD_OK
+    SDError code;
+    char detail[SD_PATH_MAX];
+};
+
+#if configNUM_THREAD_LOCAL_STORAGE_POINTERS > 1
+#define SD_ERROR_TLS_INDEX (configNUM_THREAD_LOCAL_STORAGE_POINTERS - 1)
+
+static void freeTaskError(int index, void* error) {
+    free(error);
+}
+
+static TaskError* taskError(bool create) {
+    TaskError* error = (TaskError*)pvTaskGetThreadLocalStoragePointer(nullptr, SD_ERROR_TLS_INDEX);
+    if (!error && create) {
+        error = (TaskError*)calloc(1, sizeof(TaskError));
+        if (error) vTaskSetThreadLocalStoragePointerAndDelCallback(nullptr, SD_ERROR_TLS_INDEX, error, freeTaskError);
+    }
+    return error;
+}
+#else
+#include <pthread.h>
+
+static pthread_key_t error_key;
+static pthread_once_t error_key_once = PTHREAD_ONCE_INIT;
+
+static void createErrorKey() {
+    pthread_key_create(&error_key, free);
+}
+
+static TaskError* taskError(bool create) {
+    pthread_once(&error_key_once, createErrorKey);
+    TaskError* error = (TaskError*)pthread_getspecific(error_key);
+    if (!error && create) {
+        error = (TaskError*)calloc(1, sizeof(TaskError));
+        if (error) pthread_setspecific(error_key, error);
+    }
+    return error;
+}
+#endif
+
+// What openFile() and openDir() return: the backend's File, holding one of
+// the mounter's handles from open until close() or the last copy going
+// away, so unmount() and a card pull defer ending the card until then.
+class SDHandleFileImpl : public fs::FileImpl {
+public:
+    SDHandleFileImpl(SDMounter* sd, const File& file) : sd(sd), file(file), held(true), written(false) {
+        sd->acquireHandle();
+    }
+
+    ~SDHandleFileImpl() { close(); }
+
+    static File wrap(SDMounter* sd, const File& file) {
+        return file ? File(fs::FileImplPtr(new SDHandleFileImpl(sd, file))) : File();
+    }
+
+    size_t write(const uint8_t* buf, size_t size) {
+        written = true;
+        return file.write(buf, size);
+    }
+    size_t read(uint8_t* buf, size_t size) { return file.read(buf, size); }
+    void flush() { file.flush(); }
+    bool seek(uint32_t pos, fs::SeekMode mode) { return file.seek(pos, mode); }
+    size_t position() const { return file.position(); }
+    size_t size() const { return file.size(); }
+    bool setBufferSize(size_t size) { return file.setBufferSize(size); }
+
+    void close() {
+        if (written && file) {
+            // The index may have re-read the entry while this was still open,
+            // and the clusters it took are only known to FatFs
+            SDLock guard(*sd);
+            if (sd->isDirIndexEnabled()) sd->getDirIndex().noteStale(file.path());
+            sd->noteSpace(-1, file.size());
+            written = false;
+        }
+        file.close();
+        if (held) {
+            held = false;
+            sd->releaseHandle();
+        }
+    }
+
+    time_t getLastWrite() { return file.getLastWrite(); }
+    const char* path() const { return file.path(); }
+    const char* name() const { return file.name(); }
+    boolean isDirectory() { return file.isDirectory(); }
+
+    fs::FileImplPtr openNextFile(const char* mode) {
+        File child = file.openNextFile(mode);
+        return child ? fs::FileImplPtr(new SDHandleFileImpl(sd, child)) : fs::FileImplPtr();
+    }
+
+    boolean seekDir(long position) { return file.seekDir(position); }
+    String getNextFileName() { return file.getNextFileName(); }
+    String getNextFileName(bool* is_dir) { return file.getNextFileName(is_dir); }
+    void rewindDirectory() { file.rewindDirectory(); }
+    operator bool() { return held && file; }
+
+private:
+    SDMounter* sd;
+    File file;
+    bool held;
+    bool written;
+};
+
 SDMounter::SDMounter() 
     : mounted(false), 
       auto_mount_enabled(false),
@@ -11,62 +152,113 @@ SDMounter::SDMounter()
       debug_mode(false),
       last_card_state(false),
       last_hotswap_check(0),
+      hotswap_interval_ms(SD_HOTSWAP_POLL_MS),
+      stable_probes(0),
+      cd_event(false),
+      cd_change_ms(0),
       mount_point("/sdcard"),
       current_dir("/"),
-      last_error_code(0),
-      mode_1bit(true),
+      error_logging(false),
+      api_lock(nullptr),
+      backend(&default_backend),
+      open_handles(0),
+      end_pending(false),
+      exported(false),
+      mode_1bit(false),
+      bus_width(1),
+      bus_freq_khz(SDMMC_FREQ_HIGHSPEED),
+      bus_real_freq_khz(0),
+      max_bus_freq_khz(SDMMC_FREQ_HIGHSPEED),
+      space_ready(false),
+      space_task(nullptr),
+      space_scan_gen(0),
+      space_total(0),
+      space_free(0),
+      cluster_bytes(0),
+      last_delete_items(0),
+      last_delete_ms(0),
+      last_move_method(MOVE_NONE),
+      dir_index_enabled(false),
+      atomic_writes(true),
       on_mount_callback(nullptr),
       on_unmount_callback(nullptr),
       on_card_inserted_callback(nullptr),
       on_card_removed_callback(nullptr) {
+    dir_index.setFS(&backend->fs());
+    
+    // Static storage, so this is safe while global constructors run
+    api_lock = xSemaphoreCreateRecursiveMutexStatic(&api_lock_buffer);
 }
 
 bool SDMounter::mount(bool format_if_failed, const char* mp, bool mode1bit) {
+    SDLock guard(*this);
     if (mounted) {
-        setError(1, "SD card already mounted");
+        setError(SD_ERR_ALREADY_MOUNTED);
         return true; // Already mounted is not an error
     }
     
+    if (end_pending) {
+        // The old card is still held by open handles
+        setError(SD_ERR_BUSY);
+        return false;
+    }
+    
+    if (exported) {
+        setError(SD_ERR_EXPORTED);
+        return false;
+    }
+    
     clearError();
-    mount_point = String(mp);
+    if (mp != mount_point) {
+        strlcpy(mount_point, mp, sizeof(mount_point)); // Remounts pass mount_point itself
+    }
     mode_1bit = mode1bit;
     
     Serial.println("[SDMounter] Initializing SD card...");
-    SD_MMC.setPins(SDMMC_CLK, SDMMC_CMD, SDMMC_DATA);  // Pins from pin_config.h
     
-    if (!SD_MMC.begin(mp, mode1bit)) {
+    if (!negotiateBus(mp)) {
         if (format_if_failed) {
-            Serial.println("[SDMounter] Mount failed, trying to mount then format...");
-            // Try mounting in a more permissive way, then format
-            setError(4, "SD card mount failed, format not attempted (card may be unformatted)");
-            return false;
+            // Card answers but holds no usable filesystem: let the VFS mkfs it
+            Serial.println("[SDMounter] Mount failed, formatting card...");
+            if (!beginBus(mp, 1, SDMMC_FREQ_DEFAULT, true)) {
+                setError(SD_ERR_MOUNT_FAILED, "format failed too");
+                return false;
+            }
         } else {
-            setError(4, "SD card mount failed");
+            setError(SD_ERR_MOUNT_FAILED);
             return false;
         }
     }
     
     mounted = true;
-    current_dir = "/";
+    strcpy(current_dir, "/");
+    dir_index.clear();
     last_card_state = true; // Card is present after successful mount
-    Serial.println("[SDMounter] SD card mounted successfully");
-    Serial.printf("[SDMounter] Total: %.2f MB, Used: %.2f MB\n", 
-                  getTotalBytes() / 1048576.0, getUsedBytes() / 1048576.0);
     
+    recoverVolume();
+    Serial.printf("[SDMounter] SD card mounted successfully (%u-bit, %d kHz)\n",
+                  bus_width, bus_real_freq_khz);
+    Serial.printf("[SDMounter] Card: %.2f MB (%s)\n", backend->cardSize() / 1048576.0, backend->name());
+    
+    // Free space needs a FAT scan on large cards, keep it off the mount path
+    startSpaceScan();
+    
+    resumeLogStreams();
     triggerMountCallback();
     return true;
 }
 
 bool SDMounter::unmount() {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(5, "SD card not mounted");
+        setError(SD_ERR_NOT_MOUNTED);
         return false;
     }
     
     clearError();
-    SD_MMC.end();
-    mounted = false;
-    current_dir = "/";
+    suspendLogStreams(true); // Buffered log data reaches the card first
+    endCard();
+    strcpy(current_dir, "/");
     Serial.println("[SDMounter] SD card unmounted");
     
     triggerUnmountCallback();
@@ -74,77 +266,158 @@ bool SDMounter::unmount() {
 }
 
 bool SDMounter::remount() {
+    SDLock guard(*this);
     Serial.println("[SDMounter] Remounting SD card...");
     if (mounted) {
         unmount();
         delay(100);
     }
-    return mount(false, mount_point.c_str(), mode_1bit);
+    return mount(false, mount_point, mode_1bit);
 }
 
-bool SDMounter::format() {
-    Serial.println("[SDMounter] Formatting SD card (deleting all files)...");
-    
+bool SDMounter::format(uint32_t cluster_size) {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(6, "SD card must be mounted to format");
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    // mkfs invalidates every open file on the volume. Log streams let go
+    // of theirs first; anything else still open makes it busy.
+    suspendLogStreams(true);
+    if (open_handles > 0) {
+        setError(SD_ERR_BUSY);
+        resumeLogStreams();
         return false;
     }
     
-    // SD_MMC doesn't have a format() method, so we delete everything
-    Serial.println("[SDMounter] Deleting all files and directories...");
+    Serial.printf("[SDMounter] Formatting SD card (cluster size: %s)...\n",
+                  cluster_size ? String(cluster_size).c_str() : "auto");
+    unsigned long start = millis();
+    
+    // Nothing may hold the volume while FatFs rebuilds it
+    waitSpaceScan();
+    
+    // A real mkfs on the card: fresh FATs and an empty root instead of
+    // deleting files one by one
+    int fs_error = 0;
+    SDFormatResult res = backend->format(cluster_size, &fs_error);
     
-    File root = SD_MMC.open("/");
-    if (!root || !root.isDirectory()) {
-        setError(7, "Failed to open root directory");
+    if (res == SD_FORMAT_NO_VOLUME || res == SD_FORMAT_NO_MEMORY) {
+        if (res == SD_FORMAT_NO_MEMORY) {
+            setError(SD_ERR_NO_MEMORY, "format work buffer");
+        } else {
+            setError(SD_ERR_FS_ACCESS);
+        }
+        resumeLogStreams();
         return false;
     }
     
-    // Delete all files and directories in root
-    File file = root.openNextFile();
-    while (file) {
-        String name = String(file.name());
-        String path = "/" + name;
-        
-        if (file.isDirectory()) {
-            file.close();
-            if (!deleteDirectoryRecursive(path.c_str())) {
-                Serial.printf("[SDMounter] Failed to delete directory: %s\n", path.c_str());
-            }
+    strcpy(current_dir, "/");
+    dir_index.clear();
+    
+    if (res != SD_FORMAT_OK) {
+        char detail[24];
+        snprintf(detail, sizeof(detail), "FatFs error %d", fs_error);
+        if (res == SD_FORMAT_LOST_VOLUME) {
+            setError(SD_ERR_REMOUNT_FAILED, detail);
         } else {
-            file.close();
-            if (!SD_MMC.remove(path.c_str())) {
-                Serial.printf("[SDMounter] Failed to delete file: %s\n", path.c_str());
-            }
+            // Volume still mounted with its old contents
+            setError(SD_ERR_FORMAT_FAILED, detail);
+            startSpaceScan();
+            resumeLogStreams();
         }
-        
-        file = root.openNextFile();
+        return false;
     }
-    root.close();
     
-    Serial.println("[SDMounter] Format complete (all files deleted)");
-    current_dir = "/";
+    Serial.printf("[SDMounter] Format complete in %lu ms\n", millis() - start);
+    startSpaceScan();
+    resumeLogStreams();
+    clearError();
+    return true;
+}
+
+bool SDMounter::beginExport() {
+    SDLock guard(*this);
+    if (exported) return true;
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    // The host writes the FAT behind FatFs's back, so nothing may be open.
+    // Buffered log data reaches the card first and the logs close.
+    suspendLogStreams(true);
+    if (open_handles > 0) {
+        setError(SD_ERR_BUSY);
+        resumeLogStreams();
+        return false;
+    }
+    waitSpaceScan();
+    
+    if (!backend->detachVolume()) {
+        setError(SD_ERR_EXPORT_FAILED);
+        resumeLogStreams();
+        startSpaceScan();
+        return false;
+    }
+    
+    mounted = false;
+    space_ready = false;
+    exported = true;
+    strcpy(current_dir, "/");
+    dir_index.clear();
+    Serial.println("[SDMounter] Volume handed to USB host");
+    
+    triggerUnmountCallback();
+    clearError();
+    return true;
+}
+
+bool SDMounter::endExport() {
+    SDLock guard(*this);
+    if (!exported) return mounted;
+    exported = false;
+    
+    // Re-reads the boot sector and FAT, so whatever the host did is picked up
+    if (!backend->attachVolume()) {
+        Serial.println("[SDMounter] Volume unreadable after USB, remounting card...");
+        backend->end();
+        return mount(false, mount_point, mode_1bit);
+    }
+    
+    mounted = true;
+    last_card_state = true;
+    dir_index.clear();
+    recoverVolume();
+    Serial.println("[SDMounter] Volume back from USB host");
+    
+    startSpaceScan();
+    resumeLogStreams();
+    triggerMountCallback();
     clearError();
     return true;
 }
 
 bool SDMounter::check() {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(8, "SD card not mounted");
+        setError(SD_ERR_NOT_MOUNTED);
         return false;
     }
     
     clearError();
     
     // Basic integrity check - try to read root directory
-    File root = SD_MMC.open("/");
+    File root = backend->fs().open("/");
     if (!root) {
-        setError(9, "Failed to open root directory");
+        setError(SD_ERR_ROOT_OPEN);
         return false;
     }
     
     if (!root.isDirectory()) {
         root.close();
-        setError(10, "Root is not a directory");
+        setError(SD_ERR_ROOT_NOT_DIR);
         return false;
     }
     
@@ -163,31 +436,41 @@ bool SDMounter::check() {
     return true;
 }
 
+bool SDMounter::setBackend(SDStorageBackend& storage) {
+    SDLock guard(*this);
+    // Never swap the volume under a mounted card or files still open on it
+    if (mounted || end_pending || exported) {
+        setError(mounted ? SD_ERR_ALREADY_MOUNTED : SD_ERR_BUSY);
+        return false;
+    }
+    
+    backend = &storage;
+    dir_index.setFS(&backend->fs());
+    
+    if (debug_mode) {
+        Serial.printf("[DEBUG] setBackend: %s\n", backend->name());
+    }
+    clearError();
+    return true;
+}
+
 void SDMounter::autoMount() {
-    if (auto_mount_enabled && !mounted) {
+    if (auto_mount_enabled && !mounted && !exported) {
         Serial.println("[SDMounter] Auto-mounting SD card...");
-        mount(false, "/sdcard", true);
+        mount(false, mount_point, mode_1bit);
     }
 }
 
 String SDMounter::getFsType() {
+    SDLock guard(*this);
     if (!mounted) return "NONE";
-    
-    uint8_t cardType = SD_MMC.cardType();
-    switch (cardType) {
-        case CARD_NONE: return "NONE";
-        case CARD_MMC: return "MMC";
-        case CARD_SD: return "SD";
-        case CARD_SDHC: return "SDHC";
-        case CARD_UNKNOWN:
-        default: return "UNKNOWN";
-    }
+    return backend->typeName();
 }
 
 String SDMounter::getFsLabel() {
     if (!mounted) return "";
-    // SD_MMC doesn't directly provide label, return mount point
-    return mount_point;
+    // No backend exposes a volume label, return mount point
+    return String(mount_point);
 }
 
 uint32_t SDMounter::getBlockSize() {
@@ -197,47 +480,154 @@ uint32_t SDMounter::getBlockSize() {
 
 uint64_t SDMounter::getSectorCount() {
     if (!mounted) return 0;
-    return SD_MMC.totalBytes() / 512;
+    return getTotalBytes() / 512;
 }
 
 uint64_t SDMounter::getTotalBytes() {
+    SDLock guard(*this);
     if (!mounted) return 0;
-    return SD_MMC.totalBytes();
+    if (!space_ready) refreshSpaceInfo();
+    return space_ready ? space_total : 0;
 }
 
 uint64_t SDMounter::getUsedBytes() {
+    SDLock guard(*this);
     if (!mounted) return 0;
-    return SD_MMC.usedBytes();
+    if (!space_ready) refreshSpaceInfo();
+    if (!space_ready) return 0;
+    return (space_total > (uint64_t)space_free) ? (space_total - space_free) : 0;
 }
 
 uint64_t SDMounter::getFreeBytes() {
+    SDLock guard(*this);
     if (!mounted) return 0;
-    uint64_t total = getTotalBytes();
-    uint64_t used = getUsedBytes();
-    return (total > used) ? (total - used) : 0;
+    if (!space_ready) refreshSpaceInfo();
+    if (!space_ready || space_free < 0) return 0;
+    return (uint64_t)space_free;
+}
+
+bool SDMounter::refreshSpaceInfo() {
+    SDLock guard(*this);
+    if (!mounted) return false;
+    
+    // A background scan still walking the FAT: after it, reading the count is
+    // quick, and it cannot install its own result while we hold the lock
+    waitSpaceScan();
+    return space_ready || scanSpace();
 }
 
 File SDMounter::openFile(const char* path, const char* mode) {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(11, "SD card not mounted");
+        setError(SD_ERR_NOT_MOUNTED);
         return File();
     }
     
-    String full_path = getFullPath(path);
-    File file = SD_MMC.open(full_path.c_str(), mode);
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return File();
+    
+    File file = backend->fs().open(full_path, mode);
     
     if (!file) {
-        setError(12, String("Failed to open file: ") + full_path);
+        setError(SD_ERR_OPEN_FAILED, full_path);
     } else {
+        if (dir_index_enabled && strcmp(mode, FILE_READ) != 0) {
+            dir_index.noteStale(full_path); // Final size unknown until re-read
+        }
         clearError();
     }
     
-    return file;
+    return SDHandleFileImpl::wrap(this, file);
+}
+
+bool SDMounter::openCachedFile(const char* path, SDCachedFile& file) {
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    if (!block_cache.isRunning() && !block_cache.begin()) {
+        setError(SD_ERR_CACHE_START);
+        return false;
+    }
+    
+    return file.open(block_cache, *this, path); // openFile() sets the error
+}
+
+bool SDMounter::openCompressed(const char* path, SDCompressedFile& file) {
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    return file.open(*this, path); // openFile() sets the error
+}
+
+bool SDMounter::preallocateFile(const char* path, uint64_t size, bool* contiguous) {
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
+    
+    bool is_dir = false;
+    size_t old_size = 0;
+    bool exists = backend->stat(full_path, &is_dir, &old_size);
+    if (exists && is_dir) {
+        setError(SD_ERR_OPEN_FAILED, full_path);
+        return false;
+    }
+    
+    if (space_ready && (int64_t)size > space_free + (int64_t)old_size) {
+        setError(SD_ERR_NO_SPACE, full_path);
+        return false;
+    }
+    
+    // The new extent replaces the file; its old clusters would only be in the way
+    if (exists && !backend->unlink(full_path)) {
+        setError(SD_ERR_DELETE_FAILED, full_path);
+        return false;
+    }
+    
+    bool is_contiguous = false;
+    if (!backend->preallocate(full_path, size, &is_contiguous)) {
+        backend->unlink(full_path);
+        if (dir_index_enabled) {
+            dir_index.noteRemoved(full_path);
+        }
+        noteSpace(old_size, 0);
+        setError(SD_ERR_PREALLOC_FAILED, full_path);
+        return false;
+    }
+    if (contiguous) *contiguous = is_contiguous;
+    
+    if (dir_index_enabled) {
+        dir_index.noteFile(full_path, size);
+    }
+    noteSpace(old_size, size);
+    
+    clearError();
+    return true;
+}
+
+bool SDMounter::createCompressed(const char* path, SDCompressedWriter& writer, size_t block_size) {
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    return writer.open(*this, path, block_size);
 }
 
 bool SDMounter::closeFile(File& file) {
     if (!file) {
-        setError(13, "Invalid file handle");
+        setError(SD_ERR_INVALID_HANDLE);
         return false;
     }
     file.close();
@@ -246,6 +636,7 @@ bool SDMounter::closeFile(File& file) {
 }
 
 String SDMounter::readFile(const char* path) {
+    SDLock guard(*this);
     File file = openFile(path, FILE_READ);
     if (!file) return "";
     
@@ -260,11 +651,29 @@ String SDMounter::readFile(const char* path) {
 }
 
 size_t SDMounter::readFile(const char* path, uint8_t* buffer, size_t max_len) {
-    File file = openFile(path, FILE_READ);
-    if (!file) return 0;
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return 0;
+    }
     
-    size_t bytes_read = file.read(buffer, max_len);
-    file.close();
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return 0;
+    
+    // Straight to the backend: a File object costs a heap allocation per open
+    int fd = backend->open(full_path, SD_OPEN_READ);
+    if (fd < 0) {
+        setError(SD_ERR_OPEN_FAILED, full_path);
+        return 0;
+    }
+    
+    size_t bytes_read = 0;
+    while (bytes_read < max_len) {
+        int n = backend->read(fd, buffer + bytes_read, max_len - bytes_read);
+        if (n <= 0) break;
+        bytes_read += n;
+    }
+    backend->close(fd);
     
     clearError();
     return bytes_read;
@@ -275,17 +684,84 @@ bool SDMounter::writeFile(const char* path, const char* content) {
 }
 
 bool SDMounter::writeFile(const char* path, const uint8_t* data, size_t len) {
-    File file = openFile(path, FILE_WRITE);
-    if (!file) return false;
+    SDLock guard(*this);
+    if (atomic_writes) {
+        return writeFileAtomic(path, data, len);
+    }
     
-    size_t written = file.write(data, len);
-    file.close();
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
+    
+    int64_t old_size = space_ready ? indexedSizeOf(full_path) : -1;
+    
+    int fd = backend->open(full_path, SD_OPEN_WRITE);
+    if (fd < 0) {
+        setError(SD_ERR_OPEN_FAILED, full_path);
+        return false;
+    }
+    
+    int written = backend->write(fd, data, len);
+    backend->close(fd);
+    
+    if (written != (int)len) {
+        setError(SD_ERR_WRITE_FAILED, full_path);
+        return false;
+    }
+    
+    if (dir_index_enabled) {
+        dir_index.noteFile(full_path, len);
+    }
+    noteSpace(old_size, len);
+    
+    clearError();
+    return true;
+}
+
+bool SDMounter::writeFileAtomic(const char* path, const uint8_t* data, size_t len) {
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    char full_path[SD_PATH_MAX];
+    char temp_path[SD_PATH_MAX + sizeof(SD_REPLACE_TEMP)];
+    if (!resolvePath(path, full_path)) return false;
+    
+    // Same replace protocol as truncateByCopy: the new content is complete
+    // and fsynced before the old file is touched
+    snprintf(temp_path, sizeof(temp_path), "%s" SD_REPLACE_TEMP, full_path);
+    int fd = backend->open(temp_path, SD_OPEN_WRITE);
+    if (fd < 0) {
+        setError(SD_ERR_TEMP_CREATE, full_path);
+        return false;
+    }
     
-    if (written != len) {
-        setError(14, "Write size mismatch");
+    int written = backend->write(fd, data, len);
+    bool synced = backend->sync(fd);
+    backend->close(fd);
+    
+    if (written != (int)len || !synced) {
+        backend->unlink(temp_path);
+        setError(SD_ERR_WRITE_FAILED, full_path);
+        return false;
+    }
+    
+    size_t old_size = 0;
+    if (!replaceWithTemp(full_path, &old_size)) {
+        setError(SD_ERR_REPLACE_FAILED, full_path);
         return false;
     }
     
+    if (dir_index_enabled) {
+        dir_index.noteFile(full_path, len);
+    }
+    noteSpace(old_size, len);
+    
     clearError();
     return true;
 }
@@ -295,29 +771,48 @@ bool SDMounter::appendFile(const char* path, const char* content) {
 }
 
 bool SDMounter::appendFile(const char* path, const uint8_t* data, size_t len) {
-    File file = openFile(path, FILE_APPEND);
-    if (!file) return false;
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
     
-    size_t written = file.write(data, len);
-    file.close();
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
+    
+    int fd = backend->open(full_path, SD_OPEN_APPEND);
+    if (fd < 0) {
+        setError(SD_ERR_OPEN_FAILED, full_path);
+        return false;
+    }
+    
+    int64_t current = backend->size(fd);
+    size_t old_size = (current > 0) ? current : 0;
+    int written = backend->write(fd, data, len);
+    backend->close(fd);
     
-    if (written != len) {
-        setError(15, "Append size mismatch");
+    if (written != (int)len) {
+        setError(SD_ERR_WRITE_FAILED, full_path);
         return false;
     }
     
+    if (dir_index_enabled) {
+        dir_index.noteGrow(full_path, len);
+    }
+    noteSpace(old_size, old_size + len);
+    
     clearError();
     return true;
 }
 
 bool SDMounter::seekFile(File& file, size_t position) {
     if (!file) {
-        setError(34, "Invalid file handle for seek");
+        setError(SD_ERR_INVALID_HANDLE);
         return false;
     }
     
     if (!file.seek(position)) {
-        setError(35, "Seek operation failed");
+        setError(SD_ERR_SEEK_FAILED);
         return false;
     }
     
@@ -327,7 +822,7 @@ bool SDMounter::seekFile(File& file, size_t position) {
 
 size_t SDMounter::tellFile(File& file) {
     if (!file) {
-        setError(36, "Invalid file handle for tell");
+        setError(SD_ERR_INVALID_HANDLE);
         return 0;
     }
     
@@ -336,70 +831,81 @@ size_t SDMounter::tellFile(File& file) {
 }
 
 bool SDMounter::truncateFile(const char* path, size_t size) {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(37, "SD card not mounted");
+        setError(SD_ERR_NOT_MOUNTED);
         return false;
     }
     
-    String full_path = getFullPath(path);
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
     
-    // Read existing data up to size
-    File src = SD_MMC.open(full_path.c_str(), FILE_READ);
-    if (!src) {
-        setError(38, "Failed to open source file for truncate");
+    bool is_dir = false;
+    size_t current_size = 0;
+    if (!backend->stat(full_path, &is_dir, &current_size) || is_dir) {
+        setError(SD_ERR_OPEN_FAILED, full_path);
         return false;
     }
     
-    size_t current_size = src.size();
-    
     if (current_size <= size) {
-        // File is already smaller or equal, just close and return
-        src.close();
+        // File is already smaller or equal, nothing to do
         clearError();
         return true;
     }
     
-    // Create temporary file
-    String temp_path = full_path + ".tmp";
-    File dst = SD_MMC.open(temp_path.c_str(), FILE_WRITE);
+    // In place: on the card this is f_truncate, which only cuts the
+    // cluster chain - no file data is read or written
+    bool ok = backend->truncate(full_path, size);
+    
+    if (!ok) {
+        if (debug_mode) {
+            Serial.printf("[DEBUG] truncate(%s) failed, using copy fallback\n", full_path);
+        }
+        ok = truncateByCopy(full_path, size);
+    }
+    
+    if (ok) {
+        if (dir_index_enabled) {
+            dir_index.noteFile(full_path, size);
+        }
+        noteSpace(current_size, size);
+        clearError();
+    }
+    return ok;
+}
+
+bool SDMounter::truncateByCopy(const char* full_path, size_t size) {
+    char temp_path[SD_PATH_MAX + sizeof(SD_REPLACE_TEMP)];
+    snprintf(temp_path, sizeof(temp_path), "%s" SD_REPLACE_TEMP, full_path);
+    
+    File src = backend->fs().open(full_path, FILE_READ);
+    if (!src) {
+        setError(SD_ERR_OPEN_FAILED, full_path);
+        return false;
+    }
+    
+    File dst = backend->fs().open(temp_path, FILE_WRITE);
     if (!dst) {
         src.close();
-        setError(39, "Failed to create temp file for truncate");
+        setError(SD_ERR_TEMP_CREATE, full_path);
         return false;
     }
     
     // Copy only 'size' bytes
-    uint8_t buffer[512];
-    size_t remaining = size;
-    
-    while (remaining > 0 && src.available()) {
-        size_t to_read = (remaining < sizeof(buffer)) ? remaining : sizeof(buffer);
-        size_t bytes_read = src.read(buffer, to_read);
-        dst.write(buffer, bytes_read);
-        remaining -= bytes_read;
-    }
+    size_t copied = copyFileInternal(src, dst, size);
+    dst.flush(); // fsync before the original is touched
     
     src.close();
     dst.close();
     
-    // Replace original with truncated version
-    SD_MMC.remove(full_path.c_str());
-    SD_MMC.rename(temp_path.c_str(), full_path.c_str());
-    
-    clearError();
-    return true;
-}
-
-bool SDMounter::deleteFile(const char* path) {
-    if (!mounted) {
-        setError(16, "SD card not mounted");
+    if (copied != size) {
+        backend->unlink(temp_path);
+        setError(SD_ERR_TRUNCATE_FAILED, full_path);
         return false;
     }
     
-    String full_path = getFullPath(path);
-    
-    if (!SD_MMC.remove(full_path.c_str())) {
-        setError(17, String("Failed to delete: ") + full_path);
+    if (!replaceWithTemp(full_path)) {
+        setError(SD_ERR_REPLACE_FAILED, full_path);
         return false;
     }
     
@@ -407,41 +913,199 @@ bool SDMounter::deleteFile(const char* path) {
     return true;
 }
 
-bool SDMounter::renameFile(const char* old_path, const char* new_path) {
-    if (!mounted) {
-        setError(18, "SD card not mounted");
-        return false;
-    }
+bool SDMounter::replaceWithTemp(const char* full_path, size_t* old_size) {
+    char temp_path[SD_PATH_MAX + sizeof(SD_REPLACE_TEMP)];
+    snprintf(temp_path, sizeof(temp_path), "%s" SD_REPLACE_TEMP, full_path);
     
-    String full_old = getFullPath(old_path);
-    String full_new = getFullPath(new_path);
-    
-    if (!SD_MMC.rename(full_old.c_str(), full_new.c_str())) {
-        setError(19, "Rename failed");
+    if (replaceWith(temp_path, full_path, old_size)) return true;
+    backend->unlink(temp_path);
+    return false;
+}
+
+bool SDMounter::replaceWith(const char* from_path, const char* full_path, size_t* old_size) {
+    char backup_path[SD_PATH_MAX + sizeof(SD_REPLACE_BACKUP)];
+    snprintf(backup_path, sizeof(backup_path), "%s" SD_REPLACE_BACKUP, full_path);
+    
+    // New file: nothing to protect, and a crash before this rename leaves
+    // the source where it was (an orphaned temp recoverReplace() ignores)
+    size_t size = 0;
+    bool exists = backend->stat(full_path, nullptr, &size);
+    if (old_size) *old_size = exists ? size : 0;
+    if (!exists) return backend->rename(from_path, full_path);
+    
+    // Replace via a backup so one complete version always exists on the card:
+    // original -> backup, new -> original, then drop the backup. A crash in
+    // between leaves the backup for recoverReplace() to put back.
+    if (!backend->rename(full_path, backup_path)) return false;
+    
+    if (!backend->rename(from_path, full_path)) {
+        backend->rename(backup_path, full_path); // Roll back
         return false;
     }
     
-    clearError();
+    backend->unlink(backup_path);
     return true;
 }
 
-bool SDMounter::copyFile(const char* src, const char* dst) {
-    File src_file = openFile(src, FILE_READ);
-    if (!src_file) return false;
-    
-    File dst_file = openFile(dst, FILE_WRITE);
-    if (!dst_file) {
-        src_file.close();
-        return false;
+bool SDMounter::recoverReplace(const char* full_path) {
+    char temp_path[SD_PATH_MAX + sizeof(SD_REPLACE_TEMP)];
+    char backup_path[SD_PATH_MAX + sizeof(SD_REPLACE_BACKUP)];
+    snprintf(backup_path, sizeof(backup_path), "%s" SD_REPLACE_BACKUP, full_path);
+    if (!backend->stat(backup_path)) return false;
+    
+    snprintf(temp_path, sizeof(temp_path), "%s" SD_REPLACE_TEMP, full_path);
+    
+    if (backend->stat(full_path)) {
+        // Crash after the swap: the new version is in place
+        backend->unlink(backup_path);
+    } else if (backend->stat(temp_path)) {
+        // Crash between the renames: the temp copy was fsynced before the swap
+        backend->rename(temp_path, full_path);
+        backend->unlink(backup_path);
+    } else {
+        backend->rename(backup_path, full_path);
     }
     
-    size_t copied = copyFileInternal(src_file, dst_file);
-    
-    src_file.close();
-    dst_file.close();
+    if (dir_index_enabled) {
+        dir_index.noteStale(full_path);
+        dir_index.noteRemoved(backup_path);
+        dir_index.noteRemoved(temp_path);
+    }
     
-    if (copied == 0) {
-        setError(20, "Copy failed - no bytes copied");
+    Serial.printf("[SDMounter] Recovered interrupted replace of %s\n", full_path);
+    return true;
+}
+
+void SDMounter::recoverVolume() {
+    // Finish or roll back whatever power loss cut short, once per mount
+    SDTransaction::recover(*this);
+    recoverReplaces();
+}
+
+uint32_t SDMounter::recoverReplaces() {
+    // One walk for backups left by an interrupted replace. They are only
+    // collected here: renaming while a directory is being read is unsafe.
+    std::vector<String> pending;
+    char full[SD_PATH_MAX + sizeof(SD_REPLACE_BACKUP)];
+    void* stack[SD_WALK_MAX_DEPTH];
+    size_t lens[SD_WALK_MAX_DEPTH];
+    const size_t suffix_len = strlen(SD_REPLACE_BACKUP);
+    int depth = 0;
+    
+    stack[0] = backend->openDir("/");
+    if (!stack[0]) return 0;
+    lens[0] = 0;
+    
+    while (depth >= 0) {
+        size_t base = lens[depth];
+        bool is_dir = false;
+        full[base] = '/';
+        int result = backend->readDir(stack[depth], full + base + 1, sizeof(full) - base - 1, &is_dir);
+        
+        if (result <= 0) {
+            // Done with this directory, or one that cannot be read
+            backend->closeDir(stack[depth--]);
+            continue;
+        }
+        
+        size_t len = base + 1 + strlen(full + base + 1);
+        if (is_dir) {
+            if (depth + 1 >= SD_WALK_MAX_DEPTH) continue;
+            void* sub = backend->openDir(full);
+            if (!sub) continue;
+            stack[++depth] = sub;
+            lens[depth] = len;
+        } else if (len > suffix_len && strcmp(full + len - suffix_len, SD_REPLACE_BACKUP) == 0) {
+            full[len - suffix_len] = '\0';
+            pending.push_back(String(full));
+        }
+    }
+    
+    uint32_t recovered = 0;
+    for (const String& path : pending) {
+        if (recoverReplace(path.c_str())) recovered++;
+    }
+    return recovered;
+}
+
+bool SDMounter::deleteFile(const char* path) {
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
+    
+    // unlink() on FAT also removes empty directories, so check first
+    bool is_dir = false;
+    size_t old_size = 0;
+    if (!backend->stat(full_path, &is_dir, &old_size) || is_dir ||
+        !backend->unlink(full_path)) {
+        setError(SD_ERR_DELETE_FAILED, full_path);
+        return false;
+    }
+    
+    if (dir_index_enabled) {
+        dir_index.noteRemoved(full_path);
+    }
+    noteSpace(old_size, 0);
+    
+    clearError();
+    return true;
+}
+
+bool SDMounter::renameFile(const char* old_path, const char* new_path) {
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    char full_old[SD_PATH_MAX];
+    char full_new[SD_PATH_MAX];
+    if (!resolvePath(old_path, full_old) || !resolvePath(new_path, full_new)) return false;
+    
+    if (!backend->rename(full_old, full_new)) {
+        setError(SD_ERR_RENAME_FAILED, full_old);
+        return false;
+    }
+    
+    if (dir_index_enabled) {
+        dir_index.noteRenamed(full_old, full_new);
+    }
+    
+    clearError();
+    return true;
+}
+
+bool SDMounter::copyFile(const char* src, const char* dst) {
+    SDLock guard(*this);
+    char full_dst[SD_PATH_MAX];
+    if (!resolvePath(dst, full_dst)) return false;
+    
+    File src_file = openFile(src, FILE_READ);
+    if (!src_file) return false;
+    
+    File dst_file = openFile(full_dst, FILE_WRITE);
+    if (!dst_file) {
+        src_file.close();
+        return false;
+    }
+    
+    size_t expected = src_file.size();
+    size_t copied = copyFileInternal(src_file, dst_file);
+    
+    src_file.close();
+    dst_file.close();   // Updates the free space, as for any written File
+    
+    if (dir_index_enabled) {
+        dir_index.noteFile(full_dst, copied);
+    }
+    
+    if (copied != expected) {
+        setError(SD_ERR_COPY_FAILED, full_dst);
         return false;
     }
     
@@ -450,176 +1114,338 @@ bool SDMounter::copyFile(const char* src, const char* dst) {
 }
 
 bool SDMounter::moveFile(const char* src, const char* dst) {
-    if (!copyFile(src, dst)) return false;
-    return deleteFile(src);
+    SDLock guard(*this);
+    last_move_method = MOVE_NONE;
+    
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+    
+    char full_src[SD_PATH_MAX];
+    char full_dst[SD_PATH_MAX];
+    if (!resolvePath(src, full_src) || !resolvePath(dst, full_dst)) return false;
+    
+    bool is_dir = false;
+    if (!backend->stat(full_src, &is_dir)) {
+        setError(SD_ERR_NOT_FOUND, full_src);
+        return false;
+    }
+    
+    // FAT names are case-insensitive: "/A.txt" and "/a.txt" are one file,
+    // and replacing the destination would delete the source
+    if (strcasecmp(full_src, full_dst) == 0) {
+        setError(SD_ERR_SAME_FILE, full_dst);
+        return false;
+    }
+    
+    bool dst_is_dir = false;
+    bool dst_exists = backend->stat(full_dst, &dst_is_dir);
+    if (dst_exists && dst_is_dir) {
+        setError(SD_ERR_IS_A_DIRECTORY, full_dst);
+        return false;
+    }
+    
+    // Both paths live on the same FAT volume, so a rename only rewrites
+    // directory entries - no file data is touched, even across directories.
+    // FAT refuses to rename over an existing entry, so an existing
+    // destination file is swapped out through a backup like an atomic
+    // write, which mount recovery puts back if the swap is cut short.
+    bool renamed;
+    size_t replaced_size = 0;
+    if (dst_exists && !is_dir) {
+        renamed = replaceWith(full_src, full_dst, &replaced_size);
+        if (renamed) noteSpace(replaced_size, 0);
+    } else {
+        renamed = !dst_exists && backend->rename(full_src, full_dst);
+    }
+    
+    if (renamed) {
+        last_move_method = MOVE_RENAME;
+        if (dir_index_enabled) {
+            dir_index.noteRenamed(full_src, full_dst);
+        }
+        if (debug_mode) {
+            Serial.printf("[DEBUG] moveFile: renamed %s -> %s\n", full_src, full_dst);
+        }
+        clearError();
+        return true;
+    }
+    
+    if (is_dir || dst_exists) {
+        setError(SD_ERR_MOVE_FAILED, full_src);
+        return false;
+    }
+    
+    // The backend refused a rename to a free name (e.g. a RAM disk that
+    // cannot rename across directories): stream the data instead
+    if (!copyFile(full_src, full_dst)) return false;
+    if (!deleteFile(full_src)) return false;
+    
+    last_move_method = MOVE_COPY;
+    if (debug_mode) {
+        Serial.printf("[DEBUG] moveFile: copied %s -> %s\n", full_src, full_dst);
+    }
+    return true;
 }
 
 bool SDMounter::existsFile(const char* path) {
+    SDLock guard(*this);
     if (!mounted) return false;
     
-    String full_path = getFullPath(path);
-    return SD_MMC.exists(full_path.c_str());
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
+    bool found;
+    
+    if (dir_index_enabled) {
+        SDDirIndex::Info info;
+        found = dir_index.lookup(full_path, info);
+    } else {
+        found = backend->stat(full_path);
+    }
+    
+    return found;
 }
 
 size_t SDMounter::getFileSize(const char* path) {
-    File file = openFile(path, FILE_READ);
-    if (!file) return 0;
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return 0;
+    }
     
-    size_t size = file.size();
-    file.close();
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return 0;
+    
+    if (dir_index_enabled) {
+        SDDirIndex::Info info;
+        if (!dir_index.lookup(full_path, info)) {
+            setError(SD_ERR_NOT_FOUND, full_path);
+            return 0;
+        }
+        clearError();
+        return info.size;
+    }
+    
+    size_t size = 0;
+    if (!backend->stat(full_path, nullptr, &size)) {
+        setError(SD_ERR_NOT_FOUND, full_path);
+        return 0;
+    }
+    
+    clearError();
     return size;
 }
 
 bool SDMounter::mkdir(const char* path) {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(21, "SD card not mounted");
+        setError(SD_ERR_NOT_MOUNTED);
         return false;
     }
     
-    String full_path = getFullPath(path);
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
     
-    if (!SD_MMC.mkdir(full_path.c_str())) {
-        setError(22, String("Failed to create directory: ") + full_path);
+    if (!backend->mkdir(full_path)) {
+        // An existing directory counts as success, as it always has
+        bool is_dir = false;
+        if (backend->stat(full_path, &is_dir) && is_dir) {
+            clearError();
+            return true;
+        }
+        setError(SD_ERR_MKDIR_FAILED, full_path);
         return false;
     }
     
+    if (dir_index_enabled) {
+        dir_index.noteDir(full_path);
+    }
+    noteSpace(0, 1); // A new directory takes one cluster
+    
     clearError();
     return true;
 }
 
 bool SDMounter::rmdir(const char* path) {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(23, "SD card not mounted");
+        setError(SD_ERR_NOT_MOUNTED);
         return false;
     }
     
-    String full_path = getFullPath(path);
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
     
-    if (!SD_MMC.rmdir(full_path.c_str())) {
-        setError(24, String("Failed to remove directory: ") + full_path);
+    if (strcmp(full_path, "/") == 0 || !backend->rmdir(full_path)) {
+        setError(SD_ERR_RMDIR_FAILED, full_path);
         return false;
     }
     
+    if (dir_index_enabled) {
+        dir_index.noteRemoved(full_path);
+    }
+    noteSpace(1, 0);
+    
     clearError();
     return true;
 }
 
 bool SDMounter::rmdirRecursive(const char* path) {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(25, "SD card not mounted");
+        setError(SD_ERR_NOT_MOUNTED);
         return false;
     }
     
-    String full_path = getFullPath(path);
-    return deleteDirectoryRecursive(full_path.c_str());
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
+    
+    unsigned long start = millis();
+    bool ok = deleteDirectoryRecursive(full_path, &last_delete_items);
+    last_delete_ms = millis() - start;
+    
+    if (debug_mode) {
+        Serial.printf("[DEBUG] rmdirRecursive: %u items in %lu ms (%.0f items/s)\n",
+                      last_delete_items, last_delete_ms,
+                      last_delete_ms ? last_delete_items * 1000.0 / last_delete_ms : 0.0);
+    }
+    
+    if (dir_index_enabled) {
+        dir_index.noteRemoved(full_path); // Partial deletes leave stale entries behind
+        if (!ok) dir_index.clear();
+    }
+    if (space_ready) scanSpace(); // FatFs tracked every freed cluster, just read its count
+    
+    if (!ok) {
+        setError(SD_ERR_RMDIR_FAILED, full_path);
+    } else {
+        clearError();
+    }
+    return ok;
 }
 
 String SDMounter::listDir(const char* path, bool recursive) {
-    if (!mounted) {
-        setError(26, "SD card not mounted");
-        return "";
-    }
-    
-    String full_path = getFullPath(path);
     String listing = "";
     
-    File root = SD_MMC.open(full_path.c_str());
-    if (!root || !root.isDirectory()) {
-        setError(27, String("Not a directory: ") + full_path);
-        return "";
-    }
+    SDDirFilter filter;
+    filter.recursive = recursive;
     
-    File file = root.openNextFile();
-    while (file) {
-        if (file.isDirectory()) {
-            listing += "DIR : " + String(file.name()) + "\n";
-            if (recursive) {
-                String sub_listing = listDir(file.name(), true);
-                if (sub_listing.length() > 0) {
-                    listing += sub_listing;
-                }
-            }
+    forEachEntry(path, [&listing](const SDDirEntry& entry) {
+        if (entry.is_dir) {
+            listing += "DIR : " + String(entry.name) + "\n";
         } else {
-            listing += "FILE: " + String(file.name()) + " (" + String(file.size()) + " bytes)\n";
+            listing += "FILE: " + String(entry.name) + " (" + String(entry.size) + " bytes)\n";
         }
-        file.close();
-        file = root.openNextFile();
-    }
-    root.close();
+        return true;
+    }, filter);
     
-    clearError();
     return listing;
 }
 
 std::vector<String> SDMounter::listDirVector(const char* path) {
     std::vector<String> items;
     
+    forEachEntry(path, [&items](const SDDirEntry& entry) {
+        items.push_back(String(entry.name));
+        return true;
+    });
+    
+    return items;
+}
+
+bool SDMounter::openDirIterator(const char* path, SDDirIterator& iterator, const SDDirFilter& filter) {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(28, "SD card not mounted");
-        return items;
+        setError(SD_ERR_NOT_MOUNTED);
+        return false;
     }
     
-    String full_path = getFullPath(path);
-    File root = SD_MMC.open(full_path.c_str());
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return false;
     
-    if (!root || !root.isDirectory()) {
-        setError(29, String("Not a directory: ") + full_path);
-        return items;
+    if (!iterator.open(backend->fs(), dir_index_enabled ? &dir_index : nullptr, full_path, filter)) {
+        setError(SD_ERR_NOT_A_DIRECTORY, full_path);
+        return false;
     }
     
-    File file = root.openNextFile();
-    while (file) {
-        items.push_back(String(file.name()));
-        file.close();
-        file = root.openNextFile();
+    // Like an open File: the card is not ended under the iterator
+    acquireHandle();
+    iterator.holder = this;
+    
+    clearError();
+    return true;
+}
+
+uint32_t SDMounter::forEachEntry(const char* path, SDDirVisitor visitor, const SDDirFilter& filter) {
+    SDLock guard(*this);
+    if (!mounted) {
+        setError(SD_ERR_NOT_MOUNTED);
+        return 0;
     }
-    root.close();
+    
+    // One path buffer shared by every level of the walk; resolved paths
+    // carry no trailing slash
+    char walk_path[SD_ENTRY_PATH_MAX];
+    if (!resolvePath(path, walk_path)) return 0;
+    
+    SDDirEntry entry;
+    uint32_t delivered = 0;
+    if (!walkDir(walk_path, entry, visitor, filter, delivered)) return 0;
     
     clearError();
-    return items;
+    return delivered;
 }
 
 File SDMounter::openDir(const char* path) {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(30, "SD card not mounted");
+        setError(SD_ERR_NOT_MOUNTED);
         return File();
     }
     
-    String full_path = getFullPath(path);
-    File dir = SD_MMC.open(full_path.c_str());
+    char full_path[SD_PATH_MAX];
+    if (!resolvePath(path, full_path)) return File();
+    File dir = backend->fs().open(full_path);
     
     if (!dir || !dir.isDirectory()) {
-        setError(31, String("Not a directory: ") + full_path);
+        setError(SD_ERR_NOT_A_DIRECTORY, full_path);
         return File();
     }
     
     clearError();
-    return dir;
+    return SDHandleFileImpl::wrap(this, dir);
 }
 
 bool SDMounter::changeDir(const char* path) {
+    SDLock guard(*this);
     if (!mounted) {
-        setError(32, "SD card not mounted");
+        setError(SD_ERR_NOT_MOUNTED);
         return false;
     }
     
-    String new_dir = getFullPath(path);
-    File dir = SD_MMC.open(new_dir.c_str());
+    char new_dir[SD_PATH_MAX];
+    if (!resolvePath(path, new_dir)) return false;
     
-    if (!dir || !dir.isDirectory()) {
-        dir.close();
-        setError(33, String("Not a directory: ") + new_dir);
+    bool is_dir = false;
+    if (!backend->stat(new_dir, &is_dir) || !is_dir) {
+        setError(SD_ERR_NOT_A_DIRECTORY, new_dir);
         return false;
     }
     
-    dir.close();
-    current_dir = new_dir;
-    if (!current_dir.endsWith("/")) {
-        current_dir += "/";
+    size_t len = strlen(new_dir);
+    if (new_dir[len - 1] != '/') {
+        if (len + 1 >= sizeof(current_dir)) {
+            setError(SD_ERR_PATH_TOO_LONG, new_dir);
+            return false;
+        }
+        new_dir[len++] = '/';
+        new_dir[len] = '\0';
     }
+    memcpy(current_dir, new_dir, len + 1);
     
     clearError();
-    Serial.printf("[SDMounter] Changed directory to: %s\n", current_dir.c_str());
+    Serial.printf("[SDMounter] Changed directory to: %s\n", current_dir);
     return true;
 }
 
@@ -677,53 +1503,20 @@ float SDMounter::readSpeedTest(size_t block_size, uint32_t iterations) {
     }
     
     Serial.printf("[SDMounter] Read speed test (block: %u, iterations: %u)...\n", 
-                  block_size, iterations);
+                  (unsigned)block_size, iterations);
     
-    const char* test_file = "/speed_test.tmp";
-    uint8_t* buffer = (uint8_t*)malloc(block_size);
-    if (!buffer) {
-        Serial.println("[SDMounter] Memory allocation failed");
-        return 0.0f;
-    }
+    SDBenchmark bench(backend->fs(), "/speed_test");
+    SDBenchmark::Config cfg = bench.getConfig();
+    cfg.file_size = block_size * iterations;
+    bench.setConfig(cfg);
     
-    // Create test file
-    File file = openFile(test_file, FILE_WRITE);
-    if (!file) {
-        free(buffer);
-        return 0.0f;
-    }
+    bool ok = bench.runSequentialWrite(block_size) && bench.runSequentialRead(block_size);
+    const SDBenchmark::Result* r = bench.findResult("seq_read", block_size);
+    float speed_kbps = (ok && r) ? r->kbps : 0.0f;
     
-    for (size_t i = 0; i < block_size; i++) {
-        buffer[i] = i % 256;
-    }
-    
-    for (uint32_t i = 0; i < iterations; i++) {
-        file.write(buffer, block_size);
-    }
-    file.close();
-    
-    // Read speed test
-    unsigned long start = millis();
-    file = openFile(test_file, FILE_READ);
-    if (!file) {
-        free(buffer);
-        return 0.0f;
-    }
-    
-    size_t total_read = 0;
-    while (file.available()) {
-        total_read += file.read(buffer, block_size);
-    }
-    file.close();
-    
-    unsigned long elapsed = millis() - start;
-    
-    deleteFile(test_file);
-    free(buffer);
-    
-    float speed_kbps = (total_read / 1024.0) / (elapsed / 1000.0);
-    Serial.printf("[SDMounter] Read speed: %.2f KB/s\n", speed_kbps);
+    rmdirRecursive("/speed_test");
     
+    Serial.printf("[SDMounter] Read speed: %.2f KB/s (p99 %u us)\n", speed_kbps, r ? r->p99_us : 0);
     return speed_kbps;
 }
 
@@ -734,44 +1527,54 @@ float SDMounter::writeSpeedTest(size_t block_size, uint32_t iterations) {
     }
     
     Serial.printf("[SDMounter] Write speed test (block: %u, iterations: %u)...\n", 
-                  block_size, iterations);
+                  (unsigned)block_size, iterations);
     
-    const char* test_file = "/speed_test.tmp";
-    uint8_t* buffer = (uint8_t*)malloc(block_size);
-    if (!buffer) {
-        Serial.println("[SDMounter] Memory allocation failed");
-        return 0.0f;
-    }
+    SDBenchmark bench(backend->fs(), "/speed_test");
+    SDBenchmark::Config cfg = bench.getConfig();
+    cfg.file_size = block_size * iterations;
+    bench.setConfig(cfg);
     
-    for (size_t i = 0; i < block_size; i++) {
-        buffer[i] = i % 256;
-    }
+    bool ok = bench.runSequentialWrite(block_size);
+    const SDBenchmark::Result* r = bench.findResult("seq_write", block_size);
+    float speed_kbps = (ok && r) ? r->kbps : 0.0f;
     
-    unsigned long start = millis();
-    File file = openFile(test_file, FILE_WRITE);
-    if (!file) {
-        free(buffer);
-        return 0.0f;
-    }
+    rmdirRecursive("/speed_test");
     
-    size_t total_written = 0;
-    for (uint32_t i = 0; i < iterations; i++) {
-        total_written += file.write(buffer, block_size);
+    Serial.printf("[SDMounter] Write speed: %.2f KB/s (p99 %u us)\n", speed_kbps, r ? r->p99_us : 0);
+    return speed_kbps;
+}
+
+bool SDMounter::runBenchmark(const char* report_path) {
+    if (!mounted) {
+        Serial.println("[SDMounter] Benchmark failed: not mounted");
+        return false;
     }
-    file.close();
-    
-    unsigned long elapsed = millis() - start;
     
-    deleteFile(test_file);
-    free(buffer);
+    Serial.println("[SDMounter] Running benchmark suite...");
+    SDBenchmark bench(backend->fs(), "/bench");
+    bool ok = bench.runAll();
+    bench.printResults();
     
-    float speed_kbps = (total_written / 1024.0) / (elapsed / 1000.0);
-    Serial.printf("[SDMounter] Write speed: %.2f KB/s\n", speed_kbps);
+    char base[SD_PATH_MAX];
+    char report[SD_PATH_MAX + 8];
+    bool saved = resolvePath(report_path, base);
+    if (saved) {
+        snprintf(report, sizeof(report), "%s.csv", base);
+        saved = bench.writeCsv(report);
+    }
+    if (saved) {
+        snprintf(report, sizeof(report), "%s.json", base);
+        saved = bench.writeJson(report);
+    }
+    if (saved) {
+        Serial.printf("[SDMounter] Benchmark report saved to %s.csv/.json\n", base);
+    }
     
-    return speed_kbps;
+    return ok && saved;
 }
 
 void SDMounter::dumpFsInfo() {
+    SDLock guard(*this);
     Serial.println("\n========== SD CARD INFO ==========");
     Serial.printf("Status: %s\n", mounted ? "MOUNTED" : "NOT MOUNTED");
     
@@ -780,32 +1583,95 @@ void SDMounter::dumpFsInfo() {
         return;
     }
     
-    Serial.printf("Mount Point: %s\n", mount_point.c_str());
-    Serial.printf("Current Dir: %s\n", current_dir.c_str());
+    Serial.printf("Mount Point: %s\n", mount_point);
+    Serial.printf("Current Dir: %s\n", current_dir);
     Serial.printf("Type: %s\n", getFsType().c_str());
+    Serial.printf("Bus Width: %u-bit\n", bus_width);
+    Serial.printf("Bus Clock: %d kHz\n", bus_real_freq_khz);
     Serial.printf("Block Size: %u bytes\n", getBlockSize());
-    Serial.printf("Sector Count: %llu\n", getSectorCount());
+    Serial.printf("Sector Count: %llu\n", (unsigned long long)getSectorCount());
     Serial.printf("Total Space: %.2f MB\n", getTotalBytes() / 1048576.0);
     Serial.printf("Used Space: %.2f MB\n", getUsedBytes() / 1048576.0);
     Serial.printf("Free Space: %.2f MB\n", getFreeBytes() / 1048576.0);
+    Serial.printf("Cluster Size: %u bytes\n", cluster_bytes);
     Serial.printf("Usage: %.1f%%\n", (getUsedBytes() * 100.0) / getTotalBytes());
-    Serial.printf("Last Error: [%d] %s\n", last_error_code, last_error_msg.c_str());
+    if (dir_index_enabled) {
+        Serial.printf("Dir Index: %u dirs, %u entries, %u bytes\n",
+                      (unsigned)dir_index.dirCount(), (unsigned)dir_index.entryCount(),
+                      (unsigned)dir_index.memoryUsage());
+    }
+    if (block_cache.isRunning()) {
+        SDBlockCache::Stats cache_stats = block_cache.getStats();
+        Serial.printf("Block Cache: %u x %u KB, %.1f%% hits, %u prefetched\n",
+                      block_cache.getBlockCount(), (unsigned)(block_cache.getBlockSize() / 1024),
+                      block_cache.getHitRate() * 100.0f, cache_stats.prefetch_issued);
+    }
+    Serial.printf("Open Handles: %u%s\n", open_handles, end_pending ? " (end pending)" : "");
+    String detail = getErrorDetail();
+    Serial.printf("Last Error: [%d] %s%s%s\n", getErrorCode(), getErrorText(),
+                  detail.length() ? ": " : "", detail.c_str());
     Serial.println("==================================\n");
 }
 
 bool SDMounter::isInserted() {
+    SDLock guard(*this);
     return checkCardPresent();
 }
 
 bool SDMounter::isRemoved() {
+    SDLock guard(*this);
     return !checkCardPresent();
 }
 
+void SDMounter::enableHotSwapDetection(bool enable) {
+    hotswap_enabled = enable;
+    hotswap_interval_ms = SD_HOTSWAP_POLL_MS;
+    
+#if SD_BOARD_HAS_CD
+    if (enable) {
+        pinMode(SDMMC_CD, INPUT_PULLUP);
+        attachInterruptArg(digitalPinToInterrupt(SDMMC_CD), cardDetectISR, this, CHANGE);
+        cd_change_ms = millis();
+        cd_event = true; // Evaluate the current level once
+    } else {
+        detachInterrupt(digitalPinToInterrupt(SDMMC_CD));
+    }
+#endif
+}
+
+void IRAM_ATTR SDMounter::cardDetectISR(void* arg) {
+    SDMounter* self = (SDMounter*)arg;
+    self->cd_change_ms = millis(); // Every bounce restarts the debounce window
+    self->cd_event = true;
+}
+
 void SDMounter::checkHotSwap() {
     if (!hotswap_enabled) return;
     
+    // Another task is using the card right now, so it is still there:
+    // look again on the next call instead of stalling loop()
+    if (xSemaphoreTakeRecursive(api_lock, 0) != pdTRUE) return;
+    checkHotSwapLocked();
+    xSemaphoreGiveRecursive(api_lock);
+}
+
+void SDMounter::checkHotSwapLocked() {
+    // A removed card still held by open handles is not finished yet; pending
+    // card-detect events stay queued until releaseHandle() lets it go.
+    // An exported card belongs to the USB host until endExport().
+    if (end_pending || exported) return;
+    
     unsigned long now = millis();
-    if (now - last_hotswap_check < 200) return; // Check every 200ms for faster detection
+    
+#if SD_BOARD_HAS_CD
+    // Interrupt driven: free until the CD line moves, then wait for it to settle
+    if (!cd_event) return;
+    if (now - cd_change_ms < SD_CD_DEBOUNCE_MS) return;
+    cd_event = false;
+    
+    bool current_state = checkCardPresent();
+#else
+    if (now - last_hotswap_check < hotswap_interval_ms) return;
     last_hotswap_check = now;
     
     if (debug_mode) {
@@ -814,6 +1680,28 @@ void SDMounter::checkHotSwap() {
     
     bool current_state = checkCardPresent();
     
+    if (!mounted && current_state) {
+        // The probe brought the card up. Let go of it until it has answered
+        // several probes in a row, so a card still sliding in is not mounted.
+        backend->end();
+        if (!last_card_state && ++stable_probes < SD_HOTSWAP_STABLE_PROBES) {
+            hotswap_interval_ms = SD_HOTSWAP_POLL_MS;
+            return;
+        }
+    }
+    if (!current_state) stable_probes = 0;
+    
+    // An empty-slot probe is a full card init with long timeouts, so back off
+    // exponentially while nothing is inserted, or a card is known but left
+    // unmounted
+    if (!mounted && (!current_state || last_card_state)) {
+        hotswap_interval_ms = (hotswap_interval_ms * 2 < SD_HOTSWAP_BACKOFF_MS)
+                              ? hotswap_interval_ms * 2 : SD_HOTSWAP_BACKOFF_MS;
+    } else {
+        hotswap_interval_ms = SD_HOTSWAP_POLL_MS;
+    }
+#endif
+    
     if (debug_mode) {
         Serial.printf("[DEBUG] Card check result: current_state=%d\n", current_state);
     }
@@ -822,42 +1710,29 @@ void SDMounter::checkHotSwap() {
     if (last_card_state && !current_state) {
         Serial.println("[SDMounter] ⚠️ SD card removed!");
         if (mounted) {
-            SD_MMC.end(); // Force unmount
-            mounted = false;
+            suspendLogStreams(false); // Card is gone, keep their buffers for the next mount
+            endCard(); // Force unmount once no handle is left on the card
             triggerUnmountCallback();
         }
         triggerCardRemovedCallback();
         last_card_state = false;
+        hotswap_interval_ms = SD_HOTSWAP_POLL_MS;
         return;
     }
     
     // Card was inserted
     if (!last_card_state && current_state) {
         Serial.println("[SDMounter] ✅ SD card inserted!");
-        
-        // If checkCardPresent mounted it but our flag says not mounted, update
-        if (!mounted && current_state) {
-            mounted = true;
-            last_card_state = true;
-            triggerCardInsertedCallback();
-            triggerMountCallback();
-            
-            Serial.println("[SDMounter] Card auto-mounted during detection");
-            Serial.printf("[SDMounter] Total: %.2f MB, Used: %.2f MB\n", 
-                          getTotalBytes() / 1048576.0, getUsedBytes() / 1048576.0);
-            return;
-        }
-        
+        last_card_state = true;
+        stable_probes = 0;
         triggerCardInsertedCallback();
         
-        // Try to auto-mount if enabled and not already mounted
-        if (auto_mount_enabled && !mounted) {
-            delay(200); // Give card time to stabilize
+        // Seated by now: the CD line stayed put for the debounce window, or
+        // the card answered every probe
+        if (!mounted && auto_mount_enabled) {
             Serial.println("[SDMounter] Auto-mounting inserted card...");
-            mount(false, mount_point.c_str(), mode_1bit);
+            mount(false, mount_point, mode_1bit);
         }
-        
-        last_card_state = true;
         return;
     }
     
@@ -865,25 +1740,153 @@ void SDMounter::checkHotSwap() {
     last_card_state = current_state;
 }
 
+void SDMounter::flushLogs() {
+    SDLock guard(*this);
+    for (SDLogStream* stream : log_streams) {
+        stream->sync();
+    }
+}
+
+void SDMounter::registerLogStream(SDLogStream* stream) {
+    SDLock guard(*this);
+    if (std::find(log_streams.begin(), log_streams.end(), stream) == log_streams.end()) {
+        log_streams.push_back(stream);
+    }
+}
+
+void SDMounter::unregisterLogStream(SDLogStream* stream) {
+    SDLock guard(*this);
+    log_streams.erase(std::remove(log_streams.begin(), log_streams.end(), stream), log_streams.end());
+}
+
 // Private helper methods
-void SDMounter::setError(int code, const String& msg) {
-    last_error_code = code;
-    last_error_msg = msg;
-    Serial.printf("[SDMounter] Error %d: %s\n", code, msg.c_str());
+void SDMounter::setError(SDError code, const char* detail) {
+    // Expected failures (missing files, probes) happen constantly: keep this
+    // to a code and a bounded copy, no String and no printing by default.
+    // The state belongs to the calling task, so no lock is needed.
+    TaskError* error = taskError(true);
+    if (error) {
+        error->owner = this;
+        error->code = code;
+        strlcpy(error->detail, detail ? detail : "", sizeof(error->detail));
+    }
+    
+    if (error_logging || debug_mode) {
+        Serial.printf("[SDMounter] Error %d: %s%s%s\n", code, sdErrorText(code),
+                      detail ? ": " : "", detail ? detail : "");
+    }
 }
 
 void SDMounter::clearError() {
-    last_error_code = 0;
-    last_error_msg = "";
+    TaskError* error = taskError(false);
+    if (error && error->owner == this) {
+        error->code = SD_OK;
+        error->detail[0] = '\0';
+    }
 }
 
-String SDMounter::getFullPath(const char* path) {
+SDError SDMounter::getErrorCode() const {
+    const TaskError* error = taskError(false);
+    return (error && error->owner == this) ? error->code : SD_OK;
+}
+
+String SDMounter::getErrorDetail() const {
+    const TaskError* error = taskError(false);
+    return (error && error->owner == this) ? String(error->detail) : String();
+}
+
+String SDMounter::getLastError() const {
+    const TaskError* error = taskError(false);
+    if (!error || error->owner != this || error->code == SD_OK) return "";
+    
+    String msg = sdErrorText(error->code);
+    if (error->detail[0]) {
+        msg += ": ";
+        msg += error->detail;
+    }
+    return msg;
+}
+
+void SDMounter::lock() const {
+    xSemaphoreTakeRecursive(api_lock, portMAX_DELAY);
+}
+
+void SDMounter::unlock() const {
+    xSemaphoreGiveRecursive(api_lock);
+}
+
+bool SDMounter::tryLock() const {
+    return xSemaphoreTakeRecursive(api_lock, 0) == pdTRUE;
+}
+
+String SDMounter::getCurrentDir() const {
+    SDLock guard(*this);
+    return String(current_dir);
+}
+
+void SDMounter::acquireHandle() {
+    SDLock guard(*this);
+    open_handles++;
+}
+
+void SDMounter::releaseHandle() {
+    SDLock guard(*this);
+    if (open_handles > 0) open_handles--;
+    
+    if (open_handles == 0 && end_pending) {
+        backend->end();
+        end_pending = false;
+        Serial.println("[SDMounter] Last handle closed, card released");
+    }
+}
+
+bool SDMounter::resolvePath(const char* path, char* out) {
+    SDLock guard(*this);
+    if (!path) path = "";
+    
+    // Relative paths start from the current directory (which ends in '/')
+    size_t len;
     if (isAbsolutePath(path)) {
-        return String(path);
+        out[0] = '/';
+        len = 1;
     } else {
-        String full = current_dir + String(path);
-        return full;
+        len = strlen(current_dir);
+        memcpy(out, current_dir, len);
+        while (len > 1 && out[len - 1] == '/') len--;
     }
+    out[len] = '\0';
+    
+    const char* p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        if (!*p) break;
+        
+        const char* seg = p;
+        while (*p && *p != '/') p++;
+        size_t seg_len = p - seg;
+        
+        if (seg_len == 1 && seg[0] == '.') continue;
+        
+        if (seg_len == 2 && seg[0] == '.' && seg[1] == '.') {
+            // Drop the last component; ".." at the root stays at the root
+            while (len > 1 && out[len - 1] != '/') len--;
+            if (len > 1) len--;
+            out[len] = '\0';
+            continue;
+        }
+        
+        size_t sep = (len > 1) ? 1 : 0;
+        if (len + sep + seg_len >= SD_PATH_MAX) {
+            setError(SD_ERR_PATH_TOO_LONG, path);
+            return false;
+        }
+        if (sep) out[len++] = '/';
+        memcpy(out + len, seg, seg_len);
+        len += seg_len;
+        out[len] = '\0';
+    }
+    
+    return true;
 }
 
 bool SDMounter::isAbsolutePath(const char* path) {
@@ -914,19 +1917,146 @@ void SDMounter::triggerCardRemovedCallback() {
     }
 }
 
+void SDMounter::suspendLogStreams(bool flush_first) {
+    for (SDLogStream* stream : log_streams) {
+        stream->suspend(flush_first);
+    }
+}
+
+void SDMounter::startSpaceScan() {
+    space_ready = false;
+    space_scan_gen++;
+    if (space_task) return;
+    
+    if (xTaskCreatePinnedToCore(spaceScanTask, "sd_space", 3072, this, 1, &space_task, 0) != pdPASS) {
+        space_task = nullptr; // The getters scan on first use instead
+    }
+}
+
+void SDMounter::waitSpaceScan() {
+    while (space_task) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+}
+
+bool SDMounter::scanSpace() {
+    // On the card the first call walks the whole FAT (no FSINFO); FatFs then
+    // keeps the free count current itself, so later calls return at once.
+    uint64_t total = 0;
+    uint64_t free = 0;
+    uint32_t cluster = 0;
+    if (!backend->getSpace(total, free, cluster)) {
+        return false;
+    }
+    
+    cluster_bytes = cluster;
+    space_total = total;
+    space_free = (int64_t)free;
+    space_ready = true;
+    return true;
+}
+
+void SDMounter::spaceScanTask(void* arg) {
+    SDMounter* self = (SDMounter*)arg;
+    uint32_t gen = self->space_scan_gen;
+    unsigned long start = millis();
+    
+    // The slow FAT walk runs without the lock; FatFs keeps the count current
+    // from then on, so reading it again below is quick
+    uint64_t total = 0;
+    uint64_t free = 0;
+    uint32_t cluster = 0;
+    bool walked = self->backend->getSpace(total, free, cluster);
+    self->space_task = nullptr;    // Waiters hold the lock and read the count themselves
+    
+    if (!walked) {
+        Serial.println("[SDMounter] Free space scan failed");
+    } else {
+        // Installed under the lock: noteSpace() ignores every change before
+        // this point, which the count already includes, and applies every one after
+        SDLock guard(*self);
+        if (self->mounted && gen == self->space_scan_gen && !self->space_ready && self->scanSpace()) {
+            Serial.printf("[SDMounter] Total: %.2f MB, Free: %.2f MB (%u byte clusters, scan %lu ms)\n",
+                          self->space_total / 1048576.0, self->space_free / 1048576.0,
+                          self->cluster_bytes, millis() - start);
+        }
+    }
+    
+    vTaskDelete(nullptr);
+}
+
+int64_t SDMounter::indexedSizeOf(const char* full_path) {
+    // No card access: -1 when only a stat would tell
+    if (!dir_index_enabled) return -1;
+    SDDirIndex::Info info;
+    if (!dir_index.lookup(full_path, info)) return 0;
+    return info.is_dir ? 0 : info.size;
+}
+
+void SDMounter::noteSpace(int64_t old_size, int64_t new_size) {
+    if (!space_ready || cluster_bytes == 0) return;
+    
+    // Old size unknown: FatFs counted the clusters itself, read its count
+    if (old_size < 0) {
+        scanSpace();
+        return;
+    }
+    
+    // Files occupy whole clusters, so only cluster boundaries change free space
+    if (new_size < 0) new_size = 0;
+    int64_t old_clusters = (old_size + cluster_bytes - 1) / cluster_bytes;
+    int64_t new_clusters = (new_size + cluster_bytes - 1) / cluster_bytes;
+    
+    space_free -= (new_clusters - old_clusters) * cluster_bytes;
+    if (space_free < 0) space_free = 0;
+}
+
+void SDMounter::resumeLogStreams() {
+    for (SDLogStream* stream : log_streams) {
+        stream->resume();
+    }
+}
+
+void SDMounter::endCard() {
+    // New calls fail from here on; ending the backend would pull the volume
+    // out from under open files, so it waits until the last handle is released
+    mounted = false;
+    waitSpaceScan();    // A scan still running would set space_ready again
+    space_ready = false;
+    dir_index.clear();
+    
+    if (open_handles > 0) {
+        end_pending = true;
+        Serial.printf("[SDMounter] %u handle(s) still open, card released when closed\n", open_handles);
+        return;
+    }
+    
+    backend->end();
+}
+
 bool SDMounter::checkCardPresent() {
-    // Simplified detection method
+#if SD_BOARD_HAS_CD
+    // Card-detect switch: a GPIO read, no bus traffic
+    bool present = (digitalRead(SDMMC_CD) == SDMMC_CD_ACTIVE);
+    if (debug_mode) {
+        Serial.printf("[DEBUG] checkCardPresent: CD pin present=%d\n", present);
+    }
+    return present;
+#else
+    if (end_pending) {
+        // Removed card still held by open handles: the backend is busy with it
+        return false;
+    }
     
     if (!mounted) {
         // Not mounted - try a full mount to check
-        // This is the only reliable way on ESP32 SD_MMC
+        // This is the only reliable way on ESP32 SD_MMC without a CD pin
         if (debug_mode) {
             Serial.println("[DEBUG] checkCardPresent: Not mounted, attempting begin()...");
         }
         
-        SD_MMC.setPins(SDMMC_CLK, SDMMC_CMD, SDMMC_DATA);
-        
-        if (SD_MMC.begin(mount_point.c_str(), mode_1bit)) {
+        // Reuse the last negotiated bus settings - one init attempt per poll
+        if (beginBus(mount_point, bus_width, bus_freq_khz)) {
             // Card is there! Keep it mounted for the check
             if (debug_mode) {
                 Serial.println("[DEBUG] checkCardPresent: begin() SUCCESS - card present");
@@ -939,78 +2069,202 @@ bool SDMounter::checkCardPresent() {
             }
             return false;
         }
-    } else {
-        // Already mounted - verify it's still accessible
-        if (debug_mode) {
-            Serial.println("[DEBUG] checkCardPresent: Already mounted, verifying...");
-        }
+    }
+    
+    // Already mounted - verify it's still accessible (one SEND_STATUS on the card)
+    bool accessible = backend->isPresent();
+    
+    if (debug_mode) {
+        Serial.printf("[DEBUG] checkCardPresent: Card responding=%d\n", accessible);
+    }
+    
+    return accessible;
+#endif
+}
+
+bool SDMounter::negotiateBus(const char* mp) {
+    // Widest bus and fastest clock first. Broken data lines fail the FAT mount
+    // itself, since that already reads the boot sector over the full bus.
+    const uint8_t widths[2] = {4, 1};
+    const int freqs[2] = {max_bus_freq_khz, SDMMC_FREQ_DEFAULT};
+    
+    for (uint8_t w = 0; w < 2; w++) {
+        if (widths[w] == 4 && (mode_1bit || backend->maxBusWidth() < 4)) continue;
         
-        // Quick check: card type
-        uint8_t cardType = SD_MMC.cardType();
-        if (cardType == CARD_NONE) {
+        for (uint8_t f = 0; f < 2; f++) {
+            if (f == 1 && freqs[1] >= freqs[0]) break;
+            
+            if (beginBus(mp, widths[w], freqs[f])) {
+                return true;
+            }
+            
             if (debug_mode) {
-                Serial.println("[DEBUG] checkCardPresent: cardType is NONE - card removed");
+                Serial.printf("[DEBUG] negotiateBus: %u-bit @ %d kHz failed\n", widths[w], freqs[f]);
             }
-            return false;
         }
-        
-        // Deeper check: try to access root
-        File root = SD_MMC.open("/");
-        bool accessible = (root && root.isDirectory());
-        if (root) root.close();
-        
-        if (debug_mode) {
-            Serial.printf("[DEBUG] checkCardPresent: Root accessible=%d\n", accessible);
-        }
-        
-        return accessible;
     }
+    
+    return false;
 }
 
-size_t SDMounter::copyFileInternal(File& src, File& dst) {
-    size_t total = 0;
-    uint8_t buffer[512];
+bool SDMounter::beginBus(const char* mp, uint8_t width, int freq_khz, bool format_if_failed) {
+    if (!backend->begin(mp, width, freq_khz, format_if_failed)) {
+        return false;
+    }
+    
+    bus_width = width;
+    bus_freq_khz = freq_khz;
+    
+    // Cards without high-speed support stay at the default clock
+    int real_khz = backend->busFrequency();
+    bus_real_freq_khz = (real_khz > 0) ? real_khz : freq_khz;
     
-    while (src.available()) {
-        size_t bytes_read = src.read(buffer, sizeof(buffer));
-        size_t bytes_written = dst.write(buffer, bytes_read);
-        total += bytes_written;
+    return true;
+}
+
+bool SDMounter::walkDir(char* path, SDDirEntry& entry, const SDDirVisitor& visitor,
+                        const SDDirFilter& filter, uint32_t& delivered) {
+    // Iterative: an iterator is over half a KB, too much to stack one per
+    // level on an 8 KB loop task. Levels are allocated on first use and
+    // reused by every sibling directory at the same depth.
+    SDDirIterator* levels[SD_WALK_MAX_DEPTH + 1] = {};
+    size_t lens[SD_WALK_MAX_DEPTH + 1];
+    SDDirFilter all; // Filter applied here so the walk still descends into every directory
+    SDDirIndex* index = dir_index_enabled ? &dir_index : nullptr;
+    uint32_t matched = 0;
+    int depth = 0;
+    
+    levels[0] = new SDDirIterator();
+    lens[0] = strlen(path);
+    if (!levels[0]->open(backend->fs(), index, path, all)) {
+        setError(SD_ERR_NOT_A_DIRECTORY, path);
+        delete levels[0];
+        return false;
+    }
+    
+    while (depth >= 0) {
+        if (!levels[depth]->next(entry)) {
+            levels[depth]->close();
+            if (--depth >= 0) path[lens[depth]] = '\0';
+            continue;
+        }
+        entry.depth = depth;
         
-        if (bytes_written != bytes_read) {
-            break;
+        if (filter.matches(entry.name, entry.is_dir) && matched++ >= filter.skip) {
+            if (filter.limit && delivered >= filter.limit) break;
+            delivered++;
+            if (!visitor(entry)) break;
+        }
+        
+        if (!filter.recursive || !entry.is_dir || depth >= SD_WALK_MAX_DEPTH) continue;
+        
+        size_t path_len = lens[depth];
+        size_t name_len = strlen(entry.name);
+        size_t sep = (path_len == 1) ? 0 : 1; // Root is just "/"
+        if (path_len + sep + name_len >= SD_ENTRY_PATH_MAX) continue;
+        
+        if (sep) path[path_len] = '/';
+        memcpy(path + path_len + sep, entry.name, name_len + 1);
+        
+        if (!levels[depth + 1]) levels[depth + 1] = new SDDirIterator();
+        if (levels[depth + 1]->open(backend->fs(), index, path, all)) {
+            lens[++depth] = path_len + sep + name_len;
+        } else {
+            path[path_len] = '\0';
         }
     }
     
-    return total;
+    for (SDDirIterator* level : levels) delete level;   // Closes any still open
+    return true;
 }
 
-bool SDMounter::deleteDirectoryRecursive(const char* path) {
-    File dir = SD_MMC.open(path);
-    if (!dir || !dir.isDirectory()) {
-        return false;
+size_t SDMounter::copyFileInternal(File& src, File& dst, size_t max_bytes) {
+    size_t total = copy_engine.copy(src, dst, max_bytes);
+    
+    if (debug_mode) {
+        Serial.printf("[DEBUG] Copied %u bytes in %lu us (%.2f KB/s, %s)\n",
+                      (unsigned)total, (unsigned long)copy_engine.getLastCopyMicros(),
+                      copy_engine.getLastThroughputKBps(),
+                      copy_engine.lastCopyUsedPipeline() ? "pipelined" : "sequential");
     }
     
-    File file = dir.openNextFile();
-    while (file) {
-        String file_path = String(path) + "/" + String(file.name());
+    return total;
+}
+
+bool SDMounter::deleteDirectoryRecursive(const char* path, uint32_t* items) {
+    // Iterative walk over backend listings: each entry says file or
+    // directory, so none has to be opened, and all paths share one buffer
+    if (items) *items = 0;
+    
+    char full[SD_PATH_MAX];
+    bool is_root = (strcmp(path, "/") == 0);
+    size_t len = is_root ? 0 : strlcpy(full, path, sizeof(full));
+    if (len >= sizeof(full)) return false;
+    
+    void* stack[SD_WALK_MAX_DEPTH];
+    size_t lens[SD_WALK_MAX_DEPTH];
+    int depth = 0;
+    uint32_t count = 0;
+    bool ok = true;
+    
+    stack[0] = backend->openDir(path);
+    if (!stack[0]) return false;
+    lens[0] = len;
+    
+    while (depth >= 0) {
+        // The name lands straight in the path buffer after the separator
+        size_t base = lens[depth];
+        bool is_dir = false;
+        full[base] = '/';
+        int result = backend->readDir(stack[depth], full + base + 1, sizeof(full) - base - 1, &is_dir);
         
-        if (file.isDirectory()) {
-            file.close();
-            if (!deleteDirectoryRecursive(file_path.c_str())) {
-                dir.close();
-                return false;
+        if (result < 0) {
+            ok = false;     // Name too long for the buffer, or a read error
+            break;
+        }
+        
+        if (result == 0) {
+            // Directory is empty now
+            backend->closeDir(stack[depth]);
+            full[base] = '\0';
+            if (depth > 0 || !is_root) {
+                if (!backend->rmdir(full)) {
+                    depth--;
+                    ok = false;
+                    break;
+                }
+                count++;
+            }
+            depth--;
+            continue;
+        }
+        
+        if (is_dir) {
+            if (depth + 1 >= SD_WALK_MAX_DEPTH) {
+                ok = false;
+                break;
+            }
+            void* sub = backend->openDir(full);
+            if (!sub) {
+                ok = false;
+                break;
             }
+            stack[++depth] = sub;
+            lens[depth] = base + 1 + strlen(full + base + 1);
         } else {
-            file.close();
-            if (!SD_MMC.remove(file_path.c_str())) {
-                dir.close();
-                return false;
+            if (!backend->unlink(full)) {
+                ok = false;
+                break;
             }
+            count++;
         }
-        
-        file = dir.openNextFile();
     }
-    dir.close();
     
-    return SD_MMC.rmdir(path);
+    // Bailed out early: release the directories still open
+    for (; depth >= 0; depth--) {
+        backend->closeDir(stack[depth]);
+    }
+    
+    if (items) *items = count;
+    return ok;
 }
@@ -1,29 +1,87 @@
 #pragma once
 #include <Arduino.h>
-#include <SD_MMC.h>
 #include <FS.h>
 #include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "SDCopyEngine.h"
+#include "SDBenchmark.h"
+#include "SDDirIndex.h"
+#include "SDDirIterator.h"
+#include "SDBlockCache.h"
+#include "SDError.h"
+#include "SDStorageBackend.h"
+#if defined(ESP_PLATFORM)
+#include "SDMMCBackend.h"
+#else
+// Host build (see host/CMakeLists.txt): no SDMMC peripheral, but the bus
+// clocks SD_MMC.h would define keep the negotiation code unchanged
+#define SDMMC_FREQ_DEFAULT   20000
+#define SDMMC_FREQ_HIGHSPEED 40000
+#endif
+#include "SDCompressedFile.h"
+
+class SDLogStream;
 
 // NOTE: Pins (SDMMC_CLK, SDMMC_CMD, SDMMC_DATA) must be defined in pin_config.h
 // Include your pin_config.h before including this library
+// Boards that wire all four data lines can also define SDMMC_D1, SDMMC_D2 and
+// SDMMC_D3 there; mount() then negotiates the 4-bit bus automatically.
+// Define SDMMC_CD for a card-detect switch to make hot-swap detection
+// interrupt driven instead of polled.
+// setBackend() swaps the card for a RAM disk or a directory (see
+// SDStorageBackend.h), e.g. to run the same code without hardware.
+
+#define SD_WALK_MAX_DEPTH 16
+#define SD_PATH_MAX        SD_ENTRY_PATH_MAX        // Resolved card path, with terminator
+#define SD_MOUNT_POINT_MAX 32
+
+// Suffixes of the copies an atomic replace leaves next to the file. Only
+// these are recovered at mount, so a user's own .tmp or .bak is left alone.
+#define SD_REPLACE_TEMP   ".sdtmp"
+#define SD_REPLACE_BACKUP ".sdbak"
 
 class SDMounter {
 public:
+    // How the last moveFile() completed
+    enum MoveMethod {
+        MOVE_NONE,      // Move failed
+        MOVE_RENAME,    // Directory entry renamed in place (O(1))
+        MOVE_COPY       // Streamed copy followed by delete (O(n))
+    };
+    
     // Constructor
     SDMounter();
     
     // Core mounting operations
-    bool mount(bool format_if_failed = false, const char* mount_point = "/sdcard", bool mode1bit = true);
+    // mode1bit = false negotiates the widest wired bus and fastest clock the card accepts
+    bool mount(bool format_if_failed = false, const char* mount_point = "/sdcard", bool mode1bit = false);
     bool unmount();
     bool remount();
-    bool format();
-    bool check();
+    bool format(uint32_t cluster_size = 0); // Real mkfs; 0 = FatFs default for the card size
+    bool check();   // Root readable; SDIntegrity verifies file contents
+    
+    // Hand the volume to a USB host (see SDUsbDrive). Needs no open handles;
+    // logs are flushed first. Until endExport() mounts it again, as the host
+    // left it, the mounter behaves as unmounted and mount() is refused.
+    bool beginExport();
+    bool endExport();
+    bool isExported() const { return exported; }
+    
+    // Storage under the mounter; only while unmounted
+    bool setBackend(SDStorageBackend& storage);
+    SDStorageBackend& getBackend() { return *backend; }
     
     // Auto-mount control
     void enableAutoMount(bool enable = true) { auto_mount_enabled = enable; }
     bool isAutoMountEnabled() const { return auto_mount_enabled; }
     void autoMount(); // Call this in setup() if you want auto-mount
     
+    // Bus configuration (negotiated on mount)
+    void setMaxBusFrequency(int freq_khz) { max_bus_freq_khz = freq_khz; }
+    uint8_t getBusWidth() const { return mounted ? bus_width : 0; }
+    int getBusFrequency() const { return mounted ? bus_real_freq_khz : 0; }
+    
     // File system info
     String getFsType();
     String getFsLabel();
@@ -33,6 +91,16 @@ public:
     uint64_t getUsedBytes();
     uint64_t getFreeBytes();
     
+    // Space figures are computed once in the background after mount and then
+    // kept current from SDMounter's own writes at cluster granularity. The
+    // getters wait for that first scan. Files from openFile() update them
+    // when closed after writing, SDLogStream after its flushes. Writes made
+    // through getSD() or SDRecordStore are picked up by refreshSpaceInfo(),
+    // which is cheap once the first scan is done (FatFs keeps its free count).
+    bool refreshSpaceInfo();
+    bool isSpaceInfoReady() const { return space_ready; }
+    uint32_t getClusterSize() const { return cluster_bytes; }
+    
     // File operations
     File openFile(const char* path, const char* mode = FILE_READ);
     bool closeFile(File& file);
@@ -48,33 +116,104 @@ public:
     bool deleteFile(const char* path);
     bool renameFile(const char* old_path, const char* new_path);
     bool copyFile(const char* src, const char* dst);
-    bool moveFile(const char* src, const char* dst);
+    bool moveFile(const char* src, const char* dst); // Files and directories; replaces a destination file
+    MoveMethod getLastMoveMethod() const { return last_move_method; }
     bool existsFile(const char* path);
     size_t getFileSize(const char* path);
     
+    // Atomic writes: writeFile() writes a fsynced temp file and swaps it in,
+    // so a reset never leaves a torn file. On by default. Use SDTransaction
+    // to replace several files as one unit.
+    void setAtomicWrites(bool enable) { atomic_writes = enable; }
+    bool isAtomicWrites() const { return atomic_writes; }
+    
+    // Copy engine (used by copyFile, moveFile and truncateFile)
+    SDCopyEngine& getCopyEngine() { return copy_engine; }
+    void setCopyBufferSize(size_t size) { copy_engine.setBufferSize(size); }
+    void setCopyPipelined(bool enable) { copy_engine.setPipelined(enable); }
+    void onCopyProgress(SDCopyProgressCallback callback) { copy_engine.onProgress(callback); }
+    
+    // Read cache with read-ahead for streamed files (started on first use)
+    bool openCachedFile(const char* path, SDCachedFile& file);
+    SDBlockCache& getBlockCache() { return block_cache; }
+    
+    // LZ4 block-compressed files (.sdz, see SDCompressedFile.h). The reader
+    // also opens plain files, so assets can be packed or not.
+    bool openCompressed(const char* path, SDCompressedFile& file);
+    bool createCompressed(const char* path, SDCompressedWriter& writer, size_t block_size = SD_Z_DEFAULT_BLOCK);
+    
+    // Creates (or replaces) a file with size bytes already allocated, in one
+    // contiguous run when the card and IDF allow; contiguous reports which.
+    // SDRecorder streams into such a file and trims it on close.
+    bool preallocateFile(const char* path, uint64_t size, bool* contiguous = nullptr);
+    
     // Directory operations
     bool mkdir(const char* path);
     bool rmdir(const char* path);
     bool rmdirRecursive(const char* path);
+    uint32_t getLastDeleteCount() const { return last_delete_items; } // Files + dirs removed by rmdirRecursive
+    unsigned long getLastDeleteMillis() const { return last_delete_ms; }
     String listDir(const char* path, bool recursive = false);
     std::vector<String> listDirVector(const char* path);
+    bool openDirIterator(const char* path, SDDirIterator& iterator, const SDDirFilter& filter = SDDirFilter());
+    uint32_t forEachEntry(const char* path, SDDirVisitor visitor, const SDDirFilter& filter = SDDirFilter());
     File openDir(const char* path);
     bool changeDir(const char* path);
-    String getCurrentDir() const { return current_dir; }
+    String getCurrentDir() const;
+    // Resolve a path against the current directory into a buffer of
+    // SD_PATH_MAX bytes; ".", ".." and repeated slashes are collapsed
+    bool resolvePath(const char* path, char* out);
+    
+    // Directory index: listings and lookups served from RAM once a directory
+    // has been read. Only stays coherent for changes made through SDMounter.
+    void enableDirIndex(bool enable = true) { dir_index_enabled = enable; dir_index.clear(); }
+    bool isDirIndexEnabled() const { return dir_index_enabled; }
+    void invalidateDirIndex() { dir_index.clear(); }
+    SDDirIndex& getDirIndex() { return dir_index; }
+    
+    // Log streams: flushed before unmount, parked on card removal and
+    // reopened on the next mount. Call flushLogs() before going to sleep.
+    void flushLogs();
+    void registerLogStream(SDLogStream* stream);
+    void unregisterLogStream(SDLogStream* stream);
+    
+    // Concurrency: every call takes one recursive mutex, so SDCard can be
+    // shared by loop(), callbacks and other tasks. Hold an SDLock to make
+    // several calls one step (e.g. changeDir() followed by relative opens).
+    // Reads and writes on an open File do not take the lock.
+    void lock() const;
+    void unlock() const;
+    bool tryLock() const;   // Only if free right now; unlock() after a true
+    
+    // Open handles: every File from openFile() and openDir(), and every
+    // openDirIterator() iterator, holds one until it is closed. Card removal and unmount() stop new opens at once but
+    // defer ending the card until the last one is released. Code that keeps
+    // a backend descriptor or a File from getSD() open across calls
+    // (SDRecorder, SDRecordStore) acquires one itself.
+    void acquireHandle();
+    void releaseHandle();
+    uint32_t getOpenHandles() const { return open_handles; }
     
     // Diagnostics & Debug
-    int getErrorCode() const { return last_error_code; }
-    String getLastError() const { return last_error_msg; }
+    // Errors are stored per task, in its thread-local storage, not printed;
+    // the message is built on request. setErrorLogging(true) prints every
+    // error as it is set.
+    SDError getErrorCode() const;
+    const char* getErrorText() const { return sdErrorText(getErrorCode()); }
+    String getErrorDetail() const; // Usually the path involved
+    String getLastError() const;
+    void setErrorLogging(bool enable) { error_logging = enable; }
     bool stressTest(uint32_t iterations = 100);
     float readSpeedTest(size_t block_size = 4096, uint32_t iterations = 100);
     float writeSpeedTest(size_t block_size = 4096, uint32_t iterations = 100);
+    bool runBenchmark(const char* report_path = "/bench_report"); // Writes <path>.csv and <path>.json
     void dumpFsInfo();
     
     // Hot-plug & Events
     bool isInserted();
     bool isRemoved();
     void checkHotSwap(); // Call this periodically in loop()
-    void enableHotSwapDetection(bool enable = true) { hotswap_enabled = enable; }
+    void enableHotSwapDetection(bool enable = true);
     bool isHotSwapEnabled() const { return hotswap_enabled; }
     void setDebugMode(bool enable) { debug_mode = enable; }
     void onMount(std::function<void()> callback) { on_mount_callback = callback; }
@@ -85,21 +224,55 @@ public:
     // Status check
     bool isMounted() const { return mounted; }
     
-    // Get SD_MMC reference
-    fs::SDMMCFS& getSD() { return SD_MMC; }
+    // Filesystem of the current backend (SD_MMC by default, a RAM disk on the host)
+    fs::FS& getSD() { return backend->fs(); }
 
 private:
+    friend class SDTransaction;
+    friend class SDIntegrity;
+    friend class SDLogStream;
+    friend class SDHandleFileImpl;
+    
     bool mounted;
     bool auto_mount_enabled;
     bool hotswap_enabled;
     bool debug_mode;
     bool last_card_state;
     unsigned long last_hotswap_check;
-    String mount_point;
-    String current_dir;
-    int last_error_code;
-    String last_error_msg;
-    bool mode_1bit;
+    unsigned long hotswap_interval_ms;   // Grows while the slot is empty
+    uint8_t stable_probes;               // Probes in a row that found a new card
+    volatile bool cd_event;              // Set by the card-detect ISR
+    volatile unsigned long cd_change_ms;
+    char mount_point[SD_MOUNT_POINT_MAX];
+    char current_dir[SD_PATH_MAX];   // Always ends with '/'
+    bool error_logging;
+    
+    mutable StaticSemaphore_t api_lock_buffer;
+    mutable SemaphoreHandle_t api_lock;
+    SDStorageBackend* backend;
+    volatile uint32_t open_handles;
+    bool end_pending;        // backend->end() waits for open_handles to drain
+    bool exported;           // Volume owned by a USB host
+    bool mode_1bit;          // Caller forced the 1-bit bus
+    uint8_t bus_width;       // Negotiated bus width (1 or 4)
+    int bus_freq_khz;        // Negotiated clock request
+    int bus_real_freq_khz;   // Clock actually running on the bus
+    int max_bus_freq_khz;
+    volatile bool space_ready;   // space_total/space_free valid
+    TaskHandle_t space_task;     // Background free-space scan, until its walk is done
+    uint32_t space_scan_gen;     // Bumped per scan; a scan from an older mount installs nothing
+    uint64_t space_total;
+    int64_t space_free;
+    uint32_t cluster_bytes;
+    uint32_t last_delete_items;
+    unsigned long last_delete_ms;
+    SDCopyEngine copy_engine;
+    SDBlockCache block_cache;
+    MoveMethod last_move_method;
+    SDDirIndex dir_index;
+    bool dir_index_enabled;
+    bool atomic_writes;
+    std::vector<SDLogStream*> log_streams;
     
     std::function<void()> on_mount_callback;
     std::function<void()> on_unmount_callback;
@@ -107,18 +280,53 @@ private:
     std::function<void()> on_card_removed_callback;
     
     // Helper methods
-    void setError(int code, const String& msg);
+    void setError(SDError code, const char* detail = nullptr);
     void clearError();
-    String getFullPath(const char* path);
+    void endCard();
+    void checkHotSwapLocked();
     bool isAbsolutePath(const char* path);
     void triggerMountCallback();
     void triggerUnmountCallback();
     void triggerCardInsertedCallback();
     void triggerCardRemovedCallback();
-    size_t copyFileInternal(File& src, File& dst);
-    bool deleteDirectoryRecursive(const char* path);
+    void suspendLogStreams(bool flush_first);
+    void startSpaceScan();
+    void waitSpaceScan();
+    bool scanSpace();
+    static void spaceScanTask(void* arg);
+    int64_t indexedSizeOf(const char* full_path);
+    void noteSpace(int64_t old_size, int64_t new_size);
+    void resumeLogStreams();
+    bool writeFileAtomic(const char* path, const uint8_t* data, size_t len);
+    bool truncateByCopy(const char* full_path, size_t size);
+    bool replaceWithTemp(const char* full_path, size_t* old_size = nullptr);
+    bool replaceWith(const char* from_path, const char* full_path, size_t* old_size = nullptr);
+    bool recoverReplace(const char* full_path);
+    void recoverVolume();
+    uint32_t recoverReplaces();
+    bool walkDir(char* path, SDDirEntry& entry, const SDDirVisitor& visitor,
+                 const SDDirFilter& filter, uint32_t& delivered);
+    size_t copyFileInternal(File& src, File& dst, size_t max_bytes = SIZE_MAX);
+    bool deleteDirectoryRecursive(const char* path, uint32_t* items = nullptr);
     bool checkCardPresent();
+    static void cardDetectISR(void* arg);
+    bool negotiateBus(const char* mp);
+    bool beginBus(const char* mp, uint8_t width, int freq_khz, bool format_if_failed = false);
 };
 
 // Global instance (optional - user can create their own)
 extern SDMounter SDCard;
+
+// Holds the mounter's lock for a scope:
+//   { SDLock guard(SDCard); SDCard.changeDir("/logs"); SDCard.appendFile("a.txt", line); }
+class SDLock {
+public:
+    explicit SDLock(const SDMounter& sd = SDCard) : sd(sd) { sd.lock(); }
+    ~SDLock() { sd.unlock(); }
+    
+    SDLock(const SDLock&) = delete;
+    SDLock& operator=(const SDLock&) = delete;
+    
+private:
+    const SDMounter& sd;
+};
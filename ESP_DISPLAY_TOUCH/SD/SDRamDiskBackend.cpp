@@ -0,0 +1,578 @@
+#include "SDRamDiskBackend.h"
+#include <FSImpl.h>
+#include <vector>
+
+using namespace fs;
+
+// File objects handed out by fs(). A file wraps a descriptor of the RAM
+// disk, a directory wraps a listing cursor, so both see the same faults as
+// the descriptor and path calls SDMounter makes.
+class SDRamFileImpl : public FileImpl {
+public:
+    SDRamFileImpl(SDRamDiskBackend* disk, const char* path, int fd, void* dir)
+        : disk(disk), fd(fd), dir(dir), file_path(path) {
+        const char* slash = strrchr(path, '/');
+        name_offset = slash ? (slash - path) + 1 : 0;
+    }
+
+    ~SDRamFileImpl() { close(); }
+
+    size_t write(const uint8_t* buf, size_t size) {
+        int n = (fd >= 0) ? disk->write(fd, buf, size) : -1;
+        return n > 0 ? n : 0;
+    }
+
+    size_t read(uint8_t* buf, size_t size) {
+        int n = (fd >= 0) ? disk->read(fd, buf, size) : -1;
+        return n > 0 ? n : 0;
+    }
+
+    void flush() {
+        if (fd >= 0) disk->sync(fd);
+    }
+
+    bool seek(uint32_t pos, SeekMode mode) { return fd >= 0 && disk->seekHandle(fd, pos, mode); }
+    size_t position() const { return fd >= 0 ? disk->tell(fd) : 0; }
+    size_t size() const { return fd >= 0 ? disk->sizeOf(fd) : 0; }
+    bool setBufferSize(size_t size) { return true; }
+
+    void close() {
+        if (fd >= 0) {
+            disk->close(fd);
+            fd = -1;
+        }
+        if (dir) {
+            disk->closeDir(dir);
+            dir = nullptr;
+        }
+    }
+
+    time_t getLastWrite() { return 0; }
+    const char* path() const { return file_path.c_str(); }
+    const char* name() const { return file_path.c_str() + name_offset; }
+    bool isDirectory() { return dir != nullptr; }
+
+    FileImplPtr openNextFile(const char* mode) {
+        char child[SD_RAM_PATH_MAX];
+        if (!nextEntry(child, sizeof(child), nullptr)) return FileImplPtr();
+        return disk->openFile(child, mode, false);
+    }
+
+    bool seekDir(long position) {
+        char child[SD_RAM_PATH_MAX];
+        rewindDirectory();
+        while (position-- > 0) {
+            if (!nextEntry(child, sizeof(child), nullptr)) return false;
+        }
+        return true;
+    }
+
+    String getNextFileName() {
+        return getNextFileName(nullptr);
+    }
+
+    String getNextFileName(bool* is_dir) {
+        char child[SD_RAM_PATH_MAX];
+        return nextEntry(child, sizeof(child), is_dir) ? String(child) : String();
+    }
+
+    void rewindDirectory() {
+        if (!dir) return;
+        disk->closeDir(dir);
+        dir = disk->openDir(file_path.c_str());
+    }
+
+    operator bool() { return fd >= 0 || dir != nullptr; }
+
+private:
+    SDRamDiskBackend* disk;
+    int fd;
+    void* dir;
+    String file_path;
+    size_t name_offset;
+
+    // Full path of the next entry in a directory
+    bool nextEntry(char* out, size_t out_size, bool* is_dir) {
+        if (!dir) return false;
+        size_t len = (file_path == "/") ? 0 : strlcpy(out, file_path.c_str(), out_size);
+        if (len + 2 > out_size) return false;
+        out[len++] = '/';
+        return disk->readDir(dir, out + len, out_size - len, is_dir) == 1;
+    }
+};
+
+class SDRamFSImpl : public FSImpl {
+public:
+    explicit SDRamFSImpl(SDRamDiskBackend* disk) : disk(disk) {}
+
+    FileImplPtr open(const char* path, const char* mode, const bool create) {
+        return disk->openFile(path, mode, create);
+    }
+
+    bool exists(const char* path) { return disk->stat(path); }
+    bool rename(const char* from, const char* to) { return disk->rename(from, to); }
+    bool remove(const char* path) { return disk->unlink(path); }
+    bool mkdir(const char* path) { return disk->mkdir(path); }
+    bool rmdir(const char* path) { return disk->rmdir(path); }
+
+private:
+    SDRamDiskBackend* disk;
+};
+
+SDRamDiskBackend::SDRamDiskBackend(size_t capacity)
+    : capacity(capacity),
+      used_bytes(0),
+      cluster_bytes(SD_RAM_CLUSTER),
+      begun(false),
+      ram_fs(FSImplPtr(new SDRamFSImpl(this))) {
+    lock = xSemaphoreCreateRecursiveMutexStatic(&lock_buffer);
+    for (int i = 0; i < SD_RAM_MAX_HANDLES; i++) {
+        handles[i].used = false;
+    }
+}
+
+SDRamDiskBackend::~SDRamDiskBackend() {
+    for (auto& entry : nodes) {
+        release(entry.second);
+    }
+    vSemaphoreDelete(lock);
+}
+
+bool SDRamDiskBackend::begin(const char* mount_point, uint8_t bus_width, int freq_khz, bool format_if_failed) {
+    // Nothing to negotiate; a RAM disk is always formatted
+    if (isRemoved()) return false;
+    take();
+    begun = true;
+    give();
+    return true;
+}
+
+void SDRamDiskBackend::end() {
+    take();
+    begun = false;
+    give();
+}
+
+bool SDRamDiskBackend::isPresent() {
+    return begun && !isRemoved();
+}
+
+bool SDRamDiskBackend::getSpace(uint64_t& total, uint64_t& free, uint32_t& cluster) {
+    if (!begun || !inject(OP_STAT)) return false;
+
+    take();
+    total = capacity;
+    free = capacity - used_bytes;
+    cluster = cluster_bytes;
+    give();
+    return true;
+}
+
+SDFormatResult SDRamDiskBackend::format(uint32_t cluster_size, int* fs_error) {
+    if (!begun) return SD_FORMAT_NO_VOLUME;
+    if (!inject(OP_WRITE)) return SD_FORMAT_FAILED;
+
+    take();
+    if (getOpenCount() > 0) {
+        give();
+        return SD_FORMAT_FAILED;
+    }
+
+    for (auto& entry : nodes) {
+        release(entry.second);
+    }
+    nodes.clear();
+    used_bytes = 0;
+
+    // Same rule as FatFs: a power of two of at least one sector, else default
+    bool valid = (cluster_size >= 512 && (cluster_size & (cluster_size - 1)) == 0);
+    cluster_bytes = valid ? cluster_size : SD_RAM_CLUSTER;
+    give();
+    return SD_FORMAT_OK;
+}
+
+int SDRamDiskBackend::open(const char* path, SDOpenMode mode) {
+    if (!inject(OP_OPEN)) return -1;
+
+    bool reading = (mode == SD_OPEN_READ);
+    bool creating = (mode == SD_OPEN_WRITE || mode == SD_OPEN_APPEND);
+    return openHandle(path, reading, !reading, creating, mode == SD_OPEN_WRITE, mode == SD_OPEN_APPEND);
+}
+
+int SDRamDiskBackend::read(int fd, void* buffer, size_t len) {
+    if (!inject(OP_READ, len)) return -1;
+
+    take();
+    int n = -1;
+    Handle* h = handle(fd);
+    if (h && h->readable) {
+        size_t avail = (h->pos < h->node->size) ? h->node->size - h->pos : 0;
+        n = (len < avail) ? len : avail;
+        if (n > 0) memcpy(buffer, h->node->data + h->pos, n);
+        h->pos += n;
+    }
+    give();
+    return n;
+}
+
+int SDRamDiskBackend::write(int fd, const void* buffer, size_t len) {
+    if (!inject(OP_WRITE, len)) return -1;
+
+    take();
+    int n = -1;
+    Handle* h = handle(fd);
+    if (h && h->writable) {
+        if (h->append) h->pos = h->node->size;
+        size_t end = h->pos + len;
+        // Writing past the end zero-fills the gap, as on FAT
+        if (end <= h->node->size || resize(*h->node, end)) {
+            if (len > 0) memcpy(h->node->data + h->pos, buffer, len);
+            h->pos = end;
+            n = len;
+        }
+    }
+    give();
+    return n;
+}
+
+bool SDRamDiskBackend::sync(int fd) {
+    if (!inject(OP_SYNC)) return false;
+
+    take();
+    bool ok = (handle(fd) != nullptr);
+    give();
+    return ok;
+}
+
+int64_t SDRamDiskBackend::size(int fd) {
+    if (!inject(OP_STAT)) return -1;
+
+    take();
+    Handle* h = handle(fd);
+    int64_t bytes = h ? (int64_t)h->node->size : -1;
+    give();
+    return bytes;
+}
+
+void SDRamDiskBackend::close(int fd) {
+    // Never fails, so it is not subject to fault injection
+    take();
+    Handle* h = handle(fd);
+    if (h) {
+        h->node->open_count--;
+        h->used = false;
+    }
+    give();
+}
+
+bool SDRamDiskBackend::stat(const char* path, bool* is_dir, size_t* size) {
+    if (!inject(OP_STAT)) return false;
+
+    take();
+    Node* node = find(path);
+    bool found = (node != nullptr || strcmp(path, "/") == 0);
+    if (found) {
+        if (is_dir) *is_dir = !node || node->is_dir;
+        if (size) *size = node ? node->size : 0;
+    }
+    give();
+    return found;
+}
+
+bool SDRamDiskBackend::unlink(const char* path) {
+    if (!inject(OP_UNLINK)) return false;
+
+    take();
+    Node* node = find(path);
+    // FatFs refuses to remove a file that is open
+    bool ok = (node && !node->is_dir && node->open_count == 0);
+    if (ok) {
+        used_bytes -= clusters(node->size);
+        release(*node);
+        nodes.erase(String(path));
+    }
+    give();
+    return ok;
+}
+
+bool SDRamDiskBackend::rename(const char* from, const char* to) {
+    if (!inject(OP_RENAME)) return false;
+
+    take();
+    String src(from);
+    String src_prefix = src + "/";
+    bool ok = (find(from) && !find(to) && parentIsDir(to) && !String(to).startsWith(src_prefix));
+
+    // A directory moves with everything under it, none of which may be open
+    std::vector<String> moved;
+    if (ok) {
+        moved.push_back(src);
+        for (auto it = nodes.lower_bound(src_prefix); it != nodes.end() && it->first.startsWith(src_prefix); ++it) {
+            moved.push_back(it->first);
+        }
+        for (const String& key : moved) {
+            if (nodes[key].open_count > 0) ok = false;
+        }
+    }
+
+    if (ok) {
+        for (const String& key : moved) {
+            nodes[String(to) + key.substring(src.length())] = nodes[key];
+            nodes.erase(key);
+        }
+    }
+    give();
+    return ok;
+}
+
+bool SDRamDiskBackend::mkdir(const char* path) {
+    if (!inject(OP_MKDIR)) return false;
+
+    take();
+    // A directory takes a cluster for its entries, as on FAT
+    bool ok = (strcmp(path, "/") != 0 && !find(path) && parentIsDir(path) &&
+               used_bytes + cluster_bytes <= capacity);
+    if (ok) {
+        nodes[String(path)] = {true, nullptr, 0, 0, 0};
+        used_bytes += cluster_bytes;
+    }
+    give();
+    return ok;
+}
+
+bool SDRamDiskBackend::rmdir(const char* path) {
+    if (!inject(OP_RMDIR)) return false;
+
+    take();
+    Node* node = find(path);
+    bool ok = (node && node->is_dir && !hasChildren(String(path)));
+    if (ok) {
+        nodes.erase(String(path));
+        used_bytes -= cluster_bytes;
+    }
+    give();
+    return ok;
+}
+
+bool SDRamDiskBackend::truncate(const char* path, size_t size) {
+    if (!inject(OP_TRUNCATE)) return false;
+
+    take();
+    Node* node = find(path);
+    bool ok = (node && !node->is_dir && resize(*node, size));
+    give();
+    return ok;
+}
+
+void* SDRamDiskBackend::openDir(const char* path) {
+    if (!inject(OP_LIST)) return nullptr;
+
+    take();
+    Node* node = find(path);
+    DirCursor* cursor = nullptr;
+    if (strcmp(path, "/") == 0) {
+        cursor = new DirCursor{String("/"), String()};
+    } else if (node && node->is_dir) {
+        cursor = new DirCursor{String(path) + "/", String()};
+    }
+    give();
+    return cursor;
+}
+
+int SDRamDiskBackend::readDir(void* dir, char* name, size_t name_size, bool* is_dir) {
+    if (!inject(OP_LIST)) return -1;
+
+    DirCursor* cursor = (DirCursor*)dir;
+    take();
+    // Resume after the last name returned, so entries deleted during the
+    // listing do not make it skip or repeat any
+    auto it = cursor->last.length() ? nodes.upper_bound(cursor->last) : nodes.lower_bound(cursor->prefix);
+    int result = 0;
+    for (; it != nodes.end() && it->first.startsWith(cursor->prefix); ++it) {
+        const char* entry = it->first.c_str() + cursor->prefix.length();
+        if (strchr(entry, '/')) continue;   // Inside a subdirectory
+
+        result = (strlcpy(name, entry, name_size) < name_size) ? 1 : -1;
+        if (is_dir) *is_dir = it->second.is_dir;
+        cursor->last = it->first;
+        break;
+    }
+    give();
+    return result;
+}
+
+void SDRamDiskBackend::closeDir(void* dir) {
+    delete (DirCursor*)dir;
+}
+
+uint32_t SDRamDiskBackend::getOpenCount() const {
+    take();
+    uint32_t count = 0;
+    for (int i = 0; i < SD_RAM_MAX_HANDLES; i++) {
+        if (handles[i].used) count++;
+    }
+    give();
+    return count;
+}
+
+// Private helper methods
+void SDRamDiskBackend::take() const {
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+}
+
+void SDRamDiskBackend::give() const {
+    xSemaphoreGiveRecursive(lock);
+}
+
+SDRamDiskBackend::Node* SDRamDiskBackend::find(const char* path) {
+    auto it = nodes.find(String(path));
+    return (it != nodes.end()) ? &it->second : nullptr;
+}
+
+bool SDRamDiskBackend::parentIsDir(const char* path) {
+    const char* slash = strrchr(path, '/');
+    if (!slash) return false;
+    if (slash == path) return true;     // Parent is the root
+
+    Node* parent = find(String(path).substring(0, slash - path).c_str());
+    return parent && parent->is_dir;
+}
+
+bool SDRamDiskBackend::hasChildren(const String& dir) {
+    String prefix = dir + "/";
+    auto it = nodes.lower_bound(prefix);
+    return it != nodes.end() && it->first.startsWith(prefix);
+}
+
+uint64_t SDRamDiskBackend::clusters(size_t bytes) const {
+    return (uint64_t)((bytes + cluster_bytes - 1) / cluster_bytes) * cluster_bytes;
+}
+
+bool SDRamDiskBackend::resize(Node& node, size_t new_size) {
+    uint64_t old_use = clusters(node.size);
+    uint64_t new_use = clusters(new_size);
+    if (new_use > old_use && used_bytes - old_use + new_use > capacity) return false;
+
+    if (new_size == 0) {
+        release(node);
+    } else if (new_size > node.alloc) {
+        // Grow geometrically so appends stay cheap; fall back to the exact size
+        size_t alloc = (node.alloc * 2 > new_size) ? node.alloc * 2 : new_size;
+        uint8_t* data = (uint8_t*)realloc(node.data, alloc);
+        if (!data && alloc > new_size) {
+            alloc = new_size;
+            data = (uint8_t*)realloc(node.data, alloc);
+        }
+        if (!data) return false;
+        node.data = data;
+        node.alloc = alloc;
+    }
+
+    if (new_size > node.size) {
+        memset(node.data + node.size, 0, new_size - node.size);
+    }
+    node.size = new_size;
+    used_bytes = used_bytes - old_use + new_use;
+    return true;
+}
+
+void SDRamDiskBackend::release(Node& node) {
+    free(node.data);
+    node.data = nullptr;
+    node.alloc = 0;
+}
+
+SDRamDiskBackend::Handle* SDRamDiskBackend::handle(int fd) {
+    if (fd < 0 || fd >= SD_RAM_MAX_HANDLES || !handles[fd].used) return nullptr;
+    return &handles[fd];
+}
+
+int SDRamDiskBackend::openHandle(const char* path, bool readable, bool writable, bool create, bool truncate, bool append) {
+    take();
+    int fd = -1;
+    for (int i = 0; i < SD_RAM_MAX_HANDLES; i++) {
+        if (!handles[i].used) {
+            fd = i;
+            break;
+        }
+    }
+
+    Node* node = find(path);
+    if (fd >= 0 && !node && create && parentIsDir(path)) {
+        // An empty file has no clusters yet
+        node = &nodes[String(path)];
+        *node = {false, nullptr, 0, 0, 0};
+    }
+
+    if (fd < 0 || !node || node->is_dir) {
+        give();
+        return -1;
+    }
+
+    if (truncate) resize(*node, 0);
+    node->open_count++;
+    handles[fd] = {node, 0, true, readable, writable, append};
+    give();
+    return fd;
+}
+
+FileImplPtr SDRamDiskBackend::openFile(const char* path, const char* mode, bool create) {
+    take();
+    Node* node = find(path);
+    bool is_dir = (strcmp(path, "/") == 0) || (node && node->is_dir);
+    give();
+
+    if (is_dir) {
+        void* dir = openDir(path);
+        return dir ? FileImplPtr(new SDRamFileImpl(this, path, -1, dir)) : FileImplPtr();
+    }
+
+    // Arduino modes: "r", "w", "a", each with an optional "+"
+    char m = mode[0];
+    bool plus = (strchr(mode, '+') != nullptr);
+    if (create && m != 'r') {
+        // Like VFSImpl, create missing parent directories
+        char parent[SD_RAM_PATH_MAX];
+        strlcpy(parent, path, sizeof(parent));
+        for (char* slash = strchr(parent + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+            *slash = '\0';
+            if (!stat(parent)) mkdir(parent);
+            *slash = '/';
+        }
+    }
+
+    if (!inject(OP_OPEN)) return FileImplPtr();
+    int fd = openHandle(path, m == 'r' || plus, m != 'r' || plus, m != 'r', m == 'w', m == 'a');
+    return (fd >= 0) ? FileImplPtr(new SDRamFileImpl(this, path, fd, nullptr)) : FileImplPtr();
+}
+
+bool SDRamDiskBackend::seekHandle(int fd, int64_t pos, SeekMode mode) {
+    take();
+    Handle* h = handle(fd);
+    bool ok = false;
+    if (h) {
+        int64_t base = (mode == SeekSet) ? 0 : (mode == SeekCur) ? (int64_t)h->pos : (int64_t)h->node->size;
+        if (base + pos >= 0) {
+            h->pos = base + pos;
+            ok = true;
+        }
+    }
+    give();
+    return ok;
+}
+
+size_t SDRamDiskBackend::tell(int fd) {
+    take();
+    Handle* h = handle(fd);
+    size_t pos = h ? h->pos : 0;
+    give();
+    return pos;
+}
+
+size_t SDRamDiskBackend::sizeOf(int fd) {
+    take();
+    Handle* h = handle(fd);
+    size_t bytes = h ? h->node->size : 0;
+    give();
+    return bytes;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <map>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "SDStorageBackend.h"
+
+// A volume held in RAM (PSRAM when malloc places large blocks there).
+// Behaves like a FAT card as far as SDMounter can tell: space is counted
+// in clusters, open files cannot be deleted or renamed, and the contents
+// survive end()/begin() the way a card keeps them across a remount. Every
+// operation, including File access through fs(), goes through the fault
+// injection of SDStorageBackend.
+//
+//   SDRamDiskBackend ramdisk(2 * 1024 * 1024);
+//   SDCard.setBackend(ramdisk);
+//   SDCard.mount();
+
+#define SD_RAM_MAX_HANDLES 16
+#define SD_RAM_CLUSTER     512      // Default allocation unit for space figures
+#define SD_RAM_PATH_MAX    272      // Volume path, with room for temp suffixes
+
+class SDRamDiskBackend : public SDStorageBackend {
+public:
+    explicit SDRamDiskBackend(size_t capacity = 1024 * 1024);
+    ~SDRamDiskBackend();
+
+    const char* name() const { return "RAMDISK"; }
+
+    bool begin(const char* mount_point, uint8_t bus_width, int freq_khz, bool format_if_failed);
+    void end();
+    bool isPresent();
+    fs::FS& fs() { return ram_fs; }
+    uint64_t cardSize() { return capacity; }
+    bool getSpace(uint64_t& total, uint64_t& free, uint32_t& cluster);
+    SDFormatResult format(uint32_t cluster_size, int* fs_error = nullptr);
+
+    int open(const char* path, SDOpenMode mode);
+    int read(int fd, void* buffer, size_t len);
+    int write(int fd, const void* buffer, size_t len);
+    bool sync(int fd);
+    int64_t size(int fd);
+    void close(int fd);
+
+    bool stat(const char* path, bool* is_dir = nullptr, size_t* size = nullptr);
+    bool unlink(const char* path);
+    bool rename(const char* from, const char* to);
+    bool mkdir(const char* path);
+    bool rmdir(const char* path);
+    bool truncate(const char* path, size_t size);
+
+    void* openDir(const char* path);
+    int readDir(void* dir, char* name, size_t name_size, bool* is_dir);
+    void closeDir(void* dir);
+
+    uint64_t getUsedBytes() const { return used_bytes; }
+    uint32_t getOpenCount() const;
+
+private:
+    friend class SDRamFSImpl;
+    friend class SDRamFileImpl;
+
+    struct Node {
+        bool is_dir;
+        uint8_t* data;
+        size_t size;
+        size_t alloc;
+        uint16_t open_count;
+    };
+
+    struct Handle {
+        Node* node;
+        size_t pos;
+        bool used;
+        bool readable;
+        bool writable;
+        bool append;
+    };
+
+    struct DirCursor {
+        String prefix;      // Directory path with trailing '/'
+        String last;        // Last entry returned, "" before the first
+    };
+
+    std::map<String, Node> nodes;   // Keyed by volume path; "/" is implicit
+    Handle handles[SD_RAM_MAX_HANDLES];
+    size_t capacity;
+    uint64_t used_bytes;
+    uint32_t cluster_bytes;
+    bool begun;
+    StaticSemaphore_t lock_buffer;
+    SemaphoreHandle_t lock;
+    fs::FS ram_fs;
+
+    // Private helper methods
+    void take() const;
+    void give() const;
+    Node* find(const char* path);
+    bool parentIsDir(const char* path);
+    bool hasChildren(const String& dir);
+    uint64_t clusters(size_t bytes) const;
+    bool resize(Node& node, size_t new_size);
+    void release(Node& node);
+    Handle* handle(int fd);
+    int openHandle(const char* path, bool readable, bool writable, bool create, bool truncate, bool append);
+    fs::FileImplPtr openFile(const char* path, const char* mode, bool create);
+    bool seekHandle(int fd, int64_t pos, fs::SeekMode mode);
+    size_t tell(int fd);
+    size_t sizeOf(int fd);
+};
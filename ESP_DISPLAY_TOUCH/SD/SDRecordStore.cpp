@@ -0,0 +1,606 @@
+#include "SDRecordStore.h"
+#include "SDMounter.h"
+#include "SDCrc.h"
+#include <algorithm>
+#if defined(ESP_PLATFORM)
+#include <esp_random.h>
+#endif
+
+#define SD_RECORD_MAGIC         0x31524453  // "SDR1"
+#define SD_RECORD_INDEX_MAGIC   0x49524453  // "SDRI"
+#define SD_RECORD_VERSION       1
+#define SD_RECORD_HEADER_SIZE   32
+#define SD_RECORD_SLOT_EXTRA    12          // seq + timestamp + CRC
+#define SD_RECORD_READ_BATCH    4096
+
+struct SegmentHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t segment_id;
+    uint32_t salt;
+    uint32_t first_seq;
+    uint32_t reserved[2];
+    uint32_t crc;
+};
+
+struct IndexHeader {
+    uint32_t magic;
+    uint32_t segment_id;
+    uint32_t salt;
+    uint32_t first_seq;
+    uint32_t count;
+    uint32_t first_ts;
+    uint32_t last_ts;
+    uint32_t entries;
+    uint32_t crc;           // Over this header (crc = 0) and the entries
+};
+
+static_assert(sizeof(SegmentHeader) == SD_RECORD_HEADER_SIZE, "segment header layout");
+
+static uint32_t randomSalt() {
+#if defined(ESP_PLATFORM)
+    return esp_random();
+#else
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand() ^ (uint32_t)micros();
+#endif
+}
+
+SDRecordStore::SDRecordStore()
+    : fs(nullptr),
+      mounter(nullptr),
+      truncate_fn(nullptr),
+      slot_buffer(nullptr),
+      slot_size(0),
+      slots_per_segment(0),
+      recovered_bytes(0),
+      dirty(false) {
+}
+
+SDRecordStore::~SDRecordStore() {
+    end();
+}
+
+bool SDRecordStore::begin(SDMounter& sd, const char* store_dir, const SDRecordStoreConfig& store_config) {
+    SDMounter* owner = &sd;
+    bool ok = begin(sd.getSD(), store_dir, store_config, [owner](const char* path, size_t size) {
+        return owner->truncateFile(path, size);
+    });
+
+    // Segments are opened through getSD(), which counts no handles, and
+    // the head stays open until end()
+    if (ok) {
+        mounter = owner;
+        mounter->acquireHandle();
+    }
+    return ok;
+}
+
+bool SDRecordStore::begin(fs::FS& filesystem, const char* store_dir, const SDRecordStoreConfig& store_config,
+                          SDTruncateFunction truncate) {
+    end();
+
+    if (store_config.record_size == 0 || store_config.record_size > SD_RECORD_MAX_SIZE) {
+        Serial.printf("[SDRecordStore] Invalid record size %u\n", store_config.record_size);
+        return false;
+    }
+
+    config = store_config;
+    if (config.index_stride == 0) config.index_stride = 1;
+    slot_size = config.record_size + SD_RECORD_SLOT_EXTRA;
+    if (config.segment_bytes < SD_RECORD_HEADER_SIZE + slot_size) {
+        Serial.println("[SDRecordStore] Segment too small for one record");
+        return false;
+    }
+    slots_per_segment = (config.segment_bytes - SD_RECORD_HEADER_SIZE) / slot_size;
+
+    fs = &filesystem;
+    truncate_fn = truncate;
+    dir = store_dir;
+    while (dir.length() > 1 && dir.endsWith("/")) {
+        dir.remove(dir.length() - 1);
+    }
+    recovered_bytes = 0;
+    dirty = false;
+
+    slot_buffer = (uint8_t*)malloc(slot_size);
+    if (!slot_buffer) {
+        end();
+        return false;
+    }
+
+    if (!fs->exists(dir.c_str()) && !fs->mkdir(dir.c_str())) {
+        Serial.printf("[SDRecordStore] Failed to create %s\n", dir.c_str());
+        end();
+        return false;
+    }
+
+    // Collect segment ids; names are seg_XXXXXXXX.rec
+    std::vector<uint32_t> ids;
+    File root = fs->open(dir.c_str());
+    if (root && root.isDirectory()) {
+        File file = root.openNextFile();
+        while (file) {
+            const char* name = strrchr(file.name(), '/');
+            name = name ? name + 1 : file.name();
+            unsigned int id;
+            char ext[4] = {0};
+            if (!file.isDirectory() && strlen(name) == 16 &&
+                sscanf(name, "seg_%8x.%3s", &id, ext) == 2 && strcmp(ext, "rec") == 0) {
+                ids.push_back(id);
+            }
+            file.close();
+            file = root.openNextFile();
+        }
+    }
+    if (root) root.close();
+    std::sort(ids.begin(), ids.end());
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (!loadSegment(ids[i], i == ids.size() - 1)) {
+            Serial.printf("[SDRecordStore] Skipping unreadable segment %08x\n", (unsigned)ids[i]);
+        }
+    }
+
+    if (segments.empty()) {
+        uint32_t next_id = ids.empty() ? 1 : ids.back() + 1;
+        if (!createSegment(next_id, 0)) {
+            end();
+            return false;
+        }
+    } else {
+        head = fs->open(segmentPath(segments.back().id, "rec").c_str(), "r+");
+        if (!head) {
+            Serial.println("[SDRecordStore] Failed to open head segment");
+            end();
+            return false;
+        }
+    }
+
+    applyRetention();
+
+    Serial.printf("[SDRecordStore] %s: %u records in %u segments", dir.c_str(),
+                  (unsigned)getRecordCount(), (unsigned)segments.size());
+    if (recovered_bytes) {
+        Serial.printf(", dropped %u byte torn tail", (unsigned)recovered_bytes);
+    }
+    Serial.println();
+    return true;
+}
+
+void SDRecordStore::end() {
+    if (head) {
+        if (dirty) head.flush();
+        head.close();
+    }
+    if (slot_buffer) {
+        free(slot_buffer);
+        slot_buffer = nullptr;
+    }
+    segments.clear();
+    dirty = false;
+    fs = nullptr;
+
+    if (mounter) {
+        mounter->releaseHandle();
+        mounter = nullptr;
+    }
+}
+
+bool SDRecordStore::append(uint32_t timestamp, const void* record) {
+    if (!fs || !head) return false;
+
+    if (getRecordCount() > 0 && timestamp < getLastTimestamp()) {
+        Serial.println("[SDRecordStore] Timestamp went backwards, record rejected");
+        return false;
+    }
+
+    if (segments.back().count >= slots_per_segment) {
+        const Segment& full = segments.back();
+        uint32_t next_id = full.id + 1;
+        uint32_t next_seq = full.first_seq + full.count;
+        if (!sealHead() || !createSegment(next_id, next_seq)) {
+            return false;
+        }
+        applyRetention();
+    }
+
+    Segment& seg = segments.back();
+    uint32_t seq = seg.first_seq + seg.count;
+    memcpy(slot_buffer, &seq, 4);
+    memcpy(slot_buffer + 4, &timestamp, 4);
+    memcpy(slot_buffer + 8, record, config.record_size);
+    uint32_t crc = sdCrc32(slot_buffer, 8 + config.record_size, seg.salt);
+    memcpy(slot_buffer + 8 + config.record_size, &crc, 4);
+
+    if (!head.seek(slotOffset(seg.count)) || head.write(slot_buffer, slot_size) != slot_size) {
+        Serial.println("[SDRecordStore] Record write failed");
+        return false;
+    }
+
+    noteIndex(seg, seg.count, timestamp);
+    seg.count++;
+    dirty = true;
+    return true;
+}
+
+bool SDRecordStore::flush() {
+    if (!head) return false;
+    if (dirty) {
+        head.flush();
+        dirty = false;
+    }
+    return true;
+}
+
+uint32_t SDRecordStore::query(uint32_t from, uint32_t to, SDRecordVisitor visitor) {
+    if (!fs || from > to) return 0;
+
+    size_t batch_slots = SD_RECORD_READ_BATCH / slot_size;
+    if (batch_slots == 0) batch_slots = 1;
+    std::vector<uint8_t> batch(batch_slots * slot_size);
+
+    uint32_t visited = 0;
+    for (size_t s = 0; s < segments.size(); s++) {
+        const Segment& seg = segments[s];
+        if (seg.count == 0 || seg.last_ts < from) continue;
+        if (seg.first_ts > to) break;
+
+        // Start at the last sparse entry strictly before 'from'
+        uint32_t slot = 0;
+        auto it = std::lower_bound(seg.index.begin(), seg.index.end(), from,
+                                   [](const IndexEntry& e, uint32_t ts) { return e.timestamp < ts; });
+        if (it != seg.index.begin()) {
+            slot = (it - 1)->record;
+        }
+
+        // The head is read through its own handle so unflushed records are seen
+        bool is_head = (s == segments.size() - 1);
+        File file;
+        if (!is_head) {
+            file = fs->open(segmentPath(seg.id, "rec").c_str(), "r");
+            if (!file) continue;
+        }
+        File& src = is_head ? head : file;
+
+        while (slot < seg.count) {
+            size_t n = seg.count - slot;
+            if (n > batch_slots) n = batch_slots;
+            if (!src.seek(slotOffset(slot)) || src.read(batch.data(), n * slot_size) != n * slot_size) {
+                break;
+            }
+
+            for (size_t i = 0; i < n; i++, slot++) {
+                const uint8_t* data = batch.data() + i * slot_size;
+                uint32_t ts;
+                if (!verifySlot(seg, slot, data, ts)) {
+                    Serial.printf("[SDRecordStore] Bad record %u in segment %08x\n",
+                                  (unsigned)slot, (unsigned)seg.id);
+                    slot = seg.count;
+                    break;
+                }
+                if (ts < from) continue;
+                if (ts > to) {
+                    if (file) file.close();
+                    return visited; // Timestamps only grow, nothing later can match
+                }
+                visited++;
+                if (!visitor(ts, data + 8)) {
+                    if (file) file.close();
+                    return visited;
+                }
+            }
+        }
+
+        if (file) file.close();
+    }
+
+    return visited;
+}
+
+uint32_t SDRecordStore::getRecordCount() const {
+    uint32_t count = 0;
+    for (const Segment& seg : segments) {
+        count += seg.count;
+    }
+    return count;
+}
+
+uint32_t SDRecordStore::getTotalBytes() const {
+    uint32_t bytes = 0;
+    for (const Segment& seg : segments) {
+        bytes += seg.file_bytes;
+    }
+    return bytes;
+}
+
+uint32_t SDRecordStore::getFirstTimestamp() const {
+    for (const Segment& seg : segments) {
+        if (seg.count) return seg.first_ts;
+    }
+    return 0;
+}
+
+uint32_t SDRecordStore::getLastTimestamp() const {
+    for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+        if (it->count) return it->last_ts;
+    }
+    return 0;
+}
+
+// Private helper methods
+String SDRecordStore::segmentPath(uint32_t id, const char* ext) const {
+    char name[24];
+    snprintf(name, sizeof(name), "/seg_%08x.%s", (unsigned)id, ext);
+    return (dir == "/") ? String(name) : dir + name;
+}
+
+uint32_t SDRecordStore::slotOffset(uint32_t slot) const {
+    return SD_RECORD_HEADER_SIZE + slot * slot_size;
+}
+
+bool SDRecordStore::createSegment(uint32_t id, uint32_t first_seq) {
+    String path = segmentPath(id, "rec");
+
+    SegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SD_RECORD_MAGIC;
+    header.version = SD_RECORD_VERSION;
+    header.record_size = config.record_size;
+    header.segment_id = id;
+    header.salt = randomSalt();
+    header.first_seq = first_seq;
+    header.crc = sdCrc32(&header, offsetof(SegmentHeader, crc));
+
+    File file = fs->open(path.c_str(), FILE_WRITE);
+    if (!file) {
+        Serial.printf("[SDRecordStore] Failed to create %s\n", path.c_str());
+        return false;
+    }
+
+    bool ok = file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+
+    // Preallocate: writing the last byte makes the filesystem allocate the
+    // whole cluster chain now instead of one cluster at a time while logging
+    uint8_t zero = 0;
+    ok = ok && file.seek(config.segment_bytes - 1) && file.write(&zero, 1) == 1;
+    file.close();
+
+    if (!ok) {
+        Serial.printf("[SDRecordStore] Failed to preallocate %s\n", path.c_str());
+        fs->remove(path.c_str());
+        return false;
+    }
+
+    fs->remove(segmentPath(id, "idx").c_str()); // Leftover from an earlier id wrap
+
+    head = fs->open(path.c_str(), "r+");
+    if (!head) return false;
+
+    Segment seg;
+    seg.id = id;
+    seg.salt = header.salt;
+    seg.first_seq = first_seq;
+    seg.count = 0;
+    seg.first_ts = 0;
+    seg.last_ts = 0;
+    seg.file_bytes = config.segment_bytes;
+    segments.push_back(seg);
+    dirty = false;
+    return true;
+}
+
+bool SDRecordStore::loadSegment(uint32_t id, bool is_head) {
+    String path = segmentPath(id, "rec");
+    File file = fs->open(path.c_str(), "r");
+    if (!file) return false;
+
+    Segment seg;
+    seg.id = id;
+    if (!readHeader(file, seg)) {
+        file.close();
+        return false;
+    }
+    seg.file_bytes = file.size();
+
+    if (!is_head && loadIndex(seg)) {
+        file.close();
+        segments.push_back(seg);
+        return true;
+    }
+
+    scanSegment(file, seg);
+
+    // A slot carrying the next sequence number that failed its CRC is a
+    // record torn by a reset or card pull
+    uint32_t valid_end = slotOffset(seg.count);
+    if (is_head && seg.count < slots_per_segment && valid_end + slot_size <= seg.file_bytes) {
+        uint32_t seq = 0;
+        if (file.seek(valid_end) && file.read((uint8_t*)&seq, 4) == 4 &&
+            seq == seg.first_seq + seg.count) {
+            recovered_bytes += slot_size;
+        }
+    }
+    file.close();
+
+    if (is_head) {
+        // Cut back to the last valid record, then restore the preallocation
+        if (truncate_fn && seg.file_bytes > valid_end && truncate_fn(path.c_str(), valid_end)) {
+            File grow = fs->open(path.c_str(), "r+");
+            if (grow) {
+                uint8_t zero = 0;
+                grow.seek(config.segment_bytes - 1);
+                grow.write(&zero, 1);
+                grow.close();
+            }
+        } else if (valid_end + slot_size <= seg.file_bytes) {
+            // No truncate available: make sure the slot after the last
+            // record can never verify
+            File wipe = fs->open(path.c_str(), "r+");
+            if (wipe) {
+                memset(slot_buffer, 0, slot_size);
+                wipe.seek(valid_end);
+                wipe.write(slot_buffer, slot_size);
+                wipe.close();
+            }
+        }
+        seg.file_bytes = config.segment_bytes;
+    } else {
+        // Sealed segment from a crash during rotation: trim and save its index
+        if (truncate_fn && seg.file_bytes > valid_end && truncate_fn(path.c_str(), valid_end)) {
+            seg.file_bytes = valid_end;
+        }
+        saveIndex(seg);
+    }
+
+    segments.push_back(seg);
+    return true;
+}
+
+bool SDRecordStore::readHeader(File& file, Segment& seg) {
+    SegmentHeader header;
+    if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header)) return false;
+    if (header.magic != SD_RECORD_MAGIC || header.version != SD_RECORD_VERSION) return false;
+    if (header.crc != sdCrc32(&header, offsetof(SegmentHeader, crc))) return false;
+    if (header.record_size != config.record_size || header.segment_id != seg.id) {
+        Serial.printf("[SDRecordStore] Segment %08x has record size %u, expected %u\n",
+                      (unsigned)seg.id, header.record_size, config.record_size);
+        return false;
+    }
+
+    seg.salt = header.salt;
+    seg.first_seq = header.first_seq;
+    seg.count = 0;
+    seg.first_ts = 0;
+    seg.last_ts = 0;
+    seg.index.clear();
+    return true;
+}
+
+bool SDRecordStore::scanSegment(File& file, Segment& seg) {
+    size_t batch_slots = SD_RECORD_READ_BATCH / slot_size;
+    if (batch_slots == 0) batch_slots = 1;
+    std::vector<uint8_t> batch(batch_slots * slot_size);
+
+    uint32_t slot = 0;
+    while (slot < slots_per_segment) {
+        size_t n = slots_per_segment - slot;
+        if (n > batch_slots) n = batch_slots;
+        if (!file.seek(slotOffset(slot))) break;
+        size_t got = file.read(batch.data(), n * slot_size) / slot_size;
+
+        for (size_t i = 0; i < got; i++, slot++) {
+            uint32_t ts;
+            if (!verifySlot(seg, slot, batch.data() + i * slot_size, ts)) {
+                return true;
+            }
+            noteIndex(seg, slot, ts);
+            seg.count++;
+        }
+        if (got < n) break;
+    }
+
+    return true;
+}
+
+bool SDRecordStore::verifySlot(const Segment& seg, uint32_t slot, const uint8_t* data, uint32_t& timestamp) const {
+    uint32_t seq, crc;
+    memcpy(&seq, data, 4);
+    if (seq != seg.first_seq + slot) return false;
+
+    memcpy(&crc, data + 8 + config.record_size, 4);
+    if (crc != sdCrc32(data, 8 + config.record_size, seg.salt)) return false;
+
+    memcpy(&timestamp, data + 4, 4);
+    return true;
+}
+
+void SDRecordStore::noteIndex(Segment& seg, uint32_t slot, uint32_t timestamp) {
+    if (slot == 0) seg.first_ts = timestamp;
+    seg.last_ts = timestamp;
+    if (slot % config.index_stride == 0) {
+        seg.index.push_back({timestamp, slot});
+    }
+}
+
+bool SDRecordStore::loadIndex(Segment& seg) {
+    File file = fs->open(segmentPath(seg.id, "idx").c_str(), "r");
+    if (!file) return false;
+
+    IndexHeader header;
+    bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              header.magic == SD_RECORD_INDEX_MAGIC && header.segment_id == seg.id &&
+              header.salt == seg.salt && header.first_seq == seg.first_seq &&
+              header.count <= slots_per_segment &&
+              header.entries <= slots_per_segment / config.index_stride + 1;
+
+    if (ok) {
+        uint32_t stored_crc = header.crc;
+        header.crc = 0;
+        seg.index.resize(header.entries);
+        size_t bytes = header.entries * sizeof(IndexEntry);
+        ok = file.read((uint8_t*)seg.index.data(), bytes) == bytes &&
+             sdCrc32(seg.index.data(), bytes, sdCrc32(&header, sizeof(header))) == stored_crc;
+    }
+    file.close();
+
+    if (!ok) {
+        seg.index.clear();
+        return false;
+    }
+
+    seg.count = header.count;
+    seg.first_ts = header.first_ts;
+    seg.last_ts = header.last_ts;
+    return true;
+}
+
+void SDRecordStore::saveIndex(const Segment& seg) {
+    IndexHeader header;
+    header.magic = SD_RECORD_INDEX_MAGIC;
+    header.segment_id = seg.id;
+    header.salt = seg.salt;
+    header.first_seq = seg.first_seq;
+    header.count = seg.count;
+    header.first_ts = seg.first_ts;
+    header.last_ts = seg.last_ts;
+    header.entries = seg.index.size();
+    header.crc = 0;
+
+    size_t bytes = seg.index.size() * sizeof(IndexEntry);
+    header.crc = sdCrc32(seg.index.data(), bytes, sdCrc32(&header, sizeof(header)));
+
+    File file = fs->open(segmentPath(seg.id, "idx").c_str(), FILE_WRITE);
+    if (!file) return; // Not fatal, begin() rescans the segment instead
+    file.write((const uint8_t*)&header, sizeof(header));
+    file.write((const uint8_t*)seg.index.data(), bytes);
+    file.close();
+}
+
+bool SDRecordStore::sealHead() {
+    Segment& seg = segments.back();
+    head.flush();
+    head.close();
+    dirty = false;
+
+    // Give back the unused preallocation (only a partial slot at most)
+    uint32_t valid_end = slotOffset(seg.count);
+    if (truncate_fn && seg.file_bytes > valid_end &&
+        truncate_fn(segmentPath(seg.id, "rec").c_str(), valid_end)) {
+        seg.file_bytes = valid_end;
+    }
+
+    saveIndex(seg);
+    return true;
+}
+
+void SDRecordStore::applyRetention() {
+    while (segments.size() > 1 && getTotalBytes() > config.max_total_bytes) {
+        const Segment& oldest = segments.front();
+        Serial.printf("[SDRecordStore] Retention: dropping segment %08x (%u records)\n",
+                      (unsigned)oldest.id, (unsigned)oldest.count);
+        fs->remove(segmentPath(oldest.id, "rec").c_str());
+        fs->remove(segmentPath(oldest.id, "idx").c_str());
+        segments.erase(segments.begin());
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <functional>
+#include <vector>
+
+class SDMounter;
+
+// Append-only store for fixed-size binary records (telemetry samples).
+// Records live in segment files <dir>/seg_XXXXXXXX.rec that are preallocated
+// to their full size when created:
+//
+//   header (32 bytes)  magic, version, record size, segment id, salt, first seq, CRC
+//   slot * N           seq (4) | timestamp (4) | record | CRC32 (4)
+//
+// The slot CRC is seeded with the segment's random salt and covers the
+// sequence number, so preallocated space holding stale data never verifies.
+// On begin() the newest segment is scanned and cut back to its last valid
+// record, which is all the recovery a torn write needs.
+//
+// Every index_stride-th record goes into a sparse in-RAM time index; sealed
+// segments save theirs to seg_XXXXXXXX.idx so begin() does not rescan them.
+// Timestamps must not go backwards.
+//
+// Only fs::FS is used for I/O, so the store runs against any filesystem,
+// including a host-side one for tests. Truncation is not part of fs::FS and
+// is passed in as a callback (begin(SDMounter&, ...) wires up truncateFile).
+
+#define SD_RECORD_MAX_SIZE  1024
+
+struct SDRecordStoreConfig {
+    uint16_t record_size = 32;                  // Payload bytes per record
+    uint32_t segment_bytes = 1024 * 1024;       // Preallocated size of each segment
+    uint32_t max_total_bytes = 16 * 1024 * 1024; // Retention: oldest segments go first
+    uint16_t index_stride = 64;                 // Records per sparse index entry
+};
+
+// Return false to stop the query
+typedef std::function<bool(uint32_t timestamp, const uint8_t* record)> SDRecordVisitor;
+typedef std::function<bool(const char* path, size_t size)> SDTruncateFunction;
+
+class SDRecordStore {
+public:
+    SDRecordStore();
+    ~SDRecordStore();
+
+    bool begin(SDMounter& sd, const char* dir, const SDRecordStoreConfig& config = SDRecordStoreConfig());
+    bool begin(fs::FS& fs, const char* dir, const SDRecordStoreConfig& config = SDRecordStoreConfig(),
+               SDTruncateFunction truncate = nullptr);
+    void end();
+
+    bool append(uint32_t timestamp, const void* record);
+    template <typename T>
+    bool append(uint32_t timestamp, const T& record) {
+        return sizeof(T) == config.record_size && append(timestamp, (const void*)&record);
+    }
+    bool flush();   // Make appended records durable
+
+    // Visit records with from <= timestamp <= to, oldest first.
+    // Returns the number of records visited.
+    uint32_t query(uint32_t from, uint32_t to, SDRecordVisitor visitor);
+
+    // Stats
+    uint32_t getRecordCount() const;
+    uint32_t getSegmentCount() const { return segments.size(); }
+    uint32_t getTotalBytes() const;
+    uint32_t getRecoveredBytes() const { return recovered_bytes; } // Torn tail dropped at begin()
+    uint32_t getFirstTimestamp() const;
+    uint32_t getLastTimestamp() const;
+
+private:
+    struct IndexEntry {
+        uint32_t timestamp;
+        uint32_t record;    // Slot number inside the segment
+    };
+
+    struct Segment {
+        uint32_t id;
+        uint32_t salt;
+        uint32_t first_seq;
+        uint32_t count;
+        uint32_t first_ts;
+        uint32_t last_ts;
+        uint32_t file_bytes;
+        std::vector<IndexEntry> index;
+    };
+
+    fs::FS* fs;
+    SDMounter* mounter;     // Holds a handle when opened through SDMounter
+    SDTruncateFunction truncate_fn;
+    SDRecordStoreConfig config;
+    String dir;
+    std::vector<Segment> segments;  // Oldest first, the last one takes appends
+    File head;
+    uint8_t* slot_buffer;
+    size_t slot_size;
+    uint32_t slots_per_segment;
+    uint32_t recovered_bytes;
+    bool dirty;
+
+    String segmentPath(uint32_t id, const char* ext) const;
+    bool createSegment(uint32_t id, uint32_t first_seq);
+    bool loadSegment(uint32_t id, bool is_head);
+    bool readHeader(File& file, Segment& seg);
+    bool scanSegment(File& file, Segment& seg);
+    bool loadIndex(Segment& seg);
+    void saveIndex(const Segment& seg);
+    bool sealHead();
+    void applyRetention();
+    bool verifySlot(const Segment& seg, uint32_t slot, const uint8_t* data, uint32_t& timestamp) const;
+    uint32_t slotOffset(uint32_t slot) const;
+    void noteIndex(Segment& seg, uint32_t slot, uint32_t timestamp);
+};
@@ -0,0 +1,117 @@
+#include "SDRecorder.h"
+#include <esp_heap_caps.h>
+
+SDRecorder::SDRecorder()
+    : mounter(nullptr),
+      fd(-1),
+      contiguous(false),
+      failed(false),
+      reserved(0),
+      flushed(0),
+      buffer(nullptr),
+      capacity(0),
+      fill(0) {
+    path[0] = '\0';
+}
+
+SDRecorder::~SDRecorder() {
+    close();
+}
+
+bool SDRecorder::open(SDMounter& sd, const char* file_path, uint64_t reserve_bytes, size_t buffer_size) {
+    close();
+
+    // Allocate and open as one step, so no other task sees the file in between
+    SDLock guard(sd);
+    if (!sd.resolvePath(file_path, path)) return false;
+
+    // Internal DMA memory: the SDMMC driver sends it as is, where a PSRAM or
+    // unaligned buffer would be copied through a bounce buffer sector by sector
+    capacity = (buffer_size < SD_REC_SECTOR) ? SD_REC_SECTOR : buffer_size - buffer_size % SD_REC_SECTOR;
+    buffer = (uint8_t*)heap_caps_aligned_alloc(4, capacity, MALLOC_CAP_DMA);
+    if (!buffer) {
+        Serial.println("[SDRecorder] Out of DMA memory for the buffer");
+        return false;
+    }
+
+    if (!sd.preallocateFile(path, reserve_bytes, &contiguous)) {
+        heap_caps_free(buffer);
+        buffer = nullptr;
+        return false;
+    }
+
+    fd = sd.getBackend().open(path, SD_OPEN_UPDATE);
+    if (fd < 0) {
+        Serial.printf("[SDRecorder] Failed to open %s\n", path);
+        heap_caps_free(buffer);
+        buffer = nullptr;
+        return false;
+    }
+
+    if (!contiguous) {
+        Serial.printf("[SDRecorder] %s is not one contiguous extent\n", path);
+    }
+
+    // A raw descriptor holds no handle the way openFile() does
+    mounter = &sd;
+    mounter->acquireHandle();
+    reserved = reserve_bytes;
+    flushed = 0;
+    fill = 0;
+    failed = false;
+    histogram.reset();
+    return true;
+}
+
+bool SDRecorder::close() {
+    if (fd < 0) return false;
+
+    bool ok = !failed && (fill == 0 || writeBuffer(fill));
+    ok = mounter->getBackend().sync(fd) && ok;
+    mounter->getBackend().close(fd);
+    fd = -1;
+
+    // Give back the part of the reservation that was not used
+    if (ok && flushed < reserved) {
+        ok = mounter->truncateFile(path, flushed);
+    }
+
+    heap_caps_free(buffer);
+    buffer = nullptr;
+    mounter->releaseHandle();
+    mounter = nullptr;
+    return ok;
+}
+
+size_t SDRecorder::write(const uint8_t* data, size_t len) {
+    if (fd < 0 || failed) return 0;
+
+    size_t done = 0;
+    while (done < len) {
+        size_t n = capacity - fill;
+        if (n > len - done) n = len - done;
+        memcpy(buffer + fill, data + done, n);
+        fill += n;
+        done += n;
+
+        if (fill == capacity && !writeBuffer(capacity)) return done;
+    }
+    return done;
+}
+
+// Private helper methods
+bool SDRecorder::writeBuffer(size_t len) {
+    // Whole buffers keep the file position on a sector boundary, so FatFs
+    // sends them straight to the card without its own sector buffer
+    unsigned long start = micros();
+    int n = mounter->getBackend().write(fd, buffer, len);
+    histogram.record(micros() - start);
+
+    if (n != (int)len) {
+        failed = true;
+        return false;
+    }
+    flushed += len;
+    fill = 0;
+    return true;
+}
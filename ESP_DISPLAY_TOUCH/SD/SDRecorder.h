@@ -0,0 +1,55 @@
+#pragma once
+#include <Arduino.h>
+#include "SDMounter.h"
+#include "SDLatencyHistogram.h"
+
+// Recording file for audio or high-rate sensor data. The file is allocated
+// to its expected size up front (one contiguous run where the IDF supports
+// it), then filled front to back in whole-sector writes from a DMA capable
+// buffer. Writes inside the extent never allocate clusters or touch the
+// FAT, which is what makes appendFile() spike when a file grows. close()
+// writes the tail and trims the file to the bytes actually recorded.
+//
+// Every card write is timed into a histogram. Data past the reservation
+// is still written, with the growth cost back; getOverflowBytes() shows it.
+
+#define SD_REC_DEFAULT_BUFFER (32 * 1024)
+#define SD_REC_SECTOR         512
+
+class SDRecorder : public Print {
+public:
+    SDRecorder();
+    ~SDRecorder();
+
+    // buffer_size is rounded down to whole sectors
+    bool open(SDMounter& sd, const char* path, uint64_t reserve_bytes,
+              size_t buffer_size = SD_REC_DEFAULT_BUFFER);
+    bool close();   // Writes the tail, then trims to getBytesWritten()
+    bool isOpen() const { return fd >= 0; }
+    bool hasFailed() const { return failed; }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* data, size_t len) override;
+    using Print::write;
+
+    bool isContiguous() const { return contiguous; }
+    uint64_t getReserved() const { return reserved; }
+    uint64_t getBytesWritten() const { return flushed + fill; }
+    uint64_t getOverflowBytes() const { return (flushed > reserved) ? flushed - reserved : 0; }
+    const SDLatencyHistogram& getHistogram() const { return histogram; }
+
+private:
+    SDMounter* mounter;
+    int fd;
+    char path[SD_PATH_MAX];     // Resolved, for the trim on close
+    bool contiguous;
+    bool failed;
+    uint64_t reserved;
+    uint64_t flushed;           // Bytes handed to the card
+    uint8_t* buffer;
+    size_t capacity;
+    size_t fill;
+    SDLatencyHistogram histogram;
+
+    bool writeBuffer(size_t len);
+};
@@ -0,0 +1,66 @@
+#include "SDStorageBackend.h"
+#if defined(ESP_PLATFORM)
+#include <esp_random.h>
+#endif
+
+SDStorageBackend::SDStorageBackend()
+    : removed(false) {
+    fault_stats = {0, 0};
+}
+
+void SDStorageBackend::setFaults(const SDFaultConfig& config) {
+    faults = config;
+    fault_stats = {0, 0};
+}
+
+void SDStorageBackend::clearFaults() {
+    setFaults(SDFaultConfig());
+}
+
+void SDStorageBackend::setRemoved(bool is_removed) {
+    removed = is_removed;
+}
+
+bool SDStorageBackend::preallocate(const char* path, uint64_t size, bool* contiguous) {
+    static const uint8_t zeros[512] = {0};
+    if (contiguous) *contiguous = false;
+
+    int fd = open(path, SD_OPEN_WRITE);
+    if (fd < 0) return false;
+
+    bool ok = true;
+    for (uint64_t left = size; ok && left > 0; ) {
+        size_t n = (left < sizeof(zeros)) ? left : sizeof(zeros);
+        ok = (write(fd, zeros, n) == (int)n);
+        left -= n;
+    }
+    ok = sync(fd) && ok;
+    close(fd);
+    return ok;
+}
+
+bool SDStorageBackend::inject(Op op, size_t bytes) {
+    uint32_t delay_us = faults.latency_us + (uint32_t)((uint64_t)bytes * faults.latency_per_kb_us / 1024);
+    if (delay_us >= 10000) {
+        delay(delay_us / 1000);     // Long waits yield to other tasks
+    } else if (delay_us > 0) {
+        delayMicroseconds(delay_us);
+    }
+
+    fault_stats.ops++;
+    if (removed) return false;
+    if (!(faults.fail_ops & (1UL << op))) return true;
+
+    bool fail = (faults.fail_after_ops && fault_stats.ops > faults.fail_after_ops);
+    if (!fail && faults.fail_permille) {
+#if defined(ESP_PLATFORM)
+        uint32_t roll = esp_random() % 1000;
+#else
+        uint32_t roll = (uint32_t)rand() % 1000;
+#endif
+        fail = (roll < faults.fail_permille);
+    }
+
+    if (fail) fault_stats.injected++;
+    return !fail;
+}
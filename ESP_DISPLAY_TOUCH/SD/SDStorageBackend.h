@@ -0,0 +1,131 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+
+// Storage under SDMounter. SDMounter keeps the policy (paths, atomic
+// replace, copy, recursive delete, space accounting, hot-swap state) and
+// calls a backend for the raw operations:
+//
+//   SDMMCBackend      the card on the SDMMC peripheral (default)
+//   SDRamDiskBackend  files in RAM, no card needed
+//   SDDirBackend      a directory on another filesystem (LittleFS, or the
+//                     host's disk when SDMounter is built for a PC)
+//
+// Paths handed to a backend are volume paths: absolute, normalised, without
+// the mount point. The RAM and directory backends can add latency and fail
+// operations on purpose (setFaults(), setRemoved()) so error paths and the
+// hot-swap logic can be exercised without pulling a real card.
+
+enum SDOpenMode : uint8_t {
+    SD_OPEN_READ,       // Existing file, read only
+    SD_OPEN_WRITE,      // Create or truncate, write only
+    SD_OPEN_APPEND,     // Create if missing, writes go to the end
+    SD_OPEN_UPDATE      // Existing file, write only from the start, not truncated
+};
+
+enum SDFormatResult : uint8_t {
+    SD_FORMAT_OK,
+    SD_FORMAT_NO_VOLUME,    // Could not reach the filesystem, nothing changed
+    SD_FORMAT_NO_MEMORY,
+    SD_FORMAT_FAILED,       // Volume still mounted with its old contents
+    SD_FORMAT_LOST_VOLUME   // Formatted (or not) but could not be remounted
+};
+
+struct SDFaultConfig {
+    uint32_t latency_us = 0;        // Added to every operation
+    uint32_t latency_per_kb_us = 0; // Extra per KB read or written
+    uint16_t fail_permille = 0;     // Random failures per 1000 eligible operations
+    uint32_t fail_after_ops = 0;    // Every operation after this many fails (0 = off)
+    uint32_t fail_ops = 0xFFFFFFFF; // Bit mask of SDStorageBackend::Op that may fail
+};
+
+class SDStorageBackend {
+public:
+    enum Op : uint8_t {
+        OP_OPEN,
+        OP_READ,
+        OP_WRITE,
+        OP_SYNC,
+        OP_STAT,
+        OP_UNLINK,
+        OP_RENAME,
+        OP_MKDIR,
+        OP_RMDIR,
+        OP_TRUNCATE,
+        OP_LIST
+    };
+
+    struct FaultStats {
+        uint32_t ops;
+        uint32_t injected;      // Operations failed on purpose
+    };
+
+    SDStorageBackend();
+    virtual ~SDStorageBackend() {}
+
+    virtual const char* name() const = 0;
+
+    // Volume
+    virtual bool begin(const char* mount_point, uint8_t bus_width, int freq_khz, bool format_if_failed) = 0;
+    virtual void end() = 0;
+    virtual bool isPresent() = 0;           // Cheap check while begun
+    virtual fs::FS& fs() = 0;               // For File based access
+    virtual uint8_t maxBusWidth() const { return 1; }
+    virtual int busFrequency() const { return 0; }  // kHz actually running
+    virtual const char* typeName() { return name(); }
+    virtual uint64_t cardSize() = 0;
+    virtual bool getSpace(uint64_t& total, uint64_t& free, uint32_t& cluster) = 0;
+    virtual SDFormatResult format(uint32_t cluster_size, int* fs_error = nullptr) = 0;
+
+    // Files, by descriptor
+    virtual int open(const char* path, SDOpenMode mode) = 0;    // -1 on failure
+    virtual int read(int fd, void* buffer, size_t len) = 0;
+    virtual int write(int fd, const void* buffer, size_t len) = 0;
+    virtual bool sync(int fd) = 0;
+    virtual int64_t size(int fd) = 0;
+    virtual void close(int fd) = 0;
+
+    // Paths
+    virtual bool stat(const char* path, bool* is_dir = nullptr, size_t* size = nullptr) = 0;
+    virtual bool unlink(const char* path) = 0;  // Callers only pass files
+    virtual bool rename(const char* from, const char* to) = 0;
+    virtual bool mkdir(const char* path) = 0;
+    virtual bool rmdir(const char* path) = 0;   // Empty directories only
+    virtual bool truncate(const char* path, size_t size) = 0;
+    
+    // Creates path (replacing a file) with size bytes allocated, so later
+    // writes inside it never touch the FAT. contiguous is set when the
+    // clusters are known to be one run. The default writes zeros.
+    virtual bool preallocate(const char* path, uint64_t size, bool* contiguous = nullptr);
+    
+    // Raw sectors, for handing the whole volume to a USB host. Only block
+    // devices have them. detachVolume() drops the filesystem's cached state
+    // so firmware cannot touch the volume; attachVolume() mounts it again.
+    virtual bool detachVolume() { return false; }
+    virtual bool attachVolume() { return false; }
+    virtual bool sectorInfo(uint32_t& count, uint16_t& size) { return false; }
+    virtual bool readSectors(uint32_t lba, void* buffer, uint32_t count) { return false; }
+    virtual bool writeSectors(uint32_t lba, const void* buffer, uint32_t count) { return false; }
+
+    // Directory listing: readDir() returns 1 per entry, 0 at the end and
+    // -1 on error, including a name that does not fit in name_size
+    virtual void* openDir(const char* path) = 0;
+    virtual int readDir(void* dir, char* name, size_t name_size, bool* is_dir) = 0;
+    virtual void closeDir(void* dir) = 0;
+
+    // Fault injection (honoured by the RAM and directory backends)
+    void setFaults(const SDFaultConfig& config);
+    void clearFaults();
+    void setRemoved(bool removed);          // Simulated card pull: everything fails
+    bool isRemoved() const { return removed; }
+    FaultStats getFaultStats() const { return fault_stats; }
+
+protected:
+    // Applies the configured latency and decides whether op fails
+    bool inject(Op op, size_t bytes = 0);
+
+private:
+    SDFaultConfig faults;
+    FaultStats fault_stats;
+    volatile bool removed;
+};
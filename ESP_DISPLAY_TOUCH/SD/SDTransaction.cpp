@@ -0,0 +1,338 @@
+#include "SDTransaction.h"
+#include "SDCrc.h"
+#if defined(ESP_PLATFORM)
+#include <esp_random.h>
+#endif
+
+#define SD_JOURNAL_MAGIC    0x524A4453  // "SDJR"
+#define SD_JOURNAL_PATH_MAX 255
+
+// Journal record: header | payload | CRC32 over header and payload
+//   PREPARE payload: txid (4) | op (1) | path
+//   COMMIT payload:  txid (4) | op count (2)
+struct JournalRecord {
+    uint32_t magic;
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t length;    // Payload bytes
+};
+
+SDTransaction::SDTransaction(SDMounter& sd_mounter)
+    : sd(sd_mounter),
+      txid(0),
+      failed(false) {
+}
+
+SDTransaction::~SDTransaction() {
+    if (txid != 0) {
+        abort();
+    }
+}
+
+bool SDTransaction::write(const char* path, const uint8_t* data, size_t len) {
+    SDLock guard(sd);
+    if (failed) return false;
+    if (!sd.mounted) {
+        sd.setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+
+    char resolved[SD_PATH_MAX];
+    if (!sd.resolvePath(path, resolved)) {
+        failed = true;
+        return false;
+    }
+    String full_path = resolved;
+    String staged_path = full_path + SD_TXN_SUFFIX;
+
+    // Log the op first so a rollback knows which staged file to delete
+    if (!addOp(OP_WRITE, full_path, len)) return false;
+
+    File file = sd.getSD().open(staged_path.c_str(), FILE_WRITE);
+    if (!file) {
+        sd.setError(SD_ERR_TXN_FAILED, full_path.c_str());
+        failed = true;
+        return false;
+    }
+
+    size_t written = file.write(data, len);
+    file.close();
+
+    if (written != len) {
+        sd.setError(SD_ERR_TXN_FAILED, full_path.c_str());
+        failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool SDTransaction::write(const char* path, const char* content) {
+    return write(path, (const uint8_t*)content, strlen(content));
+}
+
+bool SDTransaction::remove(const char* path) {
+    SDLock guard(sd);
+    if (failed) return false;
+    if (!sd.mounted) {
+        sd.setError(SD_ERR_NOT_MOUNTED);
+        return false;
+    }
+
+    char resolved[SD_PATH_MAX];
+    if (!sd.resolvePath(path, resolved)) {
+        failed = true;
+        return false;
+    }
+    return addOp(OP_REMOVE, resolved, 0);
+}
+
+bool SDTransaction::commit() {
+    SDLock guard(sd);
+    if (failed) {
+        abort();
+        return false;
+    }
+    if (ops.empty()) return true;
+
+    uint8_t payload[6];
+    uint16_t count = ops.size();
+    memcpy(payload, &txid, 4);
+    memcpy(payload + 4, &count, 2);
+
+    if (!writeRecord(REC_COMMIT, payload, sizeof(payload))) {
+        sd.setError(SD_ERR_TXN_FAILED, "commit record");
+        abort();
+        return false;
+    }
+
+    // Commit point: once this fsync returns, recovery replays the transaction
+    journal.flush();
+    journal.close();
+
+    bool ok = true;
+    for (const Op& op : ops) {
+        if (!apply(sd.getSD(), op.type, op.path)) {
+            Serial.printf("[SDTransaction] Failed to apply %s\n", op.path.c_str());
+            ok = false;
+        }
+    }
+
+    if (!ok) {
+        // Journal stays on the card, the next mount finishes the job
+        sd.setError(SD_ERR_TXN_APPLY);
+        ops.clear();
+        txid = 0;
+        return false;
+    }
+
+    sd.getSD().remove(SD_JOURNAL_PATH);
+
+    for (const Op& op : ops) {
+        if (sd.dir_index_enabled) {
+            if (op.type == OP_WRITE) {
+                sd.dir_index.noteFile(op.path.c_str(), op.size);
+            } else {
+                sd.dir_index.noteRemoved(op.path.c_str());
+            }
+        }
+    }
+    if (sd.space_ready) sd.scanSpace();
+
+    ops.clear();
+    txid = 0;
+    sd.clearError();
+    return true;
+}
+
+void SDTransaction::abort() {
+    SDLock guard(sd);
+    discard();
+    failed = false;
+}
+
+bool SDTransaction::recover(SDMounter& sd) {
+    File file = sd.getSD().open(SD_JOURNAL_PATH, FILE_READ);
+    if (!file) return true;
+
+    size_t size = file.size();
+    if (size > SD_JOURNAL_MAX_SIZE) size = SD_JOURNAL_MAX_SIZE;
+
+    uint8_t* buffer = (uint8_t*)malloc(size ? size : 1);
+    if (!buffer) {
+        file.close();
+        return false;
+    }
+    size = file.read(buffer, size);
+    file.close();
+
+    // Collect PREPARE records up to the first damaged one
+    std::vector<Op> ops;
+    uint32_t tx = 0;
+    bool committed = false;
+    size_t pos = 0;
+
+    while (pos + sizeof(JournalRecord) + 4 <= size) {
+        JournalRecord rec;
+        memcpy(&rec, buffer + pos, sizeof(rec));
+        if (rec.magic != SD_JOURNAL_MAGIC) break;
+
+        size_t end = pos + sizeof(rec) + rec.length;
+        if (end + 4 > size) break;
+
+        uint32_t crc;
+        memcpy(&crc, buffer + end, 4);
+        if (crc != sdCrc32(buffer + pos, sizeof(rec) + rec.length)) break;
+
+        const uint8_t* payload = buffer + pos + sizeof(rec);
+        uint32_t rec_txid = 0;
+        if (rec.length >= 4) memcpy(&rec_txid, payload, 4);
+
+        if (rec.type == REC_PREPARE && rec.length > 5 && rec.length - 5 <= SD_JOURNAL_PATH_MAX &&
+            (payload[4] == OP_WRITE || payload[4] == OP_REMOVE)) {
+            if (!ops.empty() && rec_txid != tx) break;
+            tx = rec_txid;
+
+            char path[SD_JOURNAL_PATH_MAX + 1];
+            memcpy(path, payload + 5, rec.length - 5);
+            path[rec.length - 5] = '\0';
+
+            Op op;
+            op.type = (OpType)payload[4];
+            op.path = path;
+            op.size = 0;
+            ops.push_back(op);
+        } else if (rec.type == REC_COMMIT && rec.length == 6) {
+            uint16_t count;
+            memcpy(&count, payload + 4, 2);
+            committed = (rec_txid == tx && count == ops.size());
+            break;
+        } else {
+            break;
+        }
+
+        pos = end + 4;
+    }
+    free(buffer);
+
+    bool ok = true;
+    if (committed) {
+        for (const Op& op : ops) {
+            ok = apply(sd.getSD(), op.type, op.path) && ok;
+        }
+        Serial.printf("[SDTransaction] Replayed committed transaction (%u ops)\n", (unsigned)ops.size());
+    } else {
+        for (const Op& op : ops) {
+            if (op.type == OP_WRITE) {
+                sd.getSD().remove((op.path + SD_TXN_SUFFIX).c_str());
+            }
+        }
+        Serial.printf("[SDTransaction] Rolled back uncommitted transaction (%u ops)\n", (unsigned)ops.size());
+    }
+
+    if (ok) {
+        sd.getSD().remove(SD_JOURNAL_PATH);
+    } else {
+        sd.setError(SD_ERR_TXN_APPLY, "replay at mount");
+    }
+    return ok;
+}
+
+// Private helper methods
+bool SDTransaction::addOp(OpType type, const String& full_path, size_t size) {
+    if (ops.size() >= SD_TXN_MAX_OPS) {
+        sd.setError(SD_ERR_TXN_FAILED, "too many operations");
+        failed = true;
+        return false;
+    }
+    if (full_path.length() > SD_JOURNAL_PATH_MAX) {
+        sd.setError(SD_ERR_PATH_TOO_LONG, full_path.c_str());
+        failed = true;
+        return false;
+    }
+
+    if (!journal) {
+        // One journal per card: a live one belongs to another open
+        // transaction, or to a committed one the next mount replays
+        if (sd.getSD().exists(SD_JOURNAL_PATH)) {
+            sd.setError(SD_ERR_BUSY, SD_JOURNAL_PATH);
+            failed = true;
+            return false;
+        }
+
+#if defined(ESP_PLATFORM)
+        txid = esp_random() | 1;
+#else
+        txid = ((uint32_t)rand() << 1) | 1;
+#endif
+        journal = sd.openFile(SD_JOURNAL_PATH, FILE_WRITE);
+        if (!journal) {
+            sd.setError(SD_ERR_TXN_FAILED, SD_JOURNAL_PATH);
+            failed = true;
+            return false;
+        }
+    }
+
+    uint8_t payload[5 + SD_JOURNAL_PATH_MAX];
+    memcpy(payload, &txid, 4);
+    payload[4] = type;
+    memcpy(payload + 5, full_path.c_str(), full_path.length());
+
+    if (!writeRecord(REC_PREPARE, payload, 5 + full_path.length())) {
+        sd.setError(SD_ERR_TXN_FAILED, SD_JOURNAL_PATH);
+        failed = true;
+        return false;
+    }
+
+    Op op;
+    op.type = type;
+    op.path = full_path;
+    op.size = size;
+    ops.push_back(op);
+    return true;
+}
+
+bool SDTransaction::writeRecord(RecordType type, const uint8_t* payload, size_t len) {
+    JournalRecord rec;
+    rec.magic = SD_JOURNAL_MAGIC;
+    rec.type = type;
+    rec.reserved = 0;
+    rec.length = len;
+
+    uint32_t crc = sdCrc32(payload, len, sdCrc32(&rec, sizeof(rec)));
+
+    return journal.write((const uint8_t*)&rec, sizeof(rec)) == sizeof(rec) &&
+           journal.write(payload, len) == len &&
+           journal.write((const uint8_t*)&crc, 4) == 4;
+}
+
+void SDTransaction::discard() {
+    if (journal) journal.close();
+
+    for (const Op& op : ops) {
+        if (op.type == OP_WRITE) {
+            sd.getSD().remove((op.path + SD_TXN_SUFFIX).c_str());
+        }
+    }
+
+    if (txid != 0) {
+        sd.getSD().remove(SD_JOURNAL_PATH);
+    }
+
+    ops.clear();
+    txid = 0;
+}
+
+bool SDTransaction::apply(fs::FS& fs, OpType type, const String& full_path) {
+    if (type == OP_REMOVE) {
+        return !fs.exists(full_path.c_str()) || fs.remove(full_path.c_str());
+    }
+
+    // No staged file means this op was applied before a reset
+    String staged_path = full_path + SD_TXN_SUFFIX;
+    if (!fs.exists(staged_path.c_str())) return true;
+
+    // FAT rename cannot replace, and the staged copy is already durable
+    if (fs.exists(full_path.c_str()) && !fs.remove(full_path.c_str())) return false;
+    return fs.rename(staged_path.c_str(), full_path.c_str());
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+#include "SDMounter.h"
+
+// Replace or delete several files as one unit: after a reset or card pull
+// either every change is on the card or none is.
+//
+//   SDTransaction tx(SDCard);
+//   tx.write("/config.json", config);
+//   tx.write("/layout.json", layout);
+//   tx.remove("/layout.old");
+//   tx.commit();
+//
+// New contents are staged next to their targets as <path>.txn and each op
+// is logged as a PREPARE record in /.sdjournal. commit() appends a COMMIT
+// record and fsyncs the journal once; that is the commit point. The staged
+// files are then renamed into place and the journal is deleted.
+// SDMounter::mount() calls recover(): a committed journal is replayed
+// (every step is idempotent), an uncommitted one is rolled back by deleting
+// its staged files. A reset before commit can leave a staged file the
+// unsynced journal never recorded; the next write to that path replaces it.
+//
+// One transaction per card at a time: while the journal exists another one
+// fails with SD_ERR_BUSY, until it commits or aborts (or, after a failed
+// apply, until the next mount has replayed it).
+
+#define SD_JOURNAL_PATH     "/.sdjournal"
+#define SD_TXN_SUFFIX       ".txn"
+#define SD_TXN_MAX_OPS      32
+#define SD_JOURNAL_MAX_SIZE (16 * 1024)
+
+class SDTransaction {
+public:
+    SDTransaction(SDMounter& sd = SDCard);
+    ~SDTransaction();   // Aborts if not committed
+
+    bool write(const char* path, const uint8_t* data, size_t len);
+    bool write(const char* path, const char* content);
+    bool write(const char* path, const String& content) { return write(path, content.c_str()); }
+    bool remove(const char* path);
+
+    bool commit();
+    void abort();
+    size_t size() const { return ops.size(); }
+
+    // Replay or roll back an interrupted transaction (run at mount)
+    static bool recover(SDMounter& sd);
+
+private:
+    enum OpType : uint8_t {
+        OP_WRITE = 1,
+        OP_REMOVE = 2
+    };
+
+    enum RecordType : uint8_t {
+        REC_PREPARE = 1,
+        REC_COMMIT = 2
+    };
+
+    struct Op {
+        OpType type;
+        String path;    // Full path on the card
+        size_t size;
+    };
+
+    SDMounter& sd;
+    std::vector<Op> ops;
+    File journal;
+    uint32_t txid;
+    bool failed;
+
+    bool addOp(OpType type, const String& full_path, size_t size);
+    bool writeRecord(RecordType type, const uint8_t* payload, size_t len);
+    void discard();
+    static bool apply(fs::FS& fs, OpType type, const String& full_path);
+};
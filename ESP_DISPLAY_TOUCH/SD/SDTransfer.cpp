@@ -0,0 +1,574 @@
+#include "SDTransfer.h"
+#include "SDCrc.h"
+#include <esp_heap_caps.h>
+
+#define SD_XFER_HEADER 6                                // Magic, type, seq, length
+#define SD_XFER_MAX_PAYLOAD (SD_XFER_CHUNK + 16)        // DATA offset plus slack
+#define SD_XFER_MAX_FRAME (SD_XFER_HEADER + SD_XFER_MAX_PAYLOAD + 4)
+#define SD_XFER_RX_BUFFER (2 * SD_XFER_MAX_FRAME)
+
+static const uint8_t SD_XFER_MAGIC0 = 'S';
+static const uint8_t SD_XFER_MAGIC1 = 'X';
+
+// Frames are little-endian, like the S3
+static uint16_t get16(const uint8_t* p) { uint16_t v; memcpy(&v, p, 2); return v; }
+static uint32_t get32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static void put16(uint8_t* p, uint16_t v) { memcpy(p, &v, 2); }
+static void put32(uint8_t* p, uint32_t v) { memcpy(p, &v, 4); }
+
+SDTransferServer::SDTransferServer(SDMounter& mounter)
+    : sd(mounter),
+      port(nullptr),
+      rx(nullptr),
+      rx_len(0),
+      rx_consumed(0),
+      tx(nullptr),
+      finished_seq(-1),
+      task(nullptr),
+      stopping(false),
+      busy(false) {
+    resetStats();
+}
+
+SDTransferServer::~SDTransferServer() {
+    end();
+    if (rx) heap_caps_free(rx);
+    if (tx) heap_caps_free(tx);
+}
+
+bool SDTransferServer::begin(Stream& stream, BaseType_t core, UBaseType_t priority) {
+    if (task) return true;
+
+    if (!rx) rx = (uint8_t*)heap_caps_malloc(SD_XFER_RX_BUFFER, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!tx) tx = (uint8_t*)heap_caps_malloc(SD_XFER_MAX_FRAME, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!rx || !tx) {
+        Serial.println("[SDTransfer] Out of memory");
+        return false;
+    }
+
+    port = &stream;
+    rx_len = 0;
+    rx_consumed = 0;
+    stopping = false;
+    if (xTaskCreatePinnedToCore(serverTask, "sd_xfer", 6144, this, priority, &task, core) != pdPASS) {
+        task = nullptr;
+        Serial.println("[SDTransfer] Failed to start server task");
+        return false;
+    }
+    return true;
+}
+
+void SDTransferServer::end() {
+    if (!task) return;
+
+    // A transfer in progress is dropped; an upload keeps its .part
+    stopping = true;
+    while (task) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    stopping = false;
+}
+
+// Private helper methods
+bool SDTransferServer::readFrame(Frame& frame, uint32_t timeout_ms) {
+    if (rx_consumed) {
+        dropRx(rx_consumed);
+        rx_consumed = 0;
+    }
+
+    unsigned long start = millis();
+    while (!stopping) {
+        if (parseFrame(frame)) return true;
+
+        int avail = port->available();
+        size_t space = SD_XFER_RX_BUFFER - rx_len;
+        if (avail > 0 && space > 0) {
+            size_t n = (size_t)avail < space ? (size_t)avail : space;
+            rx_len += port->readBytes((char*)rx + rx_len, n);
+            continue;
+        }
+        if (millis() - start >= timeout_ms) {
+            // A frame still incomplete after this long had a damaged
+            // length; skip its magic so the next call resyncs
+            if (rx_len >= 2) dropRx(1);
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return false;
+}
+
+bool SDTransferServer::parseFrame(Frame& frame) {
+    while (rx_len >= 2) {
+        if (rx[0] != SD_XFER_MAGIC0 || rx[1] != SD_XFER_MAGIC1) {
+            const uint8_t* next = (const uint8_t*)memchr(rx + 1, SD_XFER_MAGIC0, rx_len - 1);
+            dropRx(next ? next - rx : rx_len);
+            continue;
+        }
+        if (rx_len < SD_XFER_HEADER) return false;
+
+        uint16_t len = get16(rx + 4);
+        if (len > SD_XFER_MAX_PAYLOAD) {
+            stats.bad_frames++;
+            dropRx(1);
+            continue;
+        }
+        size_t total = SD_XFER_HEADER + len + 4;
+        if (rx_len < total) return false;
+
+        if (sdCrc32(rx + 2, SD_XFER_HEADER - 2 + len) != get32(rx + SD_XFER_HEADER + len)) {
+            // A false "SX" in log text or a damaged frame: resync after it
+            stats.bad_frames++;
+            dropRx(1);
+            continue;
+        }
+
+        frame.type = rx[2];
+        frame.seq = rx[3];
+        frame.len = len;
+        frame.payload = rx + SD_XFER_HEADER;
+        rx_consumed = total;
+        stats.frames_in++;
+        return true;
+    }
+    return false;
+}
+
+void SDTransferServer::dropRx(size_t n) {
+    if (n >= rx_len) {
+        rx_len = 0;
+        return;
+    }
+    memmove(rx, rx + n, rx_len - n);
+    rx_len -= n;
+}
+
+bool SDTransferServer::sendFrame(uint8_t type, uint8_t seq, size_t len) {
+    tx[0] = SD_XFER_MAGIC0;
+    tx[1] = SD_XFER_MAGIC1;
+    tx[2] = type;
+    tx[3] = seq;
+    put16(tx + 4, len);
+    put32(tx + SD_XFER_HEADER + len, sdCrc32(tx + 2, SD_XFER_HEADER - 2 + len));
+
+    // One write per frame, so other output on the port lands between frames
+    size_t total = SD_XFER_HEADER + len + 4;
+    if (port->write(tx, total) != total) return false;
+    stats.frames_out++;
+    return true;
+}
+
+bool SDTransferServer::sendError(uint8_t seq, uint8_t code, const char* text) {
+    uint8_t* p = out();
+    size_t len = strnlen(text, 200);
+    p[0] = code;
+    memcpy(p + 1, text, len);
+    return sendFrame(SD_XFER_ERROR, seq, 1 + len);
+}
+
+bool SDTransferServer::sendSdError(uint8_t seq) {
+    return sendError(seq, sd.getErrorCode(), sd.getLastError().c_str());
+}
+
+bool SDTransferServer::sendAck(uint8_t seq, uint32_t offset, uint8_t flags) {
+    put32(out(), offset);
+    out()[4] = flags;
+    return sendFrame(SD_XFER_ACK, seq, 5);
+}
+
+bool SDTransferServer::sendOpened(uint8_t seq, uint32_t size, uint32_t offset, uint32_t crc) {
+    put32(out(), size);
+    put32(out() + 4, offset);
+    put32(out() + 8, crc);
+    return sendFrame(SD_XFER_OK, seq, 12);
+}
+
+bool SDTransferServer::getPath(const uint8_t* data, size_t len, char* path) {
+    if (len == 0 || len >= SD_PATH_MAX || memchr(data, '\0', len)) return false;
+    memcpy(path, data, len);
+    path[len] = '\0';
+    return true;
+}
+
+bool SDTransferServer::crcPrefix(File& file, uint32_t len, uint32_t& crc) {
+    // The DATA payload area is free while no frame is being built
+    uint8_t* buf = out() + 4;
+    crc = 0;
+    file.seek(0);
+    uint32_t done = 0;
+    while (done < len) {
+        size_t n = len - done < SD_XFER_CHUNK ? len - done : SD_XFER_CHUNK;
+        if (file.read(buf, n) != n) return false;
+        crc = sdCrc32(buf, n, crc);
+        done += n;
+    }
+    return true;
+}
+
+void SDTransferServer::handleRequest(const Frame& frame) {
+    const uint8_t* p = frame.payload;
+    char path[SD_PATH_MAX];
+
+    switch (frame.type) {
+        case SD_XFER_HELLO:
+            out()[0] = SD_XFER_VERSION;
+            out()[1] = 0;
+            put16(out() + 2, SD_XFER_CHUNK);
+            put32(out() + 4, SD_XFER_WINDOW);
+            sendFrame(SD_XFER_OK, frame.seq, 8);
+            return;
+
+        case SD_XFER_CANCEL:
+            sendFrame(SD_XFER_OK, frame.seq, 0);
+            return;
+
+        case SD_XFER_END:
+            // The host missed the OK that finished its upload
+            if (frame.seq == finished_seq) sendFrame(SD_XFER_OK, frame.seq, 0);
+            return;
+
+        case SD_XFER_DATA:
+        case SD_XFER_ACK:
+            return;     // Left over from a transfer that already ended
+
+        case SD_XFER_STAT:
+        case SD_XFER_LIST:
+        case SD_XFER_DELETE:
+        case SD_XFER_MKDIR:
+            if (!getPath(p, frame.len, path)) break;
+            if (frame.type == SD_XFER_STAT) {
+                handleStat(frame.seq, path);
+            } else if (frame.type == SD_XFER_LIST) {
+                handleList(frame.seq, path);
+            } else {
+                bool ok;
+                if (frame.type == SD_XFER_MKDIR) {
+                    ok = sd.mkdir(path);
+                } else {
+                    File f = sd.openFile(path);
+                    bool is_dir = f && f.isDirectory();
+                    f.close();
+                    ok = is_dir ? sd.rmdir(path) : sd.deleteFile(path);
+                }
+                if (ok) {
+                    sendFrame(SD_XFER_OK, frame.seq, 0);
+                } else {
+                    sendSdError(frame.seq);
+                }
+            }
+            return;
+
+        case SD_XFER_GET:
+            if (frame.len < 4 || !getPath(p + 4, frame.len - 4, path)) break;
+            handleGet(frame.seq, get32(p), path);
+            return;
+
+        case SD_XFER_PUT:
+            if (frame.len < 8 || !getPath(p + 8, frame.len - 8, path)) break;
+            handlePut(frame.seq, get32(p), get32(p + 4), path);
+            return;
+    }
+    sendError(frame.seq, SD_XFER_ERR_PROTOCOL, "Bad request");
+}
+
+void SDTransferServer::handleStat(uint8_t seq, const char* path) {
+    File f = sd.openFile(path);
+    if (!f) {
+        sendSdError(seq);
+        return;
+    }
+
+    uint8_t* p = out();
+    memset(p, 0, 4);
+    p[0] = f.isDirectory();
+    put32(p + 4, f.size());
+    put32(p + 8, (uint32_t)f.getLastWrite());
+    f.close();
+    sendFrame(SD_XFER_OK, seq, 12);
+}
+
+void SDTransferServer::handleList(uint8_t seq, const char* path) {
+    SDDirIterator it;
+    if (!sd.openDirIterator(path, it)) {
+        sendSdError(seq);
+        return;
+    }
+
+    // As many entries per frame as fit
+    SDDirEntry entry;
+    size_t used = 0;
+    uint32_t count = 0;
+    while (it.next(entry)) {
+        size_t name_len = strnlen(entry.name, 255);
+        if (used + 10 + name_len > SD_XFER_CHUNK) {
+            if (!sendFrame(SD_XFER_ENTRY, seq, used)) return;
+            used = 0;
+        }
+        uint8_t* p = out() + used;
+        p[0] = entry.is_dir;
+        put32(p + 1, entry.size);
+        put32(p + 5, entry.mtime);
+        p[9] = name_len;
+        memcpy(p + 10, entry.name, name_len);
+        used += 10 + name_len;
+        count++;
+    }
+    if (used && !sendFrame(SD_XFER_ENTRY, seq, used)) return;
+
+    put32(out(), count);
+    sendFrame(SD_XFER_END, seq, 4);
+}
+
+void SDTransferServer::handleGet(uint8_t seq, uint32_t offset, const char* path) {
+    File file = sd.openFile(path);
+    if (!file) {
+        sendSdError(seq);
+        return;
+    }
+    if (file.isDirectory()) {
+        file.close();
+        sendError(seq, SD_ERR_OPEN_FAILED, "Is a directory");
+        return;
+    }
+
+    busy = true;
+
+    // The host checks this against its partial copy before keeping it
+    uint32_t size = file.size();
+    uint32_t crc = 0;
+    if (offset > size) offset = 0;
+    bool ok = crcPrefix(file, offset, crc);
+    if (!ok) {
+        sendError(seq, SD_ERR_FS_ACCESS, "Read failed");
+    } else if (sendOpened(seq, size, offset, crc)) {
+        ok = sendFile(file, seq, offset, size, crc);
+    }
+
+    file.close();
+    busy = false;
+
+    if (ok) stats.files_out++;
+    if (on_transfer) on_transfer(path, false, ok);
+}
+
+void SDTransferServer::handlePut(uint8_t seq, uint32_t offset, uint32_t size, const char* path) {
+    char part[SD_PATH_MAX];
+    if ((size_t)snprintf(part, sizeof(part), "%s.part", path) >= sizeof(part)) {
+        sendError(seq, SD_ERR_PATH_TOO_LONG, "Path too long");
+        return;
+    }
+
+    // Resume within what an earlier attempt left, and only if it still fits
+    uint32_t crc = 0;
+    if (offset > 0) {
+        File f = sd.openFile(part);
+        uint32_t have = (f && !f.isDirectory()) ? f.size() : 0;
+        if (offset > have) offset = have;
+        if (offset > size) offset = 0;
+        if (offset > 0 && !crcPrefix(f, offset, crc)) offset = 0;
+        f.close();
+        // Anything past the resume point is sent again
+        if (offset > 0 && !sd.truncateFile(part, offset)) offset = 0;
+    }
+    if (offset == 0) crc = 0;
+
+    if (sd.isSpaceInfoReady() && size - offset > sd.getFreeBytes()) {
+        sendError(seq, SD_ERR_NO_SPACE, sdErrorText(SD_ERR_NO_SPACE));
+        return;
+    }
+
+    File file = sd.openFile(part, offset > 0 ? FILE_APPEND : FILE_WRITE);
+    if (!file) {
+        sendSdError(seq);
+        return;
+    }
+
+    busy = true;
+
+    bool corrupt = false;
+    finished_seq = -1;
+    bool ok = sendOpened(seq, size, offset, crc) && receiveFile(file, seq, offset, size, crc, corrupt);
+    file.flush();   // All of it on the card before it can replace anything
+    file.close();
+
+    if (corrupt) {
+        sd.deleteFile(part);    // Nothing in it can be trusted for a resume
+    } else if (ok) {
+        // moveFile() swaps it in through the same backup rename as atomic
+        // writes, which mount() recovers: a reset leaves the old file or the new
+        ok = sd.moveFile(part, path);
+        if (ok) {
+            finished_seq = seq;
+            sendFrame(SD_XFER_OK, seq, 0);
+        } else {
+            sendSdError(seq);
+        }
+    }
+    busy = false;
+
+    if (ok) stats.files_in++;
+    if (on_transfer) on_transfer(path, true, ok);
+}
+
+bool SDTransferServer::sendFile(File& file, uint8_t seq, uint32_t offset, uint32_t size, uint32_t crc) {
+    uint32_t prefix_crc = crc;
+    uint32_t acked = offset;    // Host has everything below this
+    uint32_t next = offset;     // Next byte to send
+    uint32_t crc_end = offset;  // crc covers [0, crc_end)
+    bool end_sent = false;
+    uint8_t timeouts = 0;
+    uint8_t* data = out() + 4;
+
+    while (!stopping) {
+        // Fill the window, then wait for the host to open it again
+        while (next < size && next - acked < SD_XFER_WINDOW) {
+            size_t n = size - next < SD_XFER_CHUNK ? size - next : SD_XFER_CHUNK;
+            if ((uint32_t)file.position() != next) file.seek(next);
+            if (file.read(data, n) != n) {
+                sendError(seq, SD_ERR_FS_ACCESS, "Read failed");
+                return false;
+            }
+            if (next == crc_end) {
+                crc = sdCrc32(data, n, crc);
+                crc_end += n;
+            }
+            put32(out(), next);
+            if (!sendFrame(SD_XFER_DATA, seq, 4 + n)) return false;
+            next += n;
+            stats.bytes_out += n;
+        }
+        if (next == size && !end_sent) {
+            put32(out(), size);
+            put32(out() + 4, crc);
+            if (!sendFrame(SD_XFER_END, seq, 8)) return false;
+            end_sent = true;
+        }
+
+        Frame f;
+        if (!readFrame(f, SD_XFER_TIMEOUT_MS)) {
+            if (stopping) break;
+            if (++timeouts > SD_XFER_RETRIES) {
+                Serial.println("[SDTransfer] Host stopped answering");
+                sendError(seq, SD_XFER_ERR_TIMEOUT, "Timed out");
+                return false;
+            }
+            // Nothing back: assume the tail of the window was lost
+            next = acked;
+            end_sent = false;
+            stats.resends++;
+            continue;
+        }
+        if (f.type == SD_XFER_CANCEL) {
+            sendFrame(SD_XFER_OK, f.seq, 0);
+            return false;
+        }
+        if (f.seq == seq && f.type == SD_XFER_GET) {
+            // Our OK was lost and the host asked again: start over
+            if (!sendOpened(seq, size, offset, prefix_crc)) return false;
+            acked = next = offset;
+            end_sent = false;
+            continue;
+        }
+        if (f.seq != seq || f.type != SD_XFER_ACK || f.len < 5) continue;
+
+        uint32_t at = get32(f.payload);
+        uint8_t flags = f.payload[4];
+        if (at < acked || at > size) continue;
+        timeouts = 0;
+        if (flags & SD_XFER_ACK_DONE) return at == size;
+
+        acked = at;
+        if (next < acked || (flags & SD_XFER_ACK_RESEND)) {
+            next = acked;
+            end_sent = false;
+            stats.resends++;
+        }
+    }
+    return false;
+}
+
+bool SDTransferServer::receiveFile(File& file, uint8_t seq, uint32_t offset, uint32_t size,
+                                   uint32_t crc, bool& corrupt) {
+    uint32_t prefix_crc = crc;
+    uint32_t expected = offset;     // Next byte to write
+    uint32_t last_ack = offset;
+    uint32_t strays = 0;            // Out-of-order frames since the last write
+    uint8_t timeouts = 0;
+
+    while (!stopping) {
+        Frame f;
+        if (!readFrame(f, SD_XFER_TIMEOUT_MS)) {
+            if (stopping) break;
+            if (++timeouts > SD_XFER_RETRIES) {
+                Serial.println("[SDTransfer] Host stopped sending");
+                sendError(seq, SD_XFER_ERR_TIMEOUT, "Timed out");
+                return false;
+            }
+            // Our last ack may be what went missing
+            sendAck(seq, expected, SD_XFER_ACK_RESEND);
+            continue;
+        }
+        if (f.type == SD_XFER_CANCEL) {
+            sendFrame(SD_XFER_OK, f.seq, 0);
+            return false;
+        }
+        if (f.seq != seq) continue;
+        timeouts = 0;
+
+        if (f.type == SD_XFER_PUT && expected == offset) {
+            // Our OK was lost and the host asked again
+            if (!sendOpened(seq, size, offset, prefix_crc)) return false;
+        } else if (f.type == SD_XFER_DATA && f.len >= 4) {
+            uint32_t at = get32(f.payload);
+            size_t n = f.len - 4;
+            if (at == expected && n <= size - expected) {
+                if (file.write(f.payload + 4, n) != n) {
+                    sendError(seq, SD_ERR_WRITE_FAILED, "Card write failed");
+                    return false;
+                }
+                crc = sdCrc32(f.payload + 4, n, crc);
+                expected += n;
+                stats.bytes_in += n;
+                strays = 0;
+                if (expected - last_ack >= SD_XFER_ACK_EVERY || expected == size) {
+                    sendAck(seq, expected, 0);
+                    last_ack = expected;
+                }
+            } else if (strays++ % 4 == 0) {
+                // Past a lost frame (the rest of the window is dropped until
+                // the host goes back) or behind, after the host lost an ack.
+                // Say where we are, and again every few frames in case this
+                // is lost too.
+                bool gap = at > expected;
+                sendAck(seq, expected, gap ? SD_XFER_ACK_RESEND : 0);
+                if (gap) stats.resends++;
+            }
+        } else if (f.type == SD_XFER_END && f.len >= 8) {
+            if (expected != size || get32(f.payload) != size) {
+                sendAck(seq, expected, SD_XFER_ACK_RESEND);
+                continue;
+            }
+            if (get32(f.payload + 4) != crc) {
+                sendError(seq, SD_XFER_ERR_CRC, "File CRC mismatch");
+                corrupt = true;
+                return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void SDTransferServer::serverTask(void* arg) {
+    SDTransferServer* self = (SDTransferServer*)arg;
+
+    while (!self->stopping) {
+        Frame frame;
+        if (self->readFrame(frame, 100)) {
+            self->handleRequest(frame);
+        }
+    }
+
+    self->task = nullptr;
+    vTaskDelete(nullptr);
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "SDMounter.h"
+
+// File transfer over the USB CDC serial port, for pushing scripts and
+// layouts and pulling logs without handing the card over as a drive
+// (SDUsbDrive). A task owns the port and answers tools/sdxfer.py; the rest
+// of the firmware keeps the card and only waits on SDMounter's lock for
+// the odd open or stat, as with any other user.
+//
+// Frames (little-endian):
+//   'S' 'X' <type u8> <seq u8> <length u16> <payload> <crc32 u32>
+// The CRC (sdCrc32, same as zlib) covers type through payload. A frame
+// that fails it is dropped and the reader scans on to the next "SX", so
+// log text on the same port is skipped too. Replies, and every frame of a
+// transfer, carry the seq of the request that started it.
+//
+// File data goes in DATA frames of up to SD_XFER_CHUNK bytes tagged with
+// their file offset. The sender keeps up to SD_XFER_WINDOW bytes in flight;
+// the receiver acks what it has in order and, at the first gap, asks for
+// everything from there again (go-back-N). An upload is written to
+// <path>.part and replaces <path> only once the whole-file CRC matches, so
+// an interrupted upload leaves the old file alone. The swap is SDMounter's
+// atomic replace, so a reset in the middle of it does too. Both directions resume:
+// the side holding the partial copy asks for an offset and is told the CRC
+// of that prefix to check against its own.
+//
+// The port needs a receive buffer of at least one window, set before
+// Serial.begin(): Serial.setRxBufferSize(SD_XFER_WINDOW + 1024).
+
+#define SD_XFER_VERSION 1
+#define SD_XFER_CHUNK 4096              // File bytes per DATA frame
+#define SD_XFER_WINDOW 32768            // Unacknowledged bytes in flight
+#define SD_XFER_ACK_EVERY 8192          // Receiver acks at least this often
+#define SD_XFER_TIMEOUT_MS 1000         // Silence before a resend
+#define SD_XFER_RETRIES 5               // Silent timeouts before giving up
+
+// Frame types. Requests come from the host.
+enum SDXferType : uint8_t {
+    SD_XFER_HELLO = 0x01,       // -> OK {version u8, 0 u8, chunk u16, window u32}
+    SD_XFER_STAT = 0x02,        // path -> OK {is_dir u8, 0 u8[3], size u32, mtime u32}
+    SD_XFER_LIST = 0x03,        // path -> ENTRY... END {count u32}
+    SD_XFER_GET = 0x04,         // {offset u32, path} -> OK {size, offset, prefix crc}, DATA..., END
+    SD_XFER_PUT = 0x05,         // {offset u32, size u32, path} -> OK {size, offset, prefix crc}
+    SD_XFER_DELETE = 0x06,      // path (file or empty directory) -> OK
+    SD_XFER_MKDIR = 0x07,       // path -> OK
+    SD_XFER_CANCEL = 0x08,      // Ends the current transfer -> OK
+
+    SD_XFER_DATA = 0x10,        // {offset u32, bytes}
+    SD_XFER_ACK = 0x11,         // {offset u32, flags u8}: everything below offset received
+    SD_XFER_END = 0x12,         // Transfer: {size u32, crc32 u32}; list: {count u32}
+
+    SD_XFER_OK = 0x20,
+    SD_XFER_ERROR = 0x21,       // {code u8, text}: an SDError or SD_XFER_ERR_*
+    SD_XFER_ENTRY = 0x22        // {is_dir u8, size u32, mtime u32, name_len u8, name}...
+};
+
+// ACK flags
+#define SD_XFER_ACK_RESEND 0x01         // Gap at offset: send again from there
+#define SD_XFER_ACK_DONE 0x02           // Download checked, transfer over
+
+// Error codes past the SDError range
+#define SD_XFER_ERR_PROTOCOL 0xF0
+#define SD_XFER_ERR_CRC 0xF1
+#define SD_XFER_ERR_TIMEOUT 0xF2
+
+// Called on the server task after each upload or download
+typedef std::function<void(const char* path, bool upload, bool ok)> SDTransferCallback;
+
+class SDTransferServer {
+public:
+    struct Stats {
+        uint64_t bytes_in;          // File data received
+        uint64_t bytes_out;
+        uint32_t files_in;          // Completed uploads
+        uint32_t files_out;
+        uint32_t frames_in;
+        uint32_t frames_out;
+        uint32_t bad_frames;        // CRC or length errors
+        uint32_t resends;           // Go-back-N rewinds
+    };
+
+    explicit SDTransferServer(SDMounter& sd = SDCard);
+    ~SDTransferServer();
+
+    // The server reads and writes port from its own task until end()
+    bool begin(Stream& port, BaseType_t core = 0, UBaseType_t priority = 1);
+    void end();
+    bool isRunning() const { return task != nullptr; }
+    bool isBusy() const { return busy; }    // Upload or download in progress
+
+    void onTransfer(SDTransferCallback callback) { on_transfer = callback; }
+    Stats getStats() const { return stats; }
+    void resetStats() { memset(&stats, 0, sizeof(stats)); }
+
+private:
+    struct Frame {
+        uint8_t type;
+        uint8_t seq;
+        uint16_t len;
+        const uint8_t* payload;     // Inside rx, valid until the next readFrame()
+    };
+
+    SDMounter& sd;
+    Stream* port;
+    uint8_t* rx;
+    size_t rx_len;
+    size_t rx_consumed;             // Bytes of the frame handed out last
+    uint8_t* tx;
+    int16_t finished_seq;           // Last upload in place, -1 = none
+    SDTransferCallback on_transfer;
+    Stats stats;
+    TaskHandle_t task;
+    volatile bool stopping;
+    volatile bool busy;
+
+    // Private helper methods
+    bool readFrame(Frame& frame, uint32_t timeout_ms);
+    bool parseFrame(Frame& frame);
+    void dropRx(size_t n);
+    uint8_t* out() { return tx + 6; }     // Payload of the frame being built
+    bool sendFrame(uint8_t type, uint8_t seq, size_t len);
+    bool sendError(uint8_t seq, uint8_t code, const char* text);
+    bool sendSdError(uint8_t seq);
+    bool sendAck(uint8_t seq, uint32_t offset, uint8_t flags);
+    bool sendOpened(uint8_t seq, uint32_t size, uint32_t offset, uint32_t crc);
+    bool getPath(const uint8_t* data, size_t len, char* path);
+    bool crcPrefix(File& file, uint32_t len, uint32_t& crc);
+    void handleRequest(const Frame& frame);
+    void handleStat(uint8_t seq, const char* path);
+    void handleList(uint8_t seq, const char* path);
+    void handleGet(uint8_t seq, uint32_t offset, const char* path);
+    void handlePut(uint8_t seq, uint32_t offset, uint32_t size, const char* path);
+    bool sendFile(File& file, uint8_t seq, uint32_t offset, uint32_t size, uint32_t crc);
+    bool receiveFile(File& file, uint8_t seq, uint32_t offset, uint32_t size, uint32_t crc, bool& corrupt);
+    static void serverTask(void* arg);
+};
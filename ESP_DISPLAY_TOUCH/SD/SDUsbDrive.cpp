@@ -0,0 +1,182 @@
+#include "SDUsbDrive.h"
+
+#if CONFIG_TINYUSB_MSC_ENABLED
+
+#include <esp_heap_caps.h>
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include <esp_memory_utils.h>
+#else
+#include <soc/soc_memory_layout.h>
+#endif
+
+SDUsbDrive* SDUsbDrive::instance = nullptr;
+
+SDUsbDrive::SDUsbDrive()
+    : sd(nullptr),
+      attached(false),
+      eject_pending(false),
+      io_lock(nullptr),
+      sector_count(0),
+      sector_size(0),
+      bounce(nullptr) {
+    resetStats();
+}
+
+bool SDUsbDrive::begin(SDMounter& mounter, const char* vendor, const char* product) {
+    sd = &mounter;
+    instance = this;
+
+    if (!io_lock) {
+        io_lock = xSemaphoreCreateMutex();
+        if (!io_lock) return false;
+    }
+
+    msc.vendorID(vendor);
+    msc.productID(product);
+    msc.productRevision("1.0");
+    msc.onRead(onRead);
+    msc.onWrite(onWrite);
+    msc.onStartStop(onStartStop);
+    msc.mediaPresent(false);    // No medium until attach()
+
+    USB.onEvent(ARDUINO_USB_STOPPED_EVENT, onUsbEvent);
+    return true;
+}
+
+bool SDUsbDrive::attach() {
+    if (attached) return true;
+    if (!sd || !io_lock) return false;
+
+    if (!bounce) {
+        bounce = (uint8_t*)heap_caps_aligned_alloc(4, SD_USB_BOUNCE, MALLOC_CAP_DMA);
+        if (!bounce) {
+            Serial.println("[SDUsbDrive] Out of DMA memory");
+            return false;
+        }
+    }
+
+    if (!sd->beginExport()) {
+        Serial.println("[SDUsbDrive] Card not available: " + sd->getLastError());
+        return false;
+    }
+
+    if (!sd->getBackend().sectorInfo(sector_count, sector_size) || sector_size == 0 ||
+        sector_size > SD_USB_BOUNCE || !msc.begin(sector_count, sector_size)) {
+        Serial.println("[SDUsbDrive] Storage has no sector access");
+        sd->endExport();
+        return false;
+    }
+
+    eject_pending = false;
+    attached = true;
+    msc.mediaPresent(true);
+    Serial.printf("[SDUsbDrive] Card on USB: %u sectors of %u bytes\n", sector_count, sector_size);
+    return true;
+}
+
+void SDUsbDrive::detach() {
+    if (!attached) return;
+
+    // The host sees the medium go first, then a transfer still running on
+    // the USB task finishes before firmware gets the card back
+    msc.mediaPresent(false);
+    xSemaphoreTake(io_lock, portMAX_DELAY);
+    attached = false;
+    eject_pending = false;
+    xSemaphoreGive(io_lock);
+
+    if (!sd->endExport()) {
+        Serial.println("[SDUsbDrive] Remount failed: " + sd->getLastError());
+    }
+    Serial.printf("[SDUsbDrive] Card back: %llu KB read, %llu KB written\n",
+                  (unsigned long long)(stats.read_bytes / 1024), (unsigned long long)(stats.write_bytes / 1024));
+}
+
+void SDUsbDrive::loop() {
+    // Remounting runs the mount callbacks, so it is kept off the USB task
+    if (eject_pending) detach();
+}
+
+// Private helper methods
+int32_t SDUsbDrive::transfer(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t len, bool write) {
+    if (!attached) return -1;
+
+    xSemaphoreTake(io_lock, portMAX_DELAY);
+    if (!attached) {
+        xSemaphoreGive(io_lock);
+        return -1;      // detach() got in first
+    }
+
+    SDStorageBackend& storage = sd->getBackend();
+    unsigned long start = micros();
+    bool ok = true;
+
+    // TinyUSB hands over whole sectors in an aligned internal buffer, which
+    // goes to the card as one command. Anything else goes through bounce.
+    bool direct = (offset == 0 && len % sector_size == 0 &&
+                   esp_ptr_dma_capable(buffer) && ((uintptr_t)buffer & 3) == 0);
+    if (direct) {
+        uint32_t count = len / sector_size;
+        ok = write ? storage.writeSectors(lba, buffer, count) : storage.readSectors(lba, buffer, count);
+    } else {
+        uint32_t done = 0;
+        while (ok && done < len) {
+            uint32_t pos = offset + done;
+            uint32_t sector = lba + pos / sector_size;
+            uint32_t in_sector = pos % sector_size;
+            uint32_t n = sector_size - in_sector;
+            if (n > len - done) n = len - done;
+
+            // Partial sectors are read, patched and written back
+            if (!write || n < sector_size) ok = storage.readSectors(sector, bounce, 1);
+            if (ok && write) {
+                memcpy(bounce + in_sector, buffer + done, n);
+                ok = storage.writeSectors(sector, bounce, 1);
+            } else if (ok) {
+                memcpy(buffer + done, bounce + in_sector, n);
+            }
+            done += n;
+        }
+    }
+
+    uint32_t elapsed = micros() - start;
+    xSemaphoreGive(io_lock);
+    if (!ok) {
+        stats.errors++;
+        return -1;
+    }
+    if (write) {
+        stats.write_bytes += len;
+        stats.write_us += elapsed;
+    } else {
+        stats.read_bytes += len;
+        stats.read_us += elapsed;
+    }
+    return len;
+}
+
+int32_t SDUsbDrive::onRead(uint32_t lba, uint32_t offset, void* buffer, uint32_t len) {
+    return instance ? instance->transfer(lba, offset, (uint8_t*)buffer, len, false) : -1;
+}
+
+int32_t SDUsbDrive::onWrite(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t len) {
+    return instance ? instance->transfer(lba, offset, buffer, len, true) : -1;
+}
+
+bool SDUsbDrive::onStartStop(uint8_t power_condition, bool start, bool load_eject) {
+    // "Eject" in the host's file manager: its caches are flushed by now
+    if (instance && load_eject && !start && instance->attached) {
+        instance->msc.mediaPresent(false);
+        instance->eject_pending = true;
+    }
+    return true;
+}
+
+void SDUsbDrive::onUsbEvent(void* arg, esp_event_base_t base, int32_t id, void* data) {
+    // Cable pulled without an eject: take the card back all the same
+    if (instance && id == ARDUINO_USB_STOPPED_EVENT && instance->attached) {
+        instance->eject_pending = true;
+    }
+}
+
+#endif // CONFIG_TINYUSB_MSC_ENABLED
@@ -0,0 +1,74 @@
+#pragma once
+#include <Arduino.h>
+#include "USB.h"
+
+#if CONFIG_TINYUSB_MSC_ENABLED
+
+#include <USBMSC.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "SDMounter.h"
+
+// The SD card as a USB drive, so logs come off the watch without pulling
+// the card. attach() hands the volume to the host through
+// SDMounter::beginExport(); SDMounter calls then fail until the host ejects
+// the drive, the cable is pulled or detach() is called, and the card is
+// mounted again with whatever the host wrote.
+//
+// Host requests go to the card as raw sector reads and writes, one
+// multi-block command per TinyUSB buffer. The S3's USB port is full speed
+// (12 Mbit/s), so the link tops out near 1 MB/s and the card, on either bus
+// width, is never the limit; getStats() shows the card side.
+//
+// Register before USB.begin(), like the HID classes:
+//   drive.begin();
+//   USB.begin();
+//   ...
+//   drive.attach();     // e.g. from a "USB drive" button
+//   drive.loop();       // in loop(): finishes an eject
+
+#define SD_USB_BOUNCE 4096  // DMA buffer for host buffers the card cannot use directly
+
+class SDUsbDrive {
+public:
+    struct Stats {
+        uint64_t read_bytes;
+        uint64_t write_bytes;
+        uint32_t read_us;       // Time in card reads
+        uint32_t write_us;
+        uint32_t errors;
+    };
+
+    SDUsbDrive();
+
+    bool begin(SDMounter& sd = SDCard, const char* vendor = "Waveshare", const char* product = "Watch SD");
+    bool attach();
+    void detach();
+    bool isAttached() const { return attached; }
+    void loop();
+
+    Stats getStats() const { return stats; }
+    void resetStats() { stats = {0, 0, 0, 0, 0}; }
+
+private:
+    USBMSC msc;
+    SDMounter* sd;
+    volatile bool attached;
+    volatile bool eject_pending;    // Set from the USB task, handled in loop()
+    SemaphoreHandle_t io_lock;      // Held by transfer(); detach() waits on it
+    uint32_t sector_count;
+    uint16_t sector_size;
+    uint8_t* bounce;
+    Stats stats;
+
+    // Private helper methods
+    int32_t transfer(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t len, bool write);
+
+    static SDUsbDrive* instance;    // USBMSC takes plain function pointers
+    static int32_t onRead(uint32_t lba, uint32_t offset, void* buffer, uint32_t len);
+    static int32_t onWrite(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t len);
+    static bool onStartStop(uint8_t power_condition, bool start, bool load_eject);
+    static void onUsbEvent(void* arg, esp_event_base_t base, int32_t id, void* data);
+};
+
+#endif // CONFIG_TINYUSB_MSC_ENABLED
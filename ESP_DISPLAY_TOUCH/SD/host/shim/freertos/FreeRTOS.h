@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// FreeRTOS on top of std::thread for the host build. Tasks are threads,
+// one tick is one millisecond (configTICK_RATE_HZ 1000, as in
+// arduino-esp32) and the core and stack arguments are ignored. Only the
+// calls the SD library makes are provided.
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define portMAX_DELAY       ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define configTICK_RATE_HZ  1000
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS 4
+#define tskNO_AFFINITY      0x7FFFFFFF
+
+struct HostTask;
+typedef HostTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+typedef void (*TlsDeleteCallbackFunction_t)(int index, void* value);
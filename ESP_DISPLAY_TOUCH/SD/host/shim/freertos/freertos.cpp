@@ -0,0 +1,292 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include <pthread.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HostTask {
+    std::string name;
+    UBaseType_t priority = 1;
+    std::mutex m;
+    std::condition_variable cv;
+    uint32_t notify = 0;
+    void* tls[configNUM_THREAD_LOCAL_STORAGE_POINTERS] = {};
+    TlsDeleteCallbackFunction_t tls_delete[configNUM_THREAD_LOCAL_STORAGE_POINTERS] = {};
+};
+
+struct HostQueue {
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+};
+
+// Handles stay valid for the life of the process, so a stale one held by
+// the library (e.g. a finished scan task) is never a dangling pointer
+static thread_local HostTask* current_task = nullptr;
+
+static const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+// Waits on cv until ready() or the timeout; portMAX_DELAY waits for ever
+template <typename Ready>
+static bool waitTicks(std::unique_lock<std::mutex>& lock, std::condition_variable& cv,
+                      TickType_t ticks, Ready ready) {
+    if (ticks == portMAX_DELAY) {
+        cv.wait(lock, ready);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+static HostTask* self() {
+    if (!current_task) {
+        current_task = new HostTask();
+        current_task->name = "main";
+    }
+    return current_task;
+}
+
+static HostTask* taskOrSelf(TaskHandle_t task) {
+    return task ? task : self();
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char* name, uint32_t stack_depth,
+                                   void* arg, UBaseType_t priority, TaskHandle_t* created,
+                                   BaseType_t core) {
+    HostTask* task = new HostTask();
+    task->name = name ? name : "";
+    task->priority = priority;
+    if (created) *created = task;
+
+    std::thread([task, code, arg] {
+        current_task = task;
+        code(arg);
+        vTaskDelete(nullptr);   // A FreeRTOS task must not return
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char* name, uint32_t stack_depth,
+                       void* arg, UBaseType_t priority, TaskHandle_t* created) {
+    return xTaskCreatePinnedToCore(code, name, stack_depth, arg, priority, created, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task && task != current_task) {
+        fprintf(stderr, "vTaskDelete: only the calling task can be deleted on the host\n");
+        abort();
+    }
+
+    HostTask* me = self();
+    for (int i = 0; i < configNUM_THREAD_LOCAL_STORAGE_POINTERS; i++) {
+        if (me->tls_delete[i] && me->tls[i]) me->tls_delete[i](i, me->tls[i]);
+        me->tls[i] = nullptr;
+    }
+    pthread_exit(nullptr);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time).count();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return self();
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    return taskOrSelf(task)->priority;
+}
+
+const char* pcTaskGetName(TaskHandle_t task) {
+    return taskOrSelf(task)->name.c_str();
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> guard(task->m);
+    task->notify++;
+    task->cv.notify_all();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+    HostTask* me = self();
+    std::unique_lock<std::mutex> lock(me->m);
+    waitTicks(lock, me->cv, ticks, [me] { return me->notify > 0; });
+    uint32_t value = me->notify;
+    if (value > 0) me->notify = clear_on_exit ? 0 : value - 1;
+    return value;
+}
+
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index, void* value) {
+    vTaskSetThreadLocalStoragePointerAndDelCallback(task, index, value, nullptr);
+}
+
+void vTaskSetThreadLocalStoragePointerAndDelCallback(TaskHandle_t task, BaseType_t index, void* value,
+                                                     TlsDeleteCallbackFunction_t callback) {
+    if (index < 0 || index >= configNUM_THREAD_LOCAL_STORAGE_POINTERS) return;
+    HostTask* t = taskOrSelf(task);
+    t->tls[index] = value;
+    t->tls_delete[index] = callback;
+}
+
+void* pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index) {
+    if (index < 0 || index >= configNUM_THREAD_LOCAL_STORAGE_POINTERS) return nullptr;
+    return taskOrSelf(task)->tls[index];
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    if (length == 0) return nullptr;
+    HostQueue* queue = new HostQueue();
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void* item, TickType_t ticks, bool front) {
+    std::unique_lock<std::mutex> lock(queue->m);
+    if (!waitTicks(lock, queue->cv, ticks, [queue] { return queue->items.size() < queue->length; })) {
+        return pdFALSE;
+    }
+    const uint8_t* bytes = (const uint8_t*)item;
+    std::vector<uint8_t> copy(bytes, bytes + queue->item_size);
+    if (front) queue->items.push_front(std::move(copy));
+    else queue->items.push_back(std::move(copy));
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(queue->m);
+    if (!waitTicks(lock, queue->cv, ticks, [queue] { return !queue->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->item_size);
+    queue->items.pop_front();
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> guard(queue->m);
+    return queue->items.size();
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> guard(queue->m);
+    queue->items.clear();
+    queue->cv.notify_all();
+    return pdPASS;
+}
+
+static SemaphoreHandle_t initSemaphore(StaticSemaphore_t* sem, bool is_static, bool is_mutex,
+                                       UBaseType_t max_count, UBaseType_t initial) {
+    sem->count = initial;
+    sem->max_count = max_count;
+    sem->is_mutex = is_mutex;
+    sem->owner = nullptr;
+    sem->depth = 0;
+    sem->is_static = is_static;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return initSemaphore(new StaticSemaphore_t(), false, true, 1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+    return xSemaphoreCreateMutex();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer) {
+    return initSemaphore(buffer, true, true, 1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t* buffer) {
+    return xSemaphoreCreateMutexStatic(buffer);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return initSemaphore(new StaticSemaphore_t(), false, false, 1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial) {
+    return initSemaphore(new StaticSemaphore_t(), false, false, max_count, initial);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    if (sem && !sem->is_static) delete sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(sem->m);
+    if (!waitTicks(lock, sem->cv, ticks, [sem] { return sem->count > 0; })) return pdFALSE;
+    sem->count--;
+    if (sem->is_mutex) sem->owner = self();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    std::lock_guard<std::mutex> guard(sem->m);
+    if (sem->is_mutex && sem->owner != self()) return pdFALSE;
+    if (sem->count >= sem->max_count) return pdFALSE;
+    sem->count++;
+    sem->owner = nullptr;
+    sem->cv.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks) {
+    {
+        std::lock_guard<std::mutex> guard(sem->m);
+        if (sem->owner == self()) {
+            sem->depth++;
+            return pdTRUE;
+        }
+    }
+    if (!xSemaphoreTake(sem, ticks)) return pdFALSE;
+    std::lock_guard<std::mutex> guard(sem->m);
+    sem->depth = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem) {
+    {
+        std::lock_guard<std::mutex> guard(sem->m);
+        if (sem->owner != self()) return pdFALSE;
+        if (--sem->depth > 0) return pdTRUE;
+    }
+    return xSemaphoreGive(sem);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem) {
+    std::lock_guard<std::mutex> guard(sem->m);
+    return sem->count;
+}
+
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t sem) {
+    std::lock_guard<std::mutex> guard(sem->m);
+    return sem->owner;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// No SDMMC pins on the host: SDMMCBackend is not built and SDMounter polls
+// for hot-swap (no SDMMC_CD)
@@ -0,0 +1,228 @@
+#include <Arduino.h>
+#include <FS.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "SDMounter.h"
+#include "SDRamDiskBackend.h"
+#include "SDDirBackend.h"
+
+// Drives the RAM disk and the directory backend through the same checks:
+// descriptor and path calls, File access through fs(), fault injection on
+// both, and SDMounter on top of each.
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static bool writeAll(SDStorageBackend& b, const char* path, const char* text) {
+    int fd = b.open(path, SD_OPEN_WRITE);
+    if (fd < 0) return false;
+    bool ok = b.write(fd, text, strlen(text)) == (int)strlen(text);
+    b.close(fd);
+    return ok;
+}
+
+static String readAll(SDStorageBackend& b, const char* path) {
+    int fd = b.open(path, SD_OPEN_READ);
+    if (fd < 0) return String();
+    char buf[128];
+    int n = b.read(fd, buf, sizeof(buf) - 1);
+    b.close(fd);
+    buf[n > 0 ? n : 0] = '\0';
+    return String(buf);
+}
+
+static void testDescriptors(SDStorageBackend& b) {
+    CHECK(b.mkdir("/d"));
+    CHECK(writeAll(b, "/d/a.txt", "hello"));
+
+    bool is_dir = true;
+    size_t size = 0;
+    CHECK(b.stat("/d/a.txt", &is_dir, &size));
+    CHECK(!is_dir && size == 5);
+    CHECK(b.stat("/d", &is_dir) && is_dir);
+    CHECK(readAll(b, "/d/a.txt") == "hello");
+
+    int fd = b.open("/d/a.txt", SD_OPEN_APPEND);
+    CHECK(fd >= 0 && b.write(fd, " world", 6) == 6);
+    CHECK(b.size(fd) == 11);
+    b.close(fd);
+    CHECK(readAll(b, "/d/a.txt") == "hello world");
+
+    // Renaming onto an existing file fails, as on FAT
+    CHECK(writeAll(b, "/d/c.txt", "c"));
+    CHECK(!b.rename("/d/a.txt", "/d/c.txt"));
+    CHECK(b.rename("/d/a.txt", "/d/b.txt"));
+    CHECK(!b.stat("/d/a.txt") && b.stat("/d/b.txt"));
+
+    CHECK(b.truncate("/d/b.txt", 5));
+    CHECK(readAll(b, "/d/b.txt") == "hello");
+
+    void* dir = b.openDir("/d");
+    CHECK(dir != nullptr);
+    int entries = 0;
+    char name[64];
+    while (dir && b.readDir(dir, name, sizeof(name), &is_dir) == 1) {
+        CHECK(!is_dir);
+        entries++;
+    }
+    if (dir) b.closeDir(dir);
+    CHECK(entries == 2);
+
+    CHECK(!b.rmdir("/d"));
+    CHECK(b.unlink("/d/b.txt") && b.unlink("/d/c.txt"));
+    CHECK(b.rmdir("/d"));
+}
+
+static void testFiles(SDStorageBackend& b) {
+    fs::FS& fs = b.fs();
+
+    // Parents are created on open, as with the Arduino VFS
+    File f = fs.open("/f/g/h.txt", FILE_WRITE, true);
+    CHECK(f);
+    CHECK(f.print("abcdef") == 6);
+    f.close();
+    CHECK(fs.exists("/f/g/h.txt"));
+
+    f = fs.open("/f/g/h.txt", FILE_READ);
+    CHECK(f && f.size() == 6 && !f.isDirectory());
+    CHECK(strcmp(f.name(), "h.txt") == 0);
+    CHECK(f.seek(2) && f.read() == 'c' && f.position() == 3);
+    char buf[8] = {};
+    CHECK(f.read((uint8_t*)buf, sizeof(buf)) == 3 && strcmp(buf, "def") == 0);
+    f.close();
+
+    f = fs.open("/f/g/h.txt", FILE_APPEND);
+    CHECK(f && f.write((const uint8_t*)"gh", 2) == 2);
+    f.close();
+    CHECK(readAll(b, "/f/g/h.txt") == "abcdefgh");
+
+    File dir = fs.open("/f/g");
+    CHECK(dir && dir.isDirectory());
+    File child = dir.openNextFile();
+    CHECK(child && strcmp(child.path(), "/f/g/h.txt") == 0);
+    child.close();
+    CHECK(!dir.openNextFile());
+    dir.rewindDirectory();
+    bool is_dir = true;
+    CHECK(dir.getNextFileName(&is_dir) == "/f/g/h.txt" && !is_dir);
+    dir.close();
+
+    CHECK(fs.rename("/f/g/h.txt", "/f/h.txt"));
+    CHECK(fs.remove("/f/h.txt") && fs.rmdir("/f/g") && fs.rmdir("/f"));
+}
+
+static void testFaults(SDStorageBackend& b) {
+    fs::FS& fs = b.fs();
+    CHECK(writeAll(b, "/x.bin", "0123456789"));
+
+    // Opens fail by descriptor and through fs() alike
+    SDFaultConfig faults;
+    faults.fail_permille = 1000;
+    faults.fail_ops = 1 << SDStorageBackend::OP_OPEN;
+    b.setFaults(faults);
+    uint32_t injected = b.getFaultStats().injected;
+    CHECK(b.open("/x.bin", SD_OPEN_READ) < 0);
+    CHECK(!fs.open("/x.bin", FILE_READ));
+    CHECK(b.getFaultStats().injected == injected + 2);
+    CHECK(b.stat("/x.bin"));
+
+    // Reads through an open File fail too
+    b.clearFaults();
+    File f = fs.open("/x.bin", FILE_READ);
+    CHECK(f);
+    faults.fail_ops = 1 << SDStorageBackend::OP_READ;
+    b.setFaults(faults);
+    uint8_t buf[4];
+    CHECK(f.read(buf, sizeof(buf)) == 0);
+    b.clearFaults();
+    CHECK(f.read(buf, sizeof(buf)) == 4 && buf[0] == '0');
+    f.close();
+
+    // A pulled card fails everything, File access included
+    b.setRemoved(true);
+    CHECK(!b.isPresent());
+    CHECK(!fs.exists("/x.bin"));
+    CHECK(!fs.open("/x.bin", FILE_READ));
+    CHECK(!fs.open("/", FILE_READ));
+    b.setRemoved(false);
+    CHECK(b.isPresent() && fs.exists("/x.bin"));
+    CHECK(b.unlink("/x.bin"));
+}
+
+static void testMounter(SDStorageBackend& b) {
+    SDMounter sd;
+    CHECK(sd.setBackend(b));
+    CHECK(sd.mount(false, "/sdcard"));
+    CHECK(sd.isMounted());
+
+    CHECK(sd.mkdir("/data"));
+    CHECK(sd.writeFile("/data/a.txt", "first"));
+    CHECK(sd.writeFile("/data/a.txt", "second"));     // Atomic replace
+    CHECK(sd.readFile("/data/a.txt") == "second");
+    CHECK(sd.appendFile("/data/a.txt", "!"));
+    CHECK(sd.getFileSize("/data/a.txt") == 7);
+    CHECK(sd.copyFile("/data/a.txt", "/data/b.txt"));
+    CHECK(sd.moveFile("/data/b.txt", "/c.txt"));
+    CHECK(sd.readFile("/c.txt") == "second!");
+    CHECK(sd.truncateFile("/c.txt", 3) && sd.readFile("/c.txt") == "sec");
+
+    std::vector<String> names = sd.listDirVector("/data");
+    CHECK(names.size() == 1 && names[0] == "a.txt");
+    CHECK(!sd.existsFile("/data/a.txt" SD_REPLACE_TEMP) && !sd.existsFile("/data/a.txt" SD_REPLACE_BACKUP));
+
+    uint64_t total = sd.getTotalBytes();
+    uint64_t free_bytes = sd.getFreeBytes();
+    CHECK(total == b.cardSize() && free_bytes > 0 && free_bytes < total);
+
+    CHECK(sd.deleteFile("/c.txt"));
+    CHECK(sd.rmdirRecursive("/data") && sd.getLastDeleteCount() == 2);
+    CHECK(!sd.existsFile("/data"));
+
+    // The mounter reports the backend's failures as errors
+    b.setRemoved(true);
+    CHECK(!sd.writeFile("/gone.txt", "x"));
+    CHECK(sd.getErrorCode() != SD_OK);
+    b.setRemoved(false);
+
+    CHECK(sd.unmount());
+    CHECK(!sd.isMounted());
+}
+
+static void run(const char* label, SDStorageBackend& b) {
+    printf("%s\n", label);
+    CHECK(b.begin("/sdcard", 1, 0, true));
+    testDescriptors(b);
+    testFiles(b);
+    testFaults(b);
+    b.end();
+    testMounter(b);
+}
+
+int main() {
+    SDRamDiskBackend ramdisk(1024 * 1024);
+    run("RAM disk", ramdisk);
+
+    char root[] = "/tmp/sd_host_XXXXXX";
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    {
+        SDDirBackend dir(root, 8 * 1024 * 1024);
+        run("Directory", dir);
+        dir.begin("/sdcard", 1, 0, false);
+        dir.format(0);
+        dir.end();
+    }
+    rmdir(root);
+
+    printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,824 @@
+#include <Arduino.h>
+#include <FS.h>
+#include <atomic>
+#include <new>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "SDMounter.h"
+#include "SDRamDiskBackend.h"
+#include "SDAsync.h"
+#include "SDLogStream.h"
+#include "SDRecordStore.h"
+#include "SDTransaction.h"
+
+// SDMounter policy on the RAM disk: handles held by open files, per-task
+// errors, recovery of replaces and transactions cut short, moves over
+// existing files,
+// recursive walks, the directory
+// index, free-space accounting, polled hot-swap and the block cache under
+// more readers than blocks, cancelling async requests, log streams
+// across an unmount and record store rotation and torn-tail recovery.
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// Counts heap allocations made by the test's own task while set
+static thread_local bool counting_allocs = false;
+static uint32_t allocs = 0;
+
+void* operator new(size_t size) {
+    if (counting_allocs) allocs++;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+static void testHandles(SDMounter& sd, SDRamDiskBackend& ram) {
+    printf("handles\n");
+    CHECK(sd.mount());
+    CHECK(sd.writeFile("/h.txt", "held"));
+    CHECK(sd.getOpenHandles() == 0);
+
+    File f = sd.openFile("/h.txt");
+    CHECK(f && sd.getOpenHandles() == 1);
+    File copy = f;
+    File dir = sd.openDir("/");
+    CHECK(dir && sd.getOpenHandles() == 2);
+    File child = dir.openNextFile();
+    CHECK(child && sd.getOpenHandles() == 3);
+    child.close();
+    dir.close();
+    CHECK(sd.getOpenHandles() == 1);
+
+    // Unmounting stops new calls but leaves the volume to the open file
+    CHECK(sd.unmount());
+    CHECK(!sd.isMounted() && ram.isPresent());
+    char buf[8] = {};
+    CHECK(copy.read((uint8_t*)buf, sizeof(buf)) == 4 && strcmp(buf, "held") == 0);
+    f = File();
+    CHECK(ram.isPresent());     // The copy still holds it
+    copy.close();
+    CHECK(sd.getOpenHandles() == 0 && !ram.isPresent());
+
+    // A File dropped without close() releases its handle too
+    CHECK(sd.mount());
+    {
+        File scoped = sd.openFile("/h.txt");
+        CHECK(sd.getOpenHandles() == 1);
+    }
+    CHECK(sd.getOpenHandles() == 0);
+
+    // So does a directory iterator, until it is closed
+    SDDirIterator it;
+    SDDirEntry entry;
+    CHECK(sd.openDirIterator("/", it) && sd.getOpenHandles() == 1);
+    CHECK(sd.unmount());
+    CHECK(ram.isPresent());
+    CHECK(it.next(entry) && strcmp(entry.name, "h.txt") == 0);
+    it.close();
+    CHECK(sd.getOpenHandles() == 0 && !ram.isPresent());
+    CHECK(sd.mount());
+    {
+        SDDirIterator scoped;
+        CHECK(sd.openDirIterator("/", scoped) && sd.getOpenHandles() == 1);
+    }
+    CHECK(sd.getOpenHandles() == 0);
+
+    CHECK(sd.deleteFile("/h.txt"));
+    CHECK(sd.unmount());
+}
+
+static bool writeRaw(SDStorageBackend& b, const char* path, const void* data, size_t len) {
+    int fd = b.open(path, SD_OPEN_WRITE);
+    if (fd < 0) return false;
+    bool ok = b.write(fd, data, len) == (int)len;
+    b.close(fd);
+    return ok;
+}
+
+static bool writeRaw(SDStorageBackend& b, const char* path, const char* text) {
+    return writeRaw(b, path, text, strlen(text));
+}
+
+static std::vector<uint8_t> readRaw(SDStorageBackend& b, const char* path) {
+    std::vector<uint8_t> data;
+    int fd = b.open(path, SD_OPEN_READ);
+    if (fd < 0) return data;
+    data.resize(b.size(fd));
+    if (b.read(fd, data.data(), data.size()) != (int)data.size()) data.clear();
+    b.close(fd);
+    return data;
+}
+
+static void testRecovery(SDMounter& sd, SDRamDiskBackend& ram) {
+    printf("recovery\n");
+    CHECK(sd.mount());
+    CHECK(sd.mkdir("/r") && sd.mkdir("/r/deep"));
+    CHECK(sd.unmount());
+
+    // Power lost at each step of a replace, plus a user's own backup
+    CHECK(ram.begin("/sdcard", 1, 0, false));
+    CHECK(writeRaw(ram, "/r/swapped.txt", "new"));          // After the swap
+    CHECK(writeRaw(ram, "/r/swapped.txt" SD_REPLACE_BACKUP, "old"));
+    CHECK(writeRaw(ram, "/r/deep/between.txt" SD_REPLACE_BACKUP, "old"));  // Between the renames
+    CHECK(writeRaw(ram, "/r/deep/between.txt" SD_REPLACE_TEMP, "new"));
+    CHECK(writeRaw(ram, "/r/early.txt" SD_REPLACE_BACKUP, "old"));   // Before the temp was moved
+    CHECK(writeRaw(ram, "/r/notes.bak", "mine"));
+    ram.end();
+
+    CHECK(sd.mount());
+    CHECK(sd.readFile("/r/swapped.txt") == "new");
+    CHECK(sd.readFile("/r/deep/between.txt") == "new");
+    CHECK(sd.readFile("/r/early.txt") == "old");
+    CHECK(sd.readFile("/r/notes.bak") == "mine");
+    CHECK(!sd.existsFile("/r/swapped.txt" SD_REPLACE_BACKUP));
+    CHECK(!sd.existsFile("/r/deep/between.txt" SD_REPLACE_BACKUP));
+    CHECK(!sd.existsFile("/r/deep/between.txt" SD_REPLACE_TEMP));
+    CHECK(!sd.existsFile("/r/early.txt" SD_REPLACE_BACKUP));
+
+    // Nothing is recovered on a miss once mounted
+    CHECK(writeRaw(ram, "/r/late.txt" SD_REPLACE_BACKUP, "old"));
+    CHECK(!sd.existsFile("/r/late.txt") && sd.getFileSize("/r/late.txt") == 0);
+    CHECK(sd.existsFile("/r/late.txt" SD_REPLACE_BACKUP));
+
+    CHECK(sd.rmdirRecursive("/r"));
+    CHECK(sd.unmount());
+}
+
+static void testTransaction(SDMounter& sd, SDRamDiskBackend& ram) {
+    printf("transaction\n");
+    CHECK(sd.mount());
+    CHECK(sd.mkdir("/t"));
+    CHECK(sd.writeFile("/t/a.txt", "a0") && sd.writeFile("/t/old.txt", "gone"));
+
+    // Commit: every op lands, staging and journal are cleaned up
+    {
+        SDTransaction tx(sd);
+        CHECK(tx.write("/t/a.txt", "a1") && tx.write("/t/b.txt", "b1") && tx.remove("/t/old.txt"));
+        CHECK(sd.getOpenHandles() == 1);    // The journal
+
+        // A second transaction must not truncate the live journal
+        SDTransaction other(sd);
+        CHECK(!other.write("/t/c.txt", "c1") && sd.getErrorCode() == SD_ERR_BUSY);
+        other.abort();
+        CHECK(sd.existsFile(SD_JOURNAL_PATH));
+
+        CHECK(tx.commit());
+    }
+    CHECK(sd.getOpenHandles() == 0);
+    CHECK(sd.readFile("/t/a.txt") == "a1" && sd.readFile("/t/b.txt") == "b1");
+    CHECK(!sd.existsFile("/t/old.txt") && !sd.existsFile("/t/a.txt" SD_TXN_SUFFIX));
+    CHECK(!sd.existsFile(SD_JOURNAL_PATH));
+
+    // Abort, explicit or by going out of scope, changes nothing
+    {
+        SDTransaction tx(sd);
+        CHECK(tx.write("/t/a.txt", "a2") && tx.remove("/t/b.txt"));
+        tx.abort();
+        CHECK(tx.size() == 0);
+        CHECK(tx.write("/t/b.txt", "b2"));
+    }
+    CHECK(sd.readFile("/t/a.txt") == "a1" && sd.readFile("/t/b.txt") == "b1");
+    CHECK(!sd.existsFile("/t/a.txt" SD_TXN_SUFFIX) && !sd.existsFile("/t/b.txt" SD_TXN_SUFFIX));
+    CHECK(!sd.existsFile(SD_JOURNAL_PATH) && sd.getOpenHandles() == 0);
+
+    // Reset before the commit record: the next mount rolls back
+    std::vector<uint8_t> journal, staged;
+    {
+        SDTransaction tx(sd);
+        CHECK(tx.write("/t/a.txt", "a3"));
+        journal = readRaw(ram, SD_JOURNAL_PATH);
+        staged = readRaw(ram, "/t/a.txt" SD_TXN_SUFFIX);
+    }
+    CHECK(!journal.empty() && staged.size() == 2);
+    CHECK(writeRaw(ram, SD_JOURNAL_PATH, journal.data(), journal.size()));
+    CHECK(writeRaw(ram, "/t/a.txt" SD_TXN_SUFFIX, staged.data(), staged.size()));
+    CHECK(sd.unmount() && sd.mount());
+    CHECK(sd.readFile("/t/a.txt") == "a1");
+    CHECK(!sd.existsFile("/t/a.txt" SD_TXN_SUFFIX) && !sd.existsFile(SD_JOURNAL_PATH));
+
+    // Reset after it: an open target stops the apply half way, the journal
+    // stays and the next mount finishes the job
+    int busy = ram.open("/t/b.txt", SD_OPEN_READ);
+    CHECK(busy >= 0);
+    {
+        SDTransaction tx(sd);
+        CHECK(tx.write("/t/a.txt", "a4") && tx.write("/t/b.txt", "b4"));
+        CHECK(!tx.commit() && sd.getErrorCode() == SD_ERR_TXN_APPLY);
+    }
+    ram.close(busy);
+    CHECK(sd.readFile("/t/a.txt") == "a4" && sd.readFile("/t/b.txt") == "b1");
+    CHECK(sd.existsFile(SD_JOURNAL_PATH));
+    {
+        SDTransaction tx(sd);
+        CHECK(!tx.write("/t/c.txt", "c1") && sd.getErrorCode() == SD_ERR_BUSY);
+    }
+    CHECK(sd.unmount() && sd.mount());
+    CHECK(sd.readFile("/t/a.txt") == "a4" && sd.readFile("/t/b.txt") == "b4");
+    CHECK(!sd.existsFile("/t/b.txt" SD_TXN_SUFFIX) && !sd.existsFile(SD_JOURNAL_PATH));
+
+    CHECK(sd.rmdirRecursive("/t"));
+    CHECK(sd.unmount());
+}
+
+static void testMove(SDMounter& sd, SDRamDiskBackend& ram) {
+    printf("move\n");
+    CHECK(sd.mount());
+    CHECK(sd.mkdir("/m") && sd.mkdir("/m/sub"));
+    CHECK(sd.writeFile("/m/a.txt", "source"));
+
+    // Onto itself, in any case, the source stays
+    CHECK(!sd.moveFile("/m/a.txt", "/m/a.txt") && sd.getErrorCode() == SD_ERR_SAME_FILE);
+    CHECK(!sd.moveFile("/m/a.txt", "/M/A.TXT") && sd.getErrorCode() == SD_ERR_SAME_FILE);
+    CHECK(!sd.moveFile("/m/a.txt", "/m/sub/../a.txt"));
+    CHECK(sd.readFile("/m/a.txt") == "source");
+
+    // Onto a directory: refused without copying
+    CHECK(!sd.moveFile("/m/a.txt", "/m/sub") && sd.getErrorCode() == SD_ERR_IS_A_DIRECTORY);
+    CHECK(sd.readFile("/m/a.txt") == "source");
+
+    // Onto an existing file: replaced by rename, its space returned
+    CHECK(sd.writeFile("/m/sub/b.txt", "destination, a good deal longer than the source"));
+    while (!sd.isSpaceInfoReady()) vTaskDelay(1);
+    CHECK(sd.moveFile("/m/a.txt", "/m/sub/b.txt"));
+    CHECK(sd.getLastMoveMethod() == SDMounter::MOVE_RENAME);
+    CHECK(sd.readFile("/m/sub/b.txt") == "source" && !sd.existsFile("/m/a.txt"));
+    CHECK(!sd.existsFile("/m/sub/b.txt" SD_REPLACE_BACKUP));
+    uint64_t total, free;
+    uint32_t cluster;
+    CHECK(ram.getSpace(total, free, cluster) && sd.getFreeBytes() == free);
+
+    CHECK(sd.rmdirRecursive("/m"));
+    CHECK(sd.unmount());
+}
+
+static void testWalk(SDMounter& sd) {
+    printf("walk\n");
+    CHECK(sd.mount());
+
+    // A chain deeper than the walk goes, a file at every level
+    char path[SD_PATH_MAX] = "/w";
+    CHECK(sd.mkdir(path));
+    for (int level = 0; level <= SD_WALK_MAX_DEPTH + 1; level++) {
+        char file[SD_PATH_MAX];
+        snprintf(file, sizeof(file), "%s/f%d.txt", path, level);
+        CHECK(sd.writeFile(file, "x"));
+        strlcat(path, "/d", sizeof(path));
+        CHECK(sd.mkdir(path));
+    }
+
+    for (int indexed = 0; indexed < 2; indexed++) {
+        sd.enableDirIndex(indexed);
+        SDDirFilter filter;
+        filter.recursive = true;
+        filter.files_only = true;
+        // "d" lists before "fN.txt", so the deepest file comes first
+        int last = SD_WALK_MAX_DEPTH + 1;
+        bool in_order = true;
+        uint32_t n = sd.forEachEntry("/w", [&](const SDDirEntry& e) {
+            char name[16];
+            snprintf(name, sizeof(name), "f%d.txt", e.depth);
+            in_order = in_order && e.depth == last - 1 && strcmp(e.name, name) == 0;
+            last = e.depth;
+            return true;
+        }, filter);
+        CHECK(n == SD_WALK_MAX_DEPTH + 1 && last == 0 && in_order);
+
+        // Pagination and an early stop still end the walk cleanly
+        filter.skip = 3;
+        filter.limit = 2;
+        uint8_t first = 0xFF;
+        CHECK(sd.forEachEntry("/w", [&](const SDDirEntry& e) {
+            if (first == 0xFF) first = e.depth;
+            return true;
+        }, filter) == 2 && first == SD_WALK_MAX_DEPTH - 3);
+        filter.skip = filter.limit = 0;
+        CHECK(sd.forEachEntry("/w", [](const SDDirEntry& e) { return e.depth > 12; }, filter) ==
+              SD_WALK_MAX_DEPTH - 11);
+    }
+
+    CHECK(sd.forEachEntry("/missing", [](const SDDirEntry&) { return true; }) == 0);
+    CHECK(sd.getErrorCode() == SD_ERR_NOT_A_DIRECTORY);
+    // Deeper than one delete walk goes, so in two parts
+    CHECK(sd.rmdirRecursive("/w/d/d/d/d/d/d/d/d"));
+    CHECK(sd.rmdirRecursive("/w"));
+    CHECK(sd.unmount());
+}
+
+// One polled probe; re-enabling resets the empty-slot back-off
+static void probe(SDMounter& sd) {
+    sd.enableHotSwapDetection(true);
+    delay(210);
+    sd.checkHotSwap();
+}
+
+static void testHotSwap(SDMounter& sd, SDRamDiskBackend& ram) {
+    printf("hot-swap\n");
+    int inserted = 0;
+    sd.onCardInserted([&]() { inserted++; });
+    sd.enableAutoMount(true);
+    CHECK(sd.mount());
+
+    ram.setRemoved(true);
+    probe(sd);
+    CHECK(!sd.isMounted());
+
+    // A card that answers once and drops out again is not mounted
+    ram.setRemoved(false);
+    probe(sd);
+    ram.setRemoved(true);
+    probe(sd);
+    ram.setRemoved(false);
+    probe(sd);
+    probe(sd);
+    CHECK(!sd.isMounted() && inserted == 0);
+    probe(sd);
+    CHECK(sd.isMounted() && inserted == 1);
+
+    // Without auto-mount an insert is only reported
+    sd.enableAutoMount(false);
+    ram.setRemoved(true);
+    probe(sd);
+    CHECK(!sd.isMounted());
+    ram.setRemoved(false);
+    for (int i = 0; i < 4; i++) probe(sd);
+    CHECK(!sd.isMounted() && !ram.isPresent() && inserted == 2);
+
+    sd.enableHotSwapDetection(false);
+    sd.onCardInserted(nullptr);
+}
+
+static void testIndex(SDMounter& sd, SDRamDiskBackend& ram) {
+    printf("index\n");
+    CHECK(sd.mount());
+    sd.enableDirIndex(true);
+    // Paths too long for a String to keep inline, so temporaries would show
+    CHECK(sd.mkdir("/indexed_directory"));
+    CHECK(sd.writeFile("/indexed_directory/a.txt", "abc"));
+    CHECK(sd.listDir("/indexed_directory") == "FILE: a.txt (3 bytes)\n");
+
+    // Sizes only the card knows: written through a File, created by an
+    // append, and one re-read while its writer was still open
+    File f = sd.openFile("/indexed_directory/b.txt", FILE_WRITE);
+    f.print("hello");
+    f.close();
+    CHECK(sd.appendFile("/indexed_directory/c.txt", "12345678"));
+    File open = sd.openFile("/indexed_directory/d.txt", FILE_WRITE);
+    open.print("12");
+    open.flush();
+    CHECK(sd.listDir("/indexed_directory").indexOf("d.txt (2 bytes)") >= 0);
+    open.print("34");
+    open.close();
+    CHECK(sd.listDir("/indexed_directory") == "FILE: a.txt (3 bytes)\nFILE: b.txt (5 bytes)\n"
+                              "FILE: c.txt (8 bytes)\nFILE: d.txt (4 bytes)\n");
+
+    // A stale entry whose file has gone is dropped, not listed
+    f = sd.openFile("/indexed_directory/e.txt", FILE_WRITE);
+    f.print("x");
+    f.close();
+    CHECK(ram.unlink("/indexed_directory/e.txt"));
+    std::vector<String> names = sd.listDirVector("/indexed_directory");
+    CHECK(names.size() == 4 && names.back() == "d.txt");
+    const SDDirIndex::DirNode* node = sd.getDirIndex().getDir("/indexed_directory");
+    CHECK(node && !node->has_stale);
+    for (const SDDirIndex::Entry& e : node->entries) CHECK(!(e.flags & SDDirIndex::FLAG_STALE));
+
+    // Lookups and listings of loaded directories allocate nothing
+    SDDirIndex::Info info;
+    SDDirIterator it;
+    SDDirEntry entry;
+    int listed = 0;
+    allocs = 0;
+    counting_allocs = true;
+    CHECK(sd.getDirIndex().lookup("/indexed_directory/c.txt", info) && info.size == 8);
+    CHECK(!sd.getDirIndex().lookup("/indexed_directory/none.txt", info));
+    CHECK(sd.existsFile("/indexed_directory/a.txt") && sd.getFileSize("/indexed_directory/b.txt") == 5);
+    CHECK(sd.getDirIndex().getDir("/indexed_directory/") == node);
+    if (sd.openDirIterator("/indexed_directory", it)) {
+        while (it.next(entry)) listed++;
+        it.close();
+    }
+    counting_allocs = false;
+    CHECK(listed == 4);
+    CHECK(allocs == 0);
+
+    sd.enableDirIndex(false);
+    CHECK(sd.rmdirRecursive("/indexed_directory"));
+    CHECK(sd.unmount());
+}
+
+static bool spaceMatches(SDMounter& sd, SDRamDiskBackend& ram) {
+    uint64_t total, free;
+    uint32_t cluster;
+    return ram.getSpace(total, free, cluster) && sd.getFreeBytes() == free;
+}
+
+static void testSpace(SDMounter& sd, SDRamDiskBackend& ram) {
+    printf("space\n");
+    static uint8_t data[20000];
+
+    for (int mode = 0; mode < 4; mode++) {
+        bool indexed = mode & 1;
+        sd.setAtomicWrites(mode & 2);
+
+        // Writes while the scan is still walking are left to its count
+        SDFaultConfig slow;
+        slow.latency_us = 20000;
+        ram.setFaults(slow);
+        CHECK(sd.mount());
+        sd.enableDirIndex(indexed);
+        CHECK(!sd.isSpaceInfoReady());
+        CHECK(sd.writeFile("/during.bin", data, 5000));
+        ram.clearFaults();
+        while (!sd.isSpaceInfoReady()) vTaskDelay(1);
+        CHECK(spaceMatches(sd, ram));
+
+        // Growing, shrinking and copying over files the mounter never sized
+        CHECK(sd.writeFile("/a.bin", data, 3000));
+        CHECK(sd.writeFile("/a.bin", data, sizeof(data)) && spaceMatches(sd, ram));
+        CHECK(sd.writeFile("/a.bin", data, 100) && spaceMatches(sd, ram));
+        CHECK(sd.copyFile("/during.bin", "/a.bin") && spaceMatches(sd, ram));
+        CHECK(sd.deleteFile("/a.bin") && sd.deleteFile("/during.bin") && spaceMatches(sd, ram));
+
+        // Written through a File: counted when it is closed
+        File f = sd.openFile("/f.bin", FILE_WRITE);
+        CHECK(f.write(data, 9000) == 9000);
+        f.close();
+        CHECK(spaceMatches(sd, ram));
+        CHECK(sd.deleteFile("/f.bin") && spaceMatches(sd, ram));
+        CHECK(sd.unmount());
+    }
+    sd.enableDirIndex(false);
+    sd.setAtomicWrites(true);
+}
+
+struct CacheReader {
+    SDMounter* sd;
+    SDBlockCache* cache;
+    std::atomic<int>* done;
+    int short_reads;
+    int bad_bytes;
+};
+
+static void cacheTask(void* arg) {
+    CacheReader* r = (CacheReader*)arg;
+    SDCachedFile f;
+    if (f.open(*r->cache, *r->sd, "/cache.bin")) {
+        uint8_t buf[700];
+        for (int pass = 0; pass < 20; pass++) {
+            f.seek(0);
+            while (f.available()) {
+                uint32_t at = f.position();
+                size_t want = std::min<size_t>(sizeof(buf), f.available());
+                size_t got = f.read(buf, want);
+                if (got != want) r->short_reads++;
+                for (size_t i = 0; i < got; i++) {
+                    if (buf[i] != (uint8_t)((at + i) * 7)) r->bad_bytes++;
+                }
+                if (!got) break;
+            }
+        }
+        f.close();
+    } else {
+        r->short_reads++;
+    }
+    (*r->done)++;
+    vTaskDelete(nullptr);
+}
+
+static void testCache(SDMounter& sd, SDRamDiskBackend& ram) {
+    printf("cache\n");
+    CHECK(sd.mount());
+    uint8_t data[16 * 1024];
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i * 7);
+    CHECK(sd.writeFile("/cache.bin", data, sizeof(data)));
+
+    // Two blocks for four readers and the read-ahead: every block is often
+    // pinned, which must mean waiting, never a short read
+    SDBlockCache cache;
+    CHECK(cache.begin(1024, 2, 2));
+    const int readers = 4;
+    CacheReader workers[readers];
+    std::atomic<int> done(0);
+    for (int i = 0; i < readers; i++) {
+        workers[i] = {&sd, &cache, &done, 0, 0};
+        CHECK(xTaskCreate(cacheTask, "reader", 4096, &workers[i], 1, nullptr) == pdPASS);
+    }
+    while (done < readers) vTaskDelay(5);
+    for (int i = 0; i < readers; i++) CHECK(workers[i].short_reads == 0 && workers[i].bad_bytes == 0);
+    SDBlockCache::Stats stats = cache.getStats();
+    CHECK(stats.hits + stats.misses > 0);
+
+    // The read-ahead handle is counted too, so a stream outlives an unmount
+    SDCachedFile stream;
+    CHECK(stream.open(cache, sd, "/cache.bin") && sd.getOpenHandles() == 2);
+    uint8_t got[16 * 1024];
+    CHECK(stream.read(got, 3000) == 3000);
+    CHECK(sd.unmount());
+    CHECK(ram.isPresent());
+    CHECK(stream.read(got + 3000, sizeof(got)) == sizeof(got) - 3000);
+    CHECK(memcmp(got, data, sizeof(data)) == 0);
+    stream.close();
+    CHECK(sd.getOpenHandles() == 0 && !ram.isPresent());
+
+    // end() closes what is still open and waits out the read-ahead
+    CHECK(sd.mount());
+    CHECK(stream.open(cache, sd, "/cache.bin"));
+    CHECK(stream.read(got, 4000) == 4000);
+    cache.end();
+    CHECK(!stream.isOpen() && sd.getOpenHandles() == 0);
+
+    CHECK(sd.deleteFile("/cache.bin"));
+    CHECK(sd.unmount());
+}
+
+struct ErrorWorker {
+    SDMounter* sd;
+    int id;
+    std::atomic<int>* done;
+    int crossed;
+};
+
+static void errorTask(void* arg) {
+    ErrorWorker* w = (ErrorWorker*)arg;
+    char path[32];
+    char missing[32];
+    snprintf(path, sizeof(path), "/e/task%d.txt", w->id);
+    snprintf(missing, sizeof(missing), "/e/none%d.txt", w->id);
+
+    for (int i = 0; i < 200; i++) {
+        w->sd->getFileSize(missing);
+        if (i % 2) w->sd->writeFile(path, "x");     // Succeeds, clears only this task's error
+        else vTaskDelay(0);
+        if (i % 2 == 0 && (w->sd->getErrorCode() != SD_ERR_NOT_FOUND || w->sd->getErrorDetail() != missing)) {
+            w->crossed++;
+        }
+    }
+    (*w->done)++;
+    vTaskDelete(nullptr);
+}
+
+static void testErrors(SDMounter& sd) {
+    printf("errors\n");
+    CHECK(sd.mount());
+    CHECK(sd.mkdir("/e"));
+
+    // More tasks than the old fixed table of error slots
+    const int tasks = 8;
+    ErrorWorker workers[tasks];
+    std::atomic<int> done(0);
+    for (int i = 0; i < tasks; i++) {
+        workers[i] = {&sd, i, &done, 0};
+        CHECK(xTaskCreate(errorTask, "err", 4096, &workers[i], 1, nullptr) == pdPASS);
+    }
+    while (done < tasks) vTaskDelay(5);
+    for (int i = 0; i < tasks; i++) CHECK(workers[i].crossed == 0);
+
+    // The failure of another task or another mounter leaves ours alone
+    CHECK(sd.getErrorCode() == SD_OK);
+    sd.getFileSize("/e/nothing.txt");
+    CHECK(sd.getErrorCode() == SD_ERR_NOT_FOUND && sd.getErrorDetail() == "/e/nothing.txt");
+    SDMounter other;
+    CHECK(other.getErrorCode() == SD_OK && other.getErrorDetail() == "");
+    CHECK(sd.getLastError().startsWith(sdErrorText(SD_ERR_NOT_FOUND)));
+    CHECK(sd.writeFile("/e/ok.txt", "ok"));
+    CHECK(sd.getErrorCode() == SD_OK);
+
+    CHECK(sd.rmdirRecursive("/e"));
+    CHECK(sd.unmount());
+}
+
+static void testAsync(SDMounter& sd) {
+    printf("async\n");
+    CHECK(sd.mount());
+    SDAsync async;
+    CHECK(async.begin(sd));
+
+    std::vector<SDAsyncResult> results;
+    auto collect = [&results](const SDAsyncResult& r) { results.push_back(r); };
+    uint32_t first, queued, kept;
+    {
+        // The worker blocks on the mounter inside the first request
+        SDLock guard(sd);
+        first = async.write("/q1.txt", "one", collect);
+        while (async.pendingRequests() > 0) vTaskDelay(1);
+        queued = async.write("/q2.txt", "two", collect);
+        kept = async.write("/q3.txt", "three", collect);
+
+        CHECK(!async.cancel(first));         // Already running
+        CHECK(!async.cancel(12345));         // Never issued
+        for (uint32_t id = 1000; id < 1064; id++) async.cancel(id);
+        CHECK(async.cancel(queued));
+        CHECK(!async.cancel(queued));        // Only once
+    }
+
+    while (results.size() < 3) {
+        async.poll();
+        vTaskDelay(1);
+    }
+    CHECK(results[0].id == first && results[0].ok && !results[0].cancelled);
+    CHECK(results[1].id == queued && results[1].cancelled && !results[1].ok);
+    CHECK(results[2].id == kept && results[2].ok);
+    CHECK(sd.existsFile("/q1.txt") && !sd.existsFile("/q2.txt") && sd.existsFile("/q3.txt"));
+    CHECK(!async.cancel(kept));              // Finished
+
+    async.end();
+    CHECK(sd.deleteFile("/q1.txt") && sd.deleteFile("/q3.txt"));
+    CHECK(sd.unmount());
+}
+
+struct LockHolder {
+    SDMounter* sd;
+    std::atomic<bool> held;
+};
+
+static void holdLockTask(void* arg) {
+    LockHolder* h = (LockHolder*)arg;
+    {
+        SDLock guard(*h->sd);
+        h->held = true;
+        delay(300);
+    }
+    h->held = false;
+    vTaskDelete(nullptr);
+}
+
+static void testLog(SDMounter& sd, SDRamDiskBackend& ram) {
+    printf("log\n");
+    CHECK(sd.mount());
+    CHECK(sd.mkdir("/logs") && sd.changeDir("/logs"));
+
+    // A relative path from a subdirectory, held open as a counted handle
+    SDLogStream log;
+    CHECK(log.begin(sd, "run.log", 256, SD_LOG_FLUSHED, false));
+    CHECK(sd.getOpenHandles() == 1);
+    log.print("one\n");
+    CHECK(log.sync());
+    CHECK(sd.readFile("/logs/run.log") == "one\n");
+
+    // Unmount flushes and closes it, so the card is really ended; lines
+    // logged meanwhile wait for the reopen on the next mount
+    log.print("two\n");
+    CHECK(sd.unmount());
+    CHECK(log.isSuspended() && !ram.isPresent());
+    log.print("three\n");
+    CHECK(sd.mount());
+    CHECK(!log.isSuspended() && sd.getOpenHandles() == 1);
+    CHECK(log.sync());
+    CHECK(sd.readFile("/logs/run.log") == "one\ntwo\nthree\n");
+
+    // While another task holds the mounter, logging, flushing and loop()
+    // go on; the index learns the new size once the mounter is free
+    sd.enableDirIndex(true);
+    CHECK(sd.getFileSize("/logs/run.log") == 14);
+    LockHolder holder = {&sd, false};
+    CHECK(xTaskCreate(holdLockTask, "holder", 4096, &holder, 1, nullptr) == pdPASS);
+    std::atomic<bool>& held = holder.held;
+    while (!held) vTaskDelay(1);
+    unsigned long start = millis();
+    log.print("four\n");
+    CHECK(log.sync());
+    log.loop();
+    CHECK(millis() - start < 100 && held);
+    while (held) vTaskDelay(1);
+    log.loop();
+    CHECK(sd.getFileSize("/logs/run.log") == 19);
+    sd.enableDirIndex(false);
+
+    // Flushed log data is counted in the free space
+    while (!sd.isSpaceInfoReady()) vTaskDelay(1);
+    for (int i = 0; i < 200; i++) log.printf("line %d of the log\n", i);
+    CHECK(log.sync());
+    log.loop();
+    CHECK(spaceMatches(sd, ram));
+
+    log.end();
+    CHECK(sd.getOpenHandles() == 0);
+    CHECK(sd.rmdirRecursive("/logs"));
+    CHECK(sd.unmount());
+}
+
+struct Sample {
+    uint32_t n;
+    uint32_t square;
+};
+
+static void testRecordStore(SDMounter& sd) {
+    printf("record store\n");
+    CHECK(sd.mount());
+
+    // 10 slots of 20 bytes per segment, at most three segments kept
+    SDRecordStoreConfig config;
+    config.record_size = sizeof(Sample);
+    config.segment_bytes = 32 + 10 * 20;
+    config.max_total_bytes = 3 * config.segment_bytes;
+    config.index_stride = 4;
+
+    SDRecordStore store;
+    CHECK(store.begin(sd, "/rec", config) && sd.getOpenHandles() == 1);
+    for (uint32_t i = 0; i < 25; i++) {
+        CHECK(store.append(i * 10, Sample{i, i * i}));
+    }
+    CHECK(store.getRecordCount() == 25 && store.getSegmentCount() == 3);
+    CHECK(!store.append(5, Sample{0, 0}));     // Timestamps never go backwards
+
+    // Range query across a segment boundary, unflushed head included
+    std::vector<uint32_t> seen;
+    bool in_order = true;
+    CHECK(store.query(50, 120, [&](uint32_t ts, const uint8_t* record) {
+        Sample s;
+        memcpy(&s, record, sizeof(s));
+        in_order = in_order && ts == s.n * 10 && s.square == s.n * s.n;
+        seen.push_back(s.n);
+        return true;
+    }) == 8);
+    CHECK(in_order && seen.size() == 8 && seen.front() == 5 && seen.back() == 12);
+    CHECK(store.query(241, 1000, [](uint32_t, const uint8_t*) { return true; }) == 0);
+
+    // The fourth segment pushes the first one out
+    for (uint32_t i = 25; i < 40; i++) {
+        CHECK(store.append(i * 10, Sample{i, i * i}));
+    }
+    CHECK(store.getSegmentCount() == 3 && store.getRecordCount() == 30);
+    CHECK(store.getFirstTimestamp() == 100 && store.getLastTimestamp() == 390);
+    CHECK(!sd.existsFile("/rec/seg_00000001.rec") && sd.existsFile("/rec/seg_00000002.idx"));
+    CHECK(store.flush());
+    store.end();
+    CHECK(sd.getOpenHandles() == 0);
+
+    // Reopened from the sealed segments' index files
+    CHECK(store.begin(sd, "/rec", config));
+    CHECK(store.getRecordCount() == 30 && store.getRecoveredBytes() == 0);
+    CHECK(store.getFirstTimestamp() == 100 && store.getLastTimestamp() == 390);
+    for (uint32_t i = 40; i < 43; i++) {
+        CHECK(store.append(i * 10, Sample{i, i * i}));
+    }
+    CHECK(store.getSegmentCount() == 3 && store.getFirstTimestamp() == 200);
+    store.end();
+
+    // A reset in the middle of the next record: its sequence number made it
+    // to the card, the rest did not
+    File seg = sd.openFile("/rec/seg_00000005.rec", "r+");
+    CHECK(seg);
+    uint8_t torn[20];
+    memset(torn, 0xA5, sizeof(torn));
+    uint32_t seq = 43;
+    memcpy(torn, &seq, 4);
+    CHECK(seg.seek(32 + 3 * 20) && seg.write(torn, sizeof(torn)) == sizeof(torn));
+    seg.close();
+
+    CHECK(store.begin(sd, "/rec", config));
+    CHECK(store.getRecoveredBytes() == 20 && store.getRecordCount() == 23);
+    CHECK(sd.getFileSize("/rec/seg_00000005.rec") == config.segment_bytes);
+    CHECK(store.append(430, Sample{43, 43 * 43}));
+    seen.clear();
+    CHECK(store.query(400, 430, [&](uint32_t ts, const uint8_t* record) {
+        Sample s;
+        memcpy(&s, record, sizeof(s));
+        seen.push_back(s.n);
+        return true;
+    }) == 4);
+    CHECK(seen.size() == 4 && seen.back() == 43);
+    store.end();
+
+    // The torn bytes were cut off, so nothing is dropped the next time
+    CHECK(store.begin(sd, "/rec", config));
+    CHECK(store.getRecoveredBytes() == 0 && store.getRecordCount() == 24);
+    store.end();
+
+    CHECK(sd.rmdirRecursive("/rec"));
+    CHECK(sd.unmount());
+}
+
+int main() {
+    SDRamDiskBackend ram(1024 * 1024);
+    SDMounter sd;
+    sd.setBackend(ram);
+
+    testHandles(sd, ram);
+    testErrors(sd);
+    testRecovery(sd, ram);
+    testTransaction(sd, ram);
+    testMove(sd, ram);
+    testWalk(sd);
+    testIndex(sd, ram);
+    testSpace(sd, ram);
+    testCache(sd, ram);
+    testAsync(sd);
+    testLog(sd, ram);
+    testRecordStore(sd);
+    testHotSwap(sd, ram);
+
+    printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
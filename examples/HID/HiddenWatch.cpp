@@ -367,19 +367,20 @@ void scanSDCardForScripts() {
   
   if (!SDCard.isMounted()) {
     Serial.println("SD card not mounted, attempting mount...");
-    if (!SDCard.mount(false, "/sdcard", true)) {
+    if (!SDCard.mount(false, "/sdcard")) {
       Serial.println("Failed to mount SD card");
       return;
     }
   }
   
-  std::vector<String> items = SDCard.listDirVector("/");
-  for (const String& item : items) {
-    if (item.endsWith(".txt")) {
-      script_files.push_back(item);
-      Serial.printf("Found script: %s\n", item.c_str());
-    }
-  }
+  SDDirFilter filter;
+  filter.extension = ".txt";
+  filter.files_only = true;
+  SDCard.forEachEntry("/", [](const SDDirEntry& entry) {
+    script_files.push_back(String(entry.name));
+    Serial.printf("Found script: %s\n", entry.name);
+    return true;
+  }, filter);
   
   Serial.printf("Total scripts found: %d\n", script_files.size());
 }
@@ -699,7 +700,8 @@ void setup() {
   lv_tick_set_cb(millis_cb);
   
   Serial.println("Mounting SD card...");
-  if (!SDCard.mount(false, "/sdcard", true)) {
+  SDCard.enableDirIndex(); // Menu re-scans "/" each time it opens
+  if (!SDCard.mount(false, "/sdcard")) {
     Serial.println("Failed to mount SD card");
   } else {
     Serial.println("SD card mounted successfully");
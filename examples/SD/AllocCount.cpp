@@ -0,0 +1,68 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+#define SD_ALLOC_PROBE_HOOKS    // This file provides the heap hooks
+#include "SDAllocProbe.h"
+
+// Prints how many heap allocations each common SDMounter call makes. The
+// path-based calls resolve into stack buffers and talk to the VFS directly,
+// so SDMounter itself adds none; anything left comes from the core (File
+// objects, FatFs long-name buffers).
+
+uint8_t buffer[64];
+
+void measure(const char* label, std::function<void()> call) {
+    call(); // Warm up: first use may allocate caches
+
+    SDAllocProbe probe;
+    probe.begin();
+    for (int i = 0; i < 10; i++) {
+        call();
+    }
+    uint32_t count = probe.end();
+    Serial.printf("%-22s %5.1f allocs/call\n", label, count / 10.0f);
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    static const char* const modes[] = {
+        "this task (heap hooks)",
+        "all tasks (heap trace)",
+        "net blocks only (core has neither heap hooks nor heap tracing)"
+    };
+    Serial.printf("Probe mode: %s\n", modes[SDAllocProbe::getMode()]);
+
+    SDCard.mkdir("/alloc_test");
+    SDCard.changeDir("/alloc_test");
+    SDCard.writeFile("data.bin", (const uint8_t*)"0123456789", 10);
+
+    measure("existsFile", [] { SDCard.existsFile("data.bin"); });
+    measure("existsFile (missing)", [] { SDCard.existsFile("./sub/../nothing.bin"); });
+    measure("getFileSize", [] { SDCard.getFileSize("data.bin"); });
+    measure("readFile (buffer)", [] { SDCard.readFile("data.bin", buffer, sizeof(buffer)); });
+    measure("writeFile", [] { SDCard.writeFile("data.bin", buffer, 10); });
+    measure("appendFile", [] { SDCard.appendFile("log.txt", buffer, 10); });
+    measure("renameFile", [] {
+        SDCard.renameFile("data.bin", "data2.bin");
+        SDCard.renameFile("data2.bin", "data.bin");
+    });
+    measure("mkdir + rmdir", [] {
+        SDCard.mkdir("tmpdir");
+        SDCard.rmdir("tmpdir");
+    });
+    measure("openFile (File)", [] { SDCard.openFile("data.bin").close(); });
+
+    SDCard.changeDir("/");
+    SDCard.rmdirRecursive("/alloc_test");
+}
+
+void loop() {
+    delay(1000);
+}
@@ -0,0 +1,68 @@
+#include <Arduino.h>
+#include "ESP32-S3-Screen-AMOLED-2.06.h"
+#include "ESP32-S3-Touch-AMOLED-2.06.h"
+#include "pin_config.h"
+#include "SDMounter.h"
+#include "SDAsync.h"
+
+// Card access from the UI without blocking it: requests run on a worker
+// task on core 0, completions are delivered in loop() via SDAsyncIO.poll(),
+// so the callbacks below can update LVGL widgets directly.
+
+ScreenClass Screen;
+TouchClass Touch;
+SDAsync SDAsyncIO;
+
+lv_obj_t* label;
+unsigned long last_tick = 0;
+unsigned long last_log = 0;
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    Screen.on();
+    Touch.on();
+
+    label = lv_label_create(lv_scr_act());
+    lv_label_set_long_mode(label, LV_LABEL_LONG_WRAP);
+    lv_obj_set_width(label, 300);
+    lv_obj_align(label, LV_ALIGN_CENTER, 0, 0);
+    lv_label_set_text(label, "Loading...");
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        lv_label_set_text(label, "Card Mount Failed");
+        return;
+    }
+
+    SDAsyncIO.begin(SDCard, SD_ASYNC_DELIVER_POLL);
+
+    // UI read - high priority lane
+    SDAsyncIO.list("/", [](const SDAsyncResult& result) {
+        String text = "SD Card Contents:\n";
+        for (const String& name : result.entries) {
+            text += name + "\n";
+        }
+        lv_label_set_text(label, result.ok ? text.c_str() : "Failed to list card");
+    });
+}
+
+void loop() {
+    unsigned long current_millis = millis();
+    if (current_millis - last_tick >= 5) {
+        lv_tick_inc(5);
+        last_tick = current_millis;
+    }
+
+    // Background logging - low priority lane, no completion needed
+    if (current_millis - last_log >= 1000) {
+        last_log = current_millis;
+        char line[32];
+        snprintf(line, sizeof(line), "%lu ms\n", current_millis);
+        SDAsyncIO.append("/uptime.log", line);
+    }
+
+    SDAsyncIO.poll();
+    lv_task_handler();
+    delay(2);
+}
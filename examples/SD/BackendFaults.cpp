@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+#include "SDRamDiskBackend.h"
+
+// Runs SDMounter on a RAM disk instead of the card: the usual file
+// operations, then the speed tests with added latency, then random write
+// failures (atomic writes must never leave a torn file), and finally a
+// simulated card pull handled by the hot-swap logic. No card needed.
+// The removal test uses the polled hot-swap path, so build it without
+// SDMMC_CD in pin_config.h.
+
+SDRamDiskBackend ramdisk(512 * 1024);
+
+bool removal_done = false;
+unsigned long removed_at = 0;
+
+void check(const char* what, bool ok) {
+    Serial.printf("  %-28s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) Serial.println("    " + SDCard.getLastError());
+}
+
+void basicOperations() {
+    Serial.println("Basic operations:");
+    check("mkdir /data", SDCard.mkdir("/data"));
+    check("writeFile", SDCard.writeFile("/data/a.txt", "hello ram disk"));
+    check("copyFile", SDCard.copyFile("/data/a.txt", "/data/b.txt"));
+    check("truncateFile", SDCard.truncateFile("/data/b.txt", 5));
+    check("read back", SDCard.readFile("/data/b.txt") == "hello");
+    check("moveFile (rename)", SDCard.moveFile("/data/b.txt", "/data/c.txt") &&
+                               SDCard.getLastMoveMethod() == SDMounter::MOVE_RENAME);
+
+    char path[32];
+    for (int i = 0; i < 50; i++) {
+        snprintf(path, sizeof(path), "/data/sub/f%02d", i);
+        if (i == 0) SDCard.mkdir("/data/sub");
+        SDCard.writeFile(path, "x");
+    }
+    check("rmdirRecursive", SDCard.rmdirRecursive("/data") && !SDCard.existsFile("/data"));
+    Serial.printf("  %u items removed, %llu bytes used\n",
+                  SDCard.getLastDeleteCount(), (unsigned long long)ramdisk.getUsedBytes());
+}
+
+void latencyTest() {
+    Serial.println("Speed with 200 us per op and 1 ms per KB:");
+    SDFaultConfig faults;
+    faults.latency_us = 200;
+    faults.latency_per_kb_us = 1000;
+    ramdisk.setFaults(faults);
+
+    float write_kbps = SDCard.writeSpeedTest(4096, 16);
+    float read_kbps = SDCard.readSpeedTest(4096, 16);
+    Serial.printf("  write %.1f KB/s, read %.1f KB/s\n", write_kbps, read_kbps);
+    ramdisk.clearFaults();
+}
+
+void failureTest() {
+    Serial.println("Atomic writes with 5% of writes and renames failing:");
+    SDCard.writeFile("/state.txt", "generation 0");
+
+    SDFaultConfig faults;
+    faults.fail_permille = 50;
+    faults.fail_ops = (1UL << SDStorageBackend::OP_WRITE) | (1UL << SDStorageBackend::OP_RENAME);
+    ramdisk.setFaults(faults);
+
+    uint32_t failed = 0;
+    uint32_t torn = 0;
+    char content[32];
+    for (int gen = 1; gen <= 200; gen++) {
+        snprintf(content, sizeof(content), "generation %d", gen);
+        if (!SDCard.writeFile("/state.txt", content)) failed++;
+
+        // Whatever happened, the file holds one complete generation
+        String now = SDCard.readFile("/state.txt");
+        if (!now.startsWith("generation ")) torn++;
+    }
+
+    SDStorageBackend::FaultStats stats = ramdisk.getFaultStats();
+    ramdisk.clearFaults();
+    Serial.printf("  %u of 200 writes failed, %u torn files, %u faults in %u ops\n",
+                  failed, torn, stats.injected, stats.ops);
+    check("no torn files", torn == 0);
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    SDCard.setBackend(ramdisk);
+    if (!SDCard.mount()) {
+        Serial.println("RAM disk mount failed: " + SDCard.getLastError());
+        return;
+    }
+
+    basicOperations();
+    latencyTest();
+    failureTest();
+
+    SDCard.onCardRemoved([]() { Serial.println("Callback: card removed"); });
+    SDCard.onMount([]() { Serial.println("Callback: mounted again"); });
+    SDCard.enableAutoMount(true);
+    SDCard.enableHotSwapDetection(true);
+
+    Serial.println("Pulling the card...");
+    ramdisk.setRemoved(true);
+    removed_at = millis();
+}
+
+void loop() {
+    SDCard.checkHotSwap();
+
+    // Put the card back after three seconds
+    if (!removal_done && removed_at && millis() - removed_at > 3000) {
+        Serial.println("Inserting the card...");
+        ramdisk.setRemoved(false);
+        removal_done = true;
+    }
+
+    static bool reported = false;
+    if (removal_done && SDCard.isMounted() && !reported) {
+        reported = true;
+        check("remounted after removal", SDCard.readFile("/state.txt").startsWith("generation "));
+    }
+    delay(50);
+}
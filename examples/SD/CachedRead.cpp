@@ -0,0 +1,63 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+
+// Streams a file in 512 byte pieces with a little work between reads, the
+// way an audio decoder consumes it: once with a plain File, once through the
+// block cache. Put any large file on the card as /stream.bin.
+
+#define CHUNK 512
+
+uint8_t chunk[CHUNK];
+
+// Stand-in for decoding; gives the prefetch task time to run ahead
+void consume() {
+    delayMicroseconds(200);
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    File plain = SDCard.openFile("/stream.bin", FILE_READ);
+    if (!plain) {
+        Serial.println("Put a large file at /stream.bin");
+        return;
+    }
+
+    uint32_t worst = 0;
+    unsigned long start = millis();
+    while (plain.available()) {
+        uint32_t t = micros();
+        plain.read(chunk, CHUNK);
+        worst = max(worst, (uint32_t)(micros() - t));
+        consume();
+    }
+    Serial.printf("File:         %lu ms, slowest read %u us\n", millis() - start, worst);
+    plain.close();
+
+    SDCachedFile cached;
+    if (!SDCard.openCachedFile("/stream.bin", cached)) return;
+
+    worst = 0;
+    start = millis();
+    while (cached.available()) {
+        uint32_t t = micros();
+        cached.read(chunk, CHUNK);
+        worst = max(worst, (uint32_t)(micros() - t));
+        consume();
+    }
+    Serial.printf("SDCachedFile: %lu ms, slowest read %u us\n", millis() - start, worst);
+    cached.close();
+
+    SDCard.getBlockCache().printStats();
+}
+
+void loop() {
+    delay(1000);
+}
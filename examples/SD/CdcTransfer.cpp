@@ -0,0 +1,54 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+#include "SDTransfer.h"
+
+// Serves the card over the USB serial port for tools/sdxfer.py:
+//   sdxfer.py -p /dev/ttyACM0 put layout.json /ui/layout.json
+//   sdxfer.py -p /dev/ttyACM0 get /logs/today.log
+// The server runs on its own task, so loop() stands in for the UI and keeps
+// its 100 ms tick during transfers. Serial output still works; the tool
+// skips it. Nothing else may read Serial while the server runs.
+
+SDTransferServer server;
+
+void setup() {
+    // Room for a full window of incoming data
+    Serial.setRxBufferSize(SD_XFER_WINDOW + 1024);
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    server.onTransfer([](const char* path, bool upload, bool ok) {
+        Serial.printf("%s %s: %s\n", upload ? "Received" : "Sent", path, ok ? "done" : "failed");
+    });
+    if (!server.begin(Serial)) {
+        Serial.println("Transfer server failed to start");
+    }
+}
+
+void loop() {
+    // The UI's frame tick; a late one shows the server getting in the way
+    static unsigned long last_tick = millis();
+    static unsigned long worst_ms = 0;
+    unsigned long now = millis();
+    if (now - last_tick > worst_ms) worst_ms = now - last_tick;
+    last_tick = now;
+
+    static bool was_busy = false;
+    bool busy = server.isBusy();
+    if (was_busy && !busy) {
+        SDTransferServer::Stats s = server.getStats();
+        Serial.printf("%llu KB in, %llu KB out, %u bad frames, %u resends, worst UI tick %lu ms\n",
+                      (unsigned long long)(s.bytes_in / 1024), (unsigned long long)(s.bytes_out / 1024),
+                      s.bad_frames, s.resends, worst_ms);
+        worst_ms = 0;
+    }
+    was_busy = busy;
+
+    delay(100);
+}
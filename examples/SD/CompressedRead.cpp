@@ -0,0 +1,109 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+
+// Writes about 1 MB of log text twice, plain and as an LZ4 .sdz file, then
+// reads both back in full and with random 4 KB seeks. Effective throughput
+// counts the decompressed bytes, so it is what a reader of the data sees.
+// Files packed on a PC with tools/sdpack.py read the same way.
+
+#define LOG_LINES   16000
+#define CHUNK       4096
+#define SEEKS       200
+
+uint8_t chunk[CHUNK];
+
+void writeLog(Print& out) {
+    char line[96];
+    randomSeed(42);
+    for (int i = 0; i < LOG_LINES; i++) {
+        int n = snprintf(line, sizeof(line), "%08lu [INFO] sensor %ld value=%ld.%02ld state=%s\n",
+                         (unsigned long)i * 37, random(8), random(100), random(100),
+                         random(4) ? "ok" : "warn");
+        out.write((const uint8_t*)line, n);
+    }
+}
+
+// Works for File and SDCompressedFile alike
+template <typename T>
+float sequentialKBps(T& in) {
+    uint32_t total = 0;
+    unsigned long start = micros();
+    size_t n;
+    while ((n = in.read(chunk, CHUNK)) > 0) total += n;
+    unsigned long us = micros() - start;
+    return us ? total * 1000000.0f / 1024.0f / us : 0;
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    File plain = SDCard.openFile("/log.txt", FILE_WRITE);
+    if (!plain) return;
+    writeLog(plain);
+    plain.close();
+
+    SDCompressedWriter writer;
+    if (!SDCard.createCompressed("/log.sdz", writer, 16 * 1024)) return;
+    writeLog(writer);
+    if (!writer.close()) {
+        Serial.println("Writing /log.sdz failed");
+        return;
+    }
+    Serial.printf("Packed %llu bytes into %u (%.2fx)\n",
+                  (unsigned long long)writer.getRawBytes(), writer.getStoredBytes(), writer.getRatio());
+
+    // Sequential
+    plain = SDCard.openFile("/log.txt", FILE_READ);
+    float plain_kbps = sequentialKBps(plain);
+    uint32_t size = plain.size();
+
+    SDCompressedFile packed;
+    if (!SDCard.openCompressed("/log.sdz", packed)) return;
+    float packed_kbps = sequentialKBps(packed);
+
+    Serial.printf("Sequential:  plain %.1f KB/s, compressed %.1f KB/s effective (%.2fx)\n",
+                  plain_kbps, packed_kbps, packed_kbps / plain_kbps);
+
+    SDCompressedFile::Stats stats = packed.getStats();
+    Serial.printf("  %u blocks, %llu card bytes for %llu bytes, %u ms decompressing\n",
+                  stats.blocks_loaded, (unsigned long long)stats.card_bytes,
+                  (unsigned long long)stats.raw_bytes, stats.decompress_us / 1000);
+
+    // Random 4 KB reads: each costs at most two blocks of decompression
+    packed.resetStats();
+    randomSeed(7);
+    unsigned long plain_us = 0;
+    unsigned long packed_us = 0;
+    for (int i = 0; i < SEEKS; i++) {
+        uint32_t pos = random(size - CHUNK);
+
+        unsigned long t = micros();
+        plain.seek(pos);
+        plain.read(chunk, CHUNK);
+        plain_us += micros() - t;
+
+        t = micros();
+        packed.seek(pos);
+        packed.read(chunk, CHUNK);
+        packed_us += micros() - t;
+    }
+    Serial.printf("Random 4 KB: plain %lu us, compressed %lu us per read\n",
+                  plain_us / SEEKS, packed_us / SEEKS);
+
+    stats = packed.getStats();
+    Serial.printf("  %u blocks loaded for %d reads\n", stats.blocks_loaded, SEEKS);
+
+    plain.close();
+    packed.close();
+}
+
+void loop() {
+    delay(1000);
+}
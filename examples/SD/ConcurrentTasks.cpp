@@ -0,0 +1,95 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+
+// Runs 1 to 4 tasks against SDCard at the same time, each doing small
+// write / exists / read / failed-lookup cycles on its own file, and prints
+// the combined throughput. Every task also checks that the error it reads
+// back is its own, which fails when errors are shared between tasks.
+
+#define MAX_TASKS   4
+#define RUN_MS      5000
+
+struct Worker {
+    int id;
+    volatile uint32_t ops;
+    volatile uint32_t failures;
+    volatile uint32_t crossed_errors;
+    volatile bool done;
+};
+
+Worker workers[MAX_TASKS];
+volatile bool running = false;
+
+void workerTask(void* arg) {
+    Worker* w = (Worker*)arg;
+    char path[32];
+    char missing[32];
+    uint8_t data[256];
+    uint8_t back[256];
+    snprintf(path, sizeof(path), "/conc/task%d.bin", w->id);
+    snprintf(missing, sizeof(missing), "/conc/none%d.bin", w->id);
+    memset(data, '0' + w->id, sizeof(data));
+
+    while (running) {
+        bool ok = SDCard.writeFile(path, data, sizeof(data));
+        ok = SDCard.existsFile(path) && ok;
+        ok = (SDCard.readFile(path, back, sizeof(back)) == sizeof(back)) && ok;
+        ok = (memcmp(data, back, sizeof(back)) == 0) && ok;
+        if (!ok) w->failures++;
+
+        // Expected failure: the detail must name this task's path
+        SDCard.getFileSize(missing);
+        if (SDCard.getErrorCode() != SD_ERR_NOT_FOUND || SDCard.getErrorDetail() != missing) {
+            w->crossed_errors++;
+        }
+
+        w->ops += 4;
+    }
+
+    w->done = true;
+    vTaskDelete(nullptr);
+}
+
+void runRound(int task_count) {
+    running = true;
+    for (int i = 0; i < task_count; i++) {
+        workers[i] = {i, 0, 0, 0, false};
+        xTaskCreatePinnedToCore(workerTask, "sd_worker", 4096, &workers[i], 1, nullptr, i % 2);
+    }
+
+    delay(RUN_MS);
+    running = false;
+
+    uint32_t ops = 0, failures = 0, crossed = 0;
+    for (int i = 0; i < task_count; i++) {
+        while (!workers[i].done) delay(5);
+        ops += workers[i].ops;
+        failures += workers[i].failures;
+        crossed += workers[i].crossed_errors;
+    }
+
+    Serial.printf("%d task(s): %7.1f ops/s total, %6.1f ops/s per task, %u failures, %u crossed errors\n",
+                  task_count, ops * 1000.0f / RUN_MS, ops * 1000.0f / RUN_MS / task_count,
+                  failures, crossed);
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    SDCard.mkdir("/conc");
+    for (int n = 1; n <= MAX_TASKS; n++) {
+        runRound(n);
+    }
+    SDCard.rmdirRecursive("/conc");
+}
+
+void loop() {
+    delay(1000);
+}
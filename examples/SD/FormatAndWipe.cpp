@@ -0,0 +1,64 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+
+// Fills /wipe_test with 10 folders of 1000 small files, then removes the
+// whole tree with rmdirRecursive() and prints how fast it went. Set
+// DO_FORMAT to 1 to also time a real format; that ERASES THE WHOLE CARD.
+
+#define DO_FORMAT        0
+#define FORMAT_CLUSTER   (32 * 1024)  // 0 lets FatFs pick for the card size
+
+#define DIRS             10
+#define FILES_PER_DIR    1000
+
+void fillTree() {
+    char path[48];
+    unsigned long start = millis();
+
+    SDCard.mkdir("/wipe_test");
+    for (int d = 0; d < DIRS; d++) {
+        snprintf(path, sizeof(path), "/wipe_test/d%02d", d);
+        SDCard.mkdir(path);
+        for (int f = 0; f < FILES_PER_DIR; f++) {
+            snprintf(path, sizeof(path), "/wipe_test/d%02d/f%04d.txt", d, f);
+            File file = SDCard.getSD().open(path, FILE_WRITE);
+            file.print(f);
+            file.close();
+        }
+        Serial.printf("  d%02d done\n", d);
+    }
+
+    Serial.printf("Created %d files in %lu ms\n", DIRS * FILES_PER_DIR, millis() - start);
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    Serial.println("Creating test tree...");
+    fillTree();
+
+    bool ok = SDCard.rmdirRecursive("/wipe_test");
+    uint32_t items = SDCard.getLastDeleteCount();
+    unsigned long ms = SDCard.getLastDeleteMillis();
+    Serial.printf("rmdirRecursive %s: %u items in %lu ms (%.0f items/s)\n",
+                  ok ? "ok" : "FAILED", items, ms, ms ? items * 1000.0 / ms : 0.0);
+
+#if DO_FORMAT
+    unsigned long start = millis();
+    ok = SDCard.format(FORMAT_CLUSTER);
+    Serial.printf("format %s in %lu ms, cluster size %u bytes\n",
+                  ok ? "ok" : "FAILED", millis() - start, SDCard.getClusterSize());
+    if (!ok) Serial.println(SDCard.getLastError());
+#endif
+}
+
+void loop() {
+    delay(1000);
+}
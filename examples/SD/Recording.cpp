@@ -0,0 +1,82 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+#include "SDRecorder.h"
+
+// Records 8 MB of 48 kHz stereo 16-bit audio (192 KB/s) in 4 KB chunks,
+// once with appendFile() and once into a preallocated SDRecorder file, and
+// prints how long each chunk took to hand over. appendFile() grows the
+// file, so every new cluster is a FAT update; the recorder writes into
+// clusters allocated up front and should have no long tail.
+
+#define RECORD_BYTES (8UL * 1024 * 1024)
+#define CHUNK        4096
+
+uint8_t chunk[CHUNK];
+
+void fillChunk(uint32_t n) {
+    // A sawtooth so the file is not all zeros
+    for (size_t i = 0; i < CHUNK; i += 2) {
+        int16_t sample = (int16_t)((n * CHUNK + i) * 37);
+        chunk[i] = sample & 0xFF;
+        chunk[i + 1] = sample >> 8;
+    }
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    SDLatencyHistogram append_hist;
+    SDCard.deleteFile("/rec_append.raw");
+    unsigned long start = millis();
+    for (uint32_t n = 0; n < RECORD_BYTES / CHUNK; n++) {
+        fillChunk(n);
+        unsigned long t = micros();
+        if (!SDCard.appendFile("/rec_append.raw", chunk, CHUNK)) {
+            Serial.println("appendFile failed: " + SDCard.getLastError());
+            return;
+        }
+        append_hist.record(micros() - t);
+    }
+    Serial.printf("appendFile: %lu ms\n", millis() - start);
+    append_hist.print(Serial, "Per chunk:");
+
+    // Reserve a little more than needed; close() trims the rest
+    SDRecorder recorder;
+    start = millis();
+    if (!recorder.open(SDCard, "/rec.raw", RECORD_BYTES + 1024 * 1024)) {
+        Serial.println("Preallocation failed: " + SDCard.getLastError());
+        return;
+    }
+    Serial.printf("Preallocated %llu bytes in %lu ms, %s\n",
+                  (unsigned long long)recorder.getReserved(), millis() - start,
+                  recorder.isContiguous() ? "contiguous" : "not contiguous");
+
+    SDLatencyHistogram recorder_hist;
+    start = millis();
+    for (uint32_t n = 0; n < RECORD_BYTES / CHUNK; n++) {
+        fillChunk(n);
+        unsigned long t = micros();
+        recorder.write(chunk, CHUNK);
+        recorder_hist.record(micros() - t);
+    }
+    uint64_t recorded = recorder.getBytesWritten();
+    bool closed = recorder.close();
+    Serial.printf("SDRecorder: %lu ms, %llu bytes, close %s\n", millis() - start,
+                  (unsigned long long)recorded, closed ? "ok" : "FAILED");
+    recorder_hist.print(Serial, "Per chunk:");
+    recorder.getHistogram().print(Serial, "Card writes (32 KB each):");
+
+    Serial.printf("File sizes: %u and %u bytes\n",
+                  (unsigned)SDCard.getFileSize("/rec_append.raw"), (unsigned)SDCard.getFileSize("/rec.raw"));
+}
+
+void loop() {
+    delay(1000);
+}
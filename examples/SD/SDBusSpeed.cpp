@@ -0,0 +1,85 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+
+// Before/after throughput report for the SDMMC bus negotiation.
+// "Before" is the old fixed setup (1-bit, default 20 MHz clock),
+// "after" is whatever mount() negotiates on this board and card.
+// Full results (latency percentiles per workload) are written to
+// /bus_before.csv and /bus_after.csv.
+
+const size_t block_sizes[] = {4096, 32768};
+const uint32_t test_bytes = 4 * 1024 * 1024;
+
+struct BusResult {
+    uint8_t width;
+    int freq_khz;
+    float read_kbps[2];
+    float write_kbps[2];
+};
+
+void runPass(BusResult& result, const char* csv_path) {
+    result.width = SDCard.getBusWidth();
+    result.freq_khz = SDCard.getBusFrequency();
+
+    SDBenchmark bench(SDCard.getSD(), "/bench");
+    SDBenchmark::Config cfg = bench.getConfig();
+    cfg.file_size = test_bytes;
+    bench.setConfig(cfg);
+
+    for (int i = 0; i < 2; i++) {
+        bench.runSequential(block_sizes[i]);
+        const SDBenchmark::Result* w = bench.findResult("seq_write", block_sizes[i]);
+        const SDBenchmark::Result* r = bench.findResult("seq_read", block_sizes[i]);
+        result.write_kbps[i] = w ? w->kbps : 0.0f;
+        result.read_kbps[i] = r ? r->kbps : 0.0f;
+    }
+    bench.runRandom(4096);
+    bench.printResults();
+    bench.writeCsv(csv_path);
+    SDCard.rmdirRecursive("/bench");
+}
+
+void printRow(const char* label, const BusResult& r) {
+    Serial.printf("%-7s| %u-bit | %6d kHz | %9.0f | %9.0f | %9.0f | %9.0f\n",
+                  label, r.width, r.freq_khz,
+                  r.write_kbps[0], r.read_kbps[0], r.write_kbps[1], r.read_kbps[1]);
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+    Serial.println("SD bus speed comparison");
+
+    BusResult before = {}, after = {};
+
+    // Before: forced 1-bit at the default clock
+    SDCard.setMaxBusFrequency(SDMMC_FREQ_DEFAULT);
+    if (!SDCard.mount(false, "/sdcard", true)) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+    runPass(before, "/bus_before.csv");
+    SDCard.unmount();
+    delay(100);
+
+    // After: negotiated width and clock
+    SDCard.setMaxBusFrequency(SDMMC_FREQ_HIGHSPEED);
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+    runPass(after, "/bus_after.csv");
+
+    Serial.println("\n========== SD BUS THROUGHPUT (KB/s) ==========");
+    Serial.println("       | bus   | clock      | W 4K      | R 4K      | W 32K     | R 32K");
+    printRow("before", before);
+    printRow("after", after);
+    Serial.println("==============================================\n");
+
+    SDCard.dumpFsInfo();
+}
+
+void loop() {
+    delay(1000);
+}
@@ -0,0 +1,67 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+#include "SDLogStream.h"
+
+// 100 Hz sensor logging through a write-behind stream. appendFile() would
+// open, write and close the file (and rewrite its directory entry) for every
+// line; the stream keeps the file open and writes lines in groups from a
+// background task. The first few seconds time appendFile() for comparison.
+
+SDLogStream Log;
+
+unsigned long last_sample = 0;
+unsigned long last_report = 0;
+uint32_t sample_count = 0;
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    // Baseline: open/append/close per line
+    SDCard.deleteFile("/append.log");
+    unsigned long start = micros();
+    for (int i = 0; i < 100; i++) {
+        SDCard.appendFile("/append.log", "1234567890,0.000,0.000,0.000\n");
+    }
+    Serial.printf("appendFile: %.2f ms per line\n", (micros() - start) / 100000.0);
+
+    // Group commit every 4 KB or every second, whichever comes first
+    Log.begin(SDCard, "/sensor.log", 8192, SD_LOG_FLUSHED);
+    Log.setFlushThreshold(4096);
+    Log.setFlushInterval(1000);
+
+    start = micros();
+    for (int i = 0; i < 100; i++) {
+        Log.print("1234567890,0.000,0.000,0.000\n");
+    }
+    Serial.printf("SDLogStream: %.2f ms per line\n", (micros() - start) / 100000.0);
+
+    // Before deep sleep: SDCard.flushLogs(); unmount() flushes on its own
+}
+
+void loop() {
+    unsigned long now = millis();
+
+    if (now - last_sample >= 10) {
+        last_sample = now;
+        float ax = sin(now / 1000.0f);
+        Log.printf("%lu,%.3f,%.3f,%.3f\n", now, ax, ax * 0.5f, ax * 0.25f);
+        sample_count++;
+    }
+
+    if (now - last_report >= 5000) {
+        last_report = now;
+        Serial.printf("Samples: %u  written: %u bytes  flushes: %u  dropped: %u\n",
+                      sample_count, Log.getBytesWritten(), Log.getFlushCount(), Log.getDroppedBytes());
+    }
+
+    SDCard.checkHotSwap();
+    Log.loop();
+    delay(1);
+}
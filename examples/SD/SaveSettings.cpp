@@ -0,0 +1,46 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+#include "SDTransaction.h"
+
+// Saves a settings file and the matching layout file as one unit. Pull the
+// card or reset during the loop: after the next mount both files are either
+// the new pair or the old pair, never a mix and never a torn file.
+
+uint32_t generation = 0;
+
+bool saveAll(uint32_t gen) {
+    char settings[64];
+    char layout[64];
+    snprintf(settings, sizeof(settings), "{\"generation\":%u,\"brightness\":200}", gen);
+    snprintf(layout, sizeof(layout), "{\"generation\":%u,\"widgets\":4}", gen);
+
+    SDTransaction tx(SDCard);
+    tx.write("/settings.json", settings);
+    tx.write("/layout.json", layout);
+    return tx.commit(); // Staged files are rolled back if anything failed
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    // mount() replays or rolls back a transaction interrupted last time
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    Serial.println("settings.json: " + SDCard.readFile("/settings.json"));
+    Serial.println("layout.json:   " + SDCard.readFile("/layout.json"));
+
+    // Single files: writeFile() swaps in a fsynced temp copy (on by default)
+    SDCard.writeFile("/boot_count.txt", String(millis()).c_str());
+}
+
+void loop() {
+    unsigned long start = micros();
+    bool ok = saveAll(++generation);
+    Serial.printf("Generation %u %s in %lu us\n", generation, ok ? "saved" : "FAILED", micros() - start);
+    delay(2000);
+}
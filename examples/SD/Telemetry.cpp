@@ -0,0 +1,73 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+#include "SDRecordStore.h"
+
+// Binary telemetry log: one 16 byte record per sample instead of a ~40 byte
+// formatted text line, written into preallocated segment files. Every few
+// seconds the last second of samples is read back with a range query.
+
+struct Sample {
+    float ax, ay, az;
+    uint16_t battery_mv;
+    uint16_t flags;
+};
+
+SDRecordStore Telemetry;
+
+unsigned long last_sample = 0;
+unsigned long last_query = 0;
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    SDRecordStoreConfig config;
+    config.record_size = sizeof(Sample);
+    config.segment_bytes = 256 * 1024;
+    config.max_total_bytes = 4 * 1024 * 1024;
+
+    if (!Telemetry.begin(SDCard, "/telemetry", config)) {
+        Serial.println("Record store failed");
+        return;
+    }
+    Serial.printf("Stored: %u records, %u ms .. %u ms\n", Telemetry.getRecordCount(),
+                  Telemetry.getFirstTimestamp(), Telemetry.getLastTimestamp());
+}
+
+void loop() {
+    unsigned long now = millis();
+
+    if (now - last_sample >= 20) {
+        last_sample = now;
+        Sample sample;
+        sample.ax = sin(now / 500.0f);
+        sample.ay = cos(now / 500.0f);
+        sample.az = 1.0f;
+        sample.battery_mv = 3900;
+        sample.flags = 0;
+        Telemetry.append(now, sample);
+    }
+
+    if (now - last_query >= 5000) {
+        last_query = now;
+        Telemetry.flush();
+
+        float peak = 0;
+        uint32_t count = Telemetry.query(now - 1000, now, [&peak](uint32_t timestamp, const uint8_t* record) {
+            Sample sample;
+            memcpy(&sample, record, sizeof(sample));
+            if (fabsf(sample.ax) > peak) peak = fabsf(sample.ax);
+            return true;
+        });
+        Serial.printf("Last second: %u samples, peak ax %.3f, %u segments, %u KB\n",
+                      count, peak, Telemetry.getSegmentCount(), Telemetry.getTotalBytes() / 1024);
+    }
+
+    delay(1);
+}
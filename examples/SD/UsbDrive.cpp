@@ -0,0 +1,61 @@
+#include <Arduino.h>
+#include "pin_config.h"
+#include "SDMounter.h"
+#include "SDUsbDrive.h"
+
+// Shows the SD card as a USB drive. Build with USB Mode "USB-OTG
+// (TinyUSB)" and use the UART port for Serial. Send 'u' to hand the card
+// to the PC and 'd' to take it back; ejecting the drive on the PC or
+// pulling the cable takes it back too. While the PC has it, SDCard calls
+// fail, and afterwards the files the PC wrote are visible here.
+
+SDUsbDrive drive;
+unsigned long last_report = 0;
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+    SDCard.writeFile("/from_watch.txt", "Written on the watch before going to USB\n");
+
+    SDCard.onMount([]() {
+        Serial.println("Card is back on the watch:");
+        Serial.print(SDCard.listDir("/"));
+    });
+
+    drive.begin();
+    USB.begin();
+    Serial.println("Send 'u' to attach the card over USB, 'd' to detach");
+}
+
+void loop() {
+    drive.loop();
+
+    if (Serial.available()) {
+        char c = Serial.read();
+        if (c == 'u') {
+            drive.resetStats();
+            drive.attach();
+            Serial.printf("SDCard.existsFile() while attached: %d (%s)\n",
+                          SDCard.existsFile("/from_watch.txt"), SDCard.getErrorText());
+        } else if (c == 'd') {
+            drive.detach();
+        }
+    }
+
+    // Card-side throughput while the PC copies files
+    if (drive.isAttached() && millis() - last_report > 2000) {
+        last_report = millis();
+        SDUsbDrive::Stats s = drive.getStats();
+        float read_kbps = s.read_us ? s.read_bytes * 1000000.0f / 1024.0f / s.read_us : 0;
+        float write_kbps = s.write_us ? s.write_bytes * 1000000.0f / 1024.0f / s.write_us : 0;
+        Serial.printf("USB: %llu KB read (card %.0f KB/s), %llu KB written (card %.0f KB/s), %u errors\n",
+                      (unsigned long long)(s.read_bytes / 1024), read_kbps,
+                      (unsigned long long)(s.write_bytes / 1024), write_kbps, s.errors);
+    }
+    delay(10);
+}
@@ -0,0 +1,163 @@
+#include <Arduino.h>
+#include <lvgl.h>
+#include <Wire.h>
+#include "ESP32-S3-Screen-AMOLED-2.06.h"
+#include "ESP32-S3-Touch-AMOLED-2.06.h"
+#include "esp_check.h"
+#include "es8311.h"
+#include "ESP_I2S.h"
+#include "SDMounter.h"
+#include "AudioPlayer.h"
+#include "AudioMixer.h"
+#include "canon.h"
+
+#include "demos/lv_demos.h"
+
+// Background music with UI sounds on top. canon.h loops from flash (or
+// EXAMPLE_TRACK streams from the card when there is one) and every touch
+// clicks, panned to where the finger is. Over serial:
+//   n  notification chime   m  music on / off   +/-  master volume
+// Every 5 s the mixer reports its slowest period against the time a period
+// plays for; "late" periods would be gaps.
+
+// === Global Objects ===
+ScreenClass Screen;
+TouchClass  Touch;
+I2SClass    i2s;
+AudioMixer  mixer;
+AudioPlayer player;
+
+// === LVGL ===
+#define LVGL_TICK_MS 2
+
+// === Audio / ES8311 Config ===
+#define EXAMPLE_SAMPLE_RATE     44100
+#define EXAMPLE_VOICE_VOLUME    90
+#define EXAMPLE_TRACK           "/music/track.wav"
+
+AudioVoice music = AUDIO_VOICE_NONE;
+bool streaming = false;
+uint8_t master = 80;
+
+esp_err_t es8311_codec_init(void) {
+    es8311_handle_t es_handle = es8311_create(0, ES8311_ADDRRES_0);
+    ESP_RETURN_ON_FALSE(es_handle, ESP_FAIL, "ES8311", "create failed");
+
+    const es8311_clock_config_t es_clk = {
+        .mclk_inverted       = false,
+        .sclk_inverted       = false,
+        .mclk_from_mclk_pin  = true,
+        .mclk_frequency      = EXAMPLE_SAMPLE_RATE * 256,
+        .sample_frequency    = EXAMPLE_SAMPLE_RATE
+    };
+
+    ESP_ERROR_CHECK(es8311_init(es_handle, &es_clk, ES8311_RESOLUTION_16, ES8311_RESOLUTION_16));
+    ESP_ERROR_CHECK(es8311_sample_frequency_config(es_handle, es_clk.mclk_frequency, es_clk.sample_frequency));
+    ESP_ERROR_CHECK(es8311_voice_volume_set(es_handle, EXAMPLE_VOICE_VOLUME, NULL));
+    return ESP_OK;
+}
+
+// === LVGL Tick ===
+void lvgl_tick_task(void* arg) {
+    while (true) {
+        lv_tick_inc(LVGL_TICK_MS);
+        vTaskDelay(pdMS_TO_TICKS(LVGL_TICK_MS));
+    }
+}
+
+void startMusic() {
+    if (streaming) {
+        music = mixer.playStream(player, 70);
+        player.setLoop(true);
+        player.play(EXAMPLE_TRACK);
+    } else {
+        // 16 kHz stereo in flash; the mixer converts it to 44.1 kHz
+        music = mixer.playSample((const int16_t*)canon_pcm, canon_pcm_len / 4, 2, 16000, 40, 0, true);
+    }
+}
+
+void stopMusic() {
+    mixer.stop(music);
+    if (streaming) player.stop();
+    music = AUDIO_VOICE_NONE;
+}
+
+void handleCommand(char c) {
+    switch (c) {
+        case 'n':
+            // A fifth, slightly apart, as two voices
+            mixer.playTone(880, 180, 60, -30);
+            mixer.playTone(1320, 180, 50, 30, AUDIO_WAVE_TRIANGLE);
+            break;
+        case 'm':
+            if (mixer.isActive(music)) stopMusic();
+            else startMusic();
+            break;
+        case '+': master = master > 90 ? 100 : master + 10; mixer.setMasterVolume(master); break;
+        case '-': master = master < 10 ? 0 : master - 10; mixer.setMasterVolume(master); break;
+    }
+}
+
+// === Setup ===
+void setup() {
+    Serial.begin(115200);
+    delay(500);
+
+    Screen.on();
+    Touch.on();
+    lv_demo_widgets();
+    xTaskCreatePinnedToCore(lvgl_tick_task, "lv_tick_task", 2048, NULL, 1, NULL, 0);
+
+    i2s.setPins(BCLKPIN, WSPIN, DIPIN, DOPIN, MCLKPIN);
+    if (!i2s.begin(I2S_MODE_STD, EXAMPLE_SAMPLE_RATE, I2S_DATA_BIT_WIDTH_16BIT,
+                   I2S_SLOT_MODE_STEREO, I2S_STD_SLOT_BOTH)) {
+        Serial.println("I2S init failed!");
+        return;
+    }
+    Wire.begin(15, 14);
+    if (es8311_codec_init() != ESP_OK) {
+        Serial.println("ES8311 init failed!");
+        return;
+    }
+
+    AudioMixer::checkKernels();
+    mixer.setMasterVolume(master);
+    if (!mixer.begin(i2s, EXAMPLE_SAMPLE_RATE)) {
+        Serial.println("Mixer failed to start");
+        return;
+    }
+
+    // The player only reads the card here; the mixer owns I2S
+    streaming = SDCard.mount(false, "/sdcard") && SDCard.existsFile(EXAMPLE_TRACK) && player.begin();
+    Serial.println(streaming ? "Music: " EXAMPLE_TRACK : "Music: canon.h from flash");
+    startMusic();
+}
+
+// === Loop ===
+void loop() {
+    lv_task_handler();
+
+    // A click on each new touch, on the side it happened
+    static bool was_touched = false;
+    bool touched = Touch.isTouched();
+    if (touched && !was_touched) {
+        int32_t tx, ty;
+        Touch.getTouchPoint(tx, ty);
+        int8_t pan = (int8_t)(tx * 200 / LCD_WIDTH - 100);
+        mixer.playTone(2000, 15, 70, pan, AUDIO_WAVE_SQUARE);
+    }
+    was_touched = touched;
+
+    if (Serial.available()) handleCommand(Serial.read());
+
+    static unsigned long last_report = 0;
+    if (millis() - last_report >= 5000) {
+        last_report = millis();
+        AudioMixer::Stats s = mixer.getStats();
+        Serial.printf("%u periods, slowest mix %u us of %u us, %u late, up to %u voices\n",
+                      s.periods, s.max_render_us, s.period_us, s.late, s.max_voices);
+        mixer.resetStats();
+    }
+
+    delay(5);
+}
@@ -0,0 +1,142 @@
+#include <Arduino.h>
+#include <lvgl.h>
+#include <Wire.h>
+#include "ESP32-S3-Screen-AMOLED-2.06.h"
+#include "ESP32-S3-Touch-AMOLED-2.06.h"
+#include "esp_check.h"
+#include "es8311.h"
+#include "ESP_I2S.h"
+#include "SDMounter.h"
+#include "AudioPlayer.h"
+
+#include "demos/lv_demos.h"
+
+// Streams /music/canon.wav (any 16-bit PCM WAV) from the card while the
+// LVGL widgets demo keeps the UI busy. Over serial:
+//   p  pause / resume      s  stop        r  play from the start
+//   f  forward 10 s        b  back 10 s   +/-  volume
+// Every 5 s the position and the player's underrun stats are printed; the
+// low-water mark shows how close the ring came to running dry.
+
+// === Global Objects ===
+ScreenClass Screen;
+TouchClass  Touch;
+I2SClass    i2s;
+AudioPlayer player;
+
+// === LVGL ===
+#define LVGL_TICK_MS 2
+
+// === Audio / ES8311 Config ===
+#define EXAMPLE_SAMPLE_RATE     16000
+#define EXAMPLE_VOICE_VOLUME    90
+#define EXAMPLE_TRACK           "/music/canon.wav"
+
+es8311_handle_t es_handle = nullptr;
+uint8_t volume = 80;
+
+esp_err_t es8311_codec_init(void) {
+    es_handle = es8311_create(0, ES8311_ADDRRES_0);
+    ESP_RETURN_ON_FALSE(es_handle, ESP_FAIL, "ES8311", "create failed");
+
+    const es8311_clock_config_t es_clk = {
+        .mclk_inverted       = false,
+        .sclk_inverted       = false,
+        .mclk_from_mclk_pin  = true,
+        .mclk_frequency      = EXAMPLE_SAMPLE_RATE * 256,
+        .sample_frequency    = EXAMPLE_SAMPLE_RATE
+    };
+
+    ESP_ERROR_CHECK(es8311_init(es_handle, &es_clk, ES8311_RESOLUTION_16, ES8311_RESOLUTION_16));
+    ESP_ERROR_CHECK(es8311_sample_frequency_config(es_handle, es_clk.mclk_frequency, es_clk.sample_frequency));
+    ESP_ERROR_CHECK(es8311_voice_volume_set(es_handle, EXAMPLE_VOICE_VOLUME, NULL));
+    return ESP_OK;
+}
+
+// === LVGL Tick ===
+void lvgl_tick_task(void* arg) {
+    while (true) {
+        lv_tick_inc(LVGL_TICK_MS);
+        vTaskDelay(pdMS_TO_TICKS(LVGL_TICK_MS));
+    }
+}
+
+void handleCommand(char c) {
+    uint32_t pos = player.getPositionMs();
+    switch (c) {
+        case 'p':
+            if (player.getState() == AUDIO_PAUSED) player.resume();
+            else player.pause();
+            break;
+        case 's': player.stop(); break;
+        case 'r': player.play(EXAMPLE_TRACK); break;
+        case 'f': player.seek(pos + 10000); break;
+        case 'b': player.seek(pos > 10000 ? pos - 10000 : 0); break;
+        case '+': volume = volume > 90 ? 100 : volume + 10; player.setVolume(volume); break;
+        case '-': volume = volume < 10 ? 0 : volume - 10; player.setVolume(volume); break;
+    }
+}
+
+// === Setup ===
+void setup() {
+    Serial.begin(115200);
+    delay(500);
+
+    Screen.on();
+    Touch.on();
+    lv_demo_widgets();
+    xTaskCreatePinnedToCore(lvgl_tick_task, "lv_tick_task", 2048, NULL, 1, NULL, 0);
+
+    if (!SDCard.mount(false, "/sdcard")) {
+        Serial.println("Card Mount Failed");
+        return;
+    }
+
+    i2s.setPins(BCLKPIN, WSPIN, DIPIN, DOPIN, MCLKPIN);
+    if (!i2s.begin(I2S_MODE_STD, EXAMPLE_SAMPLE_RATE, I2S_DATA_BIT_WIDTH_16BIT,
+                   I2S_SLOT_MODE_STEREO, I2S_STD_SLOT_BOTH)) {
+        Serial.println("I2S init failed!");
+        return;
+    }
+    Wire.begin(15, 14);
+    if (es8311_codec_init() != ESP_OK) {
+        Serial.println("ES8311 init failed!");
+        return;
+    }
+
+    // The codec's dividers depend on the rate; MCLK stays at 256 x rate
+    player.onFormat([](const AudioFormat& f) {
+        es8311_sample_frequency_config(es_handle, f.sample_rate * 256, f.sample_rate);
+    });
+    player.onEnd([]() {
+        Serial.println("Track finished");
+    });
+    player.setRawFormat(EXAMPLE_SAMPLE_RATE, 2);    // For .pcm files like canon.pcm
+    player.setVolume(volume);
+
+    if (!player.begin(i2s) || !player.play(EXAMPLE_TRACK)) {
+        Serial.println("Cannot play " EXAMPLE_TRACK);
+        return;
+    }
+    const AudioFormat& f = player.getFormat();
+    Serial.printf("Playing %s: %u Hz, %u ch, %u s\n", EXAMPLE_TRACK, f.sample_rate, f.channels,
+                  player.getDurationMs() / 1000);
+}
+
+// === Loop ===
+void loop() {
+    lv_task_handler();
+
+    if (Serial.available()) handleCommand(Serial.read());
+
+    static unsigned long last_report = 0;
+    if (millis() - last_report >= 5000) {
+        last_report = millis();
+        AudioPlayer::Stats s = player.getStats();
+        Serial.printf("%u.%us, %u ms buffered | underruns %u (%u ms), low water %u ms, slowest read %u ms\n",
+                      player.getPositionMs() / 1000, player.getPositionMs() / 100 % 10,
+                      player.getBufferedMs(), s.underruns, s.underrun_ms, s.low_water_ms, s.max_read_ms);
+    }
+
+    delay(5);
+}
@@ -0,0 +1,282 @@
+#!/usr/bin/env python3
+"""Pack and unpack SDMounter compressed files (.sdz) on a PC.
+
+The layout is described in ESP_DISPLAY_TOUCH/SD/SDCompressedFile.h: LZ4
+blocks of a fixed size, an index of block offsets and a footer. Files
+packed here open with SDCompressedFile on the watch, and files written by
+SDCompressedWriter unpack here.
+
+    sdpack.py pack log.txt log.sdz --block-size 16384
+    sdpack.py unpack log.sdz log.txt
+    sdpack.py info log.sdz
+
+Needs only the standard library. The compressor is the same greedy LZ4
+as SDLz4.cpp, so the output matches the watch byte for byte.
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = 0x315A4453          # "SDZ1"
+END_MAGIC = 0x455A4453      # "SDZE"
+VERSION = 1
+CODEC_LZ4 = 1
+HEADER = struct.Struct("<IBBB9x")
+FOOTER = struct.Struct("<QIIII")
+BLOCK_HEADER = struct.Struct("<II")
+STORED = 0x80000000
+MIN_SHIFT = 10
+MAX_SHIFT = 16
+
+MIN_MATCH = 4
+MFLIMIT = 12
+LAST_LITERALS = 5
+HASH_BITS = 12
+
+
+class FormatError(Exception):
+    pass
+
+
+def _hash4(data, i):
+    seq = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | (data[i + 3] << 24)
+    return seq, ((seq * 2654435761) & 0xFFFFFFFF) >> (32 - HASH_BITS)
+
+
+def _length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def _sequence(out, data, anchor, literals, offset=None, match_len=0):
+    token = min(literals, 15) << 4
+    if offset is not None:
+        token |= min(match_len, 15)
+    out.append(token)
+    if literals >= 15:
+        _length(out, literals - 15)
+    out += data[anchor:anchor + literals]
+    if offset is not None:
+        out += struct.pack("<H", offset)
+        if match_len >= 15:
+            _length(out, match_len - 15)
+
+
+def lz4_compress(data):
+    """LZ4 block format, same matches as sdLz4Compress()."""
+    n = len(data)
+    table = [0] * (1 << HASH_BITS)
+    out = bytearray()
+    anchor = 0
+    i = 0
+
+    while i + MFLIMIT <= n:
+        h = _hash4(data, i)[1]
+        ref = table[h]
+        table[h] = i
+        if ref >= i or data[ref:ref + 4] != data[i:i + 4]:
+            i += 1 + ((i - anchor) >> 6)
+            continue
+
+        match_end = i + MIN_MATCH
+        ref_end = ref + MIN_MATCH
+        while match_end < n - LAST_LITERALS and data[match_end] == data[ref_end]:
+            match_end += 1
+            ref_end += 1
+
+        _sequence(out, data, anchor, i - anchor, i - ref, match_end - i - MIN_MATCH)
+        if match_end + MFLIMIT <= n:
+            table[_hash4(data, match_end - 2)[1]] = match_end - 2
+        anchor = i = match_end
+
+    _sequence(out, data, anchor, n - anchor)
+    return bytes(out)
+
+
+def lz4_decompress(src, raw_len):
+    out = bytearray()
+    ip = 0
+    end = len(src)
+
+    def more(ip, n):
+        while True:
+            if ip >= end:
+                raise FormatError("truncated length")
+            b = src[ip]
+            ip += 1
+            n += b
+            if b != 255:
+                return ip, n
+
+    while ip < end:
+        token = src[ip]
+        ip += 1
+        literals = token >> 4
+        if literals == 15:
+            ip, literals = more(ip, literals)
+        if ip + literals > end:
+            raise FormatError("literals past the end")
+        out += src[ip:ip + literals]
+        ip += literals
+        if ip == end:
+            break
+
+        if end - ip < 2:
+            raise FormatError("truncated offset")
+        offset = src[ip] | (src[ip + 1] << 8)
+        ip += 2
+        if offset == 0 or offset > len(out):
+            raise FormatError("bad match offset")
+        match_len = token & 15
+        if match_len == 15:
+            ip, match_len = more(ip, match_len)
+        match_len += MIN_MATCH
+        start = len(out) - offset
+        if offset >= match_len:
+            out += out[start:start + match_len]
+        else:
+            for k in range(match_len):
+                out.append(out[start + k])
+
+    if len(out) != raw_len:
+        raise FormatError("block decodes to %d bytes, expected %d" % (len(out), raw_len))
+    return bytes(out)
+
+
+def block_shift(block_size):
+    shift = MIN_SHIFT
+    while shift < MAX_SHIFT and (1 << (shift + 1)) <= block_size:
+        shift += 1
+    return shift
+
+
+def pack(raw, block_size):
+    shift = block_shift(block_size)
+    size = 1 << shift
+    out = bytearray(HEADER.pack(MAGIC, VERSION, CODEC_LZ4, shift))
+    index = []
+
+    for start in range(0, len(raw), size):
+        chunk = raw[start:start + size]
+        packed = lz4_compress(chunk)
+        index.append(len(out))
+        if len(packed) >= len(chunk):
+            out += BLOCK_HEADER.pack(len(chunk) | STORED, len(chunk)) + chunk
+        else:
+            out += BLOCK_HEADER.pack(len(packed), len(chunk)) + packed
+
+    index_bytes = struct.pack("<%dI" % len(index), *index)
+    index_offset = len(out)
+    out += index_bytes
+    out += FOOTER.pack(len(raw), len(index), index_offset, zlib.crc32(index_bytes), END_MAGIC)
+    return bytes(out)
+
+
+def parse(data):
+    """Returns (block shift, raw size, block offsets, recovered)."""
+    if len(data) < HEADER.size:
+        raise FormatError("too short for a header")
+    magic, version, codec, shift = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise FormatError("not an .sdz file")
+    if version != VERSION or codec != CODEC_LZ4 or not MIN_SHIFT <= shift <= MAX_SHIFT:
+        raise FormatError("unsupported version %d, codec %d or block shift %d" % (version, codec, shift))
+
+    if len(data) >= HEADER.size + FOOTER.size:
+        raw_size, count, index_offset, crc, end = FOOTER.unpack_from(data, len(data) - FOOTER.size)
+        index_bytes = data[index_offset:index_offset + count * 4]
+        if (end == END_MAGIC and index_offset + count * 4 + FOOTER.size == len(data)
+                and count == (raw_size + (1 << shift) - 1) >> shift
+                and zlib.crc32(index_bytes) == crc):
+            return shift, raw_size, list(struct.unpack("<%dI" % count, index_bytes)), False
+
+    # No valid footer: the writer was cut short, keep the complete blocks
+    offsets = []
+    raw_size = 0
+    offset = HEADER.size
+    while offset + BLOCK_HEADER.size <= len(data):
+        stored, raw = BLOCK_HEADER.unpack_from(data, offset)
+        stored &= ~STORED
+        if raw == 0 or raw > (1 << shift) or offset + BLOCK_HEADER.size + stored > len(data):
+            break
+        offsets.append(offset)
+        raw_size += raw
+        offset += BLOCK_HEADER.size + stored
+        if raw < (1 << shift):
+            break
+    return shift, raw_size, offsets, True
+
+
+def unpack(data):
+    shift, raw_size, offsets, recovered = parse(data)
+    out = bytearray()
+    for n, offset in enumerate(offsets):
+        stored, raw = BLOCK_HEADER.unpack_from(data, offset)
+        body = data[offset + BLOCK_HEADER.size:offset + BLOCK_HEADER.size + (stored & ~STORED)]
+        if stored & STORED:
+            out += body
+        else:
+            try:
+                out += lz4_decompress(body, raw)
+            except FormatError as e:
+                raise FormatError("block %d: %s" % (n, e))
+    if len(out) != raw_size:
+        raise FormatError("unpacked %d bytes, footer says %d" % (len(out), raw_size))
+    return bytes(out), recovered
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("pack", help="compress a file to .sdz")
+    p.add_argument("input")
+    p.add_argument("output")
+    p.add_argument("--block-size", type=int, default=16384,
+                   help="seek granularity in bytes, 1024-65536 (default 16384)")
+
+    p = sub.add_parser("unpack", help="restore the original file")
+    p.add_argument("input")
+    p.add_argument("output")
+
+    p = sub.add_parser("info", help="show the block layout and ratio")
+    p.add_argument("input")
+
+    args = parser.parse_args()
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    try:
+        if args.command == "pack":
+            out = pack(data, args.block_size)
+            with open(args.output, "wb") as f:
+                f.write(out)
+            ratio = len(data) / len(out) if out else 0
+            print("%s: %d -> %d bytes (%.2fx)" % (args.output, len(data), len(out), ratio))
+        elif args.command == "unpack":
+            out, recovered = unpack(data)
+            with open(args.output, "wb") as f:
+                f.write(out)
+            print("%s: %d bytes%s" % (args.output, len(out), " (recovered, no index)" if recovered else ""))
+        else:
+            shift, raw_size, offsets, recovered = parse(data)
+            stored = sum(1 for o in offsets if BLOCK_HEADER.unpack_from(data, o)[0] & STORED)
+            ratio = raw_size / len(data) if data else 0
+            print("block size   %d" % (1 << shift))
+            print("blocks       %d (%d stored uncompressed)" % (len(offsets), stored))
+            print("raw size     %d" % raw_size)
+            print("file size    %d (%.2fx)" % (len(data), ratio))
+            if recovered:
+                print("index        missing, rebuilt from block headers")
+    except FormatError as e:
+        print("%s: %s" % (args.input, e), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,389 @@
+#!/usr/bin/env python3
+"""Copy files to and from the watch's SD card over the USB serial port.
+
+Talks to SDTransferServer (ESP_DISPLAY_TOUCH/SD/SDTransfer.h): CRC-checked
+frames, a window of data in flight and go-back-N resends, so transfers run
+at what the USB link allows. Interrupted transfers resume: a download is
+kept in <local>.part, an upload in <remote>.part on the card, and the next
+run continues after checking the CRC of what is already there.
+
+    sdxfer.py -p /dev/ttyACM0 ls /logs
+    sdxfer.py -p /dev/ttyACM0 get /logs/today.log
+    sdxfer.py -p /dev/ttyACM0 put layout.json /ui/layout.json
+    sdxfer.py -p /dev/ttyACM0 rm /logs/old.log
+
+Needs pyserial.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+import zlib
+
+import serial
+
+MAGIC = b"SX"
+HEADER = struct.Struct("<2sBBH")
+CRC = struct.Struct("<I")
+
+HELLO, STAT, LIST, GET, PUT, DELETE, MKDIR, CANCEL = range(1, 9)
+DATA, ACK, END = 0x10, 0x11, 0x12
+OK, ERROR, ENTRY = 0x20, 0x21, 0x22
+
+ACK_RESEND = 0x01
+ACK_DONE = 0x02
+ACK_EVERY = 8192
+TIMEOUT = 1.0
+RETRIES = 5
+
+
+class XferError(Exception):
+    pass
+
+
+class Link:
+    def __init__(self, port, baud):
+        self.ser = serial.Serial()
+        self.ser.port = port
+        self.ser.baudrate = baud
+        self.ser.timeout = 0.02
+        # Leave DTR/RTS low: on the S3's USB port they drive reset and boot
+        self.ser.dtr = False
+        self.ser.rts = False
+        self.ser.open()
+        self.rx = bytearray()
+        self.seq = 0
+        self.chunk = 4096
+        self.window = 32768
+        self.resends = 0
+
+    def next_seq(self):
+        self.seq = (self.seq + 1) & 0xFF
+        return self.seq
+
+    def send(self, ftype, seq, payload=b""):
+        body = HEADER.pack(MAGIC, ftype, seq, len(payload)) + payload
+        self.ser.write(body + CRC.pack(zlib.crc32(body[2:])))
+
+    def read(self, timeout=TIMEOUT):
+        """Next good frame as (type, seq, payload), or None on timeout."""
+        deadline = time.monotonic() + timeout
+        while True:
+            frame = self._parse()
+            if frame:
+                return frame
+            if time.monotonic() >= deadline:
+                if len(self.rx) >= 2:
+                    del self.rx[:1]     # Stuck on a damaged length: resync
+                return None
+            self.rx += self.ser.read(max(1, self.ser.in_waiting))
+
+    def _parse(self):
+        rx = self.rx
+        while len(rx) >= 2:
+            start = rx.find(MAGIC)
+            if start < 0:
+                del rx[:-1]         # Keep a trailing 'S'
+                return None
+            del rx[:start]
+            if len(rx) < HEADER.size:
+                return None
+            _, ftype, seq, length = HEADER.unpack_from(rx)
+            if length > self.chunk + 16:
+                del rx[:1]
+                continue
+            total = HEADER.size + length + CRC.size
+            if len(rx) < total:
+                return None
+            if zlib.crc32(rx[2:HEADER.size + length]) != CRC.unpack_from(rx, HEADER.size + length)[0]:
+                del rx[:1]          # Log text or a damaged frame
+                continue
+            payload = bytes(rx[HEADER.size:HEADER.size + length])
+            del rx[:total]
+            return ftype, seq, payload
+        return None
+
+    def request(self, ftype, payload=b"", tries=3):
+        """Sends a request and returns the payload of its OK reply. A lost
+        request or reply is sent again with the same seq."""
+        seq = self.next_seq()
+        for _ in range(tries):
+            self.send(ftype, seq, payload)
+            reply = self.reply(seq)
+            if reply is not None:
+                return reply
+        raise XferError("no reply from the watch")
+
+    def reply(self, seq, timeout=2 * TIMEOUT):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            frame = self.read(deadline - time.monotonic())
+            if not frame or frame[1] != seq:
+                continue
+            ftype, _, payload = frame
+            if ftype == OK:
+                return payload
+            if ftype == ERROR:
+                raise XferError(payload[1:].decode(errors="replace") or "error %d" % payload[0])
+        return None
+
+    def hello(self):
+        version, _, chunk, window = struct.unpack("<BBHI", self.request(HELLO))
+        self.chunk, self.window = chunk, window
+        return version
+
+    def cancel(self):
+        try:
+            self.request(CANCEL)
+        except XferError:
+            pass
+        self.rx.clear()
+
+    def stat(self, path):
+        is_dir, size, mtime = struct.unpack("<B3xII", self.request(STAT, path.encode()))
+        return bool(is_dir), size, mtime
+
+    def listdir(self, path):
+        seq = self.next_seq()
+        self.send(LIST, seq, path.encode())
+        entries = []
+        while True:
+            frame = self.read(3.0)
+            if not frame:
+                raise XferError("no reply from the watch")
+            ftype, fseq, payload = frame
+            if fseq != seq:
+                continue
+            if ftype == ERROR:
+                raise XferError(payload[1:].decode(errors="replace"))
+            if ftype == END:
+                return entries
+            pos = 0
+            while ftype == ENTRY and pos < len(payload):
+                is_dir, size, mtime, name_len = struct.unpack_from("<BIIB", payload, pos)
+                name = payload[pos + 10:pos + 10 + name_len].decode(errors="replace")
+                entries.append((name, bool(is_dir), size, mtime))
+                pos += 10 + name_len
+
+    def get(self, remote, local, restart=False, progress=None):
+        part = local + ".part"
+        have = 0 if restart or not os.path.exists(part) else os.path.getsize(part)
+        size, offset, crc = struct.unpack("<III", self.request(GET, struct.pack("<I", have) + remote.encode()))
+        seq = self.seq
+
+        if offset:
+            with open(part, "rb") as f:
+                matches = file_crc(f, offset) == crc
+            if not matches:
+                # Our partial copy is not a prefix of the file on the card
+                self.cancel()
+                return self.get(remote, local, True, progress)
+
+        with open(part, "r+b" if offset else "wb") as f:
+            f.truncate(offset)
+            f.seek(offset)
+            self._receive(f, seq, offset, size, crc, progress)
+
+        os.replace(part, local)
+        return size, offset
+
+    def _receive(self, f, seq, offset, size, crc, progress):
+        expected = last_ack = offset
+        strays = 0
+        timeouts = 0
+        while True:
+            frame = self.read()
+            if not frame:
+                timeouts += 1
+                if timeouts > RETRIES:
+                    raise XferError("transfer stalled")
+                self.send(ACK, seq, struct.pack("<IB", expected, ACK_RESEND))
+                continue
+            ftype, fseq, payload = frame
+            if fseq != seq:
+                continue
+            timeouts = 0
+            if ftype == ERROR:
+                raise XferError(payload[1:].decode(errors="replace"))
+            if ftype == DATA:
+                at = struct.unpack_from("<I", payload)[0]
+                data = payload[4:]
+                if at == expected:
+                    f.write(data)
+                    crc = zlib.crc32(data, crc)
+                    expected += len(data)
+                    strays = 0
+                    if expected - last_ack >= ACK_EVERY:
+                        self.send(ACK, seq, struct.pack("<IB", expected, 0))
+                        last_ack = expected
+                    if progress:
+                        progress(expected, size)
+                else:
+                    # Same rule as the watch: report the first stray frame
+                    # and every fourth after it
+                    if strays % 4 == 0:
+                        flags = ACK_RESEND if at > expected else 0
+                        self.send(ACK, seq, struct.pack("<IB", expected, flags))
+                        self.resends += at > expected
+                    strays += 1
+            elif ftype == END:
+                end_size, end_crc = struct.unpack("<II", payload)
+                if expected != end_size:
+                    self.send(ACK, seq, struct.pack("<IB", expected, ACK_RESEND))
+                    continue
+                if end_crc != crc:
+                    raise XferError("file CRC mismatch")
+                self.send(ACK, seq, struct.pack("<IB", expected, ACK_DONE))
+                return
+
+    def put(self, local, remote, restart=False, progress=None):
+        size = os.path.getsize(local)
+        with open(local, "rb") as f:
+            # Ask for as much as we have; the watch offers what its .part holds
+            ask = 0 if restart else size
+            _, offset, crc = struct.unpack("<III", self.request(PUT, struct.pack("<II", ask, size) + remote.encode()))
+            seq = self.seq
+            if offset and file_crc(f, offset) != crc:
+                self.cancel()
+                return self.put(local, remote, True, progress)
+            self._send(f, seq, offset, size, crc, progress)
+        return size, offset
+
+    def _send(self, f, seq, offset, size, crc, progress):
+        acked = next_pos = crc_end = offset
+        end_sent = False
+        timeouts = 0
+        while True:
+            while next_pos < size and next_pos - acked < self.window:
+                f.seek(next_pos)
+                data = f.read(min(self.chunk, size - next_pos))
+                if next_pos == crc_end:
+                    crc = zlib.crc32(data, crc)
+                    crc_end += len(data)
+                self.send(DATA, seq, struct.pack("<I", next_pos) + data)
+                next_pos += len(data)
+            if acked == size and not end_sent:
+                self.send(END, seq, struct.pack("<II", size, crc))
+                end_sent = True
+
+            frame = self.read()
+            if not frame:
+                timeouts += 1
+                if timeouts > RETRIES:
+                    raise XferError("transfer stalled")
+                next_pos = acked
+                end_sent = False
+                self.resends += 1
+                continue
+            ftype, fseq, payload = frame
+            if fseq != seq:
+                continue
+            if ftype == ERROR:
+                raise XferError(payload[1:].decode(errors="replace"))
+            if ftype == OK and end_sent:
+                return      # Checked and renamed into place
+            if ftype != ACK:
+                continue
+            at, flags = struct.unpack("<IB", payload)
+            if at < acked or at > size:
+                continue
+            timeouts = 0
+            acked = at
+            if progress:
+                progress(acked, size)
+            if next_pos < acked or flags & ACK_RESEND:
+                next_pos = acked
+                end_sent = False
+                self.resends += 1
+
+
+def file_crc(f, length):
+    f.seek(0)
+    crc = 0
+    while length > 0:
+        data = f.read(min(65536, length))
+        if not data:
+            return None
+        crc = zlib.crc32(data, crc)
+        length -= len(data)
+    return crc
+
+
+def show_progress(done, total):
+    pct = 100 * done // total if total else 100
+    sys.stderr.write("\r%3d%% %d/%d" % (pct, done, total))
+    sys.stderr.flush()
+
+
+def report(verb, path, size, offset, elapsed, resends):
+    moved = size - offset
+    kbps = moved / 1024 / elapsed if elapsed > 0 else 0
+    resumed = " (resumed at %d)" % offset if offset else ""
+    print("\r%s %s: %d bytes in %.2f s, %.0f KB/s%s, %d resends" %
+          (verb, path, moved, elapsed, kbps, resumed, resends))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("-p", "--port", required=True, help="serial port of the watch")
+    parser.add_argument("-b", "--baud", type=int, default=115200,
+                        help="ignored by USB CDC, needed by some adapters")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("ls", help="list a directory")
+    p.add_argument("path", nargs="?", default="/")
+
+    p = sub.add_parser("stat", help="size and time of a file")
+    p.add_argument("path")
+
+    p = sub.add_parser("get", help="copy a file from the card")
+    p.add_argument("remote")
+    p.add_argument("local", nargs="?")
+    p.add_argument("--restart", action="store_true", help="ignore a partial download")
+
+    p = sub.add_parser("put", help="copy a file to the card")
+    p.add_argument("local")
+    p.add_argument("remote")
+    p.add_argument("--restart", action="store_true", help="ignore a partial upload")
+
+    p = sub.add_parser("rm", help="delete a file or empty directory")
+    p.add_argument("path")
+
+    p = sub.add_parser("mkdir", help="create a directory")
+    p.add_argument("path")
+
+    args = parser.parse_args()
+    try:
+        link = Link(args.port, args.baud)
+        link.hello()
+        if args.command == "ls":
+            for name, is_dir, size, mtime in sorted(link.listdir(args.path)):
+                when = time.strftime("%Y-%m-%d %H:%M", time.localtime(mtime)) if mtime else "-"
+                print("%10s  %s  %s" % ("<dir>" if is_dir else size, when, name + ("/" if is_dir else "")))
+        elif args.command == "stat":
+            is_dir, size, mtime = link.stat(args.path)
+            print("%s: %s, %d bytes, %s" % (args.path, "directory" if is_dir else "file", size,
+                                            time.ctime(mtime) if mtime else "no time"))
+        elif args.command == "get":
+            local = args.local or os.path.basename(args.remote.rstrip("/"))
+            start = time.monotonic()
+            size, offset = link.get(args.remote, local, args.restart, show_progress)
+            report("got", local, size, offset, time.monotonic() - start, link.resends)
+        elif args.command == "put":
+            start = time.monotonic()
+            size, offset = link.put(args.local, args.remote, args.restart, show_progress)
+            report("put", args.remote, size, offset, time.monotonic() - start, link.resends)
+        elif args.command == "rm":
+            link.request(DELETE, args.path.encode(), tries=1)    # A retry would fail on success
+        else:
+            link.request(MKDIR, args.path.encode(), tries=1)
+    except (XferError, serial.SerialException, OSError) as e:
+        sys.stderr.write("\nsdxfer: %s\n" % e)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())